@@ -45,6 +45,7 @@ struct _EAddressbookModelPrivate {
 
 	/* Query Results */
 	GPtrArray *contacts;
+	GHashTable *uid_index; /* UID -> index into 'contacts' */
 
 	/* Signal Handler IDs */
 	gulong create_contact_id;
@@ -59,6 +60,10 @@ struct _EAddressbookModelPrivate {
 	guint first_get_view : 1;
 };
 
+/* Changes of more row ranges than this are
+ * announced as a single range spanning them. */
+#define MAX_CHANGED_RANGES 16
+
 enum {
 	PROP_0,
 	PROP_CLIENT,
@@ -93,6 +98,39 @@ free_data (EAddressbookModel *model)
 	array = model->priv->contacts;
 	g_ptr_array_foreach (array, (GFunc) g_object_unref, NULL);
 	g_ptr_array_set_size (array, 0);
+
+	g_hash_table_remove_all (model->priv->uid_index);
+}
+
+static void
+uid_index_insert (EAddressbookModel *model,
+                  EContact *contact,
+                  guint index)
+{
+	const gchar *uid;
+
+	uid = e_contact_get_const (contact, E_CONTACT_UID);
+	if (uid == NULL)
+		return;
+
+	g_hash_table_insert (
+		model->priv->uid_index,
+		g_strdup (uid), GUINT_TO_POINTER (index));
+}
+
+static gboolean
+uid_index_lookup (EAddressbookModel *model,
+                  const gchar *uid,
+                  guint *out_index)
+{
+	gpointer value;
+
+	if (!g_hash_table_lookup_extended (model->priv->uid_index, uid, NULL, &value))
+		return FALSE;
+
+	*out_index = GPOINTER_TO_UINT (value);
+
+	return TRUE;
 }
 
 static void
@@ -188,6 +226,7 @@ view_create_contact_cb (EBookClientView *client_view,
 	while (contact_list != NULL) {
 		EContact *contact = contact_list->data;
 
+		uid_index_insert (model, contact, array->len);
 		g_ptr_array_add (array, g_object_ref (contact));
 		contact_list = contact_list->next;
 	}
@@ -211,103 +250,152 @@ view_remove_contact_cb (EBookClientView *client_view,
                         const GSList *ids,
                         EAddressbookModel *model)
 {
-	/* XXX we should keep a hash around instead of this O(n*m) loop */
 	const GSList *iter;
 	GArray *indices;
 	GPtrArray *array;
-	gint ii;
+	guint ii, jj, first_removed;
 
 	array = model->priv->contacts;
 	indices = g_array_new (FALSE, FALSE, sizeof (gint));
+	first_removed = array->len;
 
 	for (iter = ids; iter != NULL; iter = iter->next) {
 		const gchar *target_uid = iter->data;
+		guint index;
 
-		for (ii = 0; ii < array->len; ii++) {
-			EContact *contact;
-			const gchar *uid;
+		if (!uid_index_lookup (model, target_uid, &index))
+			continue;
 
-			contact = array->pdata[ii];
-			/* check if already removed */
-			if (!contact)
-				continue;
+		g_hash_table_remove (model->priv->uid_index, target_uid);
 
-			uid = e_contact_get_const (contact, E_CONTACT_UID);
-			g_return_if_fail (uid != NULL);
+		g_object_unref (array->pdata[index]);
+		array->pdata[index] = NULL;
 
-			if (strcmp (uid, target_uid) == 0) {
-				g_object_unref (contact);
-				g_array_append_val (indices, ii);
-				array->pdata[ii] = NULL;
-				break;
-			}
-		}
+		g_array_append_val (indices, index);
+		first_removed = MIN (first_removed, index);
 	}
 
-	/* Sort the 'indices' array in descending order, since
-	 * g_ptr_array_remove_index() shifts subsequent elements
-	 * down one position to fill the gap. */
-	g_array_sort (indices, sort_descending);
+	/* Close the gaps in a single pass, updating
+	 * the index of every contact which moved. */
+	for (ii = jj = first_removed; ii < array->len; ii++) {
+		EContact *contact = array->pdata[ii];
 
-	for (ii = 0; ii < indices->len; ii++) {
-		gint index;
+		if (contact == NULL)
+			continue;
 
-		index = g_array_index (indices, gint, ii);
-		g_ptr_array_remove_index (array, index);
+		array->pdata[jj] = contact;
+		uid_index_insert (model, contact, jj);
+		jj++;
 	}
 
+	if (first_removed < array->len)
+		g_ptr_array_set_size (array, jj);
+
+	/* Listeners expect the indices in descending order,
+	 * as if the contacts were removed one by one. */
+	g_array_sort (indices, sort_descending);
+
 	g_signal_emit (model, signals[CONTACTS_REMOVED], 0, indices);
 	g_array_free (indices, FALSE);
 
 	update_folder_bar_message (model);
 }
 
+static gint
+sort_ascending (gconstpointer ca,
+                gconstpointer cb)
+{
+	gint a = *((gint *) ca);
+	gint b = *((gint *) cb);
+
+	return (a == b) ? 0 : (a < b) ? -1 : 1;
+}
+
+static void
+emit_contacts_changed (EAddressbookModel *model,
+                       GArray *indices)
+{
+	guint ii, n_ranges = 1;
+	gint start, end;
+
+	if (indices->len == 0)
+		return;
+
+	g_array_sort (indices, sort_ascending);
+
+	for (ii = 1; ii < indices->len; ii++) {
+		if (g_array_index (indices, gint, ii) >
+		    g_array_index (indices, gint, ii - 1) + 1)
+			n_ranges++;
+	}
+
+	/* Too scattered, announce the whole span at once. */
+	if (n_ranges > MAX_CHANGED_RANGES) {
+		start = g_array_index (indices, gint, 0);
+		end = g_array_index (indices, gint, indices->len - 1);
+
+		g_signal_emit (
+			model, signals[CONTACT_CHANGED], 0,
+			start, end - start + 1);
+		return;
+	}
+
+	start = end = g_array_index (indices, gint, 0);
+
+	for (ii = 1; ii <= indices->len; ii++) {
+		gint index = -1;
+
+		if (ii < indices->len)
+			index = g_array_index (indices, gint, ii);
+
+		/* Duplicates and neighbours extend the range. */
+		if (index != -1 && index <= end + 1) {
+			end = MAX (end, index);
+			continue;
+		}
+
+		g_signal_emit (
+			model, signals[CONTACT_CHANGED], 0,
+			start, end - start + 1);
+
+		start = end = index;
+	}
+}
+
 static void
 view_modify_contact_cb (EBookClientView *client_view,
                         const GSList *contact_list,
                         EAddressbookModel *model)
 {
 	GPtrArray *array;
+	GArray *indices;
 
 	array = model->priv->contacts;
+	indices = g_array_new (FALSE, FALSE, sizeof (gint));
 
 	while (contact_list != NULL) {
 		EContact *new_contact = contact_list->data;
 		const gchar *target_uid;
-		gint ii;
+		guint index;
 
 		target_uid = e_contact_get_const (new_contact, E_CONTACT_UID);
 		g_warn_if_fail (target_uid != NULL);
 
 		/* skip contacts without UID */
-		if (!target_uid) {
-			contact_list = contact_list->next;
-			continue;
-		}
-
-		for (ii = 0; ii < array->len; ii++) {
-			EContact *old_contact;
-			const gchar *uid;
-
-			old_contact = array->pdata[ii];
-			g_return_if_fail (old_contact != NULL);
-
-			uid = e_contact_get_const (old_contact, E_CONTACT_UID);
-			g_return_if_fail (uid != NULL);
-
-			if (strcmp (uid, target_uid) != 0)
-				continue;
-
-			g_object_unref (old_contact);
-			array->pdata[ii] = e_contact_duplicate (new_contact);
+		if (target_uid != NULL &&
+		    uid_index_lookup (model, target_uid, &index)) {
+			g_object_unref (array->pdata[index]);
+			array->pdata[index] = e_contact_duplicate (new_contact);
 
-			g_signal_emit (
-				model, signals[CONTACT_CHANGED], 0, ii);
-			break;
+			g_array_append_val (indices, index);
 		}
 
 		contact_list = contact_list->next;
 	}
+
+	emit_contacts_changed (model, indices);
+
+	g_array_free (indices, TRUE);
 }
 
 static void
@@ -579,6 +667,7 @@ addressbook_model_finalize (GObject *object)
 	priv = E_ADDRESSBOOK_MODEL_GET_PRIVATE (object);
 
 	g_ptr_array_free (priv->contacts, TRUE);
+	g_hash_table_destroy (priv->uid_index);
 
 	/* Chain up to parent's finalize() method. */
 	G_OBJECT_CLASS (e_addressbook_model_parent_class)->finalize (object);
@@ -742,8 +831,9 @@ e_addressbook_model_class_init (EAddressbookModelClass *class)
 		G_SIGNAL_RUN_LAST,
 		G_STRUCT_OFFSET (EAddressbookModelClass, contact_changed),
 		NULL, NULL,
-		g_cclosure_marshal_VOID__INT,
-		G_TYPE_NONE, 1,
+		e_marshal_NONE__INT_INT,
+		G_TYPE_NONE, 2,
+		G_TYPE_INT,
 		G_TYPE_INT);
 
 	signals[MODEL_CHANGED] = g_signal_new (
@@ -770,6 +860,9 @@ e_addressbook_model_init (EAddressbookModel *model)
 {
 	model->priv = E_ADDRESSBOOK_MODEL_GET_PRIVATE (model);
 	model->priv->contacts = g_ptr_array_new ();
+	model->priv->uid_index = g_hash_table_new_full (
+		g_str_hash, g_str_equal,
+		(GDestroyNotify) g_free, NULL);
 	model->priv->first_get_view = TRUE;
 }
 
@@ -865,6 +958,8 @@ e_addressbook_model_find (EAddressbookModel *model,
                           EContact *contact)
 {
 	GPtrArray *array;
+	const gchar *uid;
+	guint index;
 	gint ii;
 
 	/* XXX This searches for a particular EContact instance,
@@ -876,6 +971,12 @@ e_addressbook_model_find (EAddressbookModel *model,
 	g_return_val_if_fail (E_IS_CONTACT (contact), -1);
 
 	array = model->priv->contacts;
+
+	uid = e_contact_get_const (contact, E_CONTACT_UID);
+	if (uid != NULL && uid_index_lookup (model, uid, &index) &&
+	    array->pdata[index] == contact)
+		return index;
+
 	for (ii = 0; ii < array->len; ii++) {
 		EContact *candidate = array->pdata[ii];
 
@@ -74,7 +74,8 @@ struct _EAddressbookModelClass {
 	void		(*contacts_removed)	(EAddressbookModel *model,
 						 gpointer id_list);
 	void		(*contact_changed)	(EAddressbookModel *model,
-						 gint index);
+						 gint index,
+						 gint count);
 	void		(*model_changed)	(EAddressbookModel *model);
 	void		(*stop_state_changed)	(EAddressbookModel *model);
 };
@@ -382,9 +382,13 @@ remove_contacts (EAddressbookModel *model,
 static void
 modify_contact (EAddressbookModel *model,
                 gint index,
+                gint count,
                 EAddressbookReflowAdapter *adapter)
 {
-	e_reflow_model_item_changed (E_REFLOW_MODEL (adapter), index);
+	if (count == 1)
+		e_reflow_model_item_changed (E_REFLOW_MODEL (adapter), index);
+	else
+		e_reflow_model_changed (E_REFLOW_MODEL (adapter));
 }
 
 static void
@@ -380,13 +380,17 @@ remove_contacts (EAddressbookModel *model,
 static void
 modify_contact (EAddressbookModel *model,
                 gint index,
+                gint count,
                 EAddressbookTableAdapter *adapter)
 {
 	/* clear whole cache */
 	g_hash_table_remove_all (adapter->priv->emails);
 
 	e_table_model_pre_change (E_TABLE_MODEL (adapter));
-	e_table_model_row_changed (E_TABLE_MODEL (adapter), index);
+	if (count == 1)
+		e_table_model_row_changed (E_TABLE_MODEL (adapter), index);
+	else
+		e_table_model_changed (E_TABLE_MODEL (adapter));
 }
 
 static void
@@ -51,6 +51,9 @@ struct _ECalDataModelPrivate {
 
 	guint32 views_update_freeze;
 	gboolean views_update_required;
+
+	GMutex expand_cache_lock;
+	GHashTable *expand_cache; /* ExpandCacheKey ~> ExpandCacheEntry */
 };
 
 enum {
@@ -104,6 +107,29 @@ typedef struct _SubscriberData {
 	time_t range_end;
 } SubscriberData;
 
+/* Expanded recurrences are remembered per recurring component, thus
+   a change of the range expands only the part not covered yet */
+
+/* Drop instances of a component once there are more than this */
+#define EXPAND_CACHE_MAX_INSTANCES 4096
+
+typedef struct _ExpandCacheKey {
+	ECalClient *client;
+	gchar *uid;
+} ExpandCacheKey;
+
+typedef struct _ExpandCacheRange {
+	time_t start;
+	time_t end;
+} ExpandCacheRange;
+
+typedef struct _ExpandCacheEntry {
+	guint revision; /* hash of the component's iCalendar string */
+	icaltimezone *zone;
+	GArray *ranges; /* ExpandCacheRange, sorted, not overlapping */
+	GTree *instances; /* time_t instance_start ~> ComponentData */
+} ExpandCacheEntry;
+
 static ComponentData *
 component_data_new (ECalComponent *comp,
 		    time_t instance_start,
@@ -188,6 +214,282 @@ component_data_equal (ComponentData *comp_data1,
 	return equal;
 }
 
+static guint
+expand_cache_key_hash (gconstpointer ptr)
+{
+	const ExpandCacheKey *key = ptr;
+
+	return g_direct_hash (key->client) ^ g_str_hash (key->uid);
+}
+
+static gboolean
+expand_cache_key_equal (gconstpointer ptr1,
+			gconstpointer ptr2)
+{
+	const ExpandCacheKey *key1 = ptr1, *key2 = ptr2;
+
+	return key1->client == key2->client && g_str_equal (key1->uid, key2->uid);
+}
+
+static void
+expand_cache_key_free (gpointer ptr)
+{
+	ExpandCacheKey *key = ptr;
+
+	if (key) {
+		g_object_unref (key->client);
+		g_free (key->uid);
+		g_free (key);
+	}
+}
+
+static gint
+expand_cache_compare_times (gconstpointer ptr1,
+			    gconstpointer ptr2,
+			    gpointer user_data)
+{
+	time_t tt1 = *((const time_t *) ptr1);
+	time_t tt2 = *((const time_t *) ptr2);
+
+	return tt1 < tt2 ? -1 : tt1 > tt2 ? 1 : 0;
+}
+
+static ExpandCacheEntry *
+expand_cache_entry_new (guint revision,
+			icaltimezone *zone)
+{
+	ExpandCacheEntry *entry;
+
+	entry = g_new0 (ExpandCacheEntry, 1);
+	entry->revision = revision;
+	entry->zone = zone;
+	entry->ranges = g_array_new (FALSE, FALSE, sizeof (ExpandCacheRange));
+	/* The key points into the value, thus existing values are never replaced */
+	entry->instances = g_tree_new_full (expand_cache_compare_times, NULL, NULL, component_data_free);
+
+	return entry;
+}
+
+static void
+expand_cache_entry_free (gpointer ptr)
+{
+	ExpandCacheEntry *entry = ptr;
+
+	if (entry) {
+		g_array_free (entry->ranges, TRUE);
+		g_tree_destroy (entry->instances);
+		g_free (entry);
+	}
+}
+
+/* Returns parts of the range not covered by the entry yet, which can be NULL */
+static GArray *
+expand_cache_entry_get_gaps (ExpandCacheEntry *entry,
+			     time_t range_start,
+			     time_t range_end)
+{
+	GArray *gaps;
+	ExpandCacheRange gap;
+	time_t cursor = range_start;
+	guint ii;
+
+	gaps = g_array_new (FALSE, FALSE, sizeof (ExpandCacheRange));
+
+	for (ii = 0; entry && ii < entry->ranges->len && cursor <= range_end; ii++) {
+		ExpandCacheRange *range = &g_array_index (entry->ranges, ExpandCacheRange, ii);
+
+		if (range->end < cursor)
+			continue;
+
+		if (range->start > range_end)
+			break;
+
+		if (range->start > cursor) {
+			gap.start = cursor;
+			gap.end = range->start - 1;
+			g_array_append_val (gaps, gap);
+		}
+
+		cursor = range->end + 1;
+	}
+
+	if (cursor <= range_end) {
+		gap.start = cursor;
+		gap.end = range_end;
+		g_array_append_val (gaps, gap);
+	}
+
+	return gaps;
+}
+
+static void
+expand_cache_entry_add_range (ExpandCacheEntry *entry,
+			      time_t start,
+			      time_t end)
+{
+	ExpandCacheRange range;
+	guint ii;
+
+	range.start = start;
+	range.end = end;
+
+	/* Merge with all overlapping or adjacent ranges */
+	ii = 0;
+	while (ii < entry->ranges->len) {
+		ExpandCacheRange *existing = &g_array_index (entry->ranges, ExpandCacheRange, ii);
+
+		if (existing->end + 1 < range.start) {
+			ii++;
+			continue;
+		}
+
+		if (existing->start > range.end + 1)
+			break;
+
+		range.start = MIN (range.start, existing->start);
+		range.end = MAX (range.end, existing->end);
+
+		g_array_remove_index (entry->ranges, ii);
+	}
+
+	g_array_insert_val (entry->ranges, ii, range);
+}
+
+typedef struct _ExpandCacheCollectData {
+	time_t range_start;
+	time_t range_end;
+	GSList **pexpanded_recurrences;
+} ExpandCacheCollectData;
+
+static gboolean
+expand_cache_collect_instance_cb (gpointer key,
+				  gpointer value,
+				  gpointer user_data)
+{
+	ComponentData *comp_data = value;
+	ExpandCacheCollectData *ccd = user_data;
+
+	/* Instances are ordered by their start */
+	if (comp_data->instance_start > ccd->range_end)
+		return TRUE;
+
+	if (comp_data->instance_end >= ccd->range_start) {
+		*ccd->pexpanded_recurrences = g_slist_prepend (*ccd->pexpanded_recurrences,
+			component_data_new (comp_data->component, comp_data->instance_start,
+			comp_data->instance_end, comp_data->is_detached));
+	}
+
+	return FALSE;
+}
+
+static void
+cal_data_model_expand_cache_remove (ECalDataModel *data_model,
+				    ECalClient *client,
+				    const gchar *uid)
+{
+	ExpandCacheKey key;
+
+	if (!uid)
+		return;
+
+	key.client = client;
+	key.uid = (gchar *) uid;
+
+	g_mutex_lock (&data_model->priv->expand_cache_lock);
+	g_hash_table_remove (data_model->priv->expand_cache, &key);
+	g_mutex_unlock (&data_model->priv->expand_cache_lock);
+}
+
+typedef struct _ExpandCacheFindData {
+	const gchar *rid;
+	icalcomponent *icomp;
+	gboolean found;
+	gboolean same;
+} ExpandCacheFindData;
+
+static gboolean
+expand_cache_find_instance_cb (gpointer key,
+			       gpointer value,
+			       gpointer user_data)
+{
+	ComponentData *comp_data = value;
+	ExpandCacheFindData *fd = user_data;
+	icalcomponent *icomp;
+	gchar *rid;
+
+	rid = e_cal_component_get_recurid_as_string (comp_data->component);
+	fd->found = g_strcmp0 (rid, fd->rid) == 0;
+	g_free (rid);
+
+	if (!fd->found)
+		return FALSE;
+
+	/* An instance generated from the master component carries
+	   the master's sequence and stamp, not the detached one's */
+	icomp = e_cal_component_get_icalcomponent (comp_data->component);
+	fd->same = icomp &&
+		icalcomponent_get_sequence (icomp) == icalcomponent_get_sequence (fd->icomp) &&
+		icaltime_compare (icalcomponent_get_dtstamp (icomp), icalcomponent_get_dtstamp (fd->icomp)) == 0;
+
+	return TRUE;
+}
+
+/* Drops the cached expansion of the component the detached instance @icomp
+   belongs to, unless the cached instances contain it already */
+static void
+cal_data_model_expand_cache_remove_for_detached (ECalDataModel *data_model,
+						 ECalClient *client,
+						 icalcomponent *icomp,
+						 const ECalComponentId *id)
+{
+	ExpandCacheEntry *entry;
+	ExpandCacheKey key;
+	ExpandCacheFindData fd;
+
+	if (!id->uid)
+		return;
+
+	key.client = client;
+	key.uid = id->uid;
+
+	fd.rid = id->rid;
+	fd.icomp = icomp;
+	fd.found = FALSE;
+	fd.same = FALSE;
+
+	g_mutex_lock (&data_model->priv->expand_cache_lock);
+
+	entry = g_hash_table_lookup (data_model->priv->expand_cache, &key);
+	if (entry) {
+		g_tree_foreach (entry->instances, expand_cache_find_instance_cb, &fd);
+
+		if (!fd.found || !fd.same)
+			g_hash_table_remove (data_model->priv->expand_cache, &key);
+	}
+
+	g_mutex_unlock (&data_model->priv->expand_cache_lock);
+}
+
+static gboolean
+cal_data_model_expand_cache_is_client_cb (gpointer key,
+					  gpointer value,
+					  gpointer user_data)
+{
+	ExpandCacheKey *cache_key = key;
+
+	return cache_key->client == user_data;
+}
+
+static void
+cal_data_model_expand_cache_remove_client (ECalDataModel *data_model,
+					   ECalClient *client)
+{
+	g_mutex_lock (&data_model->priv->expand_cache_lock);
+	g_hash_table_foreach_remove (data_model->priv->expand_cache,
+		cal_data_model_expand_cache_is_client_cb, client);
+	g_mutex_unlock (&data_model->priv->expand_cache_lock);
+}
+
 static ViewData *
 view_data_new (ECalClient *client)
 {
@@ -1050,6 +1352,114 @@ cal_data_model_instance_generated (ECalComponent *comp,
 	return TRUE;
 }
 
+static void
+cal_data_model_expand_recurrences_cached (ECalDataModel *data_model,
+					  ECalClient *client,
+					  icalcomponent *icomp,
+					  icaltimezone *zone,
+					  time_t range_start,
+					  time_t range_end,
+					  GSList **pexpanded_recurrences)
+{
+	GenerateInstancesData gid;
+	ExpandCacheKey key;
+	ExpandCacheEntry *entry;
+	ExpandCacheCollectData ccd;
+	GSList *generated = NULL, *link;
+	GArray *gaps;
+	gchar *as_str;
+	guint revision, ii;
+
+	gid.client = client;
+	gid.zone = zone;
+
+	key.client = client;
+	key.uid = (gchar *) icalcomponent_get_uid (icomp);
+
+	/* Nothing to cache for an unlimited range */
+	if (!key.uid || (range_start == (time_t) 0 && range_end == (time_t) 0)) {
+		gid.pexpanded_recurrences = pexpanded_recurrences;
+
+		e_cal_client_generate_instances_for_object_sync (client, icomp, range_start, range_end,
+			cal_data_model_instance_generated, &gid);
+		return;
+	}
+
+	as_str = icalcomponent_as_ical_string_r (icomp);
+	revision = g_str_hash (as_str);
+	g_free (as_str);
+
+	g_mutex_lock (&data_model->priv->expand_cache_lock);
+
+	entry = g_hash_table_lookup (data_model->priv->expand_cache, &key);
+	if (entry && (entry->revision != revision || entry->zone != zone ||
+	    g_tree_nnodes (entry->instances) > EXPAND_CACHE_MAX_INSTANCES)) {
+		g_hash_table_remove (data_model->priv->expand_cache, &key);
+		entry = NULL;
+	}
+
+	gaps = expand_cache_entry_get_gaps (entry, range_start, range_end);
+
+	g_mutex_unlock (&data_model->priv->expand_cache_lock);
+
+	/* Expand only the parts of the range not known yet */
+	gid.pexpanded_recurrences = &generated;
+
+	for (ii = 0; ii < gaps->len; ii++) {
+		ExpandCacheRange *gap = &g_array_index (gaps, ExpandCacheRange, ii);
+
+		e_cal_client_generate_instances_for_object_sync (client, icomp, gap->start, gap->end,
+			cal_data_model_instance_generated, &gid);
+	}
+
+	g_mutex_lock (&data_model->priv->expand_cache_lock);
+
+	/* Could be dropped or replaced meanwhile */
+	entry = g_hash_table_lookup (data_model->priv->expand_cache, &key);
+	if (entry && (entry->revision != revision || entry->zone != zone)) {
+		g_hash_table_remove (data_model->priv->expand_cache, &key);
+		entry = NULL;
+	}
+
+	if (!entry) {
+		ExpandCacheKey *new_key;
+
+		new_key = g_new0 (ExpandCacheKey, 1);
+		new_key->client = g_object_ref (client);
+		new_key->uid = g_strdup (key.uid);
+
+		entry = expand_cache_entry_new (revision, zone);
+		g_hash_table_insert (data_model->priv->expand_cache, new_key, entry);
+	}
+
+	for (link = generated; link; link = g_slist_next (link)) {
+		ComponentData *comp_data = link->data;
+
+		/* An instance overlapping more gaps is generated for each of them */
+		if (g_tree_lookup (entry->instances, &comp_data->instance_start))
+			component_data_free (comp_data);
+		else
+			g_tree_insert (entry->instances, &comp_data->instance_start, comp_data);
+	}
+
+	for (ii = 0; ii < gaps->len; ii++) {
+		ExpandCacheRange *gap = &g_array_index (gaps, ExpandCacheRange, ii);
+
+		expand_cache_entry_add_range (entry, gap->start, gap->end);
+	}
+
+	ccd.range_start = range_start;
+	ccd.range_end = range_end;
+	ccd.pexpanded_recurrences = pexpanded_recurrences;
+
+	g_tree_foreach (entry->instances, expand_cache_collect_instance_cb, &ccd);
+
+	g_mutex_unlock (&data_model->priv->expand_cache_lock);
+
+	g_slist_free (generated);
+	g_array_free (gaps, TRUE);
+}
+
 static void
 cal_data_model_expand_recurrences_thread (ECalDataModel *data_model,
 					  gpointer user_data)
@@ -1058,6 +1468,7 @@ cal_data_model_expand_recurrences_thread (ECalDataModel *data_model,
 	GSList *to_expand_recurrences, *link;
 	GSList *expanded_recurrences = NULL;
 	time_t range_start, range_end;
+	icaltimezone *zone;
 	ViewData *view_data;
 
 	g_return_if_fail (E_IS_CAL_DATA_MODEL (data_model));
@@ -1070,6 +1481,7 @@ cal_data_model_expand_recurrences_thread (ECalDataModel *data_model,
 
 	range_start = data_model->priv->range_start;
 	range_end = data_model->priv->range_end;
+	zone = data_model->priv->zone;
 
 	UNLOCK_PROPS ();
 
@@ -1094,17 +1506,12 @@ cal_data_model_expand_recurrences_thread (ECalDataModel *data_model,
 
 	for (link = to_expand_recurrences; link && view_data->is_used; link = g_slist_next (link)) {
 		icalcomponent *icomp = link->data;
-		GenerateInstancesData gid;
 
 		if (!icomp)
 			continue;
 
-		gid.client = client;
-		gid.pexpanded_recurrences = &expanded_recurrences;
-		gid.zone = data_model->priv->zone;
-
-		e_cal_client_generate_instances_for_object_sync (client, icomp, range_start, range_end,
-			cal_data_model_instance_generated, &gid);
+		cal_data_model_expand_recurrences_cached (data_model, client, icomp, zone,
+			range_start, range_end, &expanded_recurrences);
 	}
 
 	g_slist_free_full (to_expand_recurrences, (GDestroyNotify) icalcomponent_free);
@@ -1184,6 +1591,11 @@ cal_data_model_process_modified_or_added_objects (ECalClientView *view,
 			if (!icomp || !icalcomponent_get_uid (icomp))
 				continue;
 
+			/* A new revision of the component or of any of its detached
+			   instances makes the expanded recurrences out of date */
+			if (!is_add)
+				cal_data_model_expand_cache_remove (data_model, client, icalcomponent_get_uid (icomp));
+
 			if (data_model->priv->expand_recurrences &&
 			    !e_cal_util_component_is_instance (icomp) &&
 			    e_cal_util_component_has_recurrences (icomp)) {
@@ -1201,6 +1613,19 @@ cal_data_model_process_modified_or_added_objects (ECalClientView *view,
 				if (!comp)
 					continue;
 
+				/* A detached instance not among the cached instances is a new
+				   exception; known ones are added again on every range change
+				   and view restart, which must not drop the cached expansion */
+				if (is_add && e_cal_util_component_is_instance (icomp)) {
+					ECalComponentId *id;
+
+					id = e_cal_component_get_id (comp);
+					if (id) {
+						cal_data_model_expand_cache_remove_for_detached (data_model, client, icomp, id);
+						e_cal_component_free_id (id);
+					}
+				}
+
 				cal_comp_get_instance_times (client, icomp, data_model->priv->zone, &instance_start, NULL, &instance_end, NULL, NULL);
 
 				if (instance_end > instance_start)
@@ -1295,6 +1720,8 @@ cal_data_model_view_objects_removed (ECalClientView *view,
 			const ECalComponentId *id = link->data;
 
 			if (id) {
+				cal_data_model_expand_cache_remove (data_model, view_data->client, id->uid);
+
 				if (!id->rid || !*id->rid) {
 					if (!g_hash_table_contains (gathered_uids, id->uid)) {
 						GatherComponentsData gather_data;
@@ -1687,6 +2114,8 @@ cal_data_model_remove_client_view (ECalDataModel *data_model,
 		g_hash_table_remove (data_model->priv->views, client);
 	}
 
+	cal_data_model_expand_cache_remove_client (data_model, client);
+
 	UNLOCK_PROPS ();
 }
 
@@ -1904,6 +2333,8 @@ cal_data_model_finalize (GObject *object)
 	g_slist_free_full (data_model->priv->subscribers, subscriber_data_free);
 	g_free (data_model->priv->filter);
 	g_free (data_model->priv->full_filter);
+	g_hash_table_destroy (data_model->priv->expand_cache);
+	g_mutex_clear (&data_model->priv->expand_cache_lock);
 
 	e_weak_ref_free (data_model->priv->submit_thread_job_responder);
 	g_rec_mutex_clear (&data_model->priv->props_lock);
@@ -1975,6 +2406,10 @@ e_cal_data_model_init (ECalDataModel *data_model)
 	data_model->priv->views_update_freeze = 0;
 	data_model->priv->views_update_required = FALSE;
 
+	data_model->priv->expand_cache = g_hash_table_new_full (expand_cache_key_hash, expand_cache_key_equal,
+		expand_cache_key_free, expand_cache_entry_free);
+	g_mutex_init (&data_model->priv->expand_cache_lock);
+
 	g_rec_mutex_init (&data_model->priv->props_lock);
 }
 
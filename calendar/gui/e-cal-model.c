@@ -67,6 +67,18 @@ struct _ECalModelPrivate {
 	/* Array for storing the objects. Each element is of type ECalModelComponent */
 	GPtrArray *objects;
 
+	/* ComponentKey -> index into the objects array */
+	GHashTable *objects_index;
+
+	/* UID -> number of objects with that UID, which tells about
+	 * objects looked up without a client or a recurrence ID. */
+	GHashTable *uid_counts;
+
+	/* Objects added while frozen are at the end of the array
+	 * and are announced to the views only on the last thaw. */
+	guint freeze_count;
+	guint n_pending;
+
 	icalcomponent_kind kind;
 	icaltimezone *zone;
 
@@ -117,6 +129,12 @@ typedef struct {
 	GList *uids;
 } AssignedColorData;
 
+typedef struct _ComponentKey {
+	ECalClient *client;
+	gchar *uid;
+	gchar *rid;
+} ComponentKey;
+
 static const gchar *cal_model_get_color_for_component (ECalModel *model, ECalModelComponent *comp_data);
 
 enum {
@@ -1005,6 +1023,8 @@ cal_model_finalize (GObject *object)
 		g_object_unref (comp_data);
 	}
 	g_ptr_array_free (priv->objects, TRUE);
+	g_hash_table_destroy (priv->objects_index);
+	g_hash_table_destroy (priv->uid_counts);
 
 	/* Chain up to parent's finalize() method. */
 	G_OBJECT_CLASS (e_cal_model_parent_class)->finalize (object);
@@ -1098,7 +1118,8 @@ cal_model_row_count (ETableModel *etm)
 
 	priv = model->priv;
 
-	return priv->objects->len;
+	/* Rows added while frozen are not known to the views yet. */
+	return priv->objects->len - priv->n_pending;
 }
 
 static const gchar *
@@ -1655,10 +1676,135 @@ cal_model_value_to_string (ETableModel *etm,
 	return g_strdup ("");
 }
 
+static ComponentKey *
+component_key_new (ECalModelComponent *comp_data)
+{
+	ComponentKey *key;
+	struct icaltimetype icalrid;
+	const gchar *uid;
+
+	uid = icalcomponent_get_uid (comp_data->icalcomp);
+	if (!uid || !*uid)
+		return NULL;
+
+	key = g_slice_new0 (ComponentKey);
+	key->client = comp_data->client;
+	key->uid = g_strdup (uid);
+
+	icalrid = icalcomponent_get_recurrenceid (comp_data->icalcomp);
+	if (!icaltime_is_null_time (icalrid))
+		key->rid = icaltime_as_ical_string_r (icalrid);
+
+	return key;
+}
+
+static void
+component_key_free (ComponentKey *key)
+{
+	g_free (key->uid);
+	g_free (key->rid);
+
+	g_slice_free (ComponentKey, key);
+}
+
+static guint
+component_key_hash (gconstpointer ptr)
+{
+	const ComponentKey *key = ptr;
+	guint hash;
+
+	hash = g_direct_hash (key->client) ^ g_str_hash (key->uid);
+	if (key->rid)
+		hash ^= g_str_hash (key->rid);
+
+	return hash;
+}
+
+static gboolean
+component_key_equal (gconstpointer ptr1,
+                     gconstpointer ptr2)
+{
+	const ComponentKey *key1 = ptr1, *key2 = ptr2;
+
+	return key1->client == key2->client &&
+		g_str_equal (key1->uid, key2->uid) &&
+		g_strcmp0 (key1->rid, key2->rid) == 0;
+}
+
+static void
+cal_model_index_add (ECalModel *model,
+                     ECalModelComponent *comp_data,
+                     gint index)
+{
+	ComponentKey *key;
+	guint count;
+
+	key = component_key_new (comp_data);
+	if (!key)
+		return;
+
+	count = GPOINTER_TO_UINT (g_hash_table_lookup (model->priv->uid_counts, key->uid));
+	g_hash_table_insert (model->priv->uid_counts, g_strdup (key->uid), GUINT_TO_POINTER (count + 1));
+
+	/* Keep the first of the objects with the same ID, if any. */
+	if (g_hash_table_contains (model->priv->objects_index, key))
+		component_key_free (key);
+	else
+		g_hash_table_insert (model->priv->objects_index, key, GINT_TO_POINTER (index));
+}
+
+static void
+cal_model_index_remove (ECalModel *model,
+                        ECalModelComponent *comp_data,
+                        gint index)
+{
+	ComponentKey *key;
+	gpointer value;
+	guint count;
+
+	key = component_key_new (comp_data);
+	if (!key)
+		return;
+
+	count = GPOINTER_TO_UINT (g_hash_table_lookup (model->priv->uid_counts, key->uid));
+	if (count > 1)
+		g_hash_table_insert (model->priv->uid_counts, g_strdup (key->uid), GUINT_TO_POINTER (count - 1));
+	else
+		g_hash_table_remove (model->priv->uid_counts, key->uid);
+
+	if (g_hash_table_lookup_extended (model->priv->objects_index, key, NULL, &value) &&
+	    GPOINTER_TO_INT (value) == index)
+		g_hash_table_remove (model->priv->objects_index, key);
+
+	component_key_free (key);
+}
+
+static void
+cal_model_index_move (ECalModel *model,
+                      ECalModelComponent *comp_data,
+                      gint old_index,
+                      gint new_index)
+{
+	ComponentKey *key;
+	gpointer value;
+
+	key = component_key_new (comp_data);
+	if (!key)
+		return;
+
+	/* The hash table keeps its own key, thus this one is freed by the insert. */
+	if (g_hash_table_lookup_extended (model->priv->objects_index, key, NULL, &value) &&
+	    GPOINTER_TO_INT (value) == old_index)
+		g_hash_table_insert (model->priv->objects_index, key, GINT_TO_POINTER (new_index));
+	else
+		component_key_free (key);
+}
+
+/* Used when either any client or any recurrence ID matches */
 static gint
-e_cal_model_get_component_index (ECalModel *model,
-				 ECalClient *client,
-				 const ECalComponentId *id)
+cal_model_find_component_index (ECalModel *model,
+				ECalClient *client,
+				const ECalComponentId *id)
 {
 	gint ii;
 
@@ -1696,6 +1842,114 @@ e_cal_model_get_component_index (ECalModel *model,
 	return -1;
 }
 
+static gint
+e_cal_model_get_component_index (ECalModel *model,
+				 ECalClient *client,
+				 const ECalComponentId *id)
+{
+	ComponentKey key;
+	gpointer value;
+
+	if (!id->uid || !g_hash_table_contains (model->priv->uid_counts, id->uid))
+		return -1;
+
+	if (client) {
+		key.client = client;
+		key.uid = id->uid;
+		key.rid = (id->rid && *id->rid) ? id->rid : NULL;
+
+		if (g_hash_table_lookup_extended (model->priv->objects_index, &key, NULL, &value))
+			return GPOINTER_TO_INT (value);
+
+		if (key.rid)
+			return -1;
+	}
+
+	/* Objects of this UID are there, but none with this exact ID. */
+	return cal_model_find_component_index (model, client, id);
+}
+
+/* Takes ownership of the comp_data */
+static void
+cal_model_append_component (ECalModel *model,
+			    ECalModelComponent *comp_data)
+{
+	ETableModel *table_model = E_TABLE_MODEL (model);
+
+	if (!model->priv->freeze_count)
+		e_table_model_pre_change (table_model);
+
+	g_ptr_array_add (model->priv->objects, comp_data);
+	cal_model_index_add (model, comp_data, model->priv->objects->len - 1);
+
+	if (model->priv->freeze_count)
+		model->priv->n_pending++;
+	else
+		e_table_model_row_inserted (table_model, model->priv->objects->len - 1);
+}
+
+static void
+cal_model_flush_pending_rows (ECalModel *model)
+{
+	ETableModel *table_model;
+	guint n_pending;
+
+	n_pending = model->priv->n_pending;
+	if (!n_pending)
+		return;
+
+	model->priv->n_pending = 0;
+
+	table_model = E_TABLE_MODEL (model);
+	e_table_model_pre_change (table_model);
+	e_table_model_rows_inserted (table_model, model->priv->objects->len - n_pending, n_pending);
+}
+
+/* The last object is moved into the place of the removed one,
+ * thus the rest of the array does not need to be shifted. */
+static void
+cal_model_remove_component_at (ECalModel *model,
+			       gint index)
+{
+	ECalModelComponent *comp_data;
+	ETableModel *table_model;
+	GSList *link;
+	gint last;
+
+	/* Pending rows can be moved, let the views know about them. */
+	cal_model_flush_pending_rows (model);
+
+	table_model = E_TABLE_MODEL (model);
+	e_table_model_pre_change (table_model);
+
+	comp_data = g_ptr_array_index (model->priv->objects, index);
+	if (!comp_data) {
+		e_table_model_no_change (table_model);
+		return;
+	}
+
+	cal_model_index_remove (model, comp_data, index);
+
+	last = model->priv->objects->len - 1;
+	g_ptr_array_remove_index_fast (model->priv->objects, index);
+
+	if (index != last)
+		cal_model_index_move (model, g_ptr_array_index (model->priv->objects, index), last, index);
+
+	link = g_slist_append (NULL, comp_data);
+	g_signal_emit (model, signals[COMPS_DELETED], 0, link);
+
+	g_slist_free (link);
+	g_object_unref (comp_data);
+
+	e_table_model_row_deleted (table_model, last);
+
+	if (index != last) {
+		e_table_model_pre_change (table_model);
+		e_table_model_row_changed (table_model, index);
+	}
+}
+
 /* We do this check since the calendar items are downloaded from the server
  * in the open_method, since the default timezone might not be set there. */
 static void
@@ -1751,16 +2005,17 @@ cal_model_data_subscriber_component_added_or_modified (ECalDataModelSubscriber *
 	ensure_dates_are_in_default_zone (model, icalcomp);
 
 	if (index < 0) {
-		e_table_model_pre_change (table_model);
-
 		comp_data = g_object_new (E_TYPE_CAL_MODEL_COMPONENT, NULL);
 		comp_data->is_new_component = FALSE;
 		comp_data->client = g_object_ref (client);
 		comp_data->icalcomp = icalcomp;
 		e_cal_model_set_instance_times (comp_data, model->priv->zone);
-		g_ptr_array_add (model->priv->objects, comp_data);
 
-		e_table_model_row_inserted (table_model, model->priv->objects->len - 1);
+		cal_model_append_component (model, comp_data);
+	} else if (index >= model->priv->objects->len - model->priv->n_pending) {
+		/* Not announced yet, the views will read it on thaw. */
+		comp_data = g_ptr_array_index (model->priv->objects, index);
+		e_cal_model_component_set_icalcomponent (comp_data, model, icalcomp);
 	} else {
 		e_table_model_pre_change (table_model);
 
@@ -1794,10 +2049,7 @@ e_cal_model_data_subscriber_component_removed (ECalDataModelSubscriber *subscrib
 					       const gchar *rid)
 {
 	ECalModel *model;
-	ECalModelComponent *comp_data;
-	ETableModel *table_model;
 	ECalComponentId id;
-	GSList *link;
 	gint index;
 
 	model = E_CAL_MODEL (subscriber);
@@ -1810,40 +2062,30 @@ e_cal_model_data_subscriber_component_removed (ECalDataModelSubscriber *subscrib
 	if (index < 0)
 		return;
 
-	table_model = E_TABLE_MODEL (model);
-	e_table_model_pre_change (table_model);
-
-	comp_data = g_ptr_array_remove_index (model->priv->objects, index);
-	if (!comp_data) {
-		e_table_model_no_change (table_model);
-		return;
-	}
-
-	link = g_slist_append (NULL, comp_data);
-	g_signal_emit (model, signals[COMPS_DELETED], 0, link);
-
-	g_slist_free (link);
-	g_object_unref (comp_data);
-
-	e_table_model_row_deleted (table_model, index);
+	cal_model_remove_component_at (model, index);
 }
 
 static void
 e_cal_model_data_subscriber_freeze (ECalDataModelSubscriber *subscriber)
 {
-	/* No freeze/thaw, the ETableModel doesn't notify about changes when frozen */
+	ECalModel *model = E_CAL_MODEL (subscriber);
 
-	/* ETableModel *table_model = E_TABLE_MODEL (subscriber);
-	e_table_model_freeze (table_model); */
+	/* Not the ETableModel freeze, which doesn't notify about changes when
+	 * frozen; added objects are only collected and announced on thaw. */
+	model->priv->freeze_count++;
 }
 
 static void
 e_cal_model_data_subscriber_thaw (ECalDataModelSubscriber *subscriber)
 {
-	/* No freeze/thaw, the ETableModel doesn't notify about changes when frozen */
+	ECalModel *model = E_CAL_MODEL (subscriber);
+
+	g_return_if_fail (model->priv->freeze_count > 0);
 
-	/* ETableModel *table_model = E_TABLE_MODEL (subscriber);
-	e_table_model_thaw (table_model); */
+	model->priv->freeze_count--;
+
+	if (!model->priv->freeze_count)
+		cal_model_flush_pending_rows (model);
 }
 
 static void
@@ -2220,6 +2462,11 @@ e_cal_model_init (ECalModel *model)
 	model->priv->end = (time_t) -1;
 
 	model->priv->objects = g_ptr_array_new ();
+	model->priv->objects_index = g_hash_table_new_full (
+		component_key_hash, component_key_equal,
+		(GDestroyNotify) component_key_free, NULL);
+	model->priv->uid_counts = g_hash_table_new_full (
+		g_str_hash, g_str_equal, g_free, NULL);
 	model->priv->kind = ICAL_NO_COMPONENT;
 
 	model->priv->use_24_hour_format = TRUE;
@@ -2830,73 +3077,40 @@ e_cal_model_set_default_source_uid (ECalModel *model,
 	g_object_notify (G_OBJECT (model), "default-source-uid");
 }
 
-static ECalModelComponent *
-search_by_id_and_client (ECalModelPrivate *priv,
-                         ECalClient *client,
-                         const ECalComponentId *id)
-{
-	gint i;
-
-	for (i = 0; i < priv->objects->len; i++) {
-		ECalModelComponent *comp_data = g_ptr_array_index (priv->objects, i);
-
-		if (comp_data) {
-			const gchar *uid;
-			gchar *rid = NULL;
-			struct icaltimetype icalrid;
-			gboolean has_rid = (id->rid && *id->rid);
-
-			uid = icalcomponent_get_uid (comp_data->icalcomp);
-			icalrid = icalcomponent_get_recurrenceid (comp_data->icalcomp);
-			if (!icaltime_is_null_time (icalrid))
-				rid = icaltime_as_ical_string_r (icalrid);
-
-			if (uid && *uid) {
-				if ((!client || comp_data->client == client) && !strcmp (id->uid, uid)) {
-					if (has_rid) {
-						if (!(rid && *rid && !strcmp (rid, id->rid))) {
-							g_free (rid);
-							continue;
-						}
-					}
-					g_free (rid);
-					return comp_data;
-				}
-			}
-
-			g_free (rid);
-		}
-	}
-
-	return NULL;
-}
-
 void
 e_cal_model_remove_all_objects (ECalModel *model)
 {
-	ECalModelComponent *comp_data;
 	ETableModel *table_model;
-	GSList *link;
-	gint index;
+	GSList *list = NULL;
+	gint n_rows, index;
 
 	table_model = E_TABLE_MODEL (model);
+	n_rows = e_table_model_row_count (table_model);
+
+	e_table_model_pre_change (table_model);
+
 	for (index = model->priv->objects->len - 1; index >= 0; index--) {
-		e_table_model_pre_change (table_model);
+		ECalModelComponent *comp_data;
 
-		comp_data = g_ptr_array_remove_index (model->priv->objects, index);
-		if (!comp_data) {
-			e_table_model_no_change (table_model);
-			continue;
-		}
+		comp_data = g_ptr_array_index (model->priv->objects, index);
+		if (comp_data)
+			list = g_slist_prepend (list, comp_data);
+	}
 
-		link = g_slist_append (NULL, comp_data);
-		g_signal_emit (model, signals[COMPS_DELETED], 0, link);
+	g_ptr_array_set_size (model->priv->objects, 0);
+	g_hash_table_remove_all (model->priv->objects_index);
+	g_hash_table_remove_all (model->priv->uid_counts);
+	model->priv->n_pending = 0;
 
-		g_slist_free (link);
-		g_object_unref (comp_data);
+	if (list)
+		g_signal_emit (model, signals[COMPS_DELETED], 0, list);
 
-		e_table_model_row_deleted (table_model, index);
-	}
+	g_slist_free_full (list, g_object_unref);
+
+	if (n_rows > 0)
+		e_table_model_rows_deleted (table_model, 0, n_rows);
+	else
+		e_table_model_no_change (table_model);
 }
 
 void
@@ -3171,13 +3385,66 @@ e_cal_model_get_component_for_client_and_uid (ECalModel *model,
 					      ECalClient *client,
 					      const ECalComponentId *id)
 {
-	ECalModelPrivate *priv;
+	gint index;
 
 	g_return_val_if_fail (E_IS_CAL_MODEL (model), NULL);
+	g_return_val_if_fail (id != NULL, NULL);
 
-	priv = model->priv;
+	index = e_cal_model_get_component_index (model, client, id);
+	if (index < 0)
+		return NULL;
 
-	return search_by_id_and_client (priv, client, id);
+	return g_ptr_array_index (model->priv->objects, index);
+}
+
+/**
+ * e_cal_model_add_object:
+ * @model: an #ECalModel
+ * @comp_data: an #ECalModelComponent
+ *
+ * Adds @comp_data to the @model, which references it.
+ **/
+void
+e_cal_model_add_object (ECalModel *model,
+			ECalModelComponent *comp_data)
+{
+	g_return_if_fail (E_IS_CAL_MODEL (model));
+	g_return_if_fail (E_IS_CAL_MODEL_COMPONENT (comp_data));
+
+	cal_model_append_component (model, g_object_ref (comp_data));
+}
+
+/**
+ * e_cal_model_remove_object:
+ * @model: an #ECalModel
+ * @comp_data: an #ECalModelComponent
+ *
+ * Removes @comp_data from the @model.
+ **/
+void
+e_cal_model_remove_object (ECalModel *model,
+			   ECalModelComponent *comp_data)
+{
+	ComponentKey *key;
+	gpointer value;
+	gint index = -1;
+
+	g_return_if_fail (E_IS_CAL_MODEL (model));
+	g_return_if_fail (E_IS_CAL_MODEL_COMPONENT (comp_data));
+
+	key = component_key_new (comp_data);
+	if (key) {
+		if (g_hash_table_lookup_extended (model->priv->objects_index, key, NULL, &value) &&
+		    g_ptr_array_index (model->priv->objects, GPOINTER_TO_INT (value)) == comp_data)
+			index = GPOINTER_TO_INT (value);
+		component_key_free (key);
+	}
+
+	if (index < 0)
+		index = get_position_in_array (model->priv->objects, comp_data);
+
+	if (index >= 0)
+		cal_model_remove_component_at (model, index);
 }
 
 /**
@@ -3250,6 +3517,9 @@ e_cal_model_generate_instances_sync (ECalModel *model,
 
 /**
  * e_cal_model_get_object_array
+ *
+ * The returned array is owned by the model and should not be modified,
+ * use e_cal_model_add_object() and e_cal_model_remove_object() instead.
  */
 GPtrArray *
 e_cal_model_get_object_array (ECalModel *model)
@@ -1538,8 +1538,6 @@ hide_completed_rows_ready (GObject *source_object,
 	ECalClient *cal_client;
 	GSList *m, *objects;
 	gboolean changed = FALSE;
-	gint pos;
-	GPtrArray *comp_objects;
 	GError *error = NULL;
 
 	cal_client = E_CAL_CLIENT (source_object);
@@ -1565,9 +1563,6 @@ hide_completed_rows_ready (GObject *source_object,
 		return;
 	}
 
-	comp_objects = e_cal_model_get_object_array (model);
-	g_return_if_fail (comp_objects != NULL);
-
 	for (m = objects; m; m = m->next) {
 		ECalModelComponent *comp_data;
 		ECalComponentId *id;
@@ -1579,13 +1574,7 @@ hide_completed_rows_ready (GObject *source_object,
 
 		comp_data = e_cal_model_get_component_for_client_and_uid (model, cal_client, id);
 		if (comp_data != NULL) {
-			e_table_model_pre_change (E_TABLE_MODEL (model));
-			pos = get_position_in_array (
-				comp_objects, comp_data);
-			if (g_ptr_array_remove (comp_objects, comp_data))
-				g_object_unref (comp_data);
-			e_table_model_row_deleted (
-				E_TABLE_MODEL (model), pos);
+			e_cal_model_remove_object (model, comp_data);
 			changed = TRUE;
 		}
 		e_cal_component_free_id (id);
@@ -1609,7 +1598,6 @@ show_completed_rows_ready (GObject *source_object,
 	ECalClient *cal_client;
 	ECalModel *model = user_data;
 	GSList *m, *objects;
-	GPtrArray *comp_objects;
 	GError *error = NULL;
 
 	cal_client = E_CAL_CLIENT (source_object);
@@ -1636,9 +1624,6 @@ show_completed_rows_ready (GObject *source_object,
 		return;
 	}
 
-	comp_objects = e_cal_model_get_object_array (model);
-	g_return_if_fail (comp_objects != NULL);
-
 	for (m = objects; m; m = m->next) {
 		ECalModelComponent *comp_data;
 		ECalComponentId *id;
@@ -1649,7 +1634,6 @@ show_completed_rows_ready (GObject *source_object,
 		id = e_cal_component_get_id (comp);
 
 		if (!(e_cal_model_get_component_for_client_and_uid (model, cal_client, id))) {
-			e_table_model_pre_change (E_TABLE_MODEL (model));
 			comp_data = g_object_new (
 				E_TYPE_CAL_MODEL_COMPONENT, NULL);
 			comp_data->client = g_object_ref (cal_client);
@@ -1664,10 +1648,8 @@ show_completed_rows_ready (GObject *source_object,
 			comp_data->completed = NULL;
 			comp_data->color = NULL;
 
-			g_ptr_array_add (comp_objects, comp_data);
-			e_table_model_row_inserted (
-				E_TABLE_MODEL (model),
-				comp_objects->len - 1);
+			e_cal_model_add_object (model, comp_data);
+			g_object_unref (comp_data);
 		}
 		e_cal_component_free_id (id);
 		g_object_unref (comp);
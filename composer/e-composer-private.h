@@ -85,6 +85,11 @@ struct _EMsgComposerPrivate {
 	gchar *mime_body;
 	gchar *charset;
 
+	/* Charset and transfer encoding analysis of the last
+	 * built text parts, reused until the text changes. */
+	gpointer plain_analysis; /* BodyAnalysis */
+	gpointer html_analysis; /* BodyAnalysis */
+
 	guint32 autosaved : 1;
 	guint32 mode_post : 1;
 	guint32 in_signature_insert : 1;
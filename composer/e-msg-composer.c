@@ -329,104 +329,251 @@ destination_list_to_vector (GList *list)
 
 #define LINE_LEN 72
 
-static gboolean
-text_requires_quoted_printable (const gchar *text,
-                                gsize len)
+/* Everything needed to pick a charset and a transfer encoding for
+ * a text part, gathered in a single pass over its UTF-8 text.  Which
+ * charsets can represent the text is decided by converting only the
+ * distinct non-ASCII characters, each of them once. */
+typedef struct _BodyAnalysis {
+	gchar *text;
+	gsize length;
+
+	gboolean is_valid_utf8;
+	gboolean has_8bit;
+	gboolean has_from_line;
+	gsize max_line_length;
+
+	/* gunichar ~> how many times it occurs in the text */
+	GHashTable *non_ascii;
+
+	/* charset name ~> CamelTransferEncoding, -1 if not usable */
+	GHashTable *encodings;
+} BodyAnalysis;
+
+static void
+body_analysis_free (BodyAnalysis *analysis)
 {
-	const gchar *p;
-	gsize pos;
+	if (analysis == NULL)
+		return;
 
-	if (!text)
-		return FALSE;
+	g_hash_table_destroy (analysis->non_ascii);
+	g_hash_table_destroy (analysis->encodings);
+	g_free (analysis->text);
 
-	if (len == -1)
-		len = strlen (text);
+	g_slice_free (BodyAnalysis, analysis);
+}
 
-	if (len >= 5 && strncmp (text, "From ", 5) == 0)
-		return TRUE;
+static BodyAnalysis *
+body_analysis_new (const gchar *text,
+                   gsize length)
+{
+	BodyAnalysis *analysis;
+	const gchar *p, *end;
+	gsize line_length = 0;
+
+	analysis = g_slice_new0 (BodyAnalysis);
+	analysis->text = g_strndup (text, length);
+	analysis->length = length;
+	analysis->is_valid_utf8 = TRUE;
+	analysis->non_ascii = g_hash_table_new (g_direct_hash, g_direct_equal);
+	analysis->encodings = g_hash_table_new_full (
+		(GHashFunc) g_str_hash,
+		(GEqualFunc) g_str_equal,
+		(GDestroyNotify) g_free,
+		(GDestroyNotify) NULL);
 
-	for (p = text, pos = 0; pos + 6 <= len; pos++, p++) {
-		if (*p == '\n' && strncmp (p + 1, "From ", 5) == 0)
-			return TRUE;
+	/* An mbox "From " line would get mangled in transit. */
+	if (length >= 5 && strncmp (text, "From ", 5) == 0)
+		analysis->has_from_line = TRUE;
+
+	for (p = text, end = text + length; p < end; ) {
+		gunichar uc;
+		gint count;
+
+		if ((guchar) *p < 128) {
+			if (*p == '\n') {
+				if (end - p >= 6 && strncmp (p + 1, "From ", 5) == 0)
+					analysis->has_from_line = TRUE;
+
+				analysis->max_line_length = MAX (
+					analysis->max_line_length, line_length);
+				line_length = 0;
+			} else {
+				line_length++;
+			}
+
+			p++;
+			continue;
+		}
+
+		analysis->has_8bit = TRUE;
+
+		uc = g_utf8_get_char_validated (p, end - p);
+		if (uc == (gunichar) -1 || uc == (gunichar) -2) {
+			analysis->is_valid_utf8 = FALSE;
+			line_length++;
+			p++;
+			continue;
+		}
+
+		count = GPOINTER_TO_INT (g_hash_table_lookup (
+			analysis->non_ascii, GUINT_TO_POINTER (uc)));
+		g_hash_table_insert (
+			analysis->non_ascii, GUINT_TO_POINTER (uc),
+			GINT_TO_POINTER (count + 1));
+
+		line_length += g_utf8_skip[*(guchar *) p];
+		p = g_utf8_next_char (p);
 	}
 
-	return FALSE;
+	analysis->max_line_length = MAX (
+		analysis->max_line_length, line_length);
+
+	return analysis;
 }
 
 static CamelTransferEncoding
-best_encoding (GByteArray *buf,
-               const gchar *charset)
+body_analysis_get_encoding (BodyAnalysis *analysis,
+                            const gchar *charset)
 {
-	gchar *in, *out, outbuf[256], *ch;
-	gsize inlen, outlen;
-	gint status, count = 0;
+	CamelTransferEncoding encoding;
+	GHashTableIter iter;
+	gpointer key, value;
+	gboolean representable = TRUE;
+	gsize count = 0;
 	iconv_t cd;
 
-	if (!charset)
+	if (!charset || !analysis->is_valid_utf8)
 		return -1;
 
+	if (g_hash_table_lookup_extended (analysis->encodings, charset, NULL, &value))
+		return GPOINTER_TO_INT (value);
+
 	cd = camel_iconv_open (charset, "utf-8");
 	if (cd == (iconv_t) -1)
 		return -1;
 
-	in = (gchar *) buf->data;
-	inlen = buf->len;
-	do {
+	/* Every character is converted on its own, from the initial
+	 * state; shift sequences of stateful charsets are 7-bit. */
+	g_hash_table_iter_init (&iter, analysis->non_ascii);
+	while (g_hash_table_iter_next (&iter, &key, &value)) {
+		gchar inbuf[6], outbuf[32], *in, *out, *ch;
+		gsize inlen, outlen;
+
+		inlen = g_unichar_to_utf8 (GPOINTER_TO_UINT (key), inbuf);
+		in = inbuf;
 		out = outbuf;
 		outlen = sizeof (outbuf);
-		status = camel_iconv (cd, (const gchar **) &in, &inlen, &out, &outlen);
+
+		camel_iconv (cd, NULL, NULL, NULL, NULL);
+
+		if (camel_iconv (cd, (const gchar **) &in, &inlen, &out, &outlen) != 0 || inlen > 0) {
+			representable = FALSE;
+			break;
+		}
+
 		for (ch = out - 1; ch >= outbuf; ch--) {
 			if ((guchar) *ch > 127)
-				count++;
+				count += GPOINTER_TO_INT (value);
 		}
-	} while (status == (gsize) -1 && errno == E2BIG);
-	camel_iconv_close (cd);
+	}
 
-	if (status == (gsize) -1 || status > 0)
-		return -1;
+	camel_iconv_close (cd);
 
-	if ((count == 0) && (buf->len < LINE_LEN) &&
-		!text_requires_quoted_printable (
-		(const gchar *) buf->data, buf->len))
-		return CAMEL_TRANSFER_ENCODING_7BIT;
-	else if (count <= buf->len * 0.17)
-		return CAMEL_TRANSFER_ENCODING_QUOTEDPRINTABLE;
+	if (!representable)
+		encoding = -1;
+	else if (count == 0 && analysis->max_line_length < LINE_LEN &&
+		 !analysis->has_from_line)
+		encoding = CAMEL_TRANSFER_ENCODING_7BIT;
+	else if (count <= analysis->length * 0.17)
+		encoding = CAMEL_TRANSFER_ENCODING_QUOTEDPRINTABLE;
 	else
-		return CAMEL_TRANSFER_ENCODING_BASE64;
+		encoding = CAMEL_TRANSFER_ENCODING_BASE64;
+
+	g_hash_table_insert (
+		analysis->encodings, g_strdup (charset),
+		GINT_TO_POINTER (encoding));
+
+	return encoding;
+}
+
+/* Returns the analysis of the text, reusing the one cached
+ * in @cached as long as the text did not change. */
+static BodyAnalysis *
+composer_analyse_body (gpointer *cached,
+                       const gchar *text,
+                       gsize length)
+{
+	BodyAnalysis *analysis = *cached;
+
+	if (analysis != NULL && analysis->length == length &&
+	    memcmp (analysis->text, text, length) == 0)
+		return analysis;
+
+	body_analysis_free (analysis);
+	analysis = body_analysis_new (text, length);
+	*cached = analysis;
+
+	return analysis;
 }
 
 static gchar *
-best_charset (GByteArray *buf,
+best_charset (BodyAnalysis *analysis,
               const gchar *default_charset,
               CamelTransferEncoding *encoding)
 {
 	const gchar *charset;
+	gchar *tmp_charset;
 
 	/* First try US-ASCII */
-	*encoding = best_encoding (buf, "US-ASCII");
+	*encoding = body_analysis_get_encoding (analysis, "US-ASCII");
 	if (*encoding == CAMEL_TRANSFER_ENCODING_7BIT)
 		return NULL;
 
 	/* Next try the user-specified charset for this message */
-	*encoding = best_encoding (buf, default_charset);
+	*encoding = body_analysis_get_encoding (analysis, default_charset);
 	if (*encoding != -1)
 		return g_strdup (default_charset);
 
 	/* Now try the user's default charset from the mail config */
-	charset = e_composer_get_default_charset ();
-	*encoding = best_encoding (buf, charset);
+	tmp_charset = e_composer_get_default_charset ();
+	*encoding = body_analysis_get_encoding (analysis, tmp_charset);
 	if (*encoding != -1)
-		return g_strdup (charset);
+		return tmp_charset;
+	g_free (tmp_charset);
+
+	/* Try to find something that will work; ASCII characters
+	 * do not make a difference, the distinct others are enough. */
+	if (analysis->is_valid_utf8) {
+		GHashTableIter iter;
+		GString *chars;
+		gpointer key;
+
+		chars = g_string_sized_new (
+			g_hash_table_size (analysis->non_ascii) * 3);
+
+		g_hash_table_iter_init (&iter, analysis->non_ascii);
+		while (g_hash_table_iter_next (&iter, &key, NULL))
+			g_string_append_unichar (chars, GPOINTER_TO_UINT (key));
+
+		charset = camel_charset_best (chars->str, chars->len);
+
+		g_string_free (chars, TRUE);
+	} else {
+		charset = NULL;
+	}
 
-	/* Try to find something that will work */
-	charset = camel_charset_best (
-		(const gchar *) buf->data, buf->len);
 	if (charset == NULL) {
+		/* Not a valid UTF-8, send it as it is. */
+		if (!analysis->is_valid_utf8) {
+			*encoding = CAMEL_TRANSFER_ENCODING_BASE64;
+			return g_strdup ("UTF-8");
+		}
+
 		*encoding = CAMEL_TRANSFER_ENCODING_7BIT;
 		return NULL;
 	}
 
-	*encoding = best_encoding (buf, charset);
+	*encoding = body_analysis_get_encoding (analysis, charset);
 
 	return g_strdup (charset);
 }
@@ -1274,19 +1421,17 @@ composer_build_message (EMsgComposer *composer,
 	/* Build the text/plain part. */
 
 	if (priv->mime_body) {
-		if (text_requires_quoted_printable (priv->mime_body, -1)) {
+		BodyAnalysis *analysis;
+
+		analysis = composer_analyse_body (
+			&priv->plain_analysis, priv->mime_body,
+			strlen (priv->mime_body));
+
+		if (analysis->has_from_line || analysis->has_8bit)
 			context->plain_encoding =
 				CAMEL_TRANSFER_ENCODING_QUOTEDPRINTABLE;
-		} else {
+		else
 			context->plain_encoding = CAMEL_TRANSFER_ENCODING_7BIT;
-			for (i = 0; priv->mime_body[i]; i++) {
-				if ((guchar) priv->mime_body[i] > 127) {
-					context->plain_encoding =
-					CAMEL_TRANSFER_ENCODING_QUOTEDPRINTABLE;
-					break;
-				}
-			}
-		}
 
 		data = g_byte_array_new ();
 		g_byte_array_append (
@@ -1298,6 +1443,7 @@ composer_build_message (EMsgComposer *composer,
 		gchar *text;
 		EHTMLEditor *editor;
 		EHTMLEditorView *view;
+		BodyAnalysis *analysis;
 
 		editor = e_msg_composer_get_editor (composer);
 		view = e_html_editor_get_view (editor);
@@ -1306,9 +1452,13 @@ composer_build_message (EMsgComposer *composer,
 		g_byte_array_append (data, (guint8 *) text, strlen (text));
 		g_free (text);
 
+		analysis = composer_analyse_body (
+			&priv->plain_analysis,
+			(const gchar *) data->data, data->len);
+
 		type = camel_content_type_new ("text", "plain");
 		charset = best_charset (
-			data, priv->charset, &context->plain_encoding);
+			analysis, priv->charset, &context->plain_encoding);
 		if (charset != NULL) {
 			camel_content_type_set_param (type, "charset", charset);
 			iconv_charset = camel_iconv_charset_name (charset);
@@ -1371,6 +1521,8 @@ composer_build_message (EMsgComposer *composer,
 		gboolean pre_encode;
 		EHTMLEditor *editor;
 		EHTMLEditorView *view;
+		BodyAnalysis *analysis;
+		CamelTransferEncoding html_encoding;
 		GList *inline_images = NULL;
 
 		editor = e_msg_composer_get_editor (composer);
@@ -1380,9 +1532,20 @@ composer_build_message (EMsgComposer *composer,
 		text = e_html_editor_view_get_text_html (view, from_domain, &inline_images);
 		length = strlen (text);
 		g_byte_array_append (data, (guint8 *) text, (guint) length);
-		pre_encode = text_requires_quoted_printable (text, length);
 		g_free (text);
 
+		analysis = composer_analyse_body (
+			&priv->html_analysis,
+			(const gchar *) data->data, data->len);
+
+		html_encoding = body_analysis_get_encoding (analysis, "UTF-8");
+		if (html_encoding == -1)
+			html_encoding = CAMEL_TRANSFER_ENCODING_QUOTEDPRINTABLE;
+
+		pre_encode =
+			html_encoding == CAMEL_TRANSFER_ENCODING_QUOTEDPRINTABLE &&
+			analysis->has_from_line;
+
 		mem_stream = camel_stream_mem_new_with_byte_array (data);
 		stream = camel_stream_filter_new (mem_stream);
 		g_object_unref (mem_stream);
@@ -1422,8 +1585,7 @@ composer_build_message (EMsgComposer *composer,
 		/* Add the text/html part. */
 		part = camel_mime_part_new ();
 		camel_medium_set_content (CAMEL_MEDIUM (part), html);
-		camel_mime_part_set_encoding (
-			part, CAMEL_TRANSFER_ENCODING_QUOTEDPRINTABLE);
+		camel_mime_part_set_encoding (part, html_encoding);
 		camel_multipart_add_part (body, part);
 		g_object_unref (part);
 
@@ -2173,6 +2335,9 @@ msg_composer_finalize (GObject *object)
 {
 	EMsgComposer *composer = E_MSG_COMPOSER (object);
 
+	body_analysis_free (composer->priv->plain_analysis);
+	body_analysis_free (composer->priv->html_analysis);
+
 	e_composer_private_finalize (composer);
 
 	/* Chain up to parent's finalize() method. */
@@ -0,0 +1,362 @@
+/*
+ * e-attachment-file-wrapper.c
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/* A CamelDataWrapper whose content is the file it was created for,
+ * instead of an in-memory copy of it.  The file is opened anew each
+ * time the content is written, thus the transfer encoding of the MIME
+ * part is applied while streaming and a big attachment never has to
+ * fit into the memory.  Writes do not share any state, which makes
+ * the wrapper safe to be written from several threads at once.  The
+ * writes fail when the file's size or modification time differ from
+ * those at the time it was attached, because the MIME part's encoding
+ * was chosen for the content it had back then. */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <glib/gi18n-lib.h>
+
+#include "e-attachment-file-wrapper.h"
+
+#define E_ATTACHMENT_FILE_WRAPPER_GET_PRIVATE(obj) \
+	(G_TYPE_INSTANCE_GET_PRIVATE \
+	((obj), E_TYPE_ATTACHMENT_FILE_WRAPPER, EAttachmentFileWrapperPrivate))
+
+#define BUFFER_SIZE 16384
+
+#define FILE_STATE_QUERY \
+	G_FILE_ATTRIBUTE_STANDARD_SIZE "," \
+	G_FILE_ATTRIBUTE_TIME_MODIFIED "," \
+	G_FILE_ATTRIBUTE_TIME_MODIFIED_USEC
+
+struct _EAttachmentFileWrapperPrivate {
+	GFile *file;
+
+	/* The file's state when it was attached. */
+	goffset size;
+	guint64 mtime;
+	guint32 mtime_usec;
+	gboolean check_mtime;
+};
+
+enum {
+	PROP_0,
+	PROP_FILE
+};
+
+G_DEFINE_TYPE (
+	EAttachmentFileWrapper,
+	e_attachment_file_wrapper,
+	CAMEL_TYPE_DATA_WRAPPER)
+
+static void
+attachment_file_wrapper_set_file (EAttachmentFileWrapper *wrapper,
+                                  GFile *file)
+{
+	g_return_if_fail (G_IS_FILE (file));
+	g_return_if_fail (wrapper->priv->file == NULL);
+
+	wrapper->priv->file = g_object_ref (file);
+}
+
+static void
+attachment_file_wrapper_set_property (GObject *object,
+                                      guint property_id,
+                                      const GValue *value,
+                                      GParamSpec *pspec)
+{
+	switch (property_id) {
+		case PROP_FILE:
+			attachment_file_wrapper_set_file (
+				E_ATTACHMENT_FILE_WRAPPER (object),
+				g_value_get_object (value));
+			return;
+	}
+
+	G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+}
+
+static void
+attachment_file_wrapper_get_property (GObject *object,
+                                      guint property_id,
+                                      GValue *value,
+                                      GParamSpec *pspec)
+{
+	switch (property_id) {
+		case PROP_FILE:
+			g_value_set_object (
+				value,
+				e_attachment_file_wrapper_get_file (
+				E_ATTACHMENT_FILE_WRAPPER (object)));
+			return;
+	}
+
+	G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+}
+
+static void
+attachment_file_wrapper_dispose (GObject *object)
+{
+	EAttachmentFileWrapperPrivate *priv;
+
+	priv = E_ATTACHMENT_FILE_WRAPPER_GET_PRIVATE (object);
+
+	g_clear_object (&priv->file);
+
+	/* Chain up to parent's dispose() method. */
+	G_OBJECT_CLASS (e_attachment_file_wrapper_parent_class)->dispose (object);
+}
+
+static GFileInputStream *
+attachment_file_wrapper_open (EAttachmentFileWrapper *wrapper,
+                              GCancellable *cancellable,
+                              GError **error)
+{
+	EAttachmentFileWrapperPrivate *priv = wrapper->priv;
+	GFileInputStream *input_stream;
+	GFileInfo *file_info;
+	gboolean unchanged;
+
+	input_stream = g_file_read (priv->file, cancellable, error);
+	if (input_stream == NULL)
+		return NULL;
+
+	/* Query the opened stream, not the path, to see
+	 * the state of what is going to be actually read. */
+	file_info = g_file_input_stream_query_info (
+		input_stream, FILE_STATE_QUERY, cancellable, error);
+	if (file_info == NULL) {
+		g_object_unref (input_stream);
+		return NULL;
+	}
+
+	unchanged = g_file_info_get_size (file_info) == priv->size;
+
+	if (unchanged && priv->check_mtime)
+		unchanged =
+			g_file_info_get_attribute_uint64 (
+				file_info, G_FILE_ATTRIBUTE_TIME_MODIFIED) == priv->mtime &&
+			g_file_info_get_attribute_uint32 (
+				file_info, G_FILE_ATTRIBUTE_TIME_MODIFIED_USEC) == priv->mtime_usec;
+
+	g_object_unref (file_info);
+
+	if (!unchanged) {
+		gchar *parse_name;
+
+		parse_name = g_file_get_parse_name (priv->file);
+		g_set_error (
+			error, G_IO_ERROR, G_IO_ERROR_FAILED,
+			_("The file \"%s\" was changed after it was attached"),
+			parse_name);
+		g_free (parse_name);
+
+		g_object_unref (input_stream);
+		return NULL;
+	}
+
+	return input_stream;
+}
+
+static gssize
+attachment_file_wrapper_write_to_stream_sync (CamelDataWrapper *data_wrapper,
+                                              CamelStream *stream,
+                                              GCancellable *cancellable,
+                                              GError **error)
+{
+	EAttachmentFileWrapper *wrapper;
+	GFileInputStream *input_stream;
+	gchar buffer[BUFFER_SIZE];
+	gssize bytes_read;
+	gssize bytes_written = 0;
+
+	wrapper = E_ATTACHMENT_FILE_WRAPPER (data_wrapper);
+
+	input_stream = attachment_file_wrapper_open (
+		wrapper, cancellable, error);
+	if (input_stream == NULL)
+		return -1;
+
+	do {
+		bytes_read = g_input_stream_read (
+			G_INPUT_STREAM (input_stream),
+			buffer, sizeof (buffer), cancellable, error);
+
+		if (bytes_read > 0 && camel_stream_write (
+			stream, buffer, bytes_read, cancellable, error) < 0)
+			bytes_read = -1;
+
+		if (bytes_read > 0)
+			bytes_written += bytes_read;
+	} while (bytes_read > 0);
+
+	g_object_unref (input_stream);
+
+	return (bytes_read < 0) ? -1 : bytes_written;
+}
+
+static gssize
+attachment_file_wrapper_write_to_output_stream_sync (CamelDataWrapper *data_wrapper,
+                                                     GOutputStream *output_stream,
+                                                     GCancellable *cancellable,
+                                                     GError **error)
+{
+	EAttachmentFileWrapper *wrapper;
+	GFileInputStream *input_stream;
+	gssize bytes_written;
+
+	wrapper = E_ATTACHMENT_FILE_WRAPPER (data_wrapper);
+
+	input_stream = attachment_file_wrapper_open (
+		wrapper, cancellable, error);
+	if (input_stream == NULL)
+		return -1;
+
+	bytes_written = g_output_stream_splice (
+		output_stream, G_INPUT_STREAM (input_stream),
+		G_OUTPUT_STREAM_SPLICE_CLOSE_SOURCE,
+		cancellable, error);
+
+	g_object_unref (input_stream);
+
+	return bytes_written;
+}
+
+static gboolean
+attachment_file_wrapper_is_offline (CamelDataWrapper *data_wrapper)
+{
+	/* The content is always at hand, there is nothing to download. */
+	return FALSE;
+}
+
+static void
+e_attachment_file_wrapper_class_init (EAttachmentFileWrapperClass *class)
+{
+	GObjectClass *object_class;
+	CamelDataWrapperClass *data_wrapper_class;
+
+	g_type_class_add_private (class, sizeof (EAttachmentFileWrapperPrivate));
+
+	object_class = G_OBJECT_CLASS (class);
+	object_class->set_property = attachment_file_wrapper_set_property;
+	object_class->get_property = attachment_file_wrapper_get_property;
+	object_class->dispose = attachment_file_wrapper_dispose;
+
+	/* The file holds the decoded content, thus writing
+	 * and decoding the content is the same operation. */
+	data_wrapper_class = CAMEL_DATA_WRAPPER_CLASS (class);
+	data_wrapper_class->write_to_stream_sync =
+		attachment_file_wrapper_write_to_stream_sync;
+	data_wrapper_class->decode_to_stream_sync =
+		attachment_file_wrapper_write_to_stream_sync;
+	data_wrapper_class->write_to_output_stream_sync =
+		attachment_file_wrapper_write_to_output_stream_sync;
+	data_wrapper_class->decode_to_output_stream_sync =
+		attachment_file_wrapper_write_to_output_stream_sync;
+	data_wrapper_class->is_offline =
+		attachment_file_wrapper_is_offline;
+
+	g_object_class_install_property (
+		object_class,
+		PROP_FILE,
+		g_param_spec_object (
+			"file",
+			"File",
+			"The file holding the content",
+			G_TYPE_FILE,
+			G_PARAM_READWRITE |
+			G_PARAM_CONSTRUCT_ONLY |
+			G_PARAM_STATIC_STRINGS));
+}
+
+static void
+e_attachment_file_wrapper_init (EAttachmentFileWrapper *wrapper)
+{
+	wrapper->priv = E_ATTACHMENT_FILE_WRAPPER_GET_PRIVATE (wrapper);
+}
+
+/**
+ * e_attachment_file_wrapper_new:
+ * @file: a #GFile
+ * @file_info: a #GFileInfo for @file
+ *
+ * Creates a new #CamelDataWrapper with the content of @file.  The content
+ * is read from @file whenever the wrapper is written.  Writing fails once
+ * the size or the modification time of @file differ from @file_info.
+ *
+ * Returns: a new #CamelDataWrapper
+ **/
+CamelDataWrapper *
+e_attachment_file_wrapper_new (GFile *file,
+                               GFileInfo *file_info)
+{
+	EAttachmentFileWrapper *wrapper;
+
+	g_return_val_if_fail (G_IS_FILE (file), NULL);
+	g_return_val_if_fail (G_IS_FILE_INFO (file_info), NULL);
+
+	wrapper = g_object_new (
+		E_TYPE_ATTACHMENT_FILE_WRAPPER,
+		"file", file, NULL);
+
+	wrapper->priv->size = g_file_info_get_size (file_info);
+	wrapper->priv->check_mtime = g_file_info_has_attribute (
+		file_info, G_FILE_ATTRIBUTE_TIME_MODIFIED);
+	wrapper->priv->mtime = g_file_info_get_attribute_uint64 (
+		file_info, G_FILE_ATTRIBUTE_TIME_MODIFIED);
+	wrapper->priv->mtime_usec = g_file_info_get_attribute_uint32 (
+		file_info, G_FILE_ATTRIBUTE_TIME_MODIFIED_USEC);
+
+	return CAMEL_DATA_WRAPPER (wrapper);
+}
+
+/**
+ * e_attachment_file_wrapper_get_file:
+ * @wrapper: an #EAttachmentFileWrapper
+ *
+ * Returns the file holding the content of @wrapper.
+ *
+ * Returns: the #GFile of @wrapper
+ **/
+GFile *
+e_attachment_file_wrapper_get_file (EAttachmentFileWrapper *wrapper)
+{
+	g_return_val_if_fail (E_IS_ATTACHMENT_FILE_WRAPPER (wrapper), NULL);
+
+	return wrapper->priv->file;
+}
+
+/**
+ * e_attachment_file_wrapper_get_size:
+ * @wrapper: an #EAttachmentFileWrapper
+ *
+ * Returns the size of the file holding the content of @wrapper, as it
+ * was when the wrapper was created.  It is the size of the decoded
+ * content, there is no in-memory copy to measure.
+ *
+ * Returns: the size of the content of @wrapper, in bytes
+ *
+ * Since: 3.18
+ **/
+goffset
+e_attachment_file_wrapper_get_size (EAttachmentFileWrapper *wrapper)
+{
+	g_return_val_if_fail (E_IS_ATTACHMENT_FILE_WRAPPER (wrapper), 0);
+
+	return wrapper->priv->size;
+}
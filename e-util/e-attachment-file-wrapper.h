@@ -0,0 +1,73 @@
+/*
+ * e-attachment-file-wrapper.h
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#if !defined (__E_UTIL_H_INSIDE__) && !defined (LIBEUTIL_COMPILATION)
+#error "Only <e-util/e-util.h> should be included directly."
+#endif
+
+#ifndef E_ATTACHMENT_FILE_WRAPPER_H
+#define E_ATTACHMENT_FILE_WRAPPER_H
+
+#include <camel/camel.h>
+
+/* Standard GObject macros */
+#define E_TYPE_ATTACHMENT_FILE_WRAPPER \
+	(e_attachment_file_wrapper_get_type ())
+#define E_ATTACHMENT_FILE_WRAPPER(obj) \
+	(G_TYPE_CHECK_INSTANCE_CAST \
+	((obj), E_TYPE_ATTACHMENT_FILE_WRAPPER, EAttachmentFileWrapper))
+#define E_ATTACHMENT_FILE_WRAPPER_CLASS(cls) \
+	(G_TYPE_CHECK_CLASS_CAST \
+	((cls), E_TYPE_ATTACHMENT_FILE_WRAPPER, EAttachmentFileWrapperClass))
+#define E_IS_ATTACHMENT_FILE_WRAPPER(obj) \
+	(G_TYPE_CHECK_INSTANCE_TYPE \
+	((obj), E_TYPE_ATTACHMENT_FILE_WRAPPER))
+#define E_IS_ATTACHMENT_FILE_WRAPPER_CLASS(cls) \
+	(G_TYPE_CHECK_CLASS_TYPE \
+	((cls), E_TYPE_ATTACHMENT_FILE_WRAPPER))
+#define E_ATTACHMENT_FILE_WRAPPER_GET_CLASS(obj) \
+	(G_TYPE_INSTANCE_GET_CLASS \
+	((obj), E_TYPE_ATTACHMENT_FILE_WRAPPER, EAttachmentFileWrapperClass))
+
+G_BEGIN_DECLS
+
+typedef struct _EAttachmentFileWrapper EAttachmentFileWrapper;
+typedef struct _EAttachmentFileWrapperClass EAttachmentFileWrapperClass;
+typedef struct _EAttachmentFileWrapperPrivate EAttachmentFileWrapperPrivate;
+
+struct _EAttachmentFileWrapper {
+	CamelDataWrapper parent;
+	EAttachmentFileWrapperPrivate *priv;
+};
+
+struct _EAttachmentFileWrapperClass {
+	CamelDataWrapperClass parent_class;
+};
+
+GType		e_attachment_file_wrapper_get_type
+						(void) G_GNUC_CONST;
+CamelDataWrapper *
+		e_attachment_file_wrapper_new	(GFile *file,
+						 GFileInfo *file_info);
+GFile *		e_attachment_file_wrapper_get_file
+						(EAttachmentFileWrapper *wrapper);
+goffset		e_attachment_file_wrapper_get_size
+						(EAttachmentFileWrapper *wrapper);
+
+G_END_DECLS
+
+#endif /* E_ATTACHMENT_FILE_WRAPPER_H */
@@ -35,6 +35,7 @@
 
 #include <libedataserver/libedataserver.h>
 
+#include "e-attachment-file-wrapper.h"
 #include "e-attachment-store.h"
 #include "e-icon-factory.h"
 #include "e-mktemp.h"
@@ -59,7 +60,7 @@
 #define EMBLEM_SIGN_UNKNOWN	"stock_signature"
 
 /* Attributes needed for EAttachmentStore columns. */
-#define ATTACHMENT_QUERY "standard::*,preview::*,thumbnail::*"
+#define ATTACHMENT_QUERY "standard::*,preview::*,thumbnail::*,time::modified,time::modified-usec"
 
 struct _EAttachmentPrivate {
 	GMutex property_lock;
@@ -1861,6 +1862,7 @@ struct _LoadContext {
 	GFileInfo *file_info;
 	goffset total_num_bytes;
 	gssize bytes_read;
+	gboolean file_backed;
 	gchar buffer[4096];
 };
 
@@ -1959,25 +1961,40 @@ attachment_load_finish (LoadContext *load_context)
 
 	file_info = load_context->file_info;
 	attachment = load_context->attachment;
-	output_stream = G_MEMORY_OUTPUT_STREAM (load_context->output_stream);
-
-	if (e_attachment_is_rfc822 (attachment))
-		wrapper = (CamelDataWrapper *) camel_mime_message_new ();
-	else
-		wrapper = camel_data_wrapper_new ();
 
 	content_type = g_file_info_get_content_type (file_info);
 	mime_type = g_content_type_get_mime_type (content_type);
 
-	data = g_memory_output_stream_get_data (output_stream);
-	size = g_memory_output_stream_get_data_size (output_stream);
+	if (load_context->file_backed) {
+		GFile *file;
+
+		/* The content stays in the file, it is read
+		 * only when the MIME part is being written. */
+		file = e_attachment_ref_file (attachment);
+		wrapper = e_attachment_file_wrapper_new (file, file_info);
+		g_object_unref (file);
+
+		size = g_file_info_get_size (file_info);
+	} else {
+		output_stream = G_MEMORY_OUTPUT_STREAM (
+			load_context->output_stream);
+
+		if (e_attachment_is_rfc822 (attachment))
+			wrapper = (CamelDataWrapper *) camel_mime_message_new ();
+		else
+			wrapper = camel_data_wrapper_new ();
+
+		data = g_memory_output_stream_get_data (output_stream);
+		size = g_memory_output_stream_get_data_size (output_stream);
+
+		stream = camel_stream_mem_new_with_buffer (data, size);
+		camel_data_wrapper_construct_from_stream_sync (
+			wrapper, stream, NULL, NULL);
+		camel_stream_close (stream, NULL, NULL);
+		g_object_unref (stream);
+	}
 
-	stream = camel_stream_mem_new_with_buffer (data, size);
-	camel_data_wrapper_construct_from_stream_sync (
-		wrapper, stream, NULL, NULL);
 	camel_data_wrapper_set_mime_type (wrapper, mime_type);
-	camel_stream_close (stream, NULL, NULL);
-	g_object_unref (stream);
 
 	mime_part = camel_mime_part_new ();
 	camel_medium_set_content (CAMEL_MEDIUM (mime_part), wrapper);
@@ -2117,6 +2134,13 @@ attachment_load_file_read_cb (GFile *file,
 	if (attachment_load_check_for_error (load_context, error))
 		return;
 
+	/* The file is readable, which is all we need to know
+	 * when the content is going to be read from it later. */
+	if (load_context->file_backed) {
+		attachment_load_finish (load_context);
+		return;
+	}
+
 	/* Load the contents into a GMemoryOutputStream. */
 	output_stream = g_memory_output_stream_new (
 		NULL, 0, g_realloc, g_free);
@@ -2194,6 +2218,7 @@ attachment_load_query_info_cb (GFile *file,
 	EAttachment *attachment;
 	GCancellable *cancellable;
 	GFileInfo *file_info;
+	gchar *path;
 	GError *error = NULL;
 
 	attachment = load_context->attachment;
@@ -2232,6 +2257,23 @@ attachment_load_query_info_cb (GFile *file,
 		g_object_unref (temporary);
 	} else {
 #endif
+		path = g_file_get_path (file);
+
+		/* Regular local files are not copied into the memory,
+		 * the MIME part reads them directly.  Messages have to
+		 * be parsed and special files, which report zero size,
+		 * can change between reads, thus those are loaded.  So
+		 * are pasted and dropped files, which are in the temp
+		 * directory and can expire while the composer is open. */
+		load_context->file_backed =
+			path != NULL &&
+			!e_mktemp_is_temporary (path) &&
+			g_file_info_get_file_type (file_info) == G_FILE_TYPE_REGULAR &&
+			g_file_info_get_size (file_info) > 0 &&
+			!e_attachment_is_rfc822 (attachment);
+
+		g_free (path);
+
 		g_file_read_async (
 			file, G_PRIORITY_DEFAULT,
 			cancellable, (GAsyncReadyCallback)
@@ -3177,25 +3219,62 @@ attachment_save_got_output_stream (SaveContext *save_context)
 	CamelMimePart *mime_part;
 	CamelStream *stream;
 	EAttachment *attachment;
-	GByteArray *buffer;
+	GByteArray *buffer = NULL;
+	GFile *source = NULL;
 
 	attachment = save_context->attachment;
 	cancellable = attachment->priv->cancellable;
 	mime_part = e_attachment_ref_mime_part (attachment);
-
-	/* Decode the MIME part to an in-memory buffer.  We have to do
-	 * this because CamelStream is synchronous-only, and using threads
-	 * is dangerous because CamelDataWrapper is not reentrant. */
-	buffer = g_byte_array_new ();
-	stream = camel_stream_mem_new ();
-	camel_stream_mem_set_byte_array (CAMEL_STREAM_MEM (stream), buffer);
 	wrapper = camel_medium_get_content (CAMEL_MEDIUM (mime_part));
-	camel_data_wrapper_decode_to_stream_sync (wrapper, stream, NULL, NULL);
-	g_object_unref (stream);
 
-	save_context->input_buffer = buffer;
+	if (E_IS_ATTACHMENT_FILE_WRAPPER (wrapper)) {
+		/* The content is in a file already, copy it from there. */
+		source = e_attachment_file_wrapper_get_file (
+			E_ATTACHMENT_FILE_WRAPPER (wrapper));
+	} else {
+		/* Decode the MIME part to an in-memory buffer.  We have
+		 * to do this because CamelStream is synchronous-only, and
+		 * using threads is dangerous because CamelDataWrapper is
+		 * not reentrant. */
+		buffer = g_byte_array_new ();
+		stream = camel_stream_mem_new ();
+		camel_stream_mem_set_byte_array (
+			CAMEL_STREAM_MEM (stream), buffer);
+		camel_data_wrapper_decode_to_stream_sync (
+			wrapper, stream, NULL, NULL);
+		g_object_unref (stream);
 
-	if (attachment->priv->save_self) {
+		save_context->input_buffer = buffer;
+	}
+
+	if (attachment->priv->save_self && source != NULL) {
+		GFileInfo *file_info;
+		GError *error = NULL;
+
+		/* Input stream might be NULL, so don't use cast macro. */
+		input_stream = (GInputStream *) g_file_read (
+			source, cancellable, &error);
+
+		if (!attachment_save_check_for_error (save_context, error)) {
+			save_context->input_stream = input_stream;
+
+			file_info = e_attachment_ref_file_info (attachment);
+			if (file_info != NULL) {
+				save_context->total_num_bytes =
+					g_file_info_get_size (file_info);
+				g_object_unref (file_info);
+			}
+
+			g_input_stream_read_async (
+				input_stream,
+				save_context->buffer,
+				sizeof (save_context->buffer),
+				G_PRIORITY_DEFAULT, cancellable,
+				(GAsyncReadyCallback) attachment_save_read_cb,
+				save_context);
+		}
+
+	} else if (attachment->priv->save_self) {
 		/* Load the buffer into a GMemoryInputStream.
 		 * But watch out for zero length MIME parts. */
 		input_stream = g_memory_input_stream_new ();
@@ -3225,10 +3304,14 @@ attachment_save_got_output_stream (SaveContext *save_context)
 		arpref = autoar_pref_new_with_gsettings (settings);
 		autoar_pref_set_delete_if_succeed (arpref, FALSE);
 
-		arextract = autoar_extract_new_memory_file (
-			buffer->data, buffer->len,
-			save_context->suggested_destname,
-			save_context->directory, arpref);
+		if (source != NULL)
+			arextract = autoar_extract_new_file (
+				source, save_context->directory, arpref);
+		else
+			arextract = autoar_extract_new_memory_file (
+				buffer->data, buffer->len,
+				save_context->suggested_destname,
+				save_context->directory, arpref);
 
 		g_signal_connect (arextract, "progress",
 			G_CALLBACK (attachment_save_extracted_progress_cb),
@@ -46,6 +46,14 @@ struct _EContactStorePrivate {
 	gint stamp;
 	EBookQuery *query;
 	GArray *contact_sources;
+
+	/* Row offset of each contact source, followed by the total count */
+	GArray *source_offsets;
+	gboolean source_offsets_dirty;
+
+	/* Set while remove_contacts_at() runs, when the UID
+	 * indexes can be behind the contacts they point into */
+	gboolean removing_contacts;
 };
 
 /* Signals */
@@ -100,14 +108,17 @@ typedef struct
 
 	EBookClientView *client_view;
 	GPtrArray *contacts;
+	GHashTable *uid_index; /* gchar *uid ~> index in contacts + 1 */
 
 	EBookClientView *client_view_pending;
 	GPtrArray *contacts_pending;
+	GHashTable *uid_index_pending;
 }
 ContactSource;
 
 static void free_contact_ptrarray (GPtrArray *contacts);
 static void clear_contact_source  (EContactStore *contact_store, ContactSource *source);
+static void clear_pending_view    (EContactStore *contact_store, ContactSource *source);
 static void stop_view             (EContactStore *contact_store, EBookClientView *view);
 
 static void
@@ -128,9 +139,11 @@ contact_store_dispose (GObject *object)
 
 		clear_contact_source (E_CONTACT_STORE (object), source);
 		free_contact_ptrarray (source->contacts);
+		g_hash_table_destroy (source->uid_index);
 		g_object_unref (source->book_client);
 	}
 	g_array_set_size (priv->contact_sources, 0);
+	priv->source_offsets_dirty = TRUE;
 
 	if (priv->query != NULL) {
 		e_book_query_unref (priv->query);
@@ -149,6 +162,7 @@ contact_store_finalize (GObject *object)
 	priv = E_CONTACT_STORE_GET_PRIVATE (object);
 
 	g_array_free (priv->contact_sources, TRUE);
+	g_array_free (priv->source_offsets, TRUE);
 
 	/* Chain up to parent's finalize() method. */
 	G_OBJECT_CLASS (e_contact_store_parent_class)->finalize (object);
@@ -213,6 +227,8 @@ e_contact_store_init (EContactStore *contact_store)
 	contact_store->priv = E_CONTACT_STORE_GET_PRIVATE (contact_store);
 	contact_store->priv->stamp = g_random_int ();
 	contact_store->priv->contact_sources = contact_sources;
+	contact_store->priv->source_offsets = g_array_new (FALSE, TRUE, sizeof (gint));
+	contact_store->priv->source_offsets_dirty = TRUE;
 }
 
 /**
@@ -321,26 +337,62 @@ find_contact_source_by_view (EContactStore *contact_store,
 	return -1;
 }
 
-static gint
-find_contact_source_by_offset (EContactStore *contact_store,
-                               gint offset)
+static void
+ensure_source_offsets (EContactStore *contact_store)
 {
 	GArray *array;
+	gint offset = 0;
 	gint i;
 
+	if (!contact_store->priv->source_offsets_dirty)
+		return;
+
 	array = contact_store->priv->contact_sources;
 
+	g_array_set_size (contact_store->priv->source_offsets, array->len + 1);
+
 	for (i = 0; i < array->len; i++) {
 		ContactSource *source;
 
 		source = &g_array_index (array, ContactSource, i);
-		if (source->contacts->len > offset)
-			return i;
+		g_array_index (contact_store->priv->source_offsets, gint, i) = offset;
+		offset += source->contacts->len;
+	}
+
+	g_array_index (contact_store->priv->source_offsets, gint, array->len) = offset;
+
+	contact_store->priv->source_offsets_dirty = FALSE;
+}
+
+static gint
+find_contact_source_by_offset (EContactStore *contact_store,
+                               gint offset)
+{
+	GArray *offsets;
+	gint lo, hi;
+
+	ensure_source_offsets (contact_store);
+
+	offsets = contact_store->priv->source_offsets;
+
+	if (offset < 0 || offset >= g_array_index (offsets, gint, offsets->len - 1))
+		return -1;
+
+	/* Find the last source starting at or before the offset;
+	 * empty sources share their offset with the next one */
+	lo = 0;
+	hi = offsets->len - 1;
+
+	while (lo < hi) {
+		gint mid = lo + (hi - lo + 1) / 2;
 
-		offset -= source->contacts->len;
+		if (g_array_index (offsets, gint, mid) <= offset)
+			lo = mid;
+		else
+			hi = mid - 1;
 	}
 
-	return -1;
+	return lo;
 }
 
 static gint
@@ -364,41 +416,171 @@ static gint
 get_contact_source_offset (EContactStore *contact_store,
                            gint contact_source_index)
 {
-	GArray *array;
-	gint offset = 0;
+	g_assert (contact_source_index < contact_store->priv->contact_sources->len);
+
+	ensure_source_offsets (contact_store);
+
+	return g_array_index (contact_store->priv->source_offsets, gint, contact_source_index);
+}
+
+static gint
+count_contacts (EContactStore *contact_store)
+{
+	GArray *offsets;
+
+	ensure_source_offsets (contact_store);
+
+	offsets = contact_store->priv->source_offsets;
+
+	return g_array_index (offsets, gint, offsets->len - 1);
+}
+
+/* ------------------ *
+ * UID index helpers  *
+ * ------------------ */
+
+static GHashTable *
+uid_index_new (void)
+{
+	return g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+}
+
+static void
+uid_index_add (GHashTable *uid_index,
+               EContact *contact,
+               gint index)
+{
+	const gchar *uid = e_contact_get_const (contact, E_CONTACT_UID);
+
+	/* The first contact with the UID wins, like with a linear search */
+	if (uid && !g_hash_table_contains (uid_index, uid))
+		g_hash_table_insert (uid_index, g_strdup (uid), GINT_TO_POINTER (index + 1));
+}
+
+/* Re-indexes contacts from index 'from', after removals before them */
+static void
+uid_index_update_from (GHashTable *uid_index,
+                       GPtrArray *contacts,
+                       gint from)
+{
 	gint i;
 
-	array = contact_store->priv->contact_sources;
+	for (i = MAX (from, 0); i < contacts->len; i++) {
+		EContact    *contact = g_ptr_array_index (contacts, i);
+		const gchar *uid = e_contact_get_const (contact, E_CONTACT_UID);
+		gint         known;
 
-	g_assert (contact_source_index < array->len);
+		if (!uid)
+			continue;
 
-	for (i = 0; i < contact_source_index; i++) {
-		ContactSource *source;
+		/* Entries moved here from higher indexes are stale, lower
+		 * ones belong to a preceding contact with the same UID */
+		known = GPOINTER_TO_INT (g_hash_table_lookup (uid_index, uid)) - 1;
+		if (known < 0 || known >= i)
+			g_hash_table_insert (uid_index, g_strdup (uid), GINT_TO_POINTER (i + 1));
+	}
+}
 
-		source = &g_array_index (array, ContactSource, i);
-		offset += source->contacts->len;
+static void
+uid_index_remove (GHashTable *uid_index,
+                  EContact *contact,
+                  gint index)
+{
+	const gchar *uid = e_contact_get_const (contact, E_CONTACT_UID);
+
+	if (uid && GPOINTER_TO_INT (g_hash_table_lookup (uid_index, uid)) == index + 1)
+		g_hash_table_remove (uid_index, uid);
+}
+
+static gint
+uid_index_lookup (EContactStore *contact_store,
+                  GHashTable *uid_index,
+                  GPtrArray *contacts,
+                  const gchar *find_uid)
+{
+	gint i;
+
+	i = GPOINTER_TO_INT (g_hash_table_lookup (uid_index, find_uid)) - 1;
+
+	if (i >= 0 && i < contacts->len) {
+		EContact    *contact = g_ptr_array_index (contacts, i);
+		const gchar *uid = e_contact_get_const (contact, E_CONTACT_UID);
+
+		if (uid && !strcmp (find_uid, uid))
+			return i;
 	}
 
-	return offset;
+	/* The index is updated only after a batch of removals is
+	 * done, thus it can be behind when asked in the meantime,
+	 * from a row-deleted handler; otherwise a miss is a miss */
+	if (!contact_store->priv->removing_contacts)
+		return -1;
+
+	for (i = 0; i < contacts->len; i++) {
+		EContact    *contact = g_ptr_array_index (contacts, i);
+		const gchar *uid = e_contact_get_const (contact, E_CONTACT_UID);
+
+		if (uid && !strcmp (find_uid, uid))
+			return i;
+	}
+
+	return -1;
 }
 
 static gint
-count_contacts (EContactStore *contact_store)
+compare_indexes_descending (gconstpointer a,
+                            gconstpointer b)
 {
-	GArray *array;
-	gint count = 0;
+	gint index1 = *((const gint *) a);
+	gint index2 = *((const gint *) b);
+
+	return index2 - index1;
+}
+
+/* Removes contacts at the given indexes, emitting row-deleted for each
+ * when offset is not negative, and updates the UID index at once. */
+static void
+remove_contacts_at (EContactStore *contact_store,
+                    GPtrArray *contacts,
+                    GHashTable *uid_index,
+                    GArray *indexes,
+                    gint offset)
+{
+	gint last = -1;
 	gint i;
 
-	array = contact_store->priv->contact_sources;
+	if (!indexes->len)
+		return;
 
-	for (i = 0; i < array->len; i++) {
-		ContactSource *source;
+	/* From the end, thus the lower indexes remain valid */
+	g_array_sort (indexes, compare_indexes_descending);
 
-		source = &g_array_index (array, ContactSource, i);
-		count += source->contacts->len;
+	contact_store->priv->removing_contacts = TRUE;
+
+	for (i = 0; i < indexes->len; i++) {
+		gint      index = g_array_index (indexes, gint, i);
+		EContact *contact;
+
+		if (index == last)
+			continue;
+
+		last = index;
+
+		contact = g_ptr_array_index (contacts, index);
+		uid_index_remove (uid_index, contact, index);
+		g_ptr_array_remove_index (contacts, index);
+
+		if (offset >= 0) {
+			contact_store->priv->source_offsets_dirty = TRUE;
+			row_deleted (contact_store, offset + index);
+		}
+
+		g_object_unref (contact);
 	}
 
-	return count;
+	uid_index_update_from (uid_index, contacts, last);
+
+	contact_store->priv->removing_contacts = FALSE;
 }
 
 static gint
@@ -408,9 +590,7 @@ find_contact_by_view_and_uid (EContactStore *contact_store,
 {
 	GArray *array;
 	ContactSource *source;
-	GPtrArray *contacts;
 	gint source_index;
-	gint i;
 
 	g_return_val_if_fail (find_uid != NULL, -1);
 
@@ -422,19 +602,9 @@ find_contact_by_view_and_uid (EContactStore *contact_store,
 	source = &g_array_index (array, ContactSource, source_index);
 
 	if (find_view == source->client_view)
-		contacts = source->contacts;          /* Current view */
+		return uid_index_lookup (contact_store, source->uid_index, source->contacts, find_uid);  /* Current view */
 	else
-		contacts = source->contacts_pending;  /* Pending view */
-
-	for (i = 0; i < contacts->len; i++) {
-		EContact    *contact = g_ptr_array_index (contacts, i);
-		const gchar *uid = e_contact_get_const (contact, E_CONTACT_UID);
-
-		if (uid && !strcmp (find_uid, uid))
-			return i;
-	}
-
-	return -1;
+		return uid_index_lookup (contact_store, source->uid_index_pending, source->contacts_pending, find_uid);  /* Pending view */
 }
 
 static gint
@@ -450,13 +620,9 @@ find_contact_by_uid (EContactStore *contact_store,
 		ContactSource *source = &g_array_index (array, ContactSource, i);
 		gint           j;
 
-		for (j = 0; j < source->contacts->len; j++) {
-			EContact    *contact = g_ptr_array_index (source->contacts, j);
-			const gchar *uid = e_contact_get_const (contact, E_CONTACT_UID);
-
-			if (!strcmp (find_uid, uid))
-				return get_contact_source_offset (contact_store, i) + j;
-		}
+		j = uid_index_lookup (contact_store, source->uid_index, source->contacts, find_uid);
+		if (j >= 0)
+			return get_contact_source_offset (contact_store, i) + j;
 	}
 
 	return -1;
@@ -549,10 +715,13 @@ view_contacts_added (EContactStore *contact_store,
 		if (client_view == source->client_view) {
 			/* Current view */
 			g_ptr_array_add (source->contacts, contact);
+			uid_index_add (source->uid_index, contact, source->contacts->len - 1);
+			contact_store->priv->source_offsets_dirty = TRUE;
 			row_inserted (contact_store, offset + source->contacts->len - 1);
 		} else {
 			/* Pending view */
 			g_ptr_array_add (source->contacts_pending, contact);
+			uid_index_add (source->uid_index_pending, contact, source->contacts_pending->len - 1);
 		}
 	}
 }
@@ -563,6 +732,7 @@ view_contacts_removed (EContactStore *contact_store,
                        EBookClientView *client_view)
 {
 	ContactSource *source;
+	GArray        *indexes;
 	gint           offset;
 	const GSList  *l;
 
@@ -571,29 +741,29 @@ view_contacts_removed (EContactStore *contact_store,
 		return;
 	}
 
+	indexes = g_array_new (FALSE, FALSE, sizeof (gint));
+
 	for (l = uids; l; l = g_slist_next (l)) {
 		const gchar *uid = l->data;
 		gint         n = find_contact_by_view_and_uid (contact_store, client_view, uid);
-		EContact    *contact;
 
 		if (n < 0) {
 			g_warning ("EContactStore got 'contacts_removed' on unknown contact!");
 			continue;
 		}
 
-		if (client_view == source->client_view) {
-			/* Current view */
-			contact = g_ptr_array_index (source->contacts, n);
-			g_object_unref (contact);
-			g_ptr_array_remove_index (source->contacts, n);
-			row_deleted (contact_store, offset + n);
-		} else {
-			/* Pending view */
-			contact = g_ptr_array_index (source->contacts_pending, n);
-			g_object_unref (contact);
-			g_ptr_array_remove_index (source->contacts_pending, n);
-		}
+		g_array_append_val (indexes, n);
 	}
+
+	if (client_view == source->client_view) {
+		/* Current view */
+		remove_contacts_at (contact_store, source->contacts, source->uid_index, indexes, offset);
+	} else {
+		/* Pending view */
+		remove_contacts_at (contact_store, source->contacts_pending, source->uid_index_pending, indexes, -1);
+	}
+
+	g_array_free (indexes, TRUE);
 }
 
 static void
@@ -647,6 +817,7 @@ view_complete (EContactStore *contact_store,
                EBookClientView *client_view)
 {
 	ContactSource *source;
+	GArray        *deleted;
 	gint           offset;
 	gint           i;
 
@@ -666,34 +837,33 @@ view_complete (EContactStore *contact_store,
 	/* However, if it was a pending view, calculate and emit the differences between that
 	 * and the current view, and move the pending view up to current.
 	 *
-	 * This is O(m * n), and can be sped up with a temporary hash table if needed. */
+	 * Both views have their UID index, thus this is O(m + n). */
 
 	/* Deletions */
+	deleted = g_array_new (FALSE, FALSE, sizeof (gint));
+
 	for (i = 0; i < source->contacts->len; i++) {
 		EContact    *old_contact = g_ptr_array_index (source->contacts, i);
 		const gchar *old_uid = e_contact_get_const (old_contact, E_CONTACT_UID);
-		gint         result;
-
-		result = find_contact_by_view_and_uid (contact_store, source->client_view_pending, old_uid);
-		if (result < 0) {
-			/* Contact is not in new view; removed */
-			g_object_unref (old_contact);
-			g_ptr_array_remove_index (source->contacts, i);
-			row_deleted (contact_store, offset + i);
-			i--;  /* Stay in place */
-		}
+
+		/* Contact is not in new view; removed */
+		if (!old_uid || !g_hash_table_contains (source->uid_index_pending, old_uid))
+			g_array_append_val (deleted, i);
 	}
 
+	remove_contacts_at (contact_store, source->contacts, source->uid_index, deleted, offset);
+	g_array_free (deleted, TRUE);
+
 	/* Insertions */
 	for (i = 0; i < source->contacts_pending->len; i++) {
 		EContact    *new_contact = g_ptr_array_index (source->contacts_pending, i);
 		const gchar *new_uid = e_contact_get_const (new_contact, E_CONTACT_UID);
-		gint         result;
 
-		result = find_contact_by_view_and_uid (contact_store, source->client_view, new_uid);
-		if (result < 0) {
+		if (!new_uid || !g_hash_table_contains (source->uid_index, new_uid)) {
 			/* Contact is not in old view; inserted */
 			g_ptr_array_add (source->contacts, new_contact);
+			uid_index_add (source->uid_index, new_contact, source->contacts->len - 1);
+			contact_store->priv->source_offsets_dirty = TRUE;
 			row_inserted (contact_store, offset + source->contacts->len - 1);
 		} else {
 			/* Contact already in old view; drop the new one */
@@ -710,6 +880,8 @@ view_complete (EContactStore *contact_store,
 	/* Free array of pending contacts (members have been either moved or unreffed) */
 	g_ptr_array_free (source->contacts_pending, TRUE);
 	source->contacts_pending = NULL;
+	g_hash_table_destroy (source->uid_index_pending);
+	source->uid_index_pending = NULL;
 }
 
 /* --------------------- *
@@ -814,6 +986,7 @@ clear_contact_source (EContactStore *contact_store,
 
 			g_object_unref (contact);
 			g_ptr_array_remove_index_fast (source->contacts, i);
+			contact_store->priv->source_offsets_dirty = TRUE;
 
 			gtk_tree_path_prev (path);
 			gtk_tree_model_row_deleted (GTK_TREE_MODEL (contact_store), path);
@@ -822,6 +995,8 @@ clear_contact_source (EContactStore *contact_store,
 		gtk_tree_path_free (path);
 	}
 
+	g_hash_table_remove_all (source->uid_index);
+
 	/* Free main and pending views, clear cached contacts */
 
 	if (source->client_view) {
@@ -831,13 +1006,22 @@ clear_contact_source (EContactStore *contact_store,
 		source->client_view = NULL;
 	}
 
+	clear_pending_view (contact_store, source);
+}
+
+static void
+clear_pending_view (EContactStore *contact_store,
+                    ContactSource *source)
+{
 	if (source->client_view_pending) {
 		stop_view (contact_store, source->client_view_pending);
 		g_object_unref (source->client_view_pending);
 		free_contact_ptrarray (source->contacts_pending);
+		g_hash_table_destroy (source->uid_index_pending);
 
 		source->client_view_pending = NULL;
 		source->contacts_pending = NULL;
+		source->uid_index_pending = NULL;
 	}
 }
 
@@ -867,19 +1051,14 @@ client_view_ready_cb (GObject *source_object,
 		source = &g_array_index (contact_store->priv->contact_sources, ContactSource, source_idx);
 
 		if (source->client_view) {
-			if (source->client_view_pending) {
-				stop_view (contact_store, source->client_view_pending);
-				g_object_unref (source->client_view_pending);
-				free_contact_ptrarray (source->contacts_pending);
-			}
+			clear_pending_view (contact_store, source);
 
 			source->client_view_pending = client_view;
 
 			if (source->client_view_pending) {
 				source->contacts_pending = g_ptr_array_new ();
+				source->uid_index_pending = uid_index_new ();
 				start_view (contact_store, client_view);
-			} else {
-				source->contacts_pending = NULL;
 			}
 		} else {
 			source->client_view = client_view;
@@ -906,15 +1085,8 @@ query_contact_source (EContactStore *contact_store,
 		return;
 	}
 
-	if (source->client_view) {
-		if (source->client_view_pending) {
-			stop_view (contact_store, source->client_view_pending);
-			g_object_unref (source->client_view_pending);
-			free_contact_ptrarray (source->contacts_pending);
-			source->client_view_pending = NULL;
-			source->contacts_pending = NULL;
-		}
-	}
+	if (source->client_view)
+		clear_pending_view (contact_store, source);
 
 	query_str = e_book_query_to_string (contact_store->priv->query);
 	e_book_client_get_view (source->book_client, query_str, NULL, client_view_ready_cb, g_object_ref (contact_store));
@@ -1064,7 +1236,9 @@ e_contact_store_add_client (EContactStore *contact_store,
 	memset (&source, 0, sizeof (ContactSource));
 	source.book_client = g_object_ref (book_client);
 	source.contacts = g_ptr_array_new ();
+	source.uid_index = uid_index_new ();
 	g_array_append_val (array, source);
+	contact_store->priv->source_offsets_dirty = TRUE;
 
 	indexed_source = &g_array_index (array, ContactSource, array->len - 1);
 
@@ -1103,9 +1277,11 @@ e_contact_store_remove_client (EContactStore *contact_store,
 	source = &g_array_index (array, ContactSource, source_index);
 	clear_contact_source (contact_store, source);
 	free_contact_ptrarray (source->contacts);
+	g_hash_table_destroy (source->uid_index);
 	g_object_unref (book_client);
 
 	g_array_remove_index (array, source_index);  /* Preserve order */
+	contact_store->priv->source_offsets_dirty = TRUE;
 
 	return TRUE;
 }
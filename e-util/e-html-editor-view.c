@@ -112,6 +112,13 @@ struct _EHTMLEditorViewPrivate {
 	GQueue *post_reload_operations;
 	guint spell_check_on_scroll_event_source_id;
 
+	/* Top-level blocks of the body already spell checked, with
+	 * a hash of their text, for the active languages below.  Only
+	 * the changed blocks are checked again on a refresh. */
+	GHashTable *spell_checked_blocks;
+	gchar *spell_checked_languages;
+	gboolean spell_check_citations;
+
 	GList *history;
 	guint history_size;
 };
@@ -129,7 +136,8 @@ enum {
 	PROP_MAGIC_LINKS,
 	PROP_MAGIC_SMILEYS,
 	PROP_UNICODE_SMILEYS,
-	PROP_SPELL_CHECKER
+	PROP_SPELL_CHECKER,
+	PROP_SPELL_CHECK_CITATIONS
 };
 
 enum {
@@ -474,6 +482,26 @@ get_parent_block_element (WebKitDOMNode *node)
 	return parent;
 }
 
+static gboolean
+is_citation_node (WebKitDOMNode *node)
+{
+	gchar *value;
+
+	if (!WEBKIT_DOM_IS_HTML_QUOTE_ELEMENT (node))
+		return FALSE;
+
+	value = webkit_dom_element_get_attribute (WEBKIT_DOM_ELEMENT (node), "type");
+
+	/* citation == <blockquote type='cite'> */
+	if (g_strcmp0 (value, "cite") == 0) {
+		g_free (value);
+		return TRUE;
+	} else {
+		g_free (value);
+		return FALSE;
+	}
+}
+
 static void
 perform_spell_check (WebKitDOMDOMSelection *dom_selection,
                      WebKitDOMRange *start_range,
@@ -494,92 +522,6 @@ perform_spell_check (WebKitDOMDOMSelection *dom_selection,
 	g_clear_object (&actual);
 }
 
-void
-e_html_editor_view_force_spell_check_for_current_paragraph (EHTMLEditorView *view)
-{
-	EHTMLEditorSelection *selection;
-	WebKitDOMDocument *document;
-	WebKitDOMDOMSelection *dom_selection;
-	WebKitDOMDOMWindow *dom_window;
-	WebKitDOMElement *selection_start_marker, *selection_end_marker;
-	WebKitDOMElement *parent, *element;
-	WebKitDOMRange *end_range, *actual;
-	WebKitDOMText *text;
-
-	if (!view->priv->inline_spelling)
-		return;
-
-	document = webkit_web_view_get_dom_document (WEBKIT_WEB_VIEW (view));
-
-	element = webkit_dom_document_query_selector (
-		document, "body[spellcheck=true]", NULL);
-
-	if (!element)
-		return;
-
-	if (!webkit_dom_node_get_first_child (WEBKIT_DOM_NODE (element)))
-		return;
-
-	selection = e_html_editor_view_get_selection (view);
-	e_html_editor_selection_save (selection);
-
-	selection_start_marker = webkit_dom_document_query_selector (
-		document, "span#-x-evo-selection-start-marker", NULL);
-	selection_end_marker = webkit_dom_document_query_selector (
-		document, "span#-x-evo-selection-end-marker", NULL);
-
-	if (!selection_start_marker || !selection_end_marker)
-		return;
-
-	/* Block callbacks of selection-changed signal as we don't want to
-	 * recount all the block format things in EHTMLEditorSelection and here as well
-	 * when we are moving with caret */
-	block_selection_changed_callbacks (view);
-
-	parent = get_parent_block_element (WEBKIT_DOM_NODE (selection_end_marker));
-
-	/* Append some text on the end of the element */
-	text = webkit_dom_document_create_text_node (document, "-x-evo-end");
-	webkit_dom_node_append_child (
-		WEBKIT_DOM_NODE (parent),
-		WEBKIT_DOM_NODE (text),
-		NULL);
-
-	parent = get_parent_block_element (WEBKIT_DOM_NODE (selection_start_marker));
-
-	/* Create range that's pointing on the end of this text */
-	end_range = webkit_dom_document_create_range (document);
-	webkit_dom_range_select_node_contents (
-		end_range, WEBKIT_DOM_NODE (text), NULL);
-	webkit_dom_range_collapse (end_range, FALSE, NULL);
-
-	dom_window = webkit_dom_document_get_default_view (document);
-	dom_selection = webkit_dom_dom_window_get_selection (dom_window);
-
-	/* Move on the beginning of the paragraph */
-	actual = webkit_dom_document_create_range (document);
-	webkit_dom_range_select_node_contents (
-		actual, WEBKIT_DOM_NODE (parent), NULL);
-	webkit_dom_range_collapse (actual, TRUE, NULL);
-	webkit_dom_dom_selection_remove_all_ranges (dom_selection);
-	webkit_dom_dom_selection_add_range (dom_selection, actual);
-
-	actual = webkit_dom_dom_selection_get_range_at (dom_selection, 0, NULL);
-	perform_spell_check (dom_selection, actual, end_range);
-
-	g_object_unref (dom_selection);
-	g_object_unref (dom_window);
-	g_object_unref (end_range);
-
-	/* Remove the text that we inserted on the end of the paragraph */
-	remove_node (WEBKIT_DOM_NODE (text));
-
-	/* Unblock the callbacks */
-	unblock_selection_changed_callbacks (view);
-
-	e_html_editor_selection_restore (selection);
-}
-
 static WebKitDOMElement *
 create_selection_marker (WebKitDOMDocument *document,
                          gboolean start)
@@ -661,6 +603,294 @@ add_selection_markers_into_element_end (WebKitDOMDocument *document,
 		*selection_end_marker = marker;
 }
 
+static void
+spell_check_element (WebKitDOMDocument *document,
+                     WebKitDOMDOMSelection *dom_selection,
+                     WebKitDOMElement *element)
+{
+	WebKitDOMRange *end_range, *actual;
+	WebKitDOMText *text;
+
+	/* Append some text on the end of the element */
+	text = webkit_dom_document_create_text_node (document, "-x-evo-end");
+	webkit_dom_node_append_child (
+		WEBKIT_DOM_NODE (element), WEBKIT_DOM_NODE (text), NULL);
+
+	/* Create range that's pointing on the end of this text */
+	end_range = webkit_dom_document_create_range (document);
+	webkit_dom_range_select_node_contents (
+		end_range, WEBKIT_DOM_NODE (text), NULL);
+	webkit_dom_range_collapse (end_range, FALSE, NULL);
+
+	/* Move on the beginning of the element */
+	actual = webkit_dom_document_create_range (document);
+	webkit_dom_range_select_node_contents (
+		actual, WEBKIT_DOM_NODE (element), NULL);
+	webkit_dom_range_collapse (actual, TRUE, NULL);
+	webkit_dom_dom_selection_remove_all_ranges (dom_selection);
+	webkit_dom_dom_selection_add_range (dom_selection, actual);
+	g_object_unref (actual);
+
+	actual = webkit_dom_dom_selection_get_range_at (dom_selection, 0, NULL);
+	perform_spell_check (dom_selection, actual, end_range);
+
+	g_object_unref (end_range);
+
+	/* Remove the text that we inserted on the end of the element */
+	remove_node (WEBKIT_DOM_NODE (text));
+}
+
+/* Returns the child of the body @node is in, or %NULL. */
+static WebKitDOMNode *
+get_top_level_block (WebKitDOMHTMLElement *body,
+                     WebKitDOMNode *node)
+{
+	while (node != NULL) {
+		WebKitDOMNode *parent;
+
+		parent = webkit_dom_node_get_parent_node (node);
+		if (parent == WEBKIT_DOM_NODE (body))
+			return node;
+
+		node = parent;
+	}
+
+	return NULL;
+}
+
+/* Whether the body content is split into top-level blocks, which
+ * can be spell checked one by one, with nothing but white space
+ * between them. */
+static gboolean
+body_has_only_blocks (WebKitDOMHTMLElement *body)
+{
+	WebKitDOMNode *child;
+
+	for (child = webkit_dom_node_get_first_child (WEBKIT_DOM_NODE (body));
+	     child != NULL;
+	     child = webkit_dom_node_get_next_sibling (child)) {
+		if (!WEBKIT_DOM_IS_ELEMENT (child)) {
+			gchar *text_content;
+			gboolean is_blank;
+
+			text_content = webkit_dom_node_get_text_content (child);
+			is_blank = !text_content || !*g_strstrip (text_content);
+			g_free (text_content);
+
+			if (!is_blank)
+				return FALSE;
+		}
+	}
+
+	return TRUE;
+}
+
+/* Every block has to be checked again with other languages. */
+static void
+spell_check_update_languages (EHTMLEditorView *view)
+{
+	ESpellChecker *checker;
+	gchar **languages;
+	gchar *comma_separated;
+
+	checker = e_html_editor_view_get_spell_checker (view);
+	languages = e_spell_checker_list_active_languages (checker, NULL);
+	comma_separated = g_strjoinv (",", languages);
+	g_strfreev (languages);
+
+	if (g_strcmp0 (comma_separated, view->priv->spell_checked_languages) != 0) {
+		g_hash_table_remove_all (view->priv->spell_checked_blocks);
+		g_free (view->priv->spell_checked_languages);
+		view->priv->spell_checked_languages = comma_separated;
+	} else {
+		g_free (comma_separated);
+	}
+}
+
+/* Checks a top-level @block of the body unless it is a citation which
+ * is not to be checked or it has the same text as when it was checked
+ * the last time, then records its text hash into @checked_blocks. */
+static void
+spell_check_block (EHTMLEditorView *view,
+                   WebKitDOMDocument *document,
+                   WebKitDOMDOMSelection *dom_selection,
+                   WebKitDOMNode *block,
+                   GHashTable *checked_blocks)
+{
+	gchar *text_content;
+	gpointer old_hash, new_hash;
+	gboolean was_checked;
+
+	if (!WEBKIT_DOM_IS_ELEMENT (block))
+		return;
+
+	if (!view->priv->spell_check_citations && is_citation_node (block))
+		return;
+
+	text_content = webkit_dom_node_get_text_content (block);
+	if (!text_content || !*text_content) {
+		g_free (text_content);
+		return;
+	}
+
+	new_hash = GUINT_TO_POINTER (g_str_hash (text_content));
+	g_free (text_content);
+
+	was_checked = g_hash_table_lookup_extended (
+		view->priv->spell_checked_blocks, block, NULL, &old_hash);
+
+	if (!was_checked || old_hash != new_hash)
+		spell_check_element (
+			document, dom_selection, WEBKIT_DOM_ELEMENT (block));
+
+	g_hash_table_insert (checked_blocks, g_object_ref (block), new_hash);
+}
+
+/* Checks only the top-level blocks of the body which changed since they
+ * were checked the last time.  Returns FALSE when the body content is
+ * not split into blocks, then the whole body has to be checked. */
+static gboolean
+spell_check_changed_blocks (EHTMLEditorView *view,
+                            WebKitDOMDocument *document,
+                            WebKitDOMDOMSelection *dom_selection,
+                            WebKitDOMHTMLElement *body)
+{
+	GHashTable *checked_blocks;
+	WebKitDOMNode *child;
+
+	if (!body_has_only_blocks (body))
+		return FALSE;
+
+	spell_check_update_languages (view);
+
+	/* Blocks which are gone from the body are not carried over. */
+	checked_blocks = g_hash_table_new_full (
+		(GHashFunc) g_direct_hash,
+		(GEqualFunc) g_direct_equal,
+		(GDestroyNotify) g_object_unref,
+		(GDestroyNotify) NULL);
+
+	for (child = webkit_dom_node_get_first_child (WEBKIT_DOM_NODE (body));
+	     child != NULL;
+	     child = webkit_dom_node_get_next_sibling (child))
+		spell_check_block (
+			view, document, dom_selection, child, checked_blocks);
+
+	g_hash_table_destroy (view->priv->spell_checked_blocks);
+	view->priv->spell_checked_blocks = checked_blocks;
+
+	return TRUE;
+}
+
+void
+e_html_editor_view_force_spell_check_for_current_paragraph (EHTMLEditorView *view)
+{
+	EHTMLEditorSelection *selection;
+	WebKitDOMDocument *document;
+	WebKitDOMDOMSelection *dom_selection;
+	WebKitDOMDOMWindow *dom_window;
+	WebKitDOMElement *selection_start_marker, *selection_end_marker;
+	WebKitDOMElement *parent, *end_parent, *element;
+	WebKitDOMNode *block;
+	WebKitDOMRange *end_range, *actual;
+	WebKitDOMText *text;
+
+	if (!view->priv->inline_spelling)
+		return;
+
+	document = webkit_web_view_get_dom_document (WEBKIT_WEB_VIEW (view));
+
+	element = webkit_dom_document_query_selector (
+		document, "body[spellcheck=true]", NULL);
+
+	if (!element)
+		return;
+
+	if (!webkit_dom_node_get_first_child (WEBKIT_DOM_NODE (element)))
+		return;
+
+	selection = e_html_editor_view_get_selection (view);
+	e_html_editor_selection_save (selection);
+
+	selection_start_marker = webkit_dom_document_query_selector (
+		document, "span#-x-evo-selection-start-marker", NULL);
+	selection_end_marker = webkit_dom_document_query_selector (
+		document, "span#-x-evo-selection-end-marker", NULL);
+
+	if (!selection_start_marker || !selection_end_marker)
+		return;
+
+	parent = get_parent_block_element (WEBKIT_DOM_NODE (selection_start_marker));
+	end_parent = get_parent_block_element (WEBKIT_DOM_NODE (selection_end_marker));
+
+	/* The citation the caret is in is not checked unless asked to. */
+	block = get_top_level_block (
+		WEBKIT_DOM_HTML_ELEMENT (element), WEBKIT_DOM_NODE (parent));
+	if (!view->priv->spell_check_citations && block != NULL &&
+	    is_citation_node (block) &&
+	    block == get_top_level_block (
+		WEBKIT_DOM_HTML_ELEMENT (element), WEBKIT_DOM_NODE (end_parent))) {
+		e_html_editor_selection_restore (selection);
+		return;
+	}
+
+	/* Block callbacks of selection-changed signal as we don't want to
+	 * recount all the block format things in EHTMLEditorSelection and here as well
+	 * when we are moving with caret */
+	block_selection_changed_callbacks (view);
+
+	dom_window = webkit_dom_document_get_default_view (document);
+	dom_selection = webkit_dom_dom_window_get_selection (dom_window);
+
+	if (parent == end_parent && block == WEBKIT_DOM_NODE (parent)) {
+		/* A paragraph of the body is checked only when its text
+		 * changed since refresh_spell_check() or the viewport
+		 * check did it, which is not the case when the caret
+		 * just moves around. */
+		spell_check_update_languages (view);
+		spell_check_block (
+			view, document, dom_selection, block,
+			view->priv->spell_checked_blocks);
+	} else {
+		/* Append some text on the end of the element */
+		text = webkit_dom_document_create_text_node (document, "-x-evo-end");
+		webkit_dom_node_append_child (
+			WEBKIT_DOM_NODE (end_parent),
+			WEBKIT_DOM_NODE (text),
+			NULL);
+
+		/* Create range that's pointing on the end of this text */
+		end_range = webkit_dom_document_create_range (document);
+		webkit_dom_range_select_node_contents (
+			end_range, WEBKIT_DOM_NODE (text), NULL);
+		webkit_dom_range_collapse (end_range, FALSE, NULL);
+
+		/* Move on the beginning of the paragraph */
+		actual = webkit_dom_document_create_range (document);
+		webkit_dom_range_select_node_contents (
+			actual, WEBKIT_DOM_NODE (parent), NULL);
+		webkit_dom_range_collapse (actual, TRUE, NULL);
+		webkit_dom_dom_selection_remove_all_ranges (dom_selection);
+		webkit_dom_dom_selection_add_range (dom_selection, actual);
+
+		actual = webkit_dom_dom_selection_get_range_at (dom_selection, 0, NULL);
+		perform_spell_check (dom_selection, actual, end_range);
+
+		g_object_unref (end_range);
+
+		/* Remove the text that we inserted on the end of the paragraph */
+		remove_node (WEBKIT_DOM_NODE (text));
+	}
+
+	g_object_unref (dom_selection);
+	g_object_unref (dom_window);
+
+	/* Unblock the callbacks */
+	unblock_selection_changed_callbacks (view);
+
+	e_html_editor_selection_restore (selection);
+}
+
 static void
 refresh_spell_check (EHTMLEditorView *view,
                      gboolean enable_spell_check)
@@ -716,33 +946,41 @@ refresh_spell_check (EHTMLEditorView *view,
 	 * when we are moving with caret */
 	block_selection_changed_callbacks (view);
 
-	/* Append some text on the end of the body */
-	text = webkit_dom_document_create_text_node (document, "-x-evo-end");
-	webkit_dom_node_append_child (
-		WEBKIT_DOM_NODE (body), WEBKIT_DOM_NODE (text), NULL);
-
-	/* Create range that's pointing on the end of this text */
-	end_range = webkit_dom_document_create_range (document);
-	webkit_dom_range_select_node_contents (
-		end_range, WEBKIT_DOM_NODE (text), NULL);
-	webkit_dom_range_collapse (end_range, FALSE, NULL);
-
 	dom_window = webkit_dom_document_get_default_view (document);
 	dom_selection = webkit_dom_dom_window_get_selection (dom_window);
 
-	/* Move on the beginning of the document */
-	webkit_dom_dom_selection_modify (
-		dom_selection, "move", "backward", "documentboundary");
+	if (!enable_spell_check ||
+	    !spell_check_changed_blocks (view, document, dom_selection, body)) {
+		/* Markers from the blocks checked so far are removed, or
+		 * the body is checked at once; start afresh next time. */
+		g_hash_table_remove_all (view->priv->spell_checked_blocks);
 
-	actual = webkit_dom_dom_selection_get_range_at (dom_selection, 0, NULL);
-	perform_spell_check (dom_selection, actual, end_range);
+		/* Append some text on the end of the body */
+		text = webkit_dom_document_create_text_node (document, "-x-evo-end");
+		webkit_dom_node_append_child (
+			WEBKIT_DOM_NODE (body), WEBKIT_DOM_NODE (text), NULL);
+
+		/* Create range that's pointing on the end of this text */
+		end_range = webkit_dom_document_create_range (document);
+		webkit_dom_range_select_node_contents (
+			end_range, WEBKIT_DOM_NODE (text), NULL);
+		webkit_dom_range_collapse (end_range, FALSE, NULL);
+
+		/* Move on the beginning of the document */
+		webkit_dom_dom_selection_modify (
+			dom_selection, "move", "backward", "documentboundary");
+
+		actual = webkit_dom_dom_selection_get_range_at (dom_selection, 0, NULL);
+		perform_spell_check (dom_selection, actual, end_range);
+
+		g_object_unref (end_range);
+
+		/* Remove the text that we inserted on the end of the body */
+		remove_node (WEBKIT_DOM_NODE (text));
+	}
 
 	g_object_unref (dom_selection);
 	g_object_unref (dom_window);
-	g_object_unref (end_range);
-
-	/* Remove the text that we inserted on the end of the body */
-	remove_node (WEBKIT_DOM_NODE (text));
 
 	/* Unblock the callbacks */
 	unblock_selection_changed_callbacks (view);
@@ -766,6 +1004,7 @@ e_html_editor_view_force_spell_check_in_viewport (EHTMLEditorView *view)
 	WebKitDOMDOMWindow *dom_window;
 	WebKitDOMElement *last_element;
 	WebKitDOMHTMLElement *body;
+	WebKitDOMNode *first_block = NULL;
 	WebKitDOMRange *end_range, *actual;
 	WebKitDOMText *text;
 
@@ -798,41 +1037,76 @@ e_html_editor_view_force_spell_check_in_viewport (EHTMLEditorView *view)
 	if (!actual)
 		return;
 
-	/* Append some text on the end of the body */
-	text = webkit_dom_document_create_text_node (document, "-x-evo-end");
-
 	dom_window = webkit_dom_document_get_default_view (document);
 	dom_selection = webkit_dom_dom_window_get_selection (dom_window);
 
 	/* We have to add 10 px offset as otherwise just the HTML element will be returned */
 	viewport_height = webkit_dom_dom_window_get_inner_height (dom_window);
 	last_element = webkit_dom_document_element_from_point (document, 10, viewport_height - 10);
-	if (last_element && !WEBKIT_DOM_IS_HTML_HTML_ELEMENT (last_element)) {
-		WebKitDOMElement *parent;
+	if (last_element && WEBKIT_DOM_IS_HTML_HTML_ELEMENT (last_element))
+		last_element = NULL;
+
+	if (body_has_only_blocks (body))
+		first_block = get_top_level_block (
+			body, webkit_dom_range_get_start_container (actual, NULL));
+
+	if (first_block != NULL) {
+		WebKitDOMNode *last_block = NULL;
+		WebKitDOMNode *block;
+
+		/* Like refresh_spell_check(), check only the blocks
+		 * which changed since they were checked, and skip
+		 * the citations if asked to. */
+		if (last_element != NULL)
+			last_block = get_top_level_block (
+				body, WEBKIT_DOM_NODE (last_element));
+
+		spell_check_update_languages (view);
+
+		for (block = first_block;
+		     block != NULL;
+		     block = webkit_dom_node_get_next_sibling (block)) {
+			spell_check_block (
+				view, document, dom_selection, block,
+				view->priv->spell_checked_blocks);
+
+			if (block == last_block)
+				break;
+		}
 
-		parent = get_parent_block_element (WEBKIT_DOM_NODE (last_element));
-		webkit_dom_node_append_child (
-			WEBKIT_DOM_NODE (parent), WEBKIT_DOM_NODE (text), NULL);
-	} else
-		webkit_dom_node_append_child (
-			WEBKIT_DOM_NODE (body), WEBKIT_DOM_NODE (text), NULL);
+		g_object_unref (actual);
+	} else {
+		/* Append some text on the end of the body */
+		text = webkit_dom_document_create_text_node (document, "-x-evo-end");
 
-	/* Create range that's pointing on the end of viewport */
-	end_range = webkit_dom_document_create_range (document);
-	webkit_dom_range_select_node_contents (
-		end_range, WEBKIT_DOM_NODE (text), NULL);
-	webkit_dom_range_collapse (end_range, FALSE, NULL);
+		if (last_element != NULL) {
+			WebKitDOMElement *parent;
 
-	webkit_dom_dom_selection_remove_all_ranges (dom_selection);
-	webkit_dom_dom_selection_add_range (dom_selection, actual);
-	perform_spell_check (dom_selection, actual, end_range);
+			parent = get_parent_block_element (WEBKIT_DOM_NODE (last_element));
+			webkit_dom_node_append_child (
+				WEBKIT_DOM_NODE (parent), WEBKIT_DOM_NODE (text), NULL);
+		} else
+			webkit_dom_node_append_child (
+				WEBKIT_DOM_NODE (body), WEBKIT_DOM_NODE (text), NULL);
+
+		/* Create range that's pointing on the end of viewport */
+		end_range = webkit_dom_document_create_range (document);
+		webkit_dom_range_select_node_contents (
+			end_range, WEBKIT_DOM_NODE (text), NULL);
+		webkit_dom_range_collapse (end_range, FALSE, NULL);
+
+		webkit_dom_dom_selection_remove_all_ranges (dom_selection);
+		webkit_dom_dom_selection_add_range (dom_selection, actual);
+		perform_spell_check (dom_selection, actual, end_range);
+
+		g_object_unref (end_range);
+
+		/* Remove the text that we inserted on the end of the body */
+		remove_node (WEBKIT_DOM_NODE (text));
+	}
 
 	g_object_unref (dom_selection);
 	g_object_unref (dom_window);
-	g_object_unref (end_range);
-
-	/* Remove the text that we inserted on the end of the body */
-	remove_node (WEBKIT_DOM_NODE (text));
 
 	/* Unblock the callbacks */
 	unblock_selection_changed_callbacks (view);
@@ -930,26 +1204,6 @@ e_html_editor_view_quote_plain_text_element_after_wrapping (WebKitDOMDocument *d
 	g_free (quotation);
 }
 
-static gboolean
-is_citation_node (WebKitDOMNode *node)
-{
-	gchar *value;
-
-	if (!WEBKIT_DOM_IS_HTML_QUOTE_ELEMENT (node))
-		return FALSE;
-
-	value = webkit_dom_element_get_attribute (WEBKIT_DOM_ELEMENT (node), "type");
-
-	/* citation == <blockquote type='cite'> */
-	if (g_strcmp0 (value, "cite") == 0) {
-		g_free (value);
-		return TRUE;
-	} else {
-		g_free (value);
-		return FALSE;
-	}
-}
-
 static gboolean
 return_pressed_in_empty_line (EHTMLEditorSelection *selection,
                               WebKitDOMDocument *document)
@@ -3422,6 +3676,12 @@ html_editor_view_set_property (GObject *object,
 				E_HTML_EDITOR_VIEW (object),
 				g_value_get_boolean (value));
 			return;
+
+		case PROP_SPELL_CHECK_CITATIONS:
+			e_html_editor_view_set_spell_check_citations (
+				E_HTML_EDITOR_VIEW (object),
+				g_value_get_boolean (value));
+			return;
 	}
 
 	G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
@@ -3505,6 +3765,12 @@ html_editor_view_get_property (GObject *object,
 				value, e_html_editor_view_get_spell_checker (
 				E_HTML_EDITOR_VIEW (object)));
 			return;
+
+		case PROP_SPELL_CHECK_CITATIONS:
+			g_value_set_boolean (
+				value, e_html_editor_view_get_spell_check_citations (
+				E_HTML_EDITOR_VIEW (object)));
+			return;
 	}
 
 	G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
@@ -3597,6 +3863,7 @@ html_editor_view_dispose (GObject *object)
 	}
 
 	g_hash_table_remove_all (priv->inline_images);
+	g_hash_table_remove_all (priv->spell_checked_blocks);
 
 	/* Chain up to parent's dispose() method. */
 	G_OBJECT_CLASS (e_html_editor_view_parent_class)->dispose (object);
@@ -3610,6 +3877,8 @@ html_editor_view_finalize (GObject *object)
 	priv = E_HTML_EDITOR_VIEW_GET_PRIVATE (object);
 
 	g_hash_table_destroy (priv->inline_images);
+	g_hash_table_destroy (priv->spell_checked_blocks);
+	g_free (priv->spell_checked_languages);
 
 	if (priv->old_settings) {
 		g_hash_table_destroy (priv->old_settings);
@@ -5071,6 +5340,23 @@ e_html_editor_view_class_init (EHTMLEditorViewClass *class)
 			G_PARAM_READABLE |
 			G_PARAM_STATIC_STRINGS));
 
+	/**
+	 * EHTMLEditorView:spell-check-citations
+	 *
+	 * Determines whether quoted citations are spell checked too.
+	 */
+	g_object_class_install_property (
+		object_class,
+		PROP_SPELL_CHECK_CITATIONS,
+		g_param_spec_boolean (
+			"spell-check-citations",
+			"Spell Check Citations",
+			"Check spelling of the quoted text too",
+			TRUE,
+			G_PARAM_READWRITE |
+			G_PARAM_CONSTRUCT |
+			G_PARAM_STATIC_STRINGS));
+
 	/**
 	 * EHTMLEditorView:popup-event
 	 *
@@ -9583,6 +9869,12 @@ e_html_editor_view_init (EHTMLEditorView *view)
 
 	view->priv->old_settings = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, (GDestroyNotify) g_variant_unref);
 
+	view->priv->spell_checked_blocks = g_hash_table_new_full (
+		(GHashFunc) g_direct_hash,
+		(GEqualFunc) g_direct_equal,
+		(GDestroyNotify) g_object_unref,
+		(GDestroyNotify) NULL);
+
 	/* Don't use CSS when possible to preserve compatibility with older
 	 * versions of Evolution or other MUAs */
 	e_html_editor_view_exec_command (
@@ -9738,6 +10030,52 @@ e_html_editor_view_set_inline_spelling (EHTMLEditorView *view,
 	g_object_notify (G_OBJECT (view), "inline-spelling");
 }
 
+/**
+ * e_html_editor_view_get_spell_check_citations:
+ * @view: an #EHTMLEditorView
+ *
+ * Returns whether the quoted citations are spell checked along with
+ * the rest of the text.
+ *
+ * Returns: @TRUE when citations are spell checked, @FALSE otherwise.
+ */
+gboolean
+e_html_editor_view_get_spell_check_citations (EHTMLEditorView *view)
+{
+	g_return_val_if_fail (E_IS_HTML_EDITOR_VIEW (view), FALSE);
+
+	return view->priv->spell_check_citations;
+}
+
+/**
+ * e_html_editor_view_set_spell_check_citations:
+ * @view: an #EHTMLEditorView
+ * @spell_check_citations: @TRUE to spell check citations, @FALSE otherwise
+ *
+ * Sets whether the quoted citations are spell checked.  Skipping them
+ * makes replies to long threads much cheaper to check.
+ */
+void
+e_html_editor_view_set_spell_check_citations (EHTMLEditorView *view,
+                                              gboolean spell_check_citations)
+{
+	g_return_if_fail (E_IS_HTML_EDITOR_VIEW (view));
+
+	if (view->priv->spell_check_citations == spell_check_citations)
+		return;
+
+	view->priv->spell_check_citations = spell_check_citations;
+
+	if (view->priv->inline_spelling) {
+		/* Remove markers from the citations first. */
+		if (!spell_check_citations)
+			e_html_editor_view_turn_spell_check_off (view);
+		e_html_editor_view_force_spell_check (view);
+	}
+
+	g_object_notify (G_OBJECT (view), "spell-check-citations");
+}
+
 /**
  * e_html_editor_view_get_magic_links:
  * @view: an #EHTMLEditorView
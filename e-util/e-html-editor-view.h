@@ -178,6 +178,11 @@ gboolean	e_html_editor_view_get_inline_spelling
 void		e_html_editor_view_set_inline_spelling
 						(EHTMLEditorView *view,
 						 gboolean inline_spelling);
+gboolean	e_html_editor_view_get_spell_check_citations
+						(EHTMLEditorView *view);
+void		e_html_editor_view_set_spell_check_citations
+						(EHTMLEditorView *view,
+						 gboolean spell_check_citations);
 gboolean	e_html_editor_view_get_magic_links
 						(EHTMLEditorView *view);
 void		e_html_editor_view_set_magic_links
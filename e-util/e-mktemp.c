@@ -101,27 +101,39 @@ expire_dir_rec (const gchar *base,
 }
 
 static GString *
-get_dir (gboolean make)
+get_dir_path (void)
 {
 	GString *path;
-	time_t now = time (NULL);
-	static time_t last = 0;
 
 #ifdef TEMP_HOME
-	const gchar *user_cache_dir;
 	gchar *tmpdir;
 
-	user_cache_dir = e_get_user_cache_dir ();
-	tmpdir = g_build_filename (user_cache_dir, "tmp", NULL);
+	tmpdir = g_build_filename (e_get_user_cache_dir (), "tmp", NULL);
 	path = g_string_new (tmpdir);
-	if (make && g_mkdir_with_parents (tmpdir, 0777) == -1) {
-		g_string_free (path, TRUE);
-		path = NULL;
-	}
 	g_free (tmpdir);
 #else
 	path = g_string_new ("/tmp/evolution-");
 	g_string_append_printf (path, "%d", (gint) getuid ());
+#endif
+
+	return path;
+}
+
+static GString *
+get_dir (gboolean make)
+{
+	GString *path;
+	time_t now = time (NULL);
+	static time_t last = 0;
+
+	path = get_dir_path ();
+
+#ifdef TEMP_HOME
+	if (make && g_mkdir_with_parents (path->str, 0777) == -1) {
+		g_string_free (path, TRUE);
+		path = NULL;
+	}
+#else
 	if (make) {
 		gint ret;
 
@@ -253,3 +265,33 @@ e_mkdtemp (const gchar *template)
 
 	return tmpdir;
 }
+
+/**
+ * e_mktemp_is_temporary:
+ * @filename: a local file name
+ *
+ * Returns whether @filename is in the directory used by e_mktemp(),
+ * e_mkstemp() and e_mkdtemp().  Files in there are removed once
+ * they were not accessed for some time.
+ *
+ * Returns: whether @filename is a temporary file
+ *
+ * Since: 3.18
+ **/
+gboolean
+e_mktemp_is_temporary (const gchar *filename)
+{
+	GString *path;
+	gboolean is_temporary;
+
+	g_return_val_if_fail (filename != NULL, FALSE);
+
+	path = get_dir_path ();
+	g_string_append_c (path, G_DIR_SEPARATOR);
+
+	is_temporary = g_str_has_prefix (filename, path->str);
+
+	g_string_free (path, TRUE);
+
+	return is_temporary;
+}
@@ -32,4 +32,6 @@ gint   e_mkstemp (const gchar *template);
 
 gchar *e_mkdtemp (const gchar *template);
 
+gboolean e_mktemp_is_temporary (const gchar *filename);
+
 #endif /* __E_MKTEMP_H__ */
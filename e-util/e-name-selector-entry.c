@@ -65,8 +65,26 @@ struct _ENameSelectorEntryPrivate {
 	GQueue cancellables;
 
 	GHashTable *known_contacts; /* gchar * ~> 1 */
+
+	/* Prefix index of the contacts in the contact_store, used to narrow
+	 * the results of the last query locally while the cue grows */
+	GArray *index_entries; /* IndexEntry */
+	GStringChunk *index_strings;
+	gboolean index_dirty;
+	gboolean index_unsorted;
+	gchar *index_cue; /* folded cue the contact_store was queried with */
+	GHashTable *index_views; /* EBookClientView * ~> 1, of the index_cue query */
+	gboolean index_incomplete; /* a view of the index_cue query was cut short */
+	GHashTable *filter_uids; /* gchar *uid ~> 1; NULL when not narrowed */
+	gchar *filter_cue;
+	gboolean filter_changing;
 };
 
+typedef struct _IndexEntry {
+	const gchar *token; /* points into index_strings */
+	EContact *contact;
+} IndexEntry;
+
 enum {
 	PROP_0,
 	PROP_CLIENT_CACHE,
@@ -110,6 +128,7 @@ static void user_delete_text (ENameSelectorEntry *name_selector_entry, gint star
 
 static void setup_default_contact_store (ENameSelectorEntry *name_selector_entry);
 static void deep_free_list (GList *list);
+static void completion_index_forget (ENameSelectorEntry *name_selector_entry);
 
 static void
 name_selector_entry_set_property (GObject *object,
@@ -205,6 +224,9 @@ name_selector_entry_dispose (GObject *object)
 	}
 
 	if (priv->contact_store) {
+		g_signal_handlers_disconnect_matched (
+			priv->contact_store, G_SIGNAL_MATCH_DATA,
+			0, 0, NULL, NULL, object);
 		g_object_unref (priv->contact_store);
 		priv->contact_store = NULL;
 	}
@@ -214,6 +236,23 @@ name_selector_entry_dispose (GObject *object)
 		priv->known_contacts = NULL;
 	}
 
+	completion_index_forget (E_NAME_SELECTOR_ENTRY (object));
+
+	if (priv->index_entries) {
+		g_array_free (priv->index_entries, TRUE);
+		priv->index_entries = NULL;
+	}
+
+	if (priv->index_strings) {
+		g_string_chunk_free (priv->index_strings);
+		priv->index_strings = NULL;
+	}
+
+	if (priv->index_views) {
+		g_hash_table_destroy (priv->index_views);
+		priv->index_views = NULL;
+	}
+
 	g_slist_foreach (priv->user_query_fields, (GFunc) g_free, NULL);
 	g_slist_free (priv->user_query_fields);
 	priv->user_query_fields = NULL;
@@ -820,6 +859,420 @@ ens_util_populate_user_query_fields (GSList *user_query_fields,
 	return g_string_free (user_fields, !user_fields->str || !*user_fields->str);
 }
 
+/* The contact_store holds results of a (beginswith ...) query, thus
+ * the results for any longer cue are a subset of them.  Contacts are
+ * indexed by their nickname, full name, file-as and email values, and
+ * by each word within them, which lets the cue be refined locally
+ * without restarting the book views. */
+
+static gchar *
+completion_index_fold (const gchar *string)
+{
+	gchar *sane, *folded;
+
+	sane = sanitize_string (string);
+	folded = g_utf8_casefold (sane, -1);
+	g_free (sane);
+
+	return folded;
+}
+
+/* Returns folded values of the indexed fields; free with g_ptr_array_unref() */
+static GPtrArray *
+completion_index_get_values (EContact *contact)
+{
+	EContactField fields[] = { E_CONTACT_FULL_NAME, E_CONTACT_NICKNAME, E_CONTACT_FILE_AS };
+	GPtrArray *values;
+	GList *emails, *link;
+	gint ii;
+
+	values = g_ptr_array_new_with_free_func (g_free);
+
+	for (ii = 0; ii < G_N_ELEMENTS (fields); ii++) {
+		const gchar *value;
+
+		value = e_contact_get_const (contact, fields[ii]);
+		if (value && *value)
+			g_ptr_array_add (values, completion_index_fold (value));
+	}
+
+	emails = e_contact_get (contact, E_CONTACT_EMAIL);
+	for (link = emails; link; link = g_list_next (link)) {
+		const gchar *value = link->data;
+
+		if (value && *value)
+			g_ptr_array_add (values, completion_index_fold (value));
+	}
+	deep_free_list (emails);
+
+	return values;
+}
+
+/* Returns the start of the next word in value, or NULL */
+static const gchar *
+completion_index_next_word (const gchar *value)
+{
+	while (*value && *value != ' ')
+		value++;
+
+	while (*value == ' ')
+		value++;
+
+	return *value ? value : NULL;
+}
+
+static gboolean
+completion_index_contact_matches (EContact *contact,
+                                  const gchar *folded_cue)
+{
+	GPtrArray *values;
+	gboolean matches = FALSE;
+	guint ii;
+
+	values = completion_index_get_values (contact);
+
+	for (ii = 0; ii < values->len && !matches; ii++) {
+		const gchar *word = g_ptr_array_index (values, ii);
+
+		for (; word && !matches; word = completion_index_next_word (word))
+			matches = g_str_has_prefix (word, folded_cue);
+	}
+
+	g_ptr_array_unref (values);
+
+	return matches;
+}
+
+static void
+completion_index_add_contact (ENameSelectorEntry *name_selector_entry,
+                              EContact *contact)
+{
+	ENameSelectorEntryPrivate *priv = name_selector_entry->priv;
+	GPtrArray *values;
+	guint ii;
+
+	if (!priv->index_entries) {
+		priv->index_entries = g_array_new (FALSE, FALSE, sizeof (IndexEntry));
+		priv->index_strings = g_string_chunk_new (4096);
+	}
+
+	values = completion_index_get_values (contact);
+
+	for (ii = 0; ii < values->len; ii++) {
+		const gchar *word;
+
+		/* Each word is a suffix of the stored value */
+		word = g_string_chunk_insert_const (priv->index_strings, g_ptr_array_index (values, ii));
+
+		for (; word; word = completion_index_next_word (word)) {
+			IndexEntry entry;
+
+			entry.token = word;
+			entry.contact = contact;
+
+			g_array_append_val (priv->index_entries, entry);
+		}
+	}
+
+	g_ptr_array_unref (values);
+
+	priv->index_unsorted = TRUE;
+}
+
+static gint
+completion_index_compare_entries (gconstpointer ptr1,
+                                  gconstpointer ptr2)
+{
+	const IndexEntry *entry1 = ptr1, *entry2 = ptr2;
+
+	return strcmp (entry1->token, entry2->token);
+}
+
+static void
+completion_index_ensure (ENameSelectorEntry *name_selector_entry)
+{
+	ENameSelectorEntryPrivate *priv = name_selector_entry->priv;
+
+	if (priv->index_dirty) {
+		GtkTreeModel *model = GTK_TREE_MODEL (priv->contact_store);
+		GtkTreeIter iter;
+
+		if (priv->index_entries) {
+			g_array_set_size (priv->index_entries, 0);
+			g_string_chunk_clear (priv->index_strings);
+		}
+
+		if (gtk_tree_model_get_iter_first (model, &iter)) {
+			do {
+				EContact *contact;
+
+				contact = e_contact_store_get_contact (priv->contact_store, &iter);
+				if (contact)
+					completion_index_add_contact (name_selector_entry, contact);
+			} while (gtk_tree_model_iter_next (model, &iter));
+		}
+
+		priv->index_dirty = FALSE;
+	}
+
+	if (priv->index_unsorted && priv->index_entries) {
+		g_array_sort (priv->index_entries, completion_index_compare_entries);
+		priv->index_unsorted = FALSE;
+	}
+}
+
+/* Returns UIDs of contacts with a word starting with folded_cue */
+static GHashTable *
+completion_index_lookup (ENameSelectorEntry *name_selector_entry,
+                         const gchar *folded_cue)
+{
+	ENameSelectorEntryPrivate *priv = name_selector_entry->priv;
+	GHashTable *uids;
+	guint lo, hi;
+
+	uids = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+
+	completion_index_ensure (name_selector_entry);
+
+	if (!priv->index_entries)
+		return uids;
+
+	/* Find the first token not less than the cue */
+	lo = 0;
+	hi = priv->index_entries->len;
+
+	while (lo < hi) {
+		guint mid = lo + (hi - lo) / 2;
+		IndexEntry *entry = &g_array_index (priv->index_entries, IndexEntry, mid);
+
+		if (strcmp (entry->token, folded_cue) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	for (; lo < priv->index_entries->len; lo++) {
+		IndexEntry *entry = &g_array_index (priv->index_entries, IndexEntry, lo);
+		const gchar *uid;
+
+		if (!g_str_has_prefix (entry->token, folded_cue))
+			break;
+
+		uid = e_contact_get_const (entry->contact, E_CONTACT_UID);
+		if (uid)
+			g_hash_table_add (uids, g_strdup (uid));
+	}
+
+	return uids;
+}
+
+/* Sets contacts to be offered; NULL filter_uids means all of them */
+static void
+completion_index_set_filter (ENameSelectorEntry *name_selector_entry,
+                             GHashTable *filter_uids,
+                             const gchar *filter_cue)
+{
+	ENameSelectorEntryPrivate *priv = name_selector_entry->priv;
+	GtkTreeModel *model;
+	GHashTable *old_uids;
+	GtkTreeIter iter;
+
+	old_uids = priv->filter_uids;
+	priv->filter_uids = filter_uids;
+
+	g_free (priv->filter_cue);
+	priv->filter_cue = g_strdup (filter_cue);
+
+	if (!old_uids && !filter_uids)
+		return;
+
+	model = GTK_TREE_MODEL (priv->contact_store);
+
+	priv->filter_changing = TRUE;
+
+	/* Regenerate completion rows of contacts changing visibility */
+	if (gtk_tree_model_get_iter_first (model, &iter)) {
+		do {
+			EContact *contact;
+			const gchar *uid;
+			gboolean was_visible, is_visible;
+
+			contact = e_contact_store_get_contact (priv->contact_store, &iter);
+			uid = contact ? e_contact_get_const (contact, E_CONTACT_UID) : NULL;
+			if (!uid)
+				continue;
+
+			was_visible = !old_uids || g_hash_table_contains (old_uids, uid);
+			is_visible = !filter_uids || g_hash_table_contains (filter_uids, uid);
+
+			if (was_visible != is_visible) {
+				GtkTreePath *path;
+
+				if (!is_visible) {
+					gchar *description;
+
+					description = describe_contact (contact);
+					if (description)
+						g_hash_table_remove (priv->known_contacts, description);
+					g_free (description);
+				}
+
+				path = gtk_tree_model_get_path (model, &iter);
+				gtk_tree_model_row_changed (model, path, &iter);
+				gtk_tree_path_free (path);
+			}
+		} while (gtk_tree_model_iter_next (model, &iter));
+	}
+
+	priv->filter_changing = FALSE;
+
+	if (old_uids)
+		g_hash_table_destroy (old_uids);
+}
+
+static void
+completion_index_view_complete (ENameSelectorEntry *name_selector_entry,
+                                const GError *error,
+                                EBookClientView *client_view)
+{
+	ENameSelectorEntryPrivate *priv = name_selector_entry->priv;
+
+	/* Such as when a size limit of an LDAP book was exceeded;
+	 * the index lacks contacts matching the query then. */
+	if (error && priv->index_views &&
+	    g_hash_table_contains (priv->index_views, client_view))
+		priv->index_incomplete = TRUE;
+}
+
+static void
+completion_index_start_view (ENameSelectorEntry *name_selector_entry,
+                             EBookClientView *client_view)
+{
+	ENameSelectorEntryPrivate *priv = name_selector_entry->priv;
+
+	if (!priv->index_views)
+		priv->index_views = g_hash_table_new_full (
+			g_direct_hash, g_direct_equal, g_object_unref, NULL);
+
+	g_hash_table_add (priv->index_views, g_object_ref (client_view));
+
+	g_signal_connect_swapped (
+		client_view, "complete",
+		G_CALLBACK (completion_index_view_complete), name_selector_entry);
+}
+
+static void
+completion_index_stop_view (ENameSelectorEntry *name_selector_entry,
+                            EBookClientView *client_view)
+{
+	ENameSelectorEntryPrivate *priv = name_selector_entry->priv;
+
+	g_signal_handlers_disconnect_by_func (
+		client_view, completion_index_view_complete, name_selector_entry);
+
+	if (priv->index_views)
+		g_hash_table_remove (priv->index_views, client_view);
+}
+
+/* Views of the former queries do not tell about the index_cue query */
+static void
+completion_index_forget_views (ENameSelectorEntry *name_selector_entry)
+{
+	ENameSelectorEntryPrivate *priv = name_selector_entry->priv;
+	GHashTableIter iter;
+	gpointer client_view;
+
+	priv->index_incomplete = FALSE;
+
+	if (!priv->index_views)
+		return;
+
+	g_hash_table_iter_init (&iter, priv->index_views);
+	while (g_hash_table_iter_next (&iter, &client_view, NULL))
+		g_signal_handlers_disconnect_by_func (
+			client_view, completion_index_view_complete, name_selector_entry);
+
+	g_hash_table_remove_all (priv->index_views);
+}
+
+static void
+completion_index_forget (ENameSelectorEntry *name_selector_entry)
+{
+	ENameSelectorEntryPrivate *priv = name_selector_entry->priv;
+
+	completion_index_forget_views (name_selector_entry);
+
+	g_free (priv->index_cue);
+	priv->index_cue = NULL;
+
+	g_free (priv->filter_cue);
+	priv->filter_cue = NULL;
+
+	if (priv->filter_uids) {
+		g_hash_table_destroy (priv->filter_uids);
+		priv->filter_uids = NULL;
+	}
+
+	priv->index_dirty = TRUE;
+}
+
+/* These are connected before the email_generator's handlers, thus
+ * the index and the filter are up to date when it generates rows. */
+
+static void
+completion_index_row_inserted (ENameSelectorEntry *name_selector_entry,
+                               GtkTreePath *path,
+                               GtkTreeIter *iter)
+{
+	ENameSelectorEntryPrivate *priv = name_selector_entry->priv;
+	EContact *contact;
+
+	contact = e_contact_store_get_contact (priv->contact_store, iter);
+	if (!contact)
+		return;
+
+	if (!priv->index_dirty)
+		completion_index_add_contact (name_selector_entry, contact);
+
+	if (priv->filter_uids && e_contact_get_const (contact, E_CONTACT_UID) &&
+	    completion_index_contact_matches (contact, priv->filter_cue))
+		g_hash_table_add (priv->filter_uids, e_contact_get (contact, E_CONTACT_UID));
+}
+
+static void
+completion_index_row_changed (ENameSelectorEntry *name_selector_entry,
+                              GtkTreePath *path,
+                              GtkTreeIter *iter)
+{
+	ENameSelectorEntryPrivate *priv = name_selector_entry->priv;
+	EContact *contact;
+	const gchar *uid;
+
+	if (priv->filter_changing)
+		return;
+
+	/* The contact can be replaced with another instance */
+	priv->index_dirty = TRUE;
+
+	contact = e_contact_store_get_contact (priv->contact_store, iter);
+	uid = contact ? e_contact_get_const (contact, E_CONTACT_UID) : NULL;
+
+	if (!priv->filter_uids || !uid)
+		return;
+
+	if (completion_index_contact_matches (contact, priv->filter_cue))
+		g_hash_table_add (priv->filter_uids, g_strdup (uid));
+	else
+		g_hash_table_remove (priv->filter_uids, uid);
+}
+
+static void
+completion_index_row_deleted (ENameSelectorEntry *name_selector_entry,
+                              GtkTreePath *path)
+{
+	name_selector_entry->priv->index_dirty = TRUE;
+}
+
 static void
 set_completion_query (ENameSelectorEntry *name_selector_entry,
                       const gchar *cue_str)
@@ -831,6 +1284,7 @@ set_completion_query (ENameSelectorEntry *name_selector_entry,
 	gchar      *full_name_query_str;
 	gchar      *file_as_query_str;
 	gchar      *user_fields_str;
+	gchar      *folded_cue;
 
 	priv = E_NAME_SELECTOR_ENTRY_GET_PRIVATE (name_selector_entry);
 
@@ -839,10 +1293,48 @@ set_completion_query (ENameSelectorEntry *name_selector_entry,
 
 	if (!cue_str) {
 		/* Clear the store */
+		completion_index_forget (name_selector_entry);
 		e_contact_store_set_query (name_selector_entry->priv->contact_store, NULL);
 		return;
 	}
 
+	folded_cue = completion_index_fold (cue_str);
+
+	/* Refine results of the running query when the cue only grew;
+	 * user query fields can match in ways the index does not know.
+	 * The books are asked again when nothing matches locally or when
+	 * the running query could not return all the contacts it matches. */
+	if (!priv->user_query_fields && priv->index_cue && !priv->index_incomplete &&
+	    e_contact_store_peek_query (priv->contact_store) &&
+	    g_str_has_prefix (folded_cue, priv->index_cue)) {
+		GHashTable *uids;
+
+		if (g_str_equal (folded_cue, priv->index_cue)) {
+			ENS_DEBUG (g_print ("Refining '%s' locally\n", cue_str));
+			completion_index_set_filter (name_selector_entry, NULL, NULL);
+			g_free (folded_cue);
+			return;
+		}
+
+		uids = completion_index_lookup (name_selector_entry, folded_cue);
+
+		if (g_hash_table_size (uids) > 0) {
+			ENS_DEBUG (g_print ("Refining '%s' locally\n", cue_str));
+			completion_index_set_filter (name_selector_entry, uids, folded_cue);
+			g_free (folded_cue);
+			return;
+		}
+
+		g_hash_table_destroy (uids);
+	}
+
+	completion_index_set_filter (name_selector_entry, NULL, NULL);
+	completion_index_forget_views (name_selector_entry);
+	g_hash_table_remove_all (priv->known_contacts);
+
+	g_free (priv->index_cue);
+	priv->index_cue = folded_cue;
+
 	encoded_cue_str = escape_sexp_string (cue_str);
 	full_name_query_str = name_style_query ("full_name", cue_str);
 	file_as_query_str = name_style_query ("file_as",   cue_str);
@@ -1256,6 +1748,7 @@ clear_completion_model (ENameSelectorEntry *name_selector_entry)
 	if (!name_selector_entry->priv->contact_store)
 		return;
 
+	completion_index_forget (name_selector_entry);
 	e_contact_store_set_query (name_selector_entry->priv->contact_store, NULL);
 	g_hash_table_remove_all (name_selector_entry->priv->known_contacts);
 	priv->is_completing = FALSE;
@@ -1281,8 +1774,6 @@ update_completion_model (ENameSelectorEntry *name_selector_entry)
 		cue_str = get_entry_substring (name_selector_entry, range_start, range_end);
 		set_completion_query (name_selector_entry, cue_str);
 		g_free (cue_str);
-
-		g_hash_table_remove_all (name_selector_entry->priv->known_contacts);
 	} else {
 		/* N/A; Clear completion model */
 		clear_completion_model (name_selector_entry);
@@ -2313,6 +2804,11 @@ generate_contact_rows (EContactStore *contact_store,
 	if (!contact_uid)
 		return 0;  /* Can happen with broken databases */
 
+	/* Narrowed out by the local index */
+	if (name_selector_entry->priv->filter_uids &&
+	    !g_hash_table_contains (name_selector_entry->priv->filter_uids, contact_uid))
+		return 0;
+
 	if (is_duplicate_contact_and_remember (name_selector_entry, contact))
 		return 0;
 
@@ -2348,7 +2844,26 @@ setup_contact_store (ENameSelectorEntry *name_selector_entry)
 		name_selector_entry->priv->email_generator = NULL;
 	}
 
+	completion_index_forget (name_selector_entry);
+
 	if (name_selector_entry->priv->contact_store) {
+		/* Keep the index up to date before the generator sees a change */
+		g_signal_connect_swapped (
+			name_selector_entry->priv->contact_store, "row-inserted",
+			G_CALLBACK (completion_index_row_inserted), name_selector_entry);
+		g_signal_connect_swapped (
+			name_selector_entry->priv->contact_store, "row-changed",
+			G_CALLBACK (completion_index_row_changed), name_selector_entry);
+		g_signal_connect_swapped (
+			name_selector_entry->priv->contact_store, "row-deleted",
+			G_CALLBACK (completion_index_row_deleted), name_selector_entry);
+		g_signal_connect_swapped (
+			name_selector_entry->priv->contact_store, "start-client-view",
+			G_CALLBACK (completion_index_start_view), name_selector_entry);
+		g_signal_connect_swapped (
+			name_selector_entry->priv->contact_store, "stop-client-view",
+			G_CALLBACK (completion_index_stop_view), name_selector_entry);
+
 		name_selector_entry->priv->email_generator =
 			e_tree_model_generator_new (
 				GTK_TREE_MODEL (
@@ -3662,8 +4177,12 @@ e_name_selector_entry_set_contact_store (ENameSelectorEntry *name_selector_entry
 	if (contact_store == name_selector_entry->priv->contact_store)
 		return;
 
-	if (name_selector_entry->priv->contact_store)
+	if (name_selector_entry->priv->contact_store) {
+		g_signal_handlers_disconnect_matched (
+			name_selector_entry->priv->contact_store, G_SIGNAL_MATCH_DATA,
+			0, 0, NULL, NULL, name_selector_entry);
 		g_object_unref (name_selector_entry->priv->contact_store);
+	}
 	name_selector_entry->priv->contact_store = contact_store;
 	if (name_selector_entry->priv->contact_store)
 		g_object_ref (name_selector_entry->priv->contact_store);
@@ -35,11 +35,22 @@
 
 #define MAX_SUGGESTIONS 10
 
+/* How many word verdicts to remember, for all checkers together. */
+#define MAX_WORD_VERDICTS 8192
+
 struct _ESpellCheckerPrivate {
 	GHashTable *active_dictionaries;
 	GHashTable *dictionaries_cache;
+
+	/* Active language codes, as a prefix of the word verdict keys. */
+	gchar *verdicts_prefix;
 };
 
+typedef struct _WordVerdict {
+	gchar *key;
+	gboolean recognized;
+} WordVerdict;
+
 enum {
 	PROP_0,
 	PROP_ACTIVE_LANGUAGES
@@ -76,6 +87,114 @@ static GHashTable *global_enchant_dicts;
 static EnchantBroker *global_broker;
 G_LOCK_DEFINE_STATIC (global_memory);
 
+/* Whether a word is recognized by a set of active languages.  The
+ * dictionaries are shared, thus so are the verdicts; every composer
+ * checks the same quoted text and the same words over again.  Keys
+ * map to links in the queue, which has the least recently used
+ * verdicts at its head. */
+static GHashTable *global_word_verdicts;
+static GQueue global_word_verdicts_lru = G_QUEUE_INIT;
+G_LOCK_DEFINE_STATIC (global_word_verdicts);
+
+static void
+word_verdict_free (WordVerdict *verdict)
+{
+	g_free (verdict->key);
+	g_slice_free (WordVerdict, verdict);
+}
+
+static gchar *
+spell_checker_dup_verdict_key (ESpellChecker *checker,
+                               const gchar *word,
+                               gsize length)
+{
+	gchar *key;
+
+	if (checker->priv->verdicts_prefix == NULL) {
+		gchar **languages;
+
+		languages = e_spell_checker_list_active_languages (checker, NULL);
+		checker->priv->verdicts_prefix = g_strjoinv (",", languages);
+		g_strfreev (languages);
+	}
+
+	if (length == (gsize) -1)
+		length = strlen (word);
+
+	key = g_strdup_printf (
+		"%s\n%.*s", checker->priv->verdicts_prefix, (gint) length, word);
+
+	return key;
+}
+
+static gboolean
+spell_checker_lookup_verdict (const gchar *key,
+                              gboolean *out_recognized)
+{
+	GList *link = NULL;
+
+	G_LOCK (global_word_verdicts);
+
+	if (global_word_verdicts != NULL)
+		link = g_hash_table_lookup (global_word_verdicts, key);
+
+	if (link != NULL) {
+		WordVerdict *verdict = link->data;
+
+		*out_recognized = verdict->recognized;
+
+		g_queue_unlink (&global_word_verdicts_lru, link);
+		g_queue_push_tail_link (&global_word_verdicts_lru, link);
+	}
+
+	G_UNLOCK (global_word_verdicts);
+
+	return link != NULL;
+}
+
+/* Takes ownership of the key. */
+static void
+spell_checker_store_verdict (gchar *key,
+                             gboolean recognized)
+{
+	WordVerdict *verdict;
+
+	verdict = g_slice_new (WordVerdict);
+	verdict->key = key;
+	verdict->recognized = recognized;
+
+	G_LOCK (global_word_verdicts);
+
+	if (global_word_verdicts == NULL)
+		global_word_verdicts = g_hash_table_new (g_str_hash, g_str_equal);
+
+	if (g_hash_table_contains (global_word_verdicts, key)) {
+		word_verdict_free (verdict);
+	} else {
+		g_queue_push_tail (&global_word_verdicts_lru, verdict);
+		g_hash_table_insert (
+			global_word_verdicts, verdict->key,
+			g_queue_peek_tail_link (&global_word_verdicts_lru));
+	}
+
+	while (g_queue_get_length (&global_word_verdicts_lru) > MAX_WORD_VERDICTS) {
+		verdict = g_queue_pop_head (&global_word_verdicts_lru);
+		g_hash_table_remove (global_word_verdicts, verdict->key);
+		word_verdict_free (verdict);
+	}
+
+	G_UNLOCK (global_word_verdicts);
+}
+
+static void
+spell_checker_active_languages_changed (ESpellChecker *checker)
+{
+	g_free (checker->priv->verdicts_prefix);
+	checker->priv->verdicts_prefix = NULL;
+
+	g_object_notify (G_OBJECT (checker), "active-languages");
+}
+
 static gboolean
 spell_checker_enchant_dicts_foreach_cb (gpointer key,
                                         gpointer value,
@@ -317,7 +436,7 @@ wksc_update_languages (WebKitSpellChecker *webkit_checker,
 		g_hash_table_add (active_dictionaries, dictionary);
 	}
 
-	g_object_notify (G_OBJECT (checker), "active-languages");
+	spell_checker_active_languages_changed (checker);
 }
 
 static void
@@ -361,6 +480,7 @@ spell_checker_finalize (GObject *object)
 
 	g_hash_table_destroy (priv->active_dictionaries);
 	g_hash_table_destroy (priv->dictionaries_cache);
+	g_free (priv->verdicts_prefix);
 
 	/* Chain up to parent's finalize() method. */
 	G_OBJECT_CLASS (e_spell_checker_parent_class)->finalize (object);
@@ -539,6 +659,12 @@ e_spell_checker_free_global_memory (void)
 	}
 
 	G_UNLOCK (global_memory);
+
+	e_spell_checker_forget_verdicts ();
+
+	G_LOCK (global_word_verdicts);
+	g_clear_pointer (&global_word_verdicts, g_hash_table_destroy);
+	G_UNLOCK (global_word_verdicts);
 }
 
 /**
@@ -673,10 +799,10 @@ e_spell_checker_set_language_active (ESpellChecker *checker,
 	if (active && !is_active) {
 		g_object_ref (dictionary);
 		g_hash_table_add (active_dictionaries, dictionary);
-		g_object_notify (G_OBJECT (checker), "active-languages");
+		spell_checker_active_languages_changed (checker);
 	} else if (!active && is_active) {
 		g_hash_table_remove (active_dictionaries, dictionary);
-		g_object_notify (G_OBJECT (checker), "active-languages");
+		spell_checker_active_languages_changed (checker);
 	}
 
 	g_object_unref (dictionary);
@@ -753,6 +879,8 @@ e_spell_checker_count_active_languages (ESpellChecker *checker)
  *
  * Calls e_spell_dictionary_check_word() on all active dictionaries in
  * @checker, and returns %TRUE if @word is recognized by any of them.
+ * The result is remembered for the set of active languages, shared
+ * by all the #ESpellChecker instances.
  *
  * Returns: %TRUE if @word is recognized, %FALSE otherwise
  **/
@@ -763,10 +891,18 @@ e_spell_checker_check_word (ESpellChecker *checker,
 {
 	GList *list, *link;
 	gboolean recognized = FALSE;
+	gchar *key;
 
 	g_return_val_if_fail (E_IS_SPELL_CHECKER (checker), TRUE);
 	g_return_val_if_fail (word != NULL && *word != '\0', TRUE);
 
+	key = spell_checker_dup_verdict_key (checker, word, length);
+
+	if (spell_checker_lookup_verdict (key, &recognized)) {
+		g_free (key);
+		return recognized;
+	}
+
 	list = g_hash_table_get_keys (checker->priv->active_dictionaries);
 
 	for (link = list; link != NULL; link = g_list_next (link)) {
@@ -781,9 +917,35 @@ e_spell_checker_check_word (ESpellChecker *checker,
 
 	g_list_free (list);
 
+	spell_checker_store_verdict (key, recognized);
+
 	return recognized;
 }
 
+/**
+ * e_spell_checker_forget_verdicts:
+ *
+ * Forgets results of e_spell_checker_check_word() remembered so far.
+ * Needed whenever a dictionary starts to recognize more words.
+ *
+ * Since: 3.18
+ **/
+void
+e_spell_checker_forget_verdicts (void)
+{
+	G_LOCK (global_word_verdicts);
+
+	if (global_word_verdicts != NULL)
+		g_hash_table_remove_all (global_word_verdicts);
+
+	g_queue_foreach (
+		&global_word_verdicts_lru,
+		(GFunc) word_verdict_free, NULL);
+	g_queue_clear (&global_word_verdicts_lru);
+
+	G_UNLOCK (global_word_verdicts);
+}
+
 /**
  * e_spell_checker_ignore_word:
  * @checker: an #ESpellChecker
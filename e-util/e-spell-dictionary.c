@@ -648,6 +648,7 @@ e_spell_dictionary_learn_word (ESpellDictionary *dictionary,
 	g_return_if_fail (enchant_dict != NULL);
 
 	enchant_dict_add_to_personal (enchant_dict, word, length);
+	e_spell_checker_forget_verdicts ();
 
 	g_object_unref (spell_checker);
 }
@@ -681,6 +682,7 @@ e_spell_dictionary_ignore_word (ESpellDictionary *dictionary,
 	g_return_if_fail (enchant_dict != NULL);
 
 	enchant_dict_add_to_session (enchant_dict, word, length);
+	e_spell_checker_forget_verdicts ();
 
 	g_object_unref (spell_checker);
 }
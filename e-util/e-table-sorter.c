@@ -24,6 +24,7 @@
 
 #include <glib/gi18n.h>
 
+#include "e-misc-utils.h"
 #include "e-table-sorter.h"
 #include "e-table-sorting-utils.h"
 
@@ -45,42 +46,79 @@ G_DEFINE_TYPE_WITH_CODE (
 		E_TYPE_SORTER,
 		e_table_sorter_interface_init))
 
-struct qsort_data {
-	ETableSorter *table_sorter;
+/* Below this many rows the threads cost more than they save. */
+#define PARALLEL_SORT_MIN_ROWS 50000
+#define MAX_SORT_THREADS 8
+
+typedef enum {
+	SORT_KEY_GENERIC,
+	SORT_KEY_INT64,
+	SORT_KEY_STRING
+} SortKeyType;
+
+/* Sort keys are extracted from the model once per column, into a form
+ * which can be compared directly.  Columns with a compare function not
+ * known here keep the model values and use the column's compare. */
+typedef struct _SortKey {
+	SortKeyType type;
+	gboolean ascending;
+	ETableCol *col;
+	gint64 *ints;
+	gchar **strs;
 	gpointer *vals;
-	gint cols;
-	gint *ascending;
-	GCompareDataFunc *compare;
+} SortKey;
+
+typedef struct _SortedBy {
+	ETableColumnSpecification *spec;
+	GtkSortType sort_type;
+} SortedBy;
+
+struct sort_data {
+	ETableSorter *table_sorter;
+	SortKey *keys;
+	gint n_keys;
 	gpointer cmp_cache;
 };
 
-/* FIXME: Make it not cache the second and later columns (as if anyone cares.) */
+struct sort_chunk {
+	struct sort_data *sd;
+	gint *rows;
+	gint *tmp;
+	gint n_rows;
+};
 
 static gint
-qsort_callback (gconstpointer data1,
-                gconstpointer data2,
-                gpointer user_data)
+table_sorter_compare_rows (struct sort_data *sd,
+                           gint row1,
+                           gint row2)
 {
-	struct qsort_data *qd = (struct qsort_data *) user_data;
-	gint row1 = *(gint *) data1;
-	gint row2 = *(gint *) data2;
 	gint j;
-	gint sort_count;
 	gint comp_val = 0;
-	gint ascending = 1;
+	gboolean ascending = TRUE;
 
-	sort_count =
-		e_table_sort_info_sorting_get_count (
-			qd->table_sorter->sort_info) +
-		e_table_sort_info_grouping_get_count (
-			qd->table_sorter->sort_info);
+	for (j = 0; j < sd->n_keys; j++) {
+		SortKey *key = &sd->keys[j];
+
+		switch (key->type) {
+		case SORT_KEY_INT64:
+			if (key->ints[row1] != key->ints[row2])
+				comp_val = key->ints[row1] < key->ints[row2] ? -1 : 1;
+			else
+				comp_val = 0;
+			break;
+		case SORT_KEY_STRING:
+			comp_val = e_str_compare (key->strs[row1], key->strs[row2]);
+			break;
+		case SORT_KEY_GENERIC:
+			comp_val = (*key->col->compare) (key->vals[row1], key->vals[row2], sd->cmp_cache);
+			break;
+		}
 
-	for (j = 0; j < sort_count; j++) {
-		comp_val = (*(qd->compare[j]))(qd->vals[qd->cols * row1 + j], qd->vals[qd->cols * row2 + j], qd->cmp_cache);
-		ascending = qd->ascending[j];
+		ascending = key->ascending;
 		if (comp_val != 0)
 			break;
 	}
+
 	if (comp_val == 0) {
 		if (row1 < row2)
 			comp_val = -1;
@@ -93,6 +131,305 @@ qsort_callback (gconstpointer data1,
 	return comp_val;
 }
 
+static void
+table_sorter_merge (struct sort_data *sd,
+                    gint *rows,
+                    gint *tmp,
+                    gint n_left,
+                    gint n_rows)
+{
+	gint *left = rows, *right = rows + n_left;
+	gint l = 0, r = n_left, i = 0;
+
+	/* Already in order, nothing to merge. */
+	if (table_sorter_compare_rows (sd, left[n_left - 1], right[0]) <= 0)
+		return;
+
+	while (l < n_left && r < n_rows) {
+		if (table_sorter_compare_rows (sd, rows[l], rows[r]) <= 0)
+			tmp[i++] = rows[l++];
+		else
+			tmp[i++] = rows[r++];
+	}
+
+	while (l < n_left)
+		tmp[i++] = rows[l++];
+
+	/* Whatever is left on the right side is in place already. */
+	memcpy (rows, tmp, i * sizeof (gint));
+}
+
+static void
+table_sorter_merge_sort (struct sort_data *sd,
+                         gint *rows,
+                         gint *tmp,
+                         gint n_rows)
+{
+	gint n_left;
+
+	if (n_rows < 16) {
+		gint i, j;
+
+		for (i = 1; i < n_rows; i++) {
+			gint row = rows[i];
+
+			for (j = i; j > 0 && table_sorter_compare_rows (sd, rows[j - 1], row) > 0; j--)
+				rows[j] = rows[j - 1];
+			rows[j] = row;
+		}
+
+		return;
+	}
+
+	n_left = n_rows / 2;
+
+	table_sorter_merge_sort (sd, rows, tmp, n_left);
+	table_sorter_merge_sort (sd, rows + n_left, tmp + n_left, n_rows - n_left);
+	table_sorter_merge (sd, rows, tmp, n_left, n_rows);
+}
+
+static gpointer
+table_sorter_sort_chunk_thread (gpointer user_data)
+{
+	struct sort_chunk *chunk = user_data;
+
+	table_sorter_merge_sort (chunk->sd, chunk->rows, chunk->tmp, chunk->n_rows);
+
+	return NULL;
+}
+
+static gboolean
+table_sorter_can_sort_in_parallel (struct sort_data *sd,
+                                   gint n_rows)
+{
+	gint j;
+
+	if (n_rows < PARALLEL_SORT_MIN_ROWS || g_get_num_processors () < 2)
+		return FALSE;
+
+	/* Column compare functions may use the shared cmp_cache,
+	 * which is not thread safe, thus only for extracted keys. */
+	for (j = 0; j < sd->n_keys; j++) {
+		if (sd->keys[j].type == SORT_KEY_GENERIC)
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+static void
+table_sorter_parallel_merge_sort (struct sort_data *sd,
+                                  gint *rows,
+                                  gint *tmp,
+                                  gint n_rows)
+{
+	struct sort_chunk chunks[MAX_SORT_THREADS];
+	GThread *threads[MAX_SORT_THREADS];
+	gint n_chunks, chunk_size, width, i;
+
+	n_chunks = MIN (g_get_num_processors (), MAX_SORT_THREADS);
+	chunk_size = (n_rows + n_chunks - 1) / n_chunks;
+
+	for (i = 0; i < n_chunks; i++) {
+		gint offset = i * chunk_size;
+
+		chunks[i].sd = sd;
+		chunks[i].rows = rows + offset;
+		chunks[i].tmp = tmp + offset;
+		chunks[i].n_rows = MIN (chunk_size, n_rows - offset);
+
+		/* The last chunk is sorted by the calling thread. */
+		if (i < n_chunks - 1)
+			threads[i] = g_thread_new (
+				"e-table-sorter",
+				table_sorter_sort_chunk_thread,
+				&chunks[i]);
+	}
+
+	table_sorter_sort_chunk_thread (&chunks[n_chunks - 1]);
+
+	for (i = 0; i < n_chunks - 1; i++)
+		g_thread_join (threads[i]);
+
+	for (width = chunk_size; width < n_rows; width *= 2) {
+		gint offset;
+
+		for (offset = 0; offset + width < n_rows; offset += 2 * width) {
+			table_sorter_merge (
+				sd, rows + offset, tmp + offset, width,
+				MIN (2 * width, n_rows - offset));
+		}
+	}
+}
+
+/* Stable LSD radix sort of the rows by a single integer key.  Bytes
+ * which are the same for every row are skipped, which is the common
+ * case for the high bytes of dates and sizes. */
+static void
+table_sorter_radix_sort (const gint64 *ints,
+                         gint *rows,
+                         gint n_rows)
+{
+	guint64 *keys, *keys_tmp, *keys_swap;
+	gint *rows_tmp, *rows_swap, *rows_orig = rows;
+	gint count[256];
+	gint shift, i;
+
+	keys = g_new (guint64, n_rows);
+	keys_tmp = g_new (guint64, n_rows);
+	rows_tmp = g_new (gint, n_rows);
+
+	/* Flip the sign bit, thus the unsigned order matches the signed. */
+	for (i = 0; i < n_rows; i++)
+		keys[i] = ((guint64) ints[rows[i]]) ^ G_GUINT64_CONSTANT (0x8000000000000000);
+
+	for (shift = 0; shift < 64; shift += 8) {
+		gint offset = 0;
+
+		memset (count, 0, sizeof (count));
+
+		for (i = 0; i < n_rows; i++)
+			count[(keys[i] >> shift) & 0xff]++;
+
+		if (n_rows == 0 || count[(keys[0] >> shift) & 0xff] == n_rows)
+			continue;
+
+		for (i = 0; i < 256; i++) {
+			gint tmp = count[i];
+
+			count[i] = offset;
+			offset += tmp;
+		}
+
+		for (i = 0; i < n_rows; i++) {
+			gint pos = count[(keys[i] >> shift) & 0xff]++;
+
+			keys_tmp[pos] = keys[i];
+			rows_tmp[pos] = rows[i];
+		}
+
+		keys_swap = keys;
+		keys = keys_tmp;
+		keys_tmp = keys_swap;
+
+		rows_swap = rows;
+		rows = rows_tmp;
+		rows_tmp = rows_swap;
+	}
+
+	if (rows != rows_orig) {
+		memcpy (rows_orig, rows, n_rows * sizeof (gint));
+		rows_tmp = rows;
+	}
+
+	g_free (keys);
+	g_free (keys_tmp);
+	g_free (rows_tmp);
+}
+
+static void
+table_sorter_extract_key (ETableSorter *table_sorter,
+                          SortKey *key,
+                          ETableCol *col,
+                          gint rows)
+{
+	const gchar *compare = col->spec->compare;
+	gint model_col = col->spec->model_col;
+	gint i;
+
+	key->col = col;
+
+	if (g_strcmp0 (compare, "integer") == 0 ||
+	    g_strcmp0 (compare, "pointer-integer64") == 0) {
+		key->type = SORT_KEY_INT64;
+		key->ints = g_new (gint64, rows);
+	} else if (g_strcmp0 (compare, "string") == 0 ||
+		   g_strcmp0 (compare, "stringcase") == 0 ||
+		   g_strcmp0 (compare, "collate") == 0) {
+		key->type = SORT_KEY_STRING;
+		key->strs = g_new (gchar *, rows);
+	} else {
+		key->type = SORT_KEY_GENERIC;
+		key->vals = g_new (gpointer, rows);
+	}
+
+	for (i = 0; i < rows; i++) {
+		gpointer value;
+
+		value = e_table_model_value_at (
+			table_sorter->source, model_col, i);
+
+		if (key->type == SORT_KEY_GENERIC) {
+			key->vals[i] = value;
+			continue;
+		}
+
+		if (g_strcmp0 (compare, "integer") == 0) {
+			key->ints[i] = GPOINTER_TO_INT (value);
+		} else if (g_strcmp0 (compare, "pointer-integer64") == 0) {
+			/* Unset values sort before set. */
+			key->ints[i] = value ? *((gint64 *) value) : G_MININT64;
+		} else if (value == NULL) {
+			key->strs[i] = NULL;
+		} else if (g_strcmp0 (compare, "collate") == 0) {
+			key->strs[i] = g_utf8_collate_key (value, -1);
+		} else if (g_strcmp0 (compare, "stringcase") == 0) {
+			gchar *tmp = g_utf8_casefold (value, -1);
+			key->strs[i] = g_utf8_collate_key (tmp, -1);
+			g_free (tmp);
+		} else {
+			key->strs[i] = g_strdup (value);
+		}
+
+		e_table_model_free_value (
+			table_sorter->source, model_col, value);
+	}
+}
+
+static void
+table_sorter_free_key (ETableSorter *table_sorter,
+                       SortKey *key,
+                       gint rows)
+{
+	gint i;
+
+	if (key->strs) {
+		for (i = 0; i < rows; i++)
+			g_free (key->strs[i]);
+		g_free (key->strs);
+	}
+
+	if (key->vals) {
+		for (i = 0; i < rows; i++)
+			e_table_model_free_value (
+				table_sorter->source,
+				key->col->spec->model_col,
+				key->vals[i]);
+		g_free (key->vals);
+	}
+
+	g_free (key->ints);
+}
+
+static void
+table_sorter_clear_sorted_by (ETableSorter *table_sorter)
+{
+	guint ii;
+
+	if (!table_sorter->sorted_by)
+		return;
+
+	for (ii = 0; ii < table_sorter->sorted_by->len; ii++) {
+		SortedBy *sorted_by;
+
+		sorted_by = &g_array_index (table_sorter->sorted_by, SortedBy, ii);
+		g_object_unref (sorted_by->spec);
+	}
+
+	g_array_free (table_sorter->sorted_by, TRUE);
+	table_sorter->sorted_by = NULL;
+}
+
 static void
 table_sorter_clean (ETableSorter *table_sorter)
 {
@@ -102,9 +439,43 @@ table_sorter_clean (ETableSorter *table_sorter)
 	g_free (table_sorter->backsorted);
 	table_sorter->backsorted = NULL;
 
+	table_sorter_clear_sorted_by (table_sorter);
+
 	table_sorter->needs_sorting = -1;
 }
 
+static ETableCol *
+table_sorter_get_nth_column (ETableSorter *table_sorter,
+                             gint n,
+                             GtkSortType *sort_type)
+{
+	ETableColumnSpecification *spec;
+	ETableCol *col;
+	gint group_cols;
+
+	group_cols = e_table_sort_info_grouping_get_count (table_sorter->sort_info);
+
+	if (n < group_cols)
+		spec = e_table_sort_info_grouping_get_nth (
+			table_sorter->sort_info,
+			n, sort_type);
+	else
+		spec = e_table_sort_info_sorting_get_nth (
+			table_sorter->sort_info,
+			n - group_cols, sort_type);
+
+	col = e_table_header_get_column_by_spec (
+		table_sorter->full_header, spec);
+	if (col == NULL) {
+		gint last = e_table_header_count (
+			table_sorter->full_header) - 1;
+		col = e_table_header_get_column (
+			table_sorter->full_header, last);
+	}
+
+	return col;
+}
+
 static void
 table_sorter_sort (ETableSorter *table_sorter)
 {
@@ -112,95 +483,134 @@ table_sorter_sort (ETableSorter *table_sorter)
 	gint i;
 	gint j;
 	gint cols;
-	gint group_cols;
-	struct qsort_data qd;
+	struct sort_data sd;
 
 	if (table_sorter->sorted)
 		return;
 
 	rows = e_table_model_row_count (table_sorter->source);
-	group_cols = e_table_sort_info_grouping_get_count (table_sorter->sort_info);
-	cols = e_table_sort_info_sorting_get_count (table_sorter->sort_info) + group_cols;
+	cols = e_table_sort_info_sorting_get_count (table_sorter->sort_info) +
+		e_table_sort_info_grouping_get_count (table_sorter->sort_info);
 
 	table_sorter->sorted = g_new (int, rows);
 	for (i = 0; i < rows; i++)
 		table_sorter->sorted[i] = i;
 
-	qd.cols = cols;
-	qd.table_sorter = table_sorter;
+	table_sorter_clear_sorted_by (table_sorter);
+	table_sorter->sorted_by = g_array_sized_new (FALSE, FALSE, sizeof (SortedBy), cols);
 
-	qd.vals = g_new (gpointer , rows * cols);
-	qd.ascending = g_new (int, cols);
-	qd.compare = g_new (GCompareDataFunc, cols);
-	qd.cmp_cache = e_table_sorting_utils_create_cmp_cache ();
+	sd.table_sorter = table_sorter;
+	sd.keys = g_new0 (SortKey, cols);
+	sd.n_keys = cols;
+	sd.cmp_cache = e_table_sorting_utils_create_cmp_cache ();
 
 	for (j = 0; j < cols; j++) {
-		ETableColumnSpecification *spec;
+		SortedBy sorted_by;
 		ETableCol *col;
 		GtkSortType sort_type;
 
-		if (j < group_cols)
-			spec = e_table_sort_info_grouping_get_nth (
-				table_sorter->sort_info,
-				j, &sort_type);
-		else
-			spec = e_table_sort_info_sorting_get_nth (
-				table_sorter->sort_info,
-				j - group_cols, &sort_type);
-
-		col = e_table_header_get_column_by_spec (
-			table_sorter->full_header, spec);
-		if (col == NULL) {
-			gint last = e_table_header_count (
-				table_sorter->full_header) - 1;
-			col = e_table_header_get_column (
-				table_sorter->full_header, last);
-		}
+		col = table_sorter_get_nth_column (table_sorter, j, &sort_type);
 
-		for (i = 0; i < rows; i++) {
-			qd.vals[i * cols + j] = e_table_model_value_at (
-				table_sorter->source,
-				col->spec->model_col, i);
+		table_sorter_extract_key (table_sorter, &sd.keys[j], col, rows);
+		sd.keys[j].ascending = (sort_type == GTK_SORT_ASCENDING);
+
+		sorted_by.spec = g_object_ref (col->spec);
+		sorted_by.sort_type = sort_type;
+		g_array_append_val (table_sorter->sorted_by, sorted_by);
+	}
+
+	if (cols == 1 && sd.keys[0].type == SORT_KEY_INT64) {
+		table_sorter_radix_sort (sd.keys[0].ints, table_sorter->sorted, rows);
+
+		/* Equal keys end up in the descending row order too,
+		 * the same as with table_sorter_compare_rows(). */
+		if (!sd.keys[0].ascending) {
+			for (i = 0; i < rows / 2; i++) {
+				gint tmp = table_sorter->sorted[i];
+
+				table_sorter->sorted[i] = table_sorter->sorted[rows - i - 1];
+				table_sorter->sorted[rows - i - 1] = tmp;
+			}
 		}
+	} else if (cols > 0) {
+		gint *tmp = g_new (gint, rows);
 
-		qd.compare[j] = col->compare;
-		qd.ascending[j] = (sort_type == GTK_SORT_ASCENDING);
+		if (table_sorter_can_sort_in_parallel (&sd, rows))
+			table_sorter_parallel_merge_sort (&sd, table_sorter->sorted, tmp, rows);
+		else
+			table_sorter_merge_sort (&sd, table_sorter->sorted, tmp, rows);
+
+		g_free (tmp);
 	}
 
-	g_qsort_with_data (table_sorter->sorted, rows, sizeof (gint), qsort_callback, &qd);
+	for (j = 0; j < cols; j++)
+		table_sorter_free_key (table_sorter, &sd.keys[j], rows);
+
+	g_free (sd.keys);
+	e_table_sorting_utils_free_cmp_cache (sd.cmp_cache);
+}
+
+/* Returns whether the sort info differs from the one the current sort
+ * was done with only by the direction of every single sort column, in
+ * which case the sorted array only needs to be reversed. */
+static gboolean
+table_sorter_only_direction_toggled (ETableSorter *table_sorter)
+{
+	gint j, cols;
+
+	if (!table_sorter->sorted || !table_sorter->sorted_by)
+		return FALSE;
+
+	cols = e_table_sort_info_sorting_get_count (table_sorter->sort_info) +
+		e_table_sort_info_grouping_get_count (table_sorter->sort_info);
+
+	if (cols == 0 || cols != table_sorter->sorted_by->len)
+		return FALSE;
 
 	for (j = 0; j < cols; j++) {
-		ETableColumnSpecification *spec;
+		SortedBy *sorted_by;
 		ETableCol *col;
 		GtkSortType sort_type;
 
-		if (j < group_cols)
-			spec = e_table_sort_info_grouping_get_nth (
-				table_sorter->sort_info,
-				j, &sort_type);
-		else
-			spec = e_table_sort_info_sorting_get_nth (
-				table_sorter->sort_info,
-				j - group_cols, &sort_type);
-
-		col = e_table_header_get_column_by_spec (
-			table_sorter->full_header, spec);
-		if (col == NULL) {
-			gint last = e_table_header_count (
-				table_sorter->full_header) - 1;
-			col = e_table_header_get_column (
-				table_sorter->full_header, last);
-		}
+		sorted_by = &g_array_index (table_sorter->sorted_by, SortedBy, j);
+		col = table_sorter_get_nth_column (table_sorter, j, &sort_type);
 
-		for (i = 0; i < rows; i++) {
-			e_table_model_free_value (table_sorter->source, col->spec->model_col, qd.vals[i * cols + j]);
-		}
+		if (col->spec != sorted_by->spec || sort_type == sorted_by->sort_type)
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+static void
+table_sorter_reverse (ETableSorter *table_sorter)
+{
+	gint i, rows;
+
+	rows = e_table_model_row_count (table_sorter->source);
+
+	for (i = 0; i < rows / 2; i++) {
+		gint tmp = table_sorter->sorted[i];
+
+		table_sorter->sorted[i] = table_sorter->sorted[rows - i - 1];
+		table_sorter->sorted[rows - i - 1] = tmp;
+	}
+
+	if (table_sorter->backsorted) {
+		for (i = 0; i < rows; i++)
+			table_sorter->backsorted[i] = rows - table_sorter->backsorted[i] - 1;
 	}
 
-	g_free (qd.vals);
-	g_free (qd.ascending);
-	g_free (qd.compare);
-	e_table_sorting_utils_free_cmp_cache (qd.cmp_cache);
+	for (i = 0; i < table_sorter->sorted_by->len; i++) {
+		SortedBy *sorted_by;
+
+		sorted_by = &g_array_index (table_sorter->sorted_by, SortedBy, i);
+
+		if (sorted_by->sort_type == GTK_SORT_ASCENDING)
+			sorted_by->sort_type = GTK_SORT_DESCENDING;
+		else
+			sorted_by->sort_type = GTK_SORT_ASCENDING;
+	}
 }
 
 static void
@@ -267,7 +677,11 @@ static void
 table_sorter_sort_info_changed_cb (ETableSortInfo *sort_info,
                                    ETableSorter *table_sorter)
 {
-	table_sorter_clean (table_sorter);
+	/* Toggling the sort direction does not need to sort again. */
+	if (table_sorter_only_direction_toggled (table_sorter))
+		table_sorter_reverse (table_sorter);
+	else
+		table_sorter_clean (table_sorter);
 }
 
 static void
@@ -66,6 +66,10 @@ struct _ETableSorter {
 	gint *sorted;
 	gint *backsorted;
 
+	/* Sort columns and their directions the 'sorted'
+	 * array corresponds to, as an array of SortedBy. */
+	GArray *sorted_by;
+
 	gulong table_model_changed_id;
 	gulong table_model_row_changed_id;
 	gulong table_model_cell_changed_id;
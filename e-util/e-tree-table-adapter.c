@@ -42,16 +42,28 @@
 
 #define d(x)
 
-#define INCREMENT_AMOUNT 100
-
+/* There is no flat row map; rows are located through the visible
+ * tree itself.  Every node keeps its children in display order with
+ * a Fenwick tree over their row counts, thus finding a row or a row
+ * of a node costs O(depth * log(siblings)) and expanding or inserting
+ * a node touches only its ancestors. */
 typedef struct {
 	ETreePath path;
 	guint32 num_visible_children;
-	guint32 index;
+
+	/* Position among the siblings, valid while
+	 * the parent's children index is valid. */
+	guint32 position;
+
+	/* Lazily built children index */
+	GNode **children;
+	guint32 *children_rows;
+	guint32 n_children;
 
 	guint expanded : 1;
 	guint expandable : 1;
 	guint expandable_set : 1;
+	guint children_index_valid : 1;
 } node_t;
 
 struct _ETreeTableAdapterPrivate {
@@ -68,16 +80,10 @@ struct _ETreeTableAdapterPrivate {
 
 	ETableHeader *header;
 
-	gint n_map;
-	gint n_vals_allocated;
-	node_t **map_table;
 	GHashTable *nodes;
 	GNode *root;
 
 	guint root_visible : 1;
-	guint remap_needed : 1;
-
-	gint last_access;
 
 	guint resort_idle_id;
 
@@ -102,6 +108,11 @@ static void	e_tree_table_adapter_table_model_init
 
 static guint signals[LAST_SIGNAL];
 
+/* The children index is built lazily by the row lookups, which are
+ * also called from worker threads, e.g. by the message list regen,
+ * thus every access to it is serialized. */
+G_LOCK_DEFINE_STATIC (children_index);
+
 G_DEFINE_TYPE_WITH_CODE (
 	ETreeTableAdapter,
 	e_tree_table_adapter,
@@ -125,53 +136,121 @@ lookup_gnode (ETreeTableAdapter *etta,
 }
 
 static void
-resize_map (ETreeTableAdapter *etta,
-            gint size)
+children_index_invalidate (GNode *gnode)
 {
-	if (size > etta->priv->n_vals_allocated) {
-		etta->priv->n_vals_allocated = MAX (etta->priv->n_vals_allocated + INCREMENT_AMOUNT, size);
-		etta->priv->map_table = g_renew (node_t *, etta->priv->map_table, etta->priv->n_vals_allocated);
+	G_LOCK (children_index);
+	((node_t *) gnode->data)->children_index_valid = FALSE;
+	G_UNLOCK (children_index);
+}
+
+/* The caller holds the children_index lock. */
+static void
+children_index_ensure (GNode *gnode)
+{
+	node_t *node = (node_t *) gnode->data;
+	GNode *child;
+	guint32 ii, n_children = 0;
+
+	if (node->children_index_valid)
+		return;
+
+	for (child = gnode->children; child; child = child->next)
+		n_children++;
+
+	node->children = g_renew (GNode *, node->children, n_children);
+	node->children_rows = g_renew (guint32, node->children_rows, n_children + 1);
+	node->n_children = n_children;
+
+	node->children_rows[0] = 0;
+	for (ii = 0, child = gnode->children; child; child = child->next, ii++) {
+		node_t *child_node = (node_t *) child->data;
+
+		child_node->position = ii;
+		node->children[ii] = child;
+		node->children_rows[ii + 1] = child_node->num_visible_children + 1;
 	}
 
-	etta->priv->n_map = size;
+	/* Build the Fenwick tree in place, in linear time. */
+	for (ii = 1; ii <= n_children; ii++) {
+		guint32 up = ii + (ii & -ii);
+
+		if (up <= n_children)
+			node->children_rows[up] += node->children_rows[ii];
+	}
+
+	node->children_index_valid = TRUE;
 }
 
+/* Adds delta to the row count of the child at position.
+ * The caller holds the children_index lock. */
 static void
-move_map_elements (ETreeTableAdapter *etta,
-                   gint to,
-                   gint from,
-                   gint count)
+children_index_add (node_t *node,
+                    guint32 position,
+                    gint delta)
 {
-	if (count <= 0 || from >= etta->priv->n_map)
+	guint32 ii;
+
+	if (!node->children_index_valid)
 		return;
-	memmove (etta->priv->map_table + to, etta->priv->map_table + from, count * sizeof (node_t *));
-	etta->priv->remap_needed = TRUE;
+
+	for (ii = position + 1; ii <= node->n_children; ii += ii & -ii)
+		node->children_rows[ii] += delta;
 }
 
-static gint
-fill_map (ETreeTableAdapter *etta,
-          gint index,
-          GNode *gnode)
+/* Returns the number of rows of the first count children.
+ * The caller holds the children_index lock. */
+static guint32
+children_index_sum (GNode *gnode,
+                    guint32 count)
 {
-	GNode *p;
+	node_t *node = (node_t *) gnode->data;
+	guint32 ii, sum = 0;
 
-	if ((gnode != etta->priv->root) || etta->priv->root_visible)
-		etta->priv->map_table[index++] = gnode->data;
+	children_index_ensure (gnode);
 
-	for (p = gnode->children; p; p = p->next)
-		index = fill_map (etta, index, p);
+	for (ii = count; ii > 0; ii -= ii & -ii)
+		sum += node->children_rows[ii];
 
-	etta->priv->remap_needed = TRUE;
-	return index;
+	return sum;
 }
 
-static void
-remap_indices (ETreeTableAdapter *etta)
+/* Returns the position of the child whose subtree contains the row
+ * at offset, relative to the first child, and makes offset relative
+ * to that child.  The caller holds the children_index lock. */
+static guint32
+children_index_find (GNode *gnode,
+                     guint32 *offset)
 {
-	gint i;
-	for (i = 0; i < etta->priv->n_map; i++)
-		etta->priv->map_table[i]->index = i;
-	etta->priv->remap_needed = FALSE;
+	node_t *node = (node_t *) gnode->data;
+	guint32 position = 0, step = 1;
+
+	children_index_ensure (gnode);
+
+	while (step * 2 <= node->n_children)
+		step *= 2;
+
+	for (; step > 0; step /= 2) {
+		if (position + step <= node->n_children &&
+		    node->children_rows[position + step] <= *offset) {
+			position += step;
+			*offset -= node->children_rows[position];
+		}
+	}
+
+	return position;
+}
+
+static gint
+get_row_count (ETreeTableAdapter *etta)
+{
+	node_t *root_node;
+
+	if (!etta->priv->root)
+		return 0;
+
+	root_node = (node_t *) etta->priv->root->data;
+
+	return root_node->num_visible_children + (etta->priv->root_visible ? 1 : 0);
 }
 
 static node_t *
@@ -238,6 +317,8 @@ resort_node (ETreeTableAdapter *etta,
 			resort_node (etta, curr, recurse);
 	}
 
+	children_index_invalidate (gnode);
+
 	g_free (paths);
 }
 
@@ -245,7 +326,9 @@ static void
 kill_gnode (GNode *node,
             ETreeTableAdapter *etta)
 {
-	g_hash_table_remove (etta->priv->nodes, ((node_t *) node->data)->path);
+	node_t *data = (node_t *) node->data;
+
+	g_hash_table_remove (etta->priv->nodes, data->path);
 
 	while (node->children) {
 		GNode *next = node->children->next;
@@ -253,7 +336,14 @@ kill_gnode (GNode *node,
 		node->children = next;
 	}
 
-	g_free (node->data);
+	if (node->parent)
+		children_index_invalidate (node->parent);
+
+	G_LOCK (children_index);
+	g_free (data->children);
+	g_free (data->children_rows);
+	G_UNLOCK (children_index);
+	g_free (data);
 	if (node == etta->priv->root)
 		etta->priv->root = NULL;
 	g_node_destroy (node);
@@ -263,11 +353,17 @@ static void
 update_child_counts (GNode *gnode,
                      gint delta)
 {
+	G_LOCK (children_index);
+
 	while (gnode) {
 		node_t *node = (node_t *) gnode->data;
 		node->num_visible_children += delta;
+		if (gnode->parent)
+			children_index_add (gnode->parent->data, node->position, delta);
 		gnode = gnode->parent;
 	}
+
+	G_UNLOCK (children_index);
 }
 
 static gint
@@ -310,9 +406,6 @@ delete_node (ETreeTableAdapter *etta,
 	to_remove += delete_children (etta, gnode);
 	kill_gnode (gnode, etta);
 
-	move_map_elements (etta, row, row + to_remove, etta->priv->n_map - row - to_remove);
-	resize_map (etta, etta->priv->n_map - to_remove);
-
 	if (parent_gnode != NULL) {
 		node_t *parent_node = parent_gnode->data;
 		gboolean expandable = e_tree_model_node_is_expandable (etta->priv->source_model, parent);
@@ -339,7 +432,6 @@ create_gnode (ETreeTableAdapter *etta,
 
 	node = g_new0 (node_t, 1);
 	node->path = path;
-	node->index = -1;
 	node->expanded = etta->priv->force_expanded_state == 0 ? e_tree_model_get_expanded_default (etta->priv->source_model) : etta->priv->force_expanded_state > 0;
 	node->expandable = e_tree_model_node_is_expandable (etta->priv->source_model, path);
 	node->expandable_set = 1;
@@ -369,6 +461,7 @@ insert_children (ETreeTableAdapter *etta,
 		count += node->num_visible_children + 1;
 	}
 	g_node_reverse_children (gnode);
+	children_index_invalidate (gnode);
 	return count;
 }
 
@@ -378,7 +471,6 @@ generate_tree (ETreeTableAdapter *etta,
 {
 	GNode *gnode;
 	node_t *node;
-	gint size;
 
 	e_table_model_pre_change (E_TABLE_MODEL (etta));
 
@@ -386,7 +478,6 @@ generate_tree (ETreeTableAdapter *etta,
 
 	if (etta->priv->root)
 		kill_gnode (etta->priv->root, etta);
-	resize_map (etta, 0);
 
 	gnode = create_gnode (etta, path);
 	node = (node_t *) gnode->data;
@@ -396,9 +487,6 @@ generate_tree (ETreeTableAdapter *etta,
 		resort_node (etta, gnode, TRUE);
 
 	etta->priv->root = gnode;
-	size = etta->priv->root_visible ? node->num_visible_children + 1 : node->num_visible_children;
-	resize_map (etta, size);
-	fill_map (etta, 0, gnode);
 	e_table_model_changed (E_TABLE_MODEL (etta));
 }
 
@@ -410,7 +498,6 @@ insert_node (ETreeTableAdapter *etta,
 	GNode *gnode, *parent_gnode;
 	node_t *node, *parent_node;
 	gboolean expandable;
-	gint size, row;
 
 	e_table_model_pre_change (E_TABLE_MODEL (etta));
 
@@ -438,7 +525,9 @@ insert_node (ETreeTableAdapter *etta,
 			e_table_model_pre_change (E_TABLE_MODEL (etta));
 			parent_node->expandable = expandable;
 			parent_node->expandable_set = 1;
-			e_table_model_row_changed (E_TABLE_MODEL (etta), parent_node->index);
+			e_table_model_row_changed (
+				E_TABLE_MODEL (etta),
+				e_tree_table_adapter_row_of_node (etta, parent));
 		}
 	}
 
@@ -454,24 +543,15 @@ insert_node (ETreeTableAdapter *etta,
 		node->num_visible_children = insert_children (etta, gnode);
 
 	g_node_append (parent_gnode, gnode);
+	children_index_invalidate (parent_gnode);
 	update_child_counts (parent_gnode, node->num_visible_children + 1);
 	resort_node (etta, parent_gnode, FALSE);
 	resort_node (etta, gnode, TRUE);
 
-	size = node->num_visible_children + 1;
-	resize_map (etta, etta->priv->n_map + size);
-	if (parent_gnode == etta->priv->root)
-		row = 0;
-	else {
-		gint new_size = parent_node->num_visible_children + 1;
-		gint old_size = new_size - size;
-		row = parent_node->index;
-		move_map_elements (etta, row + new_size, row + old_size, etta->priv->n_map - row - new_size);
-	}
-	fill_map (etta, row, parent_gnode);
 	e_table_model_rows_inserted (
 		E_TABLE_MODEL (etta),
-		e_tree_table_adapter_row_of_node (etta, path), size);
+		e_tree_table_adapter_row_of_node (etta, path),
+		node->num_visible_children + 1);
 }
 
 typedef struct {
@@ -541,7 +621,6 @@ tree_table_adapter_sort_info_changed_cb (ETableSortInfo *sort_info,
 
 	e_table_model_pre_change (E_TABLE_MODEL (etta));
 	resort_node (etta, etta->priv->root, TRUE);
-	fill_map (etta, 0, etta->priv->root);
 	e_table_model_changed (E_TABLE_MODEL (etta));
 }
 
@@ -800,8 +879,6 @@ tree_table_adapter_finalize (GObject *object)
 
 	g_hash_table_destroy (priv->nodes);
 
-	g_free (priv->map_table);
-
 	/* Chain up to parent's finalize() method. */
 	G_OBJECT_CLASS (e_tree_table_adapter_parent_class)->finalize (object);
 }
@@ -892,7 +969,7 @@ tree_table_adapter_row_count (ETableModel *etm)
 {
 	ETreeTableAdapter *etta = (ETreeTableAdapter *) etm;
 
-	return etta->priv->n_map;
+	return get_row_count (etta);
 }
 
 static gpointer
@@ -1081,7 +1158,6 @@ e_tree_table_adapter_init (ETreeTableAdapter *etta)
 	etta->priv->nodes = g_hash_table_new (NULL, NULL);
 
 	etta->priv->root_visible = TRUE;
-	etta->priv->remap_needed = TRUE;
 }
 
 ETableModel *
@@ -1160,7 +1236,6 @@ e_tree_table_adapter_set_sort_info (ETreeTableAdapter *etta,
 
 	e_table_model_pre_change (E_TABLE_MODEL (etta));
 	resort_node (etta, etta->priv->root, TRUE);
-	fill_map (etta, 0, etta->priv->root);
 	e_table_model_changed (E_TABLE_MODEL (etta));
 }
 
@@ -1376,8 +1451,6 @@ void
 e_tree_table_adapter_root_node_set_visible (ETreeTableAdapter *etta,
                                             gboolean visible)
 {
-	gint size;
-
 	g_return_if_fail (E_IS_TREE_TABLE_ADAPTER (etta));
 
 	if (etta->priv->root_visible == visible)
@@ -1391,10 +1464,6 @@ e_tree_table_adapter_root_node_set_visible (ETreeTableAdapter *etta,
 		if (root)
 			e_tree_table_adapter_node_set_expanded (etta, root, TRUE);
 	}
-	size = (visible ? 1 : 0) + (etta->priv->root ? ((node_t *) etta->priv->root->data)->num_visible_children : 0);
-	resize_map (etta, size);
-	if (etta->priv->root)
-		fill_map (etta, 0, etta->priv->root);
 	e_table_model_changed (E_TABLE_MODEL (etta));
 }
 
@@ -1442,9 +1511,6 @@ e_tree_table_adapter_node_set_expanded (ETreeTableAdapter *etta,
 		update_child_counts (gnode, num_children);
 		if (etta->priv->sort_info && e_table_sort_info_sorting_get_count (etta->priv->sort_info) > 0)
 			resort_node (etta, gnode, TRUE);
-		resize_map (etta, etta->priv->n_map + num_children);
-		move_map_elements (etta, row + 1 + num_children, row + 1, etta->priv->n_map - row - 1 - num_children);
-		fill_map (etta, row, gnode);
 		if (num_children != 0) {
 			e_table_model_rows_inserted (E_TABLE_MODEL (etta), row + 1, num_children);
 		} else
@@ -1455,9 +1521,7 @@ e_tree_table_adapter_node_set_expanded (ETreeTableAdapter *etta,
 			e_table_model_no_change (E_TABLE_MODEL (etta));
 			return;
 		}
-		move_map_elements (etta, row + 1, row + 1 + num_children, etta->priv->n_map - row - 1 - num_children);
 		update_child_counts (gnode, - num_children);
-		resize_map (etta, etta->priv->n_map - num_children);
 		e_table_model_rows_deleted (E_TABLE_MODEL (etta), row + 1, num_children);
 	}
 }
@@ -1484,32 +1548,86 @@ ETreePath
 e_tree_table_adapter_node_at_row (ETreeTableAdapter *etta,
                                   gint row)
 {
+	GNode *gnode;
+	ETreePath path = NULL;
+	guint32 offset;
+	gint n_rows;
+
 	g_return_val_if_fail (E_IS_TREE_TABLE_ADAPTER (etta), NULL);
 
-	if (row == -1 && etta->priv->n_map > 0)
-		row = etta->priv->n_map - 1;
-	else if (row < 0 || row >= etta->priv->n_map)
+	n_rows = get_row_count (etta);
+
+	if (row == -1 && n_rows > 0)
+		row = n_rows - 1;
+	else if (row < 0 || row >= n_rows)
 		return NULL;
 
-	return etta->priv->map_table[row]->path;
+	gnode = etta->priv->root;
+	offset = row;
+
+	if (etta->priv->root_visible) {
+		if (offset == 0)
+			return ((node_t *) gnode->data)->path;
+		offset--;
+	}
+
+	G_LOCK (children_index);
+
+	/* Descend, skipping the subtrees of preceding siblings. */
+	while (TRUE) {
+		node_t *node = (node_t *) gnode->data;
+		guint32 position;
+
+		position = children_index_find (gnode, &offset);
+		if (position >= node->n_children) {
+			g_warn_if_reached ();
+			break;
+		}
+
+		gnode = node->children[position];
+		if (offset == 0) {
+			path = ((node_t *) gnode->data)->path;
+			break;
+		}
+		offset--;
+	}
+
+	G_UNLOCK (children_index);
+
+	return path;
 }
 
 gint
 e_tree_table_adapter_row_of_node (ETreeTableAdapter *etta,
                                   ETreePath path)
 {
-	node_t *node;
+	GNode *gnode;
+	gint row;
 
 	g_return_val_if_fail (E_IS_TREE_TABLE_ADAPTER (etta), -1);
 
-	node = get_node (etta, path);
-	if (node == NULL)
+	gnode = lookup_gnode (etta, path);
+	if (gnode == NULL)
 		return -1;
 
-	if (etta->priv->remap_needed)
-		remap_indices (etta);
+	row = etta->priv->root_visible ? 0 : -1;
+
+	G_LOCK (children_index);
+
+	/* Each ancestor level adds the parent row and
+	 * the rows of the preceding siblings. */
+	for (; gnode->parent; gnode = gnode->parent) {
+		node_t *node = (node_t *) gnode->data;
+
+		/* Makes the position valid. */
+		children_index_ensure (gnode->parent);
+
+		row += 1 + children_index_sum (gnode->parent, node->position);
+	}
+
+	G_UNLOCK (children_index);
 
-	return node->index;
+	return row;
 }
 
 gboolean
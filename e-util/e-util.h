@@ -34,6 +34,7 @@
 #include <e-util/e-attachment-bar.h>
 #include <e-util/e-attachment-button.h>
 #include <e-util/e-attachment-dialog.h>
+#include <e-util/e-attachment-file-wrapper.h>
 #include <e-util/e-attachment-handler-image.h>
 #include <e-util/e-attachment-handler.h>
 #include <e-util/e-attachment-icon-view.h>
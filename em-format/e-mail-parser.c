@@ -720,7 +720,12 @@ e_mail_parser_wrap_as_attachment (EMailParser *parser,
 	/* Try to guess size of the attachments */
 	dw = camel_medium_get_content (CAMEL_MEDIUM (part));
 	ba = camel_data_wrapper_get_byte_array (dw);
-	if (ba) {
+	if (E_IS_ATTACHMENT_FILE_WRAPPER (dw)) {
+		/* A composed message; the content is read from the
+		 * attached file, its byte array is always empty. */
+		size = e_attachment_file_wrapper_get_size (
+			E_ATTACHMENT_FILE_WRAPPER (dw));
+	} else if (ba) {
 		size = ba->len;
 
 		if (camel_mime_part_get_encoding (part) == CAMEL_TRANSFER_ENCODING_BASE64)
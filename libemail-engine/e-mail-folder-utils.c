@@ -21,10 +21,13 @@
 
 #include "e-mail-folder-utils.h"
 
+#include <string.h>
+
 #include <glib/gi18n-lib.h>
 
 #include <libedataserver/libedataserver.h>
 
+#include <libemail-engine/e-mail-junk-filter.h>
 #include <libemail-engine/e-mail-session.h>
 #include <libemail-engine/mail-tools.h>
 
@@ -33,6 +36,10 @@
 /* X-Mailer header value */
 #define X_MAILER ("Evolution " VERSION SUB_VERSION " " VERSION_COMMENT)
 
+/* How many messages e_mail_folder_check_junk_sync()
+ * holds in memory and classifies at once. */
+#define CHECK_JUNK_BATCH_SIZE 64
+
 typedef struct _AsyncContext AsyncContext;
 
 struct _AsyncContext {
@@ -644,6 +651,199 @@ e_mail_folder_build_attachment_finish (CamelFolder *folder,
 	return g_object_ref (context->part);
 }
 
+static void
+mail_folder_check_junk_thread (GSimpleAsyncResult *simple,
+                               GObject *object,
+                               GCancellable *cancellable)
+{
+	AsyncContext *context;
+	GError *error = NULL;
+
+	context = g_simple_async_result_get_op_res_gpointer (simple);
+
+	e_mail_folder_check_junk_sync (
+		CAMEL_FOLDER (object), context->ptr_array,
+		cancellable, &error);
+
+	if (error != NULL)
+		g_simple_async_result_take_error (simple, error);
+}
+
+/* Helper for e_mail_folder_check_junk_sync() */
+static gboolean
+mail_folder_classify_messages (CamelFolder *folder,
+                               EMailJunkFilter *junk_filter,
+                               GPtrArray *uids,
+                               GPtrArray *messages,
+                               GCancellable *cancellable,
+                               GError **error)
+{
+	CamelJunkStatus *statuses;
+	gboolean success;
+	guint ii;
+
+	statuses = g_new0 (CamelJunkStatus, messages->len);
+
+	success = e_mail_junk_filter_classify_messages_sync (
+		junk_filter, messages, statuses, cancellable, error);
+
+	/* Same as the "Junk check" filter rule does. */
+	for (ii = 0; success && ii < uids->len; ii++) {
+		if (statuses[ii] == CAMEL_JUNK_STATUS_MESSAGE_IS_JUNK)
+			camel_folder_set_message_flags (
+				folder, uids->pdata[ii],
+				CAMEL_MESSAGE_JUNK,
+				CAMEL_MESSAGE_JUNK);
+	}
+
+	g_free (statuses);
+
+	g_ptr_array_set_size (uids, 0);
+	g_ptr_array_set_size (messages, 0);
+
+	return success;
+}
+
+gboolean
+e_mail_folder_check_junk_sync (CamelFolder *folder,
+                               GPtrArray *message_uids,
+                               GCancellable *cancellable,
+                               GError **error)
+{
+	CamelStore *parent_store;
+	CamelSession *session;
+	CamelJunkFilter *junk_filter = NULL;
+	GPtrArray *uids;
+	GPtrArray *messages;
+	gboolean success = TRUE;
+	guint ii;
+
+	g_return_val_if_fail (CAMEL_IS_FOLDER (folder), FALSE);
+	g_return_val_if_fail (message_uids != NULL, FALSE);
+
+	parent_store = camel_folder_get_parent_store (folder);
+	session = camel_service_ref_session (CAMEL_SERVICE (parent_store));
+
+	if (session != NULL) {
+		junk_filter = camel_session_get_junk_filter (session);
+		if (junk_filter != NULL)
+			g_object_ref (junk_filter);
+		g_object_unref (session);
+	}
+
+	/* Nothing to check with, like the junk test without a filter. */
+	if (!E_IS_MAIL_JUNK_FILTER (junk_filter)) {
+		g_clear_object (&junk_filter);
+		return TRUE;
+	}
+
+	uids = g_ptr_array_new ();
+	messages = g_ptr_array_new_with_free_func (g_object_unref);
+
+	camel_folder_freeze (folder);
+
+	camel_operation_push_message (cancellable, _("Checking for junk"));
+
+	for (ii = 0; success && ii < message_uids->len; ii++) {
+		CamelMimeMessage *message;
+		CamelMessageFlags flags;
+		const gchar *uid;
+		gint percent;
+
+		uid = g_ptr_array_index (message_uids, ii);
+
+		/* Skip messages whose junk status is known already. */
+		flags = camel_folder_get_message_flags (folder, uid);
+		if (flags & (CAMEL_MESSAGE_JUNK | CAMEL_MESSAGE_NOTJUNK))
+			continue;
+
+		message = camel_folder_get_message_sync (
+			folder, uid, cancellable, error);
+
+		if (message == NULL) {
+			success = FALSE;
+			break;
+		}
+
+		g_ptr_array_add (uids, (gpointer) uid);
+		g_ptr_array_add (messages, message);
+
+		if (messages->len == CHECK_JUNK_BATCH_SIZE)
+			success = mail_folder_classify_messages (
+				folder, E_MAIL_JUNK_FILTER (junk_filter),
+				uids, messages, cancellable, error);
+
+		percent = ((ii + 1) * 100) / message_uids->len;
+		camel_operation_progress (cancellable, percent);
+	}
+
+	if (success && messages->len > 0)
+		success = mail_folder_classify_messages (
+			folder, E_MAIL_JUNK_FILTER (junk_filter),
+			uids, messages, cancellable, error);
+
+	camel_operation_pop_message (cancellable);
+
+	camel_folder_thaw (folder);
+
+	g_ptr_array_unref (uids);
+	g_ptr_array_unref (messages);
+	g_object_unref (junk_filter);
+
+	return success;
+}
+
+void
+e_mail_folder_check_junk (CamelFolder *folder,
+                          GPtrArray *message_uids,
+                          gint io_priority,
+                          GCancellable *cancellable,
+                          GAsyncReadyCallback callback,
+                          gpointer user_data)
+{
+	GSimpleAsyncResult *simple;
+	AsyncContext *context;
+
+	g_return_if_fail (CAMEL_IS_FOLDER (folder));
+	g_return_if_fail (message_uids != NULL);
+
+	context = g_slice_new0 (AsyncContext);
+	context->ptr_array = g_ptr_array_ref (message_uids);
+
+	simple = g_simple_async_result_new (
+		G_OBJECT (folder), callback, user_data,
+		e_mail_folder_check_junk);
+
+	g_simple_async_result_set_check_cancellable (simple, cancellable);
+
+	g_simple_async_result_set_op_res_gpointer (
+		simple, context, (GDestroyNotify) async_context_free);
+
+	g_simple_async_result_run_in_thread (
+		simple, mail_folder_check_junk_thread,
+		io_priority, cancellable);
+
+	g_object_unref (simple);
+}
+
+gboolean
+e_mail_folder_check_junk_finish (CamelFolder *folder,
+                                 GAsyncResult *result,
+                                 GError **error)
+{
+	GSimpleAsyncResult *simple;
+
+	g_return_val_if_fail (
+		g_simple_async_result_is_valid (
+		result, G_OBJECT (folder),
+		e_mail_folder_check_junk), FALSE);
+
+	simple = G_SIMPLE_ASYNC_RESULT (result);
+
+	/* Assume success unless a GError is set. */
+	return !g_simple_async_result_propagate_error (simple, error);
+}
+
 static void
 mail_folder_find_duplicate_messages_thread (GSimpleAsyncResult *simple,
                                             GObject *object,
@@ -662,14 +862,176 @@ mail_folder_find_duplicate_messages_thread (GSimpleAsyncResult *simple,
 		g_simple_async_result_take_error (simple, error);
 }
 
+/* An output stream which only computes a checksum of the data written
+ * to it, thus the message content does not need to be held in memory. */
+
+typedef struct _EMFUChecksumStream EMFUChecksumStream;
+typedef struct _EMFUChecksumStreamClass EMFUChecksumStreamClass;
+
+struct _EMFUChecksumStream {
+	GOutputStream parent;
+	GChecksum *checksum;
+};
+
+struct _EMFUChecksumStreamClass {
+	GOutputStreamClass parent_class;
+};
+
+static GType emfu_checksum_stream_get_type (void);
+
+G_DEFINE_TYPE (
+	EMFUChecksumStream,
+	emfu_checksum_stream,
+	G_TYPE_OUTPUT_STREAM)
+
+static void
+emfu_checksum_stream_finalize (GObject *object)
+{
+	EMFUChecksumStream *stream = (EMFUChecksumStream *) object;
+
+	g_checksum_free (stream->checksum);
+
+	/* Chain up to parent's finalize() method. */
+	G_OBJECT_CLASS (emfu_checksum_stream_parent_class)->finalize (object);
+}
+
+static gssize
+emfu_checksum_stream_write (GOutputStream *output_stream,
+                            const void *buffer,
+                            gsize count,
+                            GCancellable *cancellable,
+                            GError **error)
+{
+	EMFUChecksumStream *stream = (EMFUChecksumStream *) output_stream;
+
+	if (g_cancellable_set_error_if_cancelled (cancellable, error))
+		return -1;
+
+	g_checksum_update (stream->checksum, buffer, count);
+
+	return count;
+}
+
+static void
+emfu_checksum_stream_class_init (EMFUChecksumStreamClass *class)
+{
+	GObjectClass *object_class;
+	GOutputStreamClass *output_stream_class;
+
+	object_class = G_OBJECT_CLASS (class);
+	object_class->finalize = emfu_checksum_stream_finalize;
+
+	output_stream_class = G_OUTPUT_STREAM_CLASS (class);
+	output_stream_class->write_fn = emfu_checksum_stream_write;
+}
+
+static void
+emfu_checksum_stream_init (EMFUChecksumStream *stream)
+{
+	stream->checksum = g_checksum_new (G_CHECKSUM_SHA256);
+}
+
+typedef struct _HashContext HashContext;
+
+struct _HashContext {
+	CamelFolder *folder;
+	GCancellable *cancellable;
+
+	GMutex lock;
+	GHashTable *hash_table;
+	gboolean failed;
+	GError *error;
+	guint n_done;
+	guint n_total;
+};
+
+static gchar *
+emfu_compute_message_digest (CamelMimeMessage *message,
+                             GCancellable *cancellable)
+{
+	CamelDataWrapper *content;
+	EMFUChecksumStream *stream;
+	gchar *digest = NULL;
+	gssize n_bytes;
+
+	/* Generate a digest string from the message's content. */
+	content = camel_medium_get_content (CAMEL_MEDIUM (message));
+
+	if (content == NULL)
+		return NULL;
+
+	stream = g_object_new (emfu_checksum_stream_get_type (), NULL);
+
+	n_bytes = camel_data_wrapper_decode_to_output_stream_sync (
+		content, G_OUTPUT_STREAM (stream), cancellable, NULL);
+
+	if (n_bytes >= 0)
+		digest = g_strdup (g_checksum_get_string (stream->checksum));
+
+	g_object_unref (stream);
+
+	return digest;
+}
+
+static void
+emfu_get_message_hash_thread (gpointer data,
+                              gpointer user_data)
+{
+	HashContext *context = user_data;
+	CamelMimeMessage *message;
+	const gchar *uid = data;
+	gchar *digest = NULL;
+	gboolean failed;
+	GError *local_error = NULL;
+
+	/* Do not bother with the rest once any message failed. */
+	g_mutex_lock (&context->lock);
+	failed = context->failed;
+	g_mutex_unlock (&context->lock);
+
+	if (failed)
+		return;
+
+	message = camel_folder_get_message_sync (
+		context->folder, uid, context->cancellable, &local_error);
+
+	if (CAMEL_IS_MIME_MESSAGE (message))
+		digest = emfu_compute_message_digest (
+			message, context->cancellable);
+
+	g_mutex_lock (&context->lock);
+
+	if (CAMEL_IS_MIME_MESSAGE (message)) {
+		g_hash_table_insert (
+			context->hash_table, g_strdup (uid), digest);
+	} else {
+		context->failed = TRUE;
+		if (context->error == NULL && local_error != NULL) {
+			context->error = local_error;
+			local_error = NULL;
+		}
+	}
+
+	context->n_done++;
+
+	camel_operation_progress (
+		context->cancellable,
+		(context->n_done * 100) / context->n_total);
+
+	g_mutex_unlock (&context->lock);
+
+	g_clear_error (&local_error);
+	g_clear_object (&message);
+}
+
 static GHashTable *
 emfu_get_messages_hash_sync (CamelFolder *folder,
                              GPtrArray *message_uids,
                              GCancellable *cancellable,
                              GError **error)
 {
-	GHashTable *hash_table;
-	CamelMimeMessage *message;
+	HashContext context;
+	GThreadPool *pool;
 	guint ii;
 
 	g_return_val_if_fail (CAMEL_IS_FOLDER (folder), NULL);
@@ -683,70 +1045,148 @@ emfu_get_messages_hash_sync (CamelFolder *folder,
 			message_uids->len),
 		message_uids->len);
 
-	hash_table = g_hash_table_new_full (
+	memset (&context, 0, sizeof (HashContext));
+	context.folder = folder;
+	context.cancellable = cancellable;
+	context.n_total = message_uids->len;
+	context.hash_table = g_hash_table_new_full (
 		(GHashFunc) g_str_hash,
 		(GEqualFunc) g_str_equal,
 		(GDestroyNotify) g_free,
 		(GDestroyNotify) g_free);
+	g_mutex_init (&context.lock);
+
+	/* Messages are retrieved and digested in parallel; the pool
+	 * is freed only after every pushed message was processed. */
+	if (message_uids->len > 0) {
+		pool = g_thread_pool_new (
+			emfu_get_message_hash_thread, &context,
+			MIN (g_get_num_processors (), message_uids->len),
+			FALSE, NULL);
+
+		for (ii = 0; ii < message_uids->len; ii++)
+			g_thread_pool_push (
+				pool, g_ptr_array_index (message_uids, ii), NULL);
+
+		g_thread_pool_free (pool, FALSE, TRUE);
+	}
+
+	g_mutex_clear (&context.lock);
 
 	/* This is an all or nothing operation.  Destroy the
 	 * hash table if we fail to retrieve any message. */
+	if (context.failed) {
+		g_hash_table_destroy (context.hash_table);
+		context.hash_table = NULL;
 
-	for (ii = 0; ii < message_uids->len; ii++) {
-		const gchar *uid;
-		gint percent;
+		if (context.error != NULL)
+			g_propagate_error (error, context.error);
+	}
 
-		uid = g_ptr_array_index (message_uids, ii);
-		percent = ((ii + 1) * 100) / message_uids->len;
+	camel_operation_pop_message (cancellable);
 
-		message = camel_folder_get_message_sync (
-			folder, uid, cancellable, error);
+	return context.hash_table;
+}
 
-		camel_operation_progress (cancellable, percent);
+typedef struct _CandidateKey {
+	guint64 message_id;
+	time_t date_sent;
+	gboolean skip;
+} CandidateKey;
 
-		if (CAMEL_IS_MIME_MESSAGE (message)) {
-			CamelDataWrapper *content;
-			gchar *digest = NULL;
+static guint
+emfu_candidate_key_hash (gconstpointer v)
+{
+	const CandidateKey *key = v;
 
-			/* Generate a digest string from the message's content. */
-			content = camel_medium_get_content (CAMEL_MEDIUM (message));
+	return g_int64_hash (&key->message_id) ^ (guint) key->date_sent;
+}
 
-			if (content != NULL) {
-				CamelStream *stream;
-				GByteArray *buffer;
-				gssize n_bytes;
+static gboolean
+emfu_candidate_key_equal (gconstpointer v1,
+                          gconstpointer v2)
+{
+	const CandidateKey *key1 = v1, *key2 = v2;
 
-				stream = camel_stream_mem_new ();
+	return key1->message_id == key2->message_id &&
+		key1->date_sent == key2->date_sent;
+}
 
-				n_bytes = camel_data_wrapper_decode_to_stream_sync (
-					content, stream, cancellable, error);
+/* Only a message sharing its Message-ID and date with another message
+ * can be its duplicate, which the folder summary tells without fetching
+ * anything.  Returns those UIDs, which are owned by @message_uids. */
+static GPtrArray *
+emfu_get_duplicate_candidates (CamelFolder *folder,
+                               GPtrArray *message_uids)
+{
+	GPtrArray *candidates;
+	GHashTable *group_sizes;
+	CandidateKey *keys;
+	guint ii;
 
-				if (n_bytes >= 0) {
-					/* The CamelStreamMem owns the buffer. */
-					buffer = camel_stream_mem_get_byte_array (
-						CAMEL_STREAM_MEM (stream));
-					g_return_val_if_fail (buffer != NULL, NULL);
+	keys = g_new0 (CandidateKey, message_uids->len);
 
-					digest = g_compute_checksum_for_data (
-						G_CHECKSUM_SHA256, buffer->data, buffer->len);
-				}
+	/* group_sizes = { CandidateKey : number of messages } */
+	group_sizes = g_hash_table_new (
+		emfu_candidate_key_hash, emfu_candidate_key_equal);
 
-				g_object_unref (stream);
-			}
+	for (ii = 0; ii < message_uids->len; ii++) {
+		const CamelSummaryMessageID *message_id;
+		CamelMessageInfo *info;
+		guint n_messages;
 
-			g_hash_table_insert (
-				hash_table, g_strdup (uid), digest);
-			g_object_unref (message);
-		} else {
-			g_hash_table_destroy (hash_table);
-			hash_table = NULL;
-			break;
+		info = camel_folder_get_message_info (
+			folder, g_ptr_array_index (message_uids, ii));
+
+		keys[ii].skip = TRUE;
+
+		if (info == NULL)
+			continue;
+
+		/* Messages marked for deletion are skipped later
+		 * anyway, thus they cannot make a group either. */
+		if (camel_message_info_flags (info) & CAMEL_MESSAGE_DELETED) {
+			camel_message_info_unref (info);
+			continue;
 		}
+
+		keys[ii].skip = FALSE;
+
+		message_id = camel_message_info_message_id (info);
+
+		keys[ii].message_id = message_id != NULL ? message_id->id.id : 0;
+		keys[ii].date_sent = camel_message_info_date_sent (info);
+
+		n_messages = GPOINTER_TO_UINT (
+			g_hash_table_lookup (group_sizes, &keys[ii]));
+		g_hash_table_insert (
+			group_sizes, &keys[ii],
+			GUINT_TO_POINTER (n_messages + 1));
+
+		camel_message_info_unref (info);
 	}
 
-	camel_operation_pop_message (cancellable);
+	candidates = g_ptr_array_sized_new (message_uids->len);
 
-	return hash_table;
+	for (ii = 0; ii < message_uids->len; ii++) {
+		guint n_messages;
+
+		if (keys[ii].skip)
+			continue;
+
+		n_messages = GPOINTER_TO_UINT (
+			g_hash_table_lookup (group_sizes, &keys[ii]));
+
+		if (n_messages > 1)
+			g_ptr_array_add (
+				candidates,
+				g_ptr_array_index (message_uids, ii));
+	}
+
+	g_hash_table_destroy (group_sizes);
+	g_free (keys);
+
+	return candidates;
 }
 
 GHashTable *
@@ -756,6 +1196,7 @@ e_mail_folder_find_duplicate_messages_sync (CamelFolder *folder,
                                             GError **error)
 {
 	GQueue trash = G_QUEUE_INIT;
+	GPtrArray *candidates;
 	GHashTable *hash_table;
 	GHashTable *unique_ids;
 	GHashTableIter iter;
@@ -764,9 +1205,13 @@ e_mail_folder_find_duplicate_messages_sync (CamelFolder *folder,
 	g_return_val_if_fail (CAMEL_IS_FOLDER (folder), NULL);
 	g_return_val_if_fail (message_uids != NULL, NULL);
 
+	candidates = emfu_get_duplicate_candidates (folder, message_uids);
+
 	/* hash_table = { MessageUID : digest-as-string } */
 	hash_table = emfu_get_messages_hash_sync (
-		folder, message_uids, cancellable, error);
+		folder, candidates, cancellable, error);
+
+	g_ptr_array_free (candidates, TRUE);
 
 	if (hash_table == NULL)
 		return NULL;
@@ -78,6 +78,20 @@ CamelMimePart *	e_mail_folder_build_attachment_finish
 						 gchar **fwd_subject,
 						 GError **error);
 
+gboolean	e_mail_folder_check_junk_sync	(CamelFolder *folder,
+						 GPtrArray *message_uids,
+						 GCancellable *cancellable,
+						 GError **error);
+void		e_mail_folder_check_junk	(CamelFolder *folder,
+						 GPtrArray *message_uids,
+						 gint io_priority,
+						 GCancellable *cancellable,
+						 GAsyncReadyCallback callback,
+						 gpointer user_data);
+gboolean	e_mail_folder_check_junk_finish	(CamelFolder *folder,
+						 GAsyncResult *result,
+						 GError **error);
+
 GHashTable *	e_mail_folder_find_duplicate_messages_sync
 						(CamelFolder *folder,
 						 GPtrArray *message_uids,
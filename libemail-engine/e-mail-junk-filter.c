@@ -19,23 +19,149 @@
 
 #include <libemail-engine/e-mail-session.h>
 
+#define E_MAIL_JUNK_FILTER_GET_PRIVATE(obj) \
+	(G_TYPE_INSTANCE_GET_PRIVATE \
+	((obj), E_TYPE_MAIL_JUNK_FILTER, EMailJunkFilterPrivate))
+
+/* How many learned messages are held back before they
+ * are passed to the junk filter without waiting for
+ * camel_junk_filter_synchronize(). */
+#define MAX_QUEUED_MESSAGES 256
+
+struct _EMailJunkFilterPrivate {
+	GMutex queue_lock;
+	GPtrArray *queued_junk;
+	GPtrArray *queued_not_junk;
+};
+
 G_DEFINE_ABSTRACT_TYPE (
 	EMailJunkFilter,
 	e_mail_junk_filter,
 	E_TYPE_EXTENSION)
 
+static gboolean
+mail_junk_filter_classify_messages (EMailJunkFilter *junk_filter,
+                                    GPtrArray *messages,
+                                    CamelJunkStatus *statuses,
+                                    GCancellable *cancellable,
+                                    GError **error)
+{
+	guint ii;
+
+	for (ii = 0; ii < messages->len; ii++) {
+		statuses[ii] = camel_junk_filter_classify (
+			CAMEL_JUNK_FILTER (junk_filter),
+			messages->pdata[ii], cancellable, error);
+
+		if (statuses[ii] == CAMEL_JUNK_STATUS_ERROR)
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+static gboolean
+mail_junk_filter_learn_messages (EMailJunkFilter *junk_filter,
+                                 GPtrArray *messages,
+                                 gboolean is_junk,
+                                 GCancellable *cancellable,
+                                 GError **error)
+{
+	guint ii;
+
+	for (ii = 0; ii < messages->len; ii++) {
+		gboolean success;
+
+		if (is_junk)
+			success = camel_junk_filter_learn_junk (
+				CAMEL_JUNK_FILTER (junk_filter),
+				messages->pdata[ii], cancellable, error);
+		else
+			success = camel_junk_filter_learn_not_junk (
+				CAMEL_JUNK_FILTER (junk_filter),
+				messages->pdata[ii], cancellable, error);
+
+		if (!success)
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+/* Passes the queued messages of one kind to the junk filter. */
+static gboolean
+mail_junk_filter_flush_queue (EMailJunkFilter *junk_filter,
+                              gboolean is_junk,
+                              GCancellable *cancellable,
+                              GError **error)
+{
+	GPtrArray *messages;
+	GPtrArray **queue;
+	gboolean success;
+
+	g_mutex_lock (&junk_filter->priv->queue_lock);
+
+	if (is_junk)
+		queue = &junk_filter->priv->queued_junk;
+	else
+		queue = &junk_filter->priv->queued_not_junk;
+
+	messages = *queue;
+	*queue = g_ptr_array_new_with_free_func (g_object_unref);
+
+	g_mutex_unlock (&junk_filter->priv->queue_lock);
+
+	success = e_mail_junk_filter_learn_messages_sync (
+		junk_filter, messages, is_junk, cancellable, error);
+
+	g_ptr_array_unref (messages);
+
+	return success;
+}
+
+static void
+mail_junk_filter_finalize (GObject *object)
+{
+	EMailJunkFilterPrivate *priv;
+
+	priv = E_MAIL_JUNK_FILTER_GET_PRIVATE (object);
+
+	g_mutex_clear (&priv->queue_lock);
+	g_ptr_array_unref (priv->queued_junk);
+	g_ptr_array_unref (priv->queued_not_junk);
+
+	/* Chain up to parent's finalize() method. */
+	G_OBJECT_CLASS (e_mail_junk_filter_parent_class)->finalize (object);
+}
+
 static void
 e_mail_junk_filter_class_init (EMailJunkFilterClass *class)
 {
+	GObjectClass *object_class;
 	EExtensionClass *extension_class;
 
+	g_type_class_add_private (class, sizeof (EMailJunkFilterPrivate));
+
+	object_class = G_OBJECT_CLASS (class);
+	object_class->finalize = mail_junk_filter_finalize;
+
 	extension_class = E_EXTENSION_CLASS (class);
 	extension_class->extensible_type = E_TYPE_MAIL_SESSION;
+
+	class->classify_messages = mail_junk_filter_classify_messages;
+	class->learn_messages = mail_junk_filter_learn_messages;
 }
 
 static void
 e_mail_junk_filter_init (EMailJunkFilter *junk_filter)
 {
+	junk_filter->priv = E_MAIL_JUNK_FILTER_GET_PRIVATE (junk_filter);
+
+	g_mutex_init (&junk_filter->priv->queue_lock);
+	junk_filter->priv->queued_junk =
+		g_ptr_array_new_with_free_func (g_object_unref);
+	junk_filter->priv->queued_not_junk =
+		g_ptr_array_new_with_free_func (g_object_unref);
 }
 
 gboolean
@@ -79,3 +205,171 @@ e_mail_junk_filter_compare (EMailJunkFilter *junk_filter_a,
 
 	return g_utf8_collate (class_a->display_name, class_b->display_name);
 }
+
+/**
+ * e_mail_junk_filter_classify_messages_sync:
+ * @junk_filter: an #EMailJunkFilter
+ * @messages: a #GPtrArray of #CamelMimeMessage
+ * @statuses: an array of @messages->len elements to store the results into
+ * @cancellable: optional #GCancellable object, or %NULL
+ * @error: return location for a #GError, or %NULL
+ *
+ * Classifies all @messages at once, which is cheaper than calling
+ * camel_junk_filter_classify() for each of them when the junk filter
+ * can process several messages in one go.  The status of the message
+ * at index i is stored at @statuses[i].
+ *
+ * Returns: %TRUE on success, %FALSE on error
+ *
+ * Since: 3.18
+ **/
+gboolean
+e_mail_junk_filter_classify_messages_sync (EMailJunkFilter *junk_filter,
+                                           GPtrArray *messages,
+                                           CamelJunkStatus *statuses,
+                                           GCancellable *cancellable,
+                                           GError **error)
+{
+	EMailJunkFilterClass *class;
+
+	g_return_val_if_fail (E_IS_MAIL_JUNK_FILTER (junk_filter), FALSE);
+	g_return_val_if_fail (CAMEL_IS_JUNK_FILTER (junk_filter), FALSE);
+	g_return_val_if_fail (messages != NULL, FALSE);
+	g_return_val_if_fail (statuses != NULL || messages->len == 0, FALSE);
+
+	if (messages->len == 0)
+		return TRUE;
+
+	class = E_MAIL_JUNK_FILTER_GET_CLASS (junk_filter);
+	g_return_val_if_fail (class->classify_messages != NULL, FALSE);
+
+	return class->classify_messages (
+		junk_filter, messages, statuses, cancellable, error);
+}
+
+/**
+ * e_mail_junk_filter_learn_messages_sync:
+ * @junk_filter: an #EMailJunkFilter
+ * @messages: a #GPtrArray of #CamelMimeMessage
+ * @is_junk: whether @messages are junk
+ * @cancellable: optional #GCancellable object, or %NULL
+ * @error: return location for a #GError, or %NULL
+ *
+ * Teaches the junk filter that all @messages are junk or not junk,
+ * according to @is_junk.  Like with camel_junk_filter_learn_junk(),
+ * camel_junk_filter_synchronize() should be called afterwards.
+ *
+ * Returns: %TRUE on success, %FALSE on error
+ *
+ * Since: 3.18
+ **/
+gboolean
+e_mail_junk_filter_learn_messages_sync (EMailJunkFilter *junk_filter,
+                                        GPtrArray *messages,
+                                        gboolean is_junk,
+                                        GCancellable *cancellable,
+                                        GError **error)
+{
+	EMailJunkFilterClass *class;
+
+	g_return_val_if_fail (E_IS_MAIL_JUNK_FILTER (junk_filter), FALSE);
+	g_return_val_if_fail (CAMEL_IS_JUNK_FILTER (junk_filter), FALSE);
+	g_return_val_if_fail (messages != NULL, FALSE);
+
+	if (messages->len == 0)
+		return TRUE;
+
+	class = E_MAIL_JUNK_FILTER_GET_CLASS (junk_filter);
+	g_return_val_if_fail (class->learn_messages != NULL, FALSE);
+
+	return class->learn_messages (
+		junk_filter, messages, is_junk, cancellable, error);
+}
+
+/**
+ * e_mail_junk_filter_queue_learn_sync:
+ * @junk_filter: an #EMailJunkFilter
+ * @message: a #CamelMimeMessage
+ * @is_junk: whether @message is junk
+ * @cancellable: optional #GCancellable object, or %NULL
+ * @error: return location for a #GError, or %NULL
+ *
+ * Queues @message to be learned as junk or not junk, according to
+ * @is_junk, together with the other queued messages.  Junk filters
+ * which implement the learn_messages() class method call this from
+ * their CamelJunkFilter learn_junk() and learn_not_junk() methods and
+ * call e_mail_junk_filter_flush_learn_sync() from synchronize(), thus
+ * one batch covers all the messages Camel learns one after another.
+ * Once too many messages are queued they are learned right away.
+ *
+ * Returns: %TRUE on success, %FALSE on error
+ *
+ * Since: 3.18
+ **/
+gboolean
+e_mail_junk_filter_queue_learn_sync (EMailJunkFilter *junk_filter,
+                                     CamelMimeMessage *message,
+                                     gboolean is_junk,
+                                     GCancellable *cancellable,
+                                     GError **error)
+{
+	EMailJunkFilterClass *class;
+	GPtrArray *queue;
+	gboolean flush;
+
+	g_return_val_if_fail (E_IS_MAIL_JUNK_FILTER (junk_filter), FALSE);
+	g_return_val_if_fail (CAMEL_IS_MIME_MESSAGE (message), FALSE);
+
+	/* The default learn_messages() calls the CamelJunkFilter
+	 * methods, which would queue the messages once again. */
+	class = E_MAIL_JUNK_FILTER_GET_CLASS (junk_filter);
+	g_return_val_if_fail (
+		class->learn_messages != mail_junk_filter_learn_messages,
+		FALSE);
+
+	g_mutex_lock (&junk_filter->priv->queue_lock);
+
+	if (is_junk)
+		queue = junk_filter->priv->queued_junk;
+	else
+		queue = junk_filter->priv->queued_not_junk;
+
+	g_ptr_array_add (queue, g_object_ref (message));
+	flush = (queue->len >= MAX_QUEUED_MESSAGES);
+
+	g_mutex_unlock (&junk_filter->priv->queue_lock);
+
+	if (!flush)
+		return TRUE;
+
+	return mail_junk_filter_flush_queue (
+		junk_filter, is_junk, cancellable, error);
+}
+
+/**
+ * e_mail_junk_filter_flush_learn_sync:
+ * @junk_filter: an #EMailJunkFilter
+ * @cancellable: optional #GCancellable object, or %NULL
+ * @error: return location for a #GError, or %NULL
+ *
+ * Learns all the messages queued by e_mail_junk_filter_queue_learn_sync(),
+ * the junk ones first.
+ *
+ * Returns: %TRUE on success, %FALSE on error
+ *
+ * Since: 3.18
+ **/
+gboolean
+e_mail_junk_filter_flush_learn_sync (EMailJunkFilter *junk_filter,
+                                     GCancellable *cancellable,
+                                     GError **error)
+{
+	g_return_val_if_fail (E_IS_MAIL_JUNK_FILTER (junk_filter), FALSE);
+
+	if (!mail_junk_filter_flush_queue (
+		junk_filter, TRUE, cancellable, error))
+		return FALSE;
+
+	return mail_junk_filter_flush_queue (
+		junk_filter, FALSE, cancellable, error);
+}
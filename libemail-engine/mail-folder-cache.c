@@ -129,6 +129,13 @@ struct _FolderInfo {
 
 	GWeakRef folder;
 	gulong folder_changed_handler_id;
+
+	/* Guarded by the activity_lock, because update_1folder()
+	 * can be called with the lock being held */
+	GMutex activity_lock;
+	gint unread; /* -1 when not known yet */
+	gint unread_delta;
+	gint64 last_activity; /* real time of the last change */
 };
 
 struct _AsyncContext {
@@ -193,8 +200,10 @@ folder_info_new (CamelStore *store,
 	folder_info->store = g_object_ref (store);
 	folder_info->full_name = g_strdup (full_name);
 	folder_info->flags = flags;
+	folder_info->unread = -1;
 
 	g_mutex_init (&folder_info->lock);
+	g_mutex_init (&folder_info->activity_lock);
 
 	return folder_info;
 }
@@ -248,6 +257,7 @@ folder_info_unref (FolderInfo *folder_info)
 		g_free (folder_info->full_name);
 
 		g_mutex_clear (&folder_info->lock);
+		g_mutex_clear (&folder_info->activity_lock);
 
 		g_slice_free (FolderInfo, folder_info);
 	}
@@ -843,6 +853,14 @@ update_1folder (MailFolderCache *cache,
 	if (unread >= 0) {
 		UpdateClosure *up;
 
+		g_mutex_lock (&folder_info->activity_lock);
+		if (folder_info->unread >= 0 && folder_info->unread != unread)
+			folder_info->unread_delta = unread - folder_info->unread;
+		if (new_messages > 0 || (folder_info->unread >= 0 && folder_info->unread != unread))
+			folder_info->last_activity = g_get_real_time ();
+		folder_info->unread = unread;
+		g_mutex_unlock (&folder_info->activity_lock);
+
 		up = update_closure_new (cache, folder_info->store);
 		up->full_name = g_strdup (folder_info->full_name);
 		up->unread = unread;
@@ -2213,6 +2231,53 @@ mail_folder_cache_get_folder_info_flags (MailFolderCache *cache,
 	return flags_set;
 }
 
+/**
+ * mail_folder_cache_get_folder_activity:
+ * @cache: a #MailFolderCache
+ * @store: a #CamelStore
+ * @folder_name: a folder name
+ * @out_last_activity: (out) (allow-none): return location for the last activity
+ * @out_unread_delta: (out) (allow-none): return location for the unread delta
+ *
+ * Gets when the unread count of the folder last changed, or new messages
+ * were noticed in it, as a real time in microseconds (or 0 when not seen
+ * yet), and by how much its unread count changed that time.
+ *
+ * Returns: whether the folder is known to @cache
+ **/
+gboolean
+mail_folder_cache_get_folder_activity (MailFolderCache *cache,
+                                       CamelStore *store,
+                                       const gchar *folder_name,
+                                       gint64 *out_last_activity,
+                                       gint *out_unread_delta)
+{
+	FolderInfo *folder_info;
+
+	g_return_val_if_fail (MAIL_IS_FOLDER_CACHE (cache), FALSE);
+	g_return_val_if_fail (CAMEL_IS_STORE (store), FALSE);
+	g_return_val_if_fail (folder_name != NULL, FALSE);
+
+	folder_info = mail_folder_cache_ref_folder_info (
+		cache, store, folder_name);
+	if (folder_info == NULL)
+		return FALSE;
+
+	g_mutex_lock (&folder_info->activity_lock);
+
+	if (out_last_activity != NULL)
+		*out_last_activity = folder_info->last_activity;
+
+	if (out_unread_delta != NULL)
+		*out_unread_delta = folder_info->unread_delta;
+
+	g_mutex_unlock (&folder_info->activity_lock);
+
+	folder_info_unref (folder_info);
+
+	return TRUE;
+}
+
 void
 mail_folder_cache_get_local_folder_uris (MailFolderCache *cache,
                                          GQueue *out_queue)
@@ -126,6 +126,12 @@ gboolean	mail_folder_cache_get_folder_info_flags
 						 CamelStore *store,
 						 const gchar *folder_name,
 						 CamelFolderInfoFlags *flags);
+gboolean	mail_folder_cache_get_folder_activity
+						(MailFolderCache *cache,
+						 CamelStore *store,
+						 const gchar *folder_name,
+						 gint64 *out_last_activity,
+						 gint *out_unread_delta);
 void		mail_folder_cache_get_local_folder_uris
 						(MailFolderCache *cache,
 						 GQueue *out_queue);
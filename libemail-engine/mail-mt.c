@@ -76,11 +76,14 @@ mail_msg_get_alert_sink ()
 	return NULL;
 }
 
+static void mail_msg_sched_drop (guint msgid);
+
 static void
 mail_msg_cancelled (CamelOperation *operation,
                     gpointer user_data)
 {
 	mail_msg_cancel (GPOINTER_TO_UINT (user_data));
+	mail_msg_sched_drop (GPOINTER_TO_UINT (user_data));
 }
 
 static gboolean
@@ -311,6 +314,20 @@ static GAsyncQueue *main_loop_queue = NULL;
 static GAsyncQueue *msg_reply_queue = NULL;
 static GThread *main_thread = NULL;
 
+static gboolean mail_msg_idle_cb (void);
+
+static void
+mail_msg_schedule_idle (void)
+{
+	G_LOCK (idle_source_id);
+	if (idle_source_id == 0)
+		/* Prioritize ahead of GTK+ redraws. */
+		idle_source_id = g_idle_add_full (
+			G_PRIORITY_HIGH_IDLE,
+			(GSourceFunc) mail_msg_idle_cb, NULL, NULL);
+	G_UNLOCK (idle_source_id);
+}
+
 static gboolean
 mail_msg_idle_cb (void)
 {
@@ -377,13 +394,251 @@ mail_msg_proxy (MailMsg *msg)
 
 	g_async_queue_push (msg_reply_queue, msg);
 
-	G_LOCK (idle_source_id);
-	if (idle_source_id == 0)
-		/* Prioritize ahead of GTK+ redraws. */
-		idle_source_id = g_idle_add_full (
-			G_PRIORITY_HIGH_IDLE,
-			(GSourceFunc) mail_msg_idle_cb, NULL, NULL);
-	G_UNLOCK (idle_source_id);
+	mail_msg_schedule_idle ();
+}
+
+/* Messages pushed to the worker threads wait here, not in thread
+ * pools, thus the messages of all the queues compete by priority and
+ * the accounts take turns.  The ordered queues still run one message
+ * at a time, in the order they were pushed, within a priority. */
+
+typedef enum {
+	SCHED_QUEUE_UNORDERED,
+	SCHED_QUEUE_FAST_ORDERED,
+	SCHED_QUEUE_SLOW_ORDERED,
+	SCHED_N_QUEUES
+} SchedQueue;
+
+static const guint sched_queue_max_running[SCHED_N_QUEUES] = { 10, 1, 1 };
+
+/* Background messages leave the rest of the threads for others. */
+#define SCHED_MAX_BACKGROUND_RUNNING 4
+
+#define SCHED_IS_BACKGROUND(msg) \
+	((msg)->priority <= MAIL_MSG_PRIORITY_BACKGROUND)
+
+typedef struct _SchedItem {
+	MailMsg *msg;
+	SchedQueue queue;
+	gint64 queued_time;
+} SchedItem;
+
+typedef struct _SchedService {
+	guint n_running;
+	guint64 last_started;
+} SchedService;
+
+/* All guarded by sched_lock. */
+static GMutex sched_lock;
+static GQueue sched_queued = G_QUEUE_INIT;	/* SchedItem, as pushed */
+static guint sched_running[SCHED_N_QUEUES];
+static GHashTable *sched_services;	/* service ~> SchedService */
+static GThreadPool *sched_pool;
+static MailMsgQueueStats sched_stats;
+
+static SchedService *
+mail_msg_sched_get_service (gpointer service)
+{
+	SchedService *sched_service;
+
+	sched_service = g_hash_table_lookup (sched_services, service);
+
+	if (sched_service == NULL) {
+		sched_service = g_new0 (SchedService, 1);
+		g_hash_table_insert (sched_services, service, sched_service);
+	}
+
+	return sched_service;
+}
+
+/* Whether item1 should run before item2. */
+static gboolean
+mail_msg_sched_before (SchedItem *item1,
+                       SchedItem *item2)
+{
+	SchedService *service1, *service2;
+
+	if (item1->msg->priority != item2->msg->priority)
+		return item1->msg->priority > item2->msg->priority;
+
+	service1 = mail_msg_sched_get_service (item1->msg->service);
+	service2 = mail_msg_sched_get_service (item2->msg->service);
+
+	if (service1->n_running != service2->n_running)
+		return service1->n_running < service2->n_running;
+
+	return service1->last_started < service2->last_started;
+}
+
+static GList *
+mail_msg_sched_pick_locked (void)
+{
+	SchedItem *queue_head[SCHED_N_QUEUES] = { NULL };
+	GList *link, *best = NULL;
+
+	/* An ordered queue can only start its first message. */
+	for (link = g_queue_peek_head_link (&sched_queued); link; link = g_list_next (link)) {
+		SchedItem *item = link->data;
+
+		if (item->queue == SCHED_QUEUE_UNORDERED)
+			continue;
+
+		if (queue_head[item->queue] == NULL ||
+		    item->msg->priority > queue_head[item->queue]->msg->priority)
+			queue_head[item->queue] = item;
+	}
+
+	for (link = g_queue_peek_head_link (&sched_queued); link; link = g_list_next (link)) {
+		SchedItem *item = link->data;
+
+		if (sched_running[item->queue] >= sched_queue_max_running[item->queue])
+			continue;
+
+		if (item->queue != SCHED_QUEUE_UNORDERED &&
+		    item != queue_head[item->queue])
+			continue;
+
+		if (SCHED_IS_BACKGROUND (item->msg) &&
+		    sched_stats.n_running_background >= SCHED_MAX_BACKGROUND_RUNNING)
+			continue;
+
+		if (best == NULL || mail_msg_sched_before (item, best->data))
+			best = link;
+	}
+
+	return best;
+}
+
+static void
+mail_msg_sched_dispatch_locked (void)
+{
+	GList *link;
+
+	while ((link = mail_msg_sched_pick_locked ()) != NULL) {
+		SchedItem *item = link->data;
+		SchedService *service;
+		gint64 wait_time;
+
+		g_queue_delete_link (&sched_queued, link);
+
+		sched_running[item->queue]++;
+
+		service = mail_msg_sched_get_service (item->msg->service);
+		service->n_running++;
+		service->last_started = ++sched_stats.n_started;
+
+		wait_time = g_get_monotonic_time () - item->queued_time;
+		sched_stats.total_wait_time += wait_time;
+		sched_stats.max_wait_time = MAX (sched_stats.max_wait_time, wait_time);
+
+		sched_stats.n_queued--;
+		sched_stats.n_running++;
+		if (SCHED_IS_BACKGROUND (item->msg)) {
+			sched_stats.n_queued_background--;
+			sched_stats.n_running_background++;
+		}
+
+		d (printf ("Starting message %p after %" G_GINT64_FORMAT " us\n", item->msg, wait_time));
+
+		g_thread_pool_push (sched_pool, item, NULL);
+	}
+}
+
+static void
+mail_msg_sched_run (SchedItem *item,
+                    gpointer user_data)
+{
+	SchedService *service;
+	gpointer msg_service = item->msg->service;
+	gboolean background = SCHED_IS_BACKGROUND (item->msg);
+
+	/* The message can be freed once it is proxied. */
+	mail_msg_proxy (item->msg);
+
+	g_mutex_lock (&sched_lock);
+
+	sched_running[item->queue]--;
+
+	service = mail_msg_sched_get_service (msg_service);
+	service->n_running--;
+
+	sched_stats.n_running--;
+	if (background)
+		sched_stats.n_running_background--;
+
+	mail_msg_sched_dispatch_locked ();
+
+	g_mutex_unlock (&sched_lock);
+
+	g_slice_free (SchedItem, item);
+}
+
+static void
+mail_msg_sched_push (MailMsg *msg,
+                     SchedQueue queue)
+{
+	SchedItem *item;
+
+	item = g_slice_new (SchedItem);
+	item->msg = msg;
+	item->queue = queue;
+	item->queued_time = g_get_monotonic_time ();
+
+	g_mutex_lock (&sched_lock);
+
+	g_queue_push_tail (&sched_queued, item);
+
+	sched_stats.n_queued++;
+	if (SCHED_IS_BACKGROUND (msg))
+		sched_stats.n_queued_background++;
+
+	mail_msg_sched_dispatch_locked ();
+
+	g_mutex_unlock (&sched_lock);
+}
+
+/* Completes a message cancelled before it started, without running it. */
+static void
+mail_msg_sched_drop (guint msgid)
+{
+	SchedItem *item = NULL;
+	GList *link;
+
+	g_mutex_lock (&sched_lock);
+
+	for (link = g_queue_peek_head_link (&sched_queued); link; link = g_list_next (link)) {
+		SchedItem *candidate = link->data;
+
+		if (candidate->msg->seq == msgid) {
+			item = candidate;
+			g_queue_delete_link (&sched_queued, link);
+
+			sched_stats.n_queued--;
+			sched_stats.n_dropped++;
+			if (SCHED_IS_BACKGROUND (item->msg))
+				sched_stats.n_queued_background--;
+			break;
+		}
+	}
+
+	/* An ordered queue may have been waiting for it. */
+	if (item != NULL)
+		mail_msg_sched_dispatch_locked ();
+
+	g_mutex_unlock (&sched_lock);
+
+	if (item == NULL)
+		return;
+
+	if (item->msg->error == NULL)
+		g_cancellable_set_error_if_cancelled (
+			item->msg->cancellable, &item->msg->error);
+
+	g_async_queue_push (msg_reply_queue, item->msg);
+
+	mail_msg_schedule_idle ();
+
+	g_slice_free (SchedItem, item);
 }
 
 void
@@ -397,6 +652,20 @@ mail_msg_init (void)
 
 	mail_msg_active_table = g_hash_table_new (NULL, NULL);
 	main_thread = g_thread_self ();
+
+	sched_services = g_hash_table_new_full (
+		(GHashFunc) g_direct_hash,
+		(GEqualFunc) g_direct_equal,
+		(GDestroyNotify) NULL,
+		(GDestroyNotify) g_free);
+
+	/* once created, run forever */
+	sched_pool = g_thread_pool_new (
+		(GFunc) mail_msg_sched_run, NULL,
+		sched_queue_max_running[SCHED_QUEUE_UNORDERED] +
+		sched_queue_max_running[SCHED_QUEUE_FAST_ORDERED] +
+		sched_queue_max_running[SCHED_QUEUE_SLOW_ORDERED],
+		FALSE, NULL);
 }
 
 static gint
@@ -412,21 +681,6 @@ mail_msg_compare (const MailMsg *msg1,
 	return (priority1 < priority2) ? 1 : -1;
 }
 
-static gpointer
-create_thread_pool (gpointer data)
-{
-	GThreadPool *thread_pool;
-	gint max_threads = GPOINTER_TO_INT (data);
-
-	/* once created, run forever */
-	thread_pool = g_thread_pool_new (
-		(GFunc) mail_msg_proxy, NULL, max_threads, FALSE, NULL);
-	g_thread_pool_set_sort_function (
-		thread_pool, (GCompareDataFunc) mail_msg_compare, NULL);
-
-	return thread_pool;
-}
-
 void
 mail_msg_main_loop_push (gpointer msg)
 {
@@ -434,43 +688,54 @@ mail_msg_main_loop_push (gpointer msg)
 		main_loop_queue, msg,
 		(GCompareDataFunc) mail_msg_compare, NULL);
 
-	G_LOCK (idle_source_id);
-	if (idle_source_id == 0)
-		/* Prioritize ahead of GTK+ redraws. */
-		idle_source_id = g_idle_add_full (
-			G_PRIORITY_HIGH_IDLE,
-			(GSourceFunc) mail_msg_idle_cb, NULL, NULL);
-	G_UNLOCK (idle_source_id);
+	mail_msg_schedule_idle ();
 }
 
 void
 mail_msg_unordered_push (gpointer msg)
 {
-	static GOnce once = G_ONCE_INIT;
-
-	g_once (&once, (GThreadFunc) create_thread_pool, GINT_TO_POINTER (10));
-
-	g_thread_pool_push ((GThreadPool *) once.retval, msg, NULL);
+	mail_msg_sched_push (msg, SCHED_QUEUE_UNORDERED);
 }
 
 void
 mail_msg_fast_ordered_push (gpointer msg)
 {
-	static GOnce once = G_ONCE_INIT;
-
-	g_once (&once, (GThreadFunc) create_thread_pool, GINT_TO_POINTER (1));
-
-	g_thread_pool_push ((GThreadPool *) once.retval, msg, NULL);
+	mail_msg_sched_push (msg, SCHED_QUEUE_FAST_ORDERED);
 }
 
 void
 mail_msg_slow_ordered_push (gpointer msg)
 {
-	static GOnce once = G_ONCE_INIT;
+	mail_msg_sched_push (msg, SCHED_QUEUE_SLOW_ORDERED);
+}
+
+/**
+ * mail_msg_get_queue_stats:
+ * @stats: a #MailMsgQueueStats to fill
+ *
+ * Fills @stats with the current state of the messages waiting for
+ * or running in the worker threads, and with the totals since
+ * mail_msg_init().  Messages for the main loop are not included.
+ **/
+void
+mail_msg_get_queue_stats (MailMsgQueueStats *stats)
+{
+	SchedItem *oldest;
+
+	g_return_if_fail (stats != NULL);
+
+	g_mutex_lock (&sched_lock);
+
+	*stats = sched_stats;
 
-	g_once (&once, (GThreadFunc) create_thread_pool, GINT_TO_POINTER (1));
+	oldest = g_queue_peek_head (&sched_queued);
+	if (oldest != NULL)
+		stats->oldest_wait_time =
+			g_get_monotonic_time () - oldest->queued_time;
+	else
+		stats->oldest_wait_time = 0;
 
-	g_thread_pool_push ((GThreadPool *) once.retval, msg, NULL);
+	g_mutex_unlock (&sched_lock);
 }
 
 gboolean
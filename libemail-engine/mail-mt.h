@@ -52,6 +52,15 @@ typedef void    (*MailMsgAlertErrorFunc)	(GCancellable *cancellable,
 typedef EAlertSink *
 		(*MailMsgGetAlertSinkFunc)	(void);
 
+/* Values of MailMsg.priority; higher ones run first.  Background
+ * messages never occupy all the worker threads, thus the interactive
+ * ones do not wait for a long synchronization to finish. */
+enum {
+	MAIL_MSG_PRIORITY_BACKGROUND = -10,
+	MAIL_MSG_PRIORITY_DEFAULT = 0,
+	MAIL_MSG_PRIORITY_INTERACTIVE = 10
+};
+
 struct _MailMsg {
 	MailMsgInfo *info;
 	volatile gint ref_count;
@@ -59,8 +68,22 @@ struct _MailMsg {
 	gint priority;			/* priority (default = 0) */
 	GCancellable *cancellable;
 	GError *error;			/* up to the caller to use this */
+	gpointer service;		/* account to take turns with, or NULL;
+					 * only compared, not referenced */
 };
 
+typedef struct _MailMsgQueueStats {
+	guint n_queued;
+	guint n_queued_background;
+	guint n_running;
+	guint n_running_background;
+	guint n_dropped;		/* cancelled before they ran */
+	guint64 n_started;
+	gint64 total_wait_time;		/* in microseconds, of the started */
+	gint64 max_wait_time;
+	gint64 oldest_wait_time;	/* of the longest queued one */
+} MailMsgQueueStats;
+
 struct _MailMsgInfo {
 	gsize size;
 	MailMsgDescFunc desc;
@@ -98,6 +121,8 @@ void mail_msg_unordered_push (gpointer msg);
 void mail_msg_fast_ordered_push (gpointer msg);
 void mail_msg_slow_ordered_push (gpointer msg);
 
+void mail_msg_get_queue_stats (MailMsgQueueStats *stats);
+
 /* Call a function in the GUI thread, wait for it to return, type is
  * the marshaller to use.  FIXME This thing is horrible, please put
  * it out of its misery. */
@@ -200,6 +200,8 @@ mail_filter_folder (EMailSession *session,
 	struct _filter_mail_msg *m;
 
 	m = mail_msg_new (&em_filter_folder_element_info);
+	m->base.priority = MAIL_MSG_PRIORITY_BACKGROUND;
+	m->base.service = camel_folder_get_parent_store (source_folder);
 	m->session = g_object_ref (session);
 	m->source_folder = g_object_ref (source_folder);
 	m->source_uids = g_ptr_array_ref (uids);
@@ -508,6 +510,8 @@ mail_fetch_mail (CamelStore *store,
 
 	m = mail_msg_new (&fetch_mail_info);
 	fm = (struct _filter_mail_msg *) m;
+	fm->base.priority = MAIL_MSG_PRIORITY_BACKGROUND;
+	fm->base.service = store;
 	fm->session = g_object_ref (session);
 	m->store = g_object_ref (store);
 	fm->cache = NULL;
@@ -1378,6 +1382,8 @@ mail_sync_folder (CamelFolder *folder,
 	struct _sync_folder_msg *m;
 
 	m = mail_msg_new (&sync_folder_info);
+	m->base.priority = MAIL_MSG_PRIORITY_BACKGROUND;
+	m->base.service = camel_folder_get_parent_store (folder);
 	m->folder = g_object_ref (folder);
 	m->test_for_expunge = test_for_expunge;
 	m->data = data;
@@ -1459,6 +1465,8 @@ mail_sync_store (CamelStore *store,
 	struct _sync_store_msg *m;
 
 	m = mail_msg_new (&sync_store_info);
+	m->base.priority = MAIL_MSG_PRIORITY_BACKGROUND;
+	m->base.service = store;
 	m->store = g_object_ref (store);
 	m->expunge = expunge;
 	m->data = data;
@@ -1538,6 +1546,7 @@ mail_empty_trash (CamelStore *store)
 	g_return_if_fail (CAMEL_IS_STORE (store));
 
 	m = mail_msg_new (&empty_trash_info);
+	m->base.service = store;
 	m->store = g_object_ref (store);
 
 	mail_msg_slow_ordered_push (m);
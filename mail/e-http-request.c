@@ -42,13 +42,210 @@
 	(G_TYPE_INSTANCE_GET_PRIVATE \
 	((obj), E_TYPE_HTTP_REQUEST, EHTTPRequestPrivate))
 
+/* Connections to one host kept for reuse and used at once. */
+#define MAX_CONNS_PER_HOST 6
+
+/* Content types of cached resources remembered at most. */
+#define MAX_CONTENT_TYPES 512
+
 struct _EHTTPRequestPrivate {
 	gchar *content_type;
 	gint content_length;
 };
 
+/* A download other requests for the same URI wait for.  It has its
+ * own cancellable, which is cancelled only when all the requests
+ * interested in the download were cancelled. */
+typedef struct _InFlight {
+	gint ref_count;
+	gint n_interested;
+	gboolean done;
+	GCancellable *cancellable;
+	GBytes *bytes;
+	gchar *content_type;
+} InFlight;
+
+typedef struct _ContentType {
+	gchar *uri_md5;
+	gchar *content_type;
+} ContentType;
+
+/* Shared by all requests, guarded by http_lock. */
+static GMutex http_lock;
+static GCond http_cond;
+static CamelDataCache *http_cache;
+static SoupSession *http_session;
+static GHashTable *http_content_types;	/* URI MD5 ~> GList in http_content_types_lru */
+static GQueue http_content_types_lru = G_QUEUE_INIT;	/* ContentType, most recent first */
+static GHashTable *http_in_flight;	/* URI MD5 ~> InFlight */
+
 G_DEFINE_TYPE (EHTTPRequest, e_http_request, SOUP_TYPE_REQUEST)
 
+static CamelDataCache *
+http_request_ref_cache (void)
+{
+	CamelDataCache *cache;
+
+	g_mutex_lock (&http_lock);
+
+	if (http_cache == NULL) {
+		GError *error = NULL;
+
+		http_cache = camel_data_cache_new (
+			e_get_user_cache_dir (), &error);
+
+		if (http_cache != NULL) {
+			camel_data_cache_set_expire_age (
+				http_cache, 24 * 60 * 60);
+			camel_data_cache_set_expire_access (
+				http_cache, 2 * 60 * 60);
+		} else {
+			g_warning ("%s: %s", G_STRFUNC, error->message);
+			g_clear_error (&error);
+		}
+
+		http_content_types = g_hash_table_new (
+			g_str_hash, g_str_equal);
+		http_in_flight = g_hash_table_new_full (
+			g_str_hash, g_str_equal,
+			(GDestroyNotify) g_free,
+			(GDestroyNotify) NULL);
+	}
+
+	cache = http_cache ? g_object_ref (http_cache) : NULL;
+
+	g_mutex_unlock (&http_lock);
+
+	return cache;
+}
+
+static SoupSession *
+http_request_ref_session (SoupSession *webkit_session)
+{
+	SoupSession *session;
+
+	g_mutex_lock (&http_lock);
+
+	if (http_session == NULL) {
+		http_session = soup_session_new_with_options (
+			SOUP_SESSION_TIMEOUT, 90,
+			SOUP_SESSION_MAX_CONNS_PER_HOST, MAX_CONNS_PER_HOST,
+			NULL);
+
+		e_binding_bind_property (
+			webkit_session, "proxy-resolver",
+			http_session, "proxy-resolver",
+			G_BINDING_SYNC_CREATE);
+	}
+
+	session = g_object_ref (http_session);
+
+	g_mutex_unlock (&http_lock);
+
+	return session;
+}
+
+/* Call with http_lock held. */
+static void
+content_type_remove_link_locked (GList *link)
+{
+	ContentType *item = link->data;
+
+	g_hash_table_remove (http_content_types, item->uri_md5);
+	g_queue_delete_link (&http_content_types_lru, link);
+
+	g_free (item->uri_md5);
+	g_free (item->content_type);
+	g_slice_free (ContentType, item);
+}
+
+static gchar *
+http_request_dup_cached_content_type (const gchar *uri_md5)
+{
+	gchar *content_type = NULL;
+	GList *link;
+
+	g_mutex_lock (&http_lock);
+
+	link = g_hash_table_lookup (http_content_types, uri_md5);
+	if (link != NULL) {
+		ContentType *item = link->data;
+
+		content_type = g_strdup (item->content_type);
+
+		g_queue_unlink (&http_content_types_lru, link);
+		g_queue_push_head_link (&http_content_types_lru, link);
+	}
+
+	g_mutex_unlock (&http_lock);
+
+	return content_type;
+}
+
+static void
+http_request_set_cached_content_type (const gchar *uri_md5,
+                                      const gchar *content_type)
+{
+	ContentType *item;
+	GList *link;
+
+	if (content_type == NULL)
+		return;
+
+	g_mutex_lock (&http_lock);
+
+	link = g_hash_table_lookup (http_content_types, uri_md5);
+	if (link != NULL)
+		content_type_remove_link_locked (link);
+
+	item = g_slice_new (ContentType);
+	item->uri_md5 = g_strdup (uri_md5);
+	item->content_type = g_strdup (content_type);
+
+	g_queue_push_head (&http_content_types_lru, item);
+	g_hash_table_insert (
+		http_content_types, item->uri_md5,
+		g_queue_peek_head_link (&http_content_types_lru));
+
+	while (g_queue_get_length (&http_content_types_lru) > MAX_CONTENT_TYPES)
+		content_type_remove_link_locked (
+			g_queue_peek_tail_link (&http_content_types_lru));
+
+	g_mutex_unlock (&http_lock);
+}
+
+/* Call with http_lock held. */
+static void
+in_flight_unref_locked (InFlight *in_flight)
+{
+	if (--in_flight->ref_count > 0)
+		return;
+
+	if (in_flight->bytes != NULL)
+		g_bytes_unref (in_flight->bytes);
+	g_object_unref (in_flight->cancellable);
+	g_free (in_flight->content_type);
+
+	g_slice_free (InFlight, in_flight);
+}
+
+/* Call with http_lock held. */
+static void
+in_flight_lose_interest_locked (InFlight *in_flight)
+{
+	if (--in_flight->n_interested == 0)
+		g_cancellable_cancel (in_flight->cancellable);
+}
+
+static void
+in_flight_requester_cancelled_cb (GCancellable *cancellable,
+                                  InFlight *in_flight)
+{
+	g_mutex_lock (&http_lock);
+	in_flight_lose_interest_locked (in_flight);
+	g_mutex_unlock (&http_lock);
+}
+
 static gssize
 copy_stream_to_stream (GIOStream *file_io_stream,
                        GMemoryInputStream *output,
@@ -136,8 +333,6 @@ send_and_handle_redirection (SoupSession *session,
 	soup_message_add_header_handler (
 		message, "got_body", "Location",
 		G_CALLBACK (redirect_handler), session);
-	soup_message_headers_append (
-		message->request_headers, "Connection", "close");
 	soup_session_send_message (session, message);
 
 	if (new_location != NULL) {
@@ -157,9 +352,113 @@ send_and_handle_redirection (SoupSession *session,
 
 static void
 http_request_cancelled_cb (GCancellable *cancellable,
-			   SoupSession *session)
+                           SoupMessage *message)
 {
-	soup_session_abort (session);
+	soup_session_cancel_message (
+		http_session, message, SOUP_STATUS_CANCELLED);
+}
+
+/* Downloads the resource and stores it in the cache. */
+static GBytes *
+http_request_fetch_sync (SoupSession *webkit_session,
+                         CamelDataCache *cache,
+                         const gchar *uri,
+                         const gchar *uri_md5,
+                         gchar **out_content_type,
+                         GCancellable *cancellable)
+{
+	SoupSession *session;
+	SoupMessage *message;
+	GMainContext *context;
+	GIOStream *cache_stream;
+	GBytes *bytes = NULL;
+	GError *error = NULL;
+	gulong cancelled_id = 0;
+
+	message = soup_message_new (SOUP_METHOD_GET, uri);
+	if (!message) {
+		g_debug ("%s: Skipping invalid URI '%s'", G_STRFUNC, uri);
+		return NULL;
+	}
+
+	session = http_request_ref_session (webkit_session);
+
+	soup_message_headers_append (
+		message->request_headers,
+		"User-Agent", "Evolution/" VERSION);
+
+	if (cancellable)
+		cancelled_id = g_cancellable_connect (cancellable, G_CALLBACK (http_request_cancelled_cb), message, NULL);
+
+	/* The session uses the thread-default main context, thus
+	 * give it a private one, to not run any of its sources in
+	 * the main context while this thread blocks on them. */
+	context = g_main_context_new ();
+	g_main_context_push_thread_default (context);
+
+	send_and_handle_redirection (session, message, NULL);
+
+	g_main_context_pop_thread_default (context);
+	g_main_context_unref (context);
+
+	if (cancellable && cancelled_id)
+		g_cancellable_disconnect (cancellable, cancelled_id);
+
+	if (!SOUP_STATUS_IS_SUCCESSFUL (message->status_code)) {
+		g_debug ("Failed to request %s (code %d)", uri, message->status_code);
+		goto exit;
+	}
+
+	/* Write the response body to cache */
+	cache_stream = NULL;
+	if (cache != NULL)
+		cache_stream = camel_data_cache_add (
+			cache, "http", uri_md5, &error);
+	if (error != NULL) {
+		g_warning (
+			"Failed to create cache file for '%s': %s",
+			uri, error->message);
+		g_clear_error (&error);
+	} else if (cache_stream != NULL) {
+		GOutputStream *output_stream;
+
+		output_stream =
+			g_io_stream_get_output_stream (cache_stream);
+
+		g_output_stream_write_all (
+			output_stream,
+			message->response_body->data,
+			message->response_body->length,
+			NULL, cancellable, &error);
+
+		g_io_stream_close (cache_stream, NULL, NULL);
+		g_object_unref (cache_stream);
+
+		if (error != NULL) {
+			if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+				g_warning (
+					"Failed to write data to cache stream: %s",
+					error->message);
+			g_clear_error (&error);
+			goto exit;
+		}
+	}
+
+	bytes = g_bytes_new (
+		message->response_body->data,
+		message->response_body->length);
+
+	*out_content_type = g_strdup (
+		soup_message_headers_get_content_type (
+			message->response_headers, NULL));
+
+	http_request_set_cached_content_type (uri_md5, *out_content_type);
+
+exit:
+	g_object_unref (message);
+	g_object_unref (session);
+
+	return bytes;
 }
 
 static void
@@ -179,7 +478,7 @@ handle_http_request (GSimpleAsyncResult *res,
 	gchar *uri_md5;
 	EShell *shell;
 	GSettings *settings;
-	const gchar *user_cache_dir, *soup_query;
+	const gchar *soup_query;
 	CamelDataCache *cache;
 	GIOStream *cache_stream;
 	gint uri_len;
@@ -244,13 +543,13 @@ handle_http_request (GSimpleAsyncResult *res,
 	uri_md5 = g_compute_checksum_for_string (G_CHECKSUM_MD5, uri, -1);
 
 	/* Open Evolution's cache */
-	user_cache_dir = e_get_user_cache_dir ();
-	cache = camel_data_cache_new (user_cache_dir, NULL);
-	camel_data_cache_set_expire_age (cache, 24 * 60 * 60);
-	camel_data_cache_set_expire_access (cache, 2 * 60 * 60);
+	cache = http_request_ref_cache ();
 
 	/* Found item in cache! */
-	cache_stream = camel_data_cache_get (cache, "http", uri_md5, NULL);
+	cache_stream = NULL;
+	if (cache != NULL)
+		cache_stream = camel_data_cache_get (
+			cache, "http", uri_md5, NULL);
 	if (cache_stream != NULL) {
 		gssize len;
 
@@ -267,29 +566,39 @@ handle_http_request (GSimpleAsyncResult *res,
 		 * get mimetype and return the stream to WebKit.
 		 * Otherwise try to fetch the resource again from the network. */
 		if ((len != -1) && (priv->content_length > 0)) {
-			GFile *file;
-			GFileInfo *info;
-			gchar *path;
-
-			path = camel_data_cache_get_filename (
-				cache, "http", uri_md5);
-			file = g_file_new_for_path (path);
-			info = g_file_query_info (
-				file, G_FILE_ATTRIBUTE_STANDARD_CONTENT_TYPE,
-				0, cancellable, NULL);
-
-			priv->content_type = g_strdup (
-				g_file_info_get_content_type (info));
+			priv->content_type =
+				http_request_dup_cached_content_type (uri_md5);
+
+			/* Not known in this session yet, sniff it. */
+			if (priv->content_type == NULL) {
+				GFile *file;
+				GFileInfo *info;
+				gchar *path;
+
+				path = camel_data_cache_get_filename (
+					cache, "http", uri_md5);
+				file = g_file_new_for_path (path);
+				info = g_file_query_info (
+					file, G_FILE_ATTRIBUTE_STANDARD_CONTENT_TYPE,
+					0, cancellable, NULL);
+
+				if (info != NULL) {
+					priv->content_type = g_strdup (
+						g_file_info_get_content_type (info));
+					http_request_set_cached_content_type (
+						uri_md5, priv->content_type);
+					g_object_unref (info);
+				}
+
+				g_object_unref (file);
+				g_free (path);
+			}
 
 			d (
 				printf ("'%s' found in cache (%d bytes, %s)\n",
 				uri, priv->content_length,
 				priv->content_type));
 
-			g_object_unref (info);
-			g_object_unref (file);
-			g_free (path);
-
 			/* Set result and quit the thread */
 			g_simple_async_result_set_op_res_gpointer (
 				res, stream, g_object_unref);
@@ -362,106 +671,89 @@ handle_http_request (GSimpleAsyncResult *res,
 	if ((image_policy == E_IMAGE_LOADING_POLICY_ALWAYS) ||
 	    force_load_images) {
 
-		SoupSession *temp_session;
-		SoupMessage *message;
-		GIOStream *cache_stream;
-		GError *error;
-		GMainContext *context;
-		gulong cancelled_id = 0;
+		InFlight *in_flight;
+		GBytes *bytes;
+		gboolean fetch;
 
 		if (g_cancellable_is_cancelled (cancellable))
 			goto cleanup;
 
-		message = soup_message_new (SOUP_METHOD_GET, uri);
-		if (!message) {
-			g_debug ("%s: Skipping invalid URI '%s'", G_STRFUNC, uri);
-			goto cleanup;
+		/* Only the first request for a URI downloads it,
+		 * the others wait for and share its result. */
+		g_mutex_lock (&http_lock);
+		in_flight = g_hash_table_lookup (http_in_flight, uri_md5);
+		/* A download everybody gave up on is not joined,
+		 * a new one replaces it. */
+		fetch = (in_flight == NULL) ||
+			g_cancellable_is_cancelled (in_flight->cancellable);
+		if (fetch) {
+			in_flight = g_slice_new0 (InFlight);
+			in_flight->cancellable = g_cancellable_new ();
+			g_hash_table_replace (
+				http_in_flight, g_strdup (uri_md5), in_flight);
 		}
-
-		context = g_main_context_new ();
-		g_main_context_push_thread_default (context);
-
-		temp_session = soup_session_new_with_options (
-			SOUP_SESSION_TIMEOUT, 90, NULL);
-
-		e_binding_bind_property (
-			soup_session, "proxy-resolver",
-			temp_session, "proxy-resolver",
-			G_BINDING_SYNC_CREATE);
-
-		soup_message_headers_append (
-			message->request_headers,
-			"User-Agent", "Evolution/" VERSION);
-
-		if (cancellable)
-			cancelled_id = g_cancellable_connect (cancellable, G_CALLBACK (http_request_cancelled_cb), temp_session, NULL);
-
-		send_and_handle_redirection (temp_session, message, NULL);
-
-		if (cancellable && cancelled_id)
-			g_cancellable_disconnect (cancellable, cancelled_id);
-
-		if (!SOUP_STATUS_IS_SUCCESSFUL (message->status_code)) {
-			g_debug ("Failed to request %s (code %d)", uri, message->status_code);
-			g_object_unref (message);
-			g_object_unref (temp_session);
-			g_main_context_unref (context);
-			goto cleanup;
-		}
-
-		/* Write the response body to cache */
-		error = NULL;
-		cache_stream = camel_data_cache_add (
-			cache, "http", uri_md5, &error);
-		if (error != NULL) {
-			g_warning (
-				"Failed to create cache file for '%s': %s",
-				uri, error->message);
-			g_clear_error (&error);
+		in_flight->ref_count++;
+		in_flight->n_interested++;
+		g_mutex_unlock (&http_lock);
+
+		if (fetch) {
+			gchar *content_type = NULL;
+			gulong cancelled_id = 0;
+
+			/* The download goes on for the other requests
+			 * when this one is cancelled, it is cancelled
+			 * only when none is interested in it anymore. */
+			if (cancellable != NULL)
+				cancelled_id = g_cancellable_connect (
+					cancellable, G_CALLBACK (
+					in_flight_requester_cancelled_cb),
+					in_flight, NULL);
+
+			bytes = http_request_fetch_sync (
+				soup_session, cache, uri, uri_md5,
+				&content_type, in_flight->cancellable);
+
+			if (cancelled_id != 0)
+				g_cancellable_disconnect (
+					cancellable, cancelled_id);
+
+			g_mutex_lock (&http_lock);
+			in_flight->bytes = bytes;
+			in_flight->content_type = content_type;
+			in_flight->done = TRUE;
+			if (g_hash_table_lookup (http_in_flight, uri_md5) == in_flight)
+				g_hash_table_remove (http_in_flight, uri_md5);
+			g_cond_broadcast (&http_cond);
 		} else {
-			GOutputStream *output_stream;
-
-			output_stream =
-				g_io_stream_get_output_stream (cache_stream);
+			g_mutex_lock (&http_lock);
+			while (!in_flight->done &&
+			       !g_cancellable_is_cancelled (cancellable))
+				g_cond_wait_until (
+					&http_cond, &http_lock,
+					g_get_monotonic_time () +
+					G_TIME_SPAN_SECOND / 10);
+
+			if (!in_flight->done)
+				in_flight_lose_interest_locked (in_flight);
+		}
 
-			g_output_stream_write_all (
-				output_stream,
-				message->response_body->data,
-				message->response_body->length,
-				NULL, cancellable, &error);
+		bytes = NULL;
+		if (in_flight->done && in_flight->bytes != NULL) {
+			bytes = g_bytes_ref (in_flight->bytes);
+			priv->content_type = g_strdup (in_flight->content_type);
+		}
 
-			g_io_stream_close (cache_stream, NULL, NULL);
-			g_object_unref (cache_stream);
+		in_flight_unref_locked (in_flight);
+		g_mutex_unlock (&http_lock);
 
-			if (error != NULL) {
-				if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
-					g_warning (
-						"Failed to write data to cache stream: %s",
-						error->message);
-				g_clear_error (&error);
-				g_object_unref (message);
-				g_object_unref (temp_session);
-				g_main_context_unref (context);
-				goto cleanup;
-			}
-		}
+		if (bytes == NULL)
+			goto cleanup;
 
 		/* Send the response body to WebKit */
-		stream = g_memory_input_stream_new_from_data (
-			g_memdup (
-				message->response_body->data,
-				message->response_body->length),
-			message->response_body->length,
-			(GDestroyNotify) g_free);
-
-		priv->content_length = message->response_body->length;
-		priv->content_type = g_strdup (
-			soup_message_headers_get_content_type (
-				message->response_headers, NULL));
+		stream = g_memory_input_stream_new_from_bytes (bytes);
+		priv->content_length = g_bytes_get_size (bytes);
 
-		g_object_unref (message);
-		g_object_unref (temp_session);
-		g_main_context_unref (context);
+		g_bytes_unref (bytes);
 
 		d (printf ("Received image from %s\n"
 			"Content-Type: %s\n"
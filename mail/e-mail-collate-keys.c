@@ -0,0 +1,462 @@
+/*
+ * e-mail-collate-keys.c
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/* A per-folder cache of collation keys, which survives folder switches
+ * and restarts.  The keys are stored in a file which is memory-mapped
+ * on the first lookup; entries are sorted by UID, thus the lookup is a
+ * binary search directly in the mapped memory.  Each entry carries a
+ * hash of the string it was computed from, thus a key for a changed
+ * message is not used.  Keys computed during the session are written
+ * out, merged with the still valid ones, when the last reference to
+ * the cache is dropped. */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string.h>
+
+#include "e-mail-collate-keys.h"
+
+#define COLLATE_KEYS_MAGIC "EMLCKEY1"
+
+typedef struct _FileHeader {
+	gchar magic[8];
+	guint32 validity;
+	guint32 n_entries;
+} FileHeader;
+
+/* UID and key are offsets into the string area following the entries. */
+typedef struct _FileEntry {
+	guint32 uid;
+	guint32 string_hash;
+	guint32 key;
+} FileEntry;
+
+typedef struct _AddedKey {
+	guint32 string_hash;
+	const gchar *key;
+} AddedKey;
+
+typedef struct _SaveItem {
+	const gchar *uid;
+	guint32 string_hash;
+	const gchar *key;
+} SaveItem;
+
+struct _EMailCollateKeys {
+	volatile gint ref_count;
+
+	CamelFolder *folder;
+	gchar *filename;
+	guint32 validity;
+
+	GMutex lock;
+	gboolean tried_load;
+	GMappedFile *mapped;
+	const FileEntry *entries;
+	guint32 n_entries;
+	const gchar *strings;
+	gsize strings_len;
+
+	/* Keys computed in this session, pooled strings. */
+	GHashTable *added;
+};
+
+static void
+added_key_free (AddedKey *added)
+{
+	camel_pstring_free (added->key);
+	g_slice_free (AddedKey, added);
+}
+
+static void
+collate_keys_load (EMailCollateKeys *keys)
+{
+	GMappedFile *mapped;
+	const FileHeader *header;
+	const gchar *contents;
+	gsize length, entries_len;
+
+	keys->tried_load = TRUE;
+
+	mapped = g_mapped_file_new (keys->filename, FALSE, NULL);
+	if (mapped == NULL)
+		return;
+
+	contents = g_mapped_file_get_contents (mapped);
+	length = g_mapped_file_get_length (mapped);
+
+	if (length < sizeof (FileHeader))
+		goto invalid;
+
+	header = (const FileHeader *) contents;
+
+	/* Keys from a different locale or with a different set
+	 * of the "Re:" subject prefixes are of no use. */
+	if (memcmp (header->magic, COLLATE_KEYS_MAGIC, sizeof (header->magic)) != 0 ||
+	    header->validity != keys->validity)
+		goto invalid;
+
+	entries_len = (gsize) header->n_entries * sizeof (FileEntry);
+	if (entries_len >= length - sizeof (FileHeader))
+		goto invalid;
+
+	keys->strings = contents + sizeof (FileHeader) + entries_len;
+	keys->strings_len = length - sizeof (FileHeader) - entries_len;
+
+	/* Make sure every string in the file is NUL-terminated. */
+	if (keys->strings[keys->strings_len - 1] != '\0')
+		goto invalid;
+
+	keys->entries = (const FileEntry *) (contents + sizeof (FileHeader));
+	keys->n_entries = header->n_entries;
+	keys->mapped = mapped;
+
+	return;
+
+invalid:
+	keys->strings = NULL;
+	keys->strings_len = 0;
+
+	g_mapped_file_unref (mapped);
+}
+
+static const FileEntry *
+collate_keys_find (EMailCollateKeys *keys,
+                   const gchar *uid)
+{
+	guint32 lo = 0, hi = keys->n_entries;
+
+	while (lo < hi) {
+		const FileEntry *entry;
+		guint32 mid;
+		gint cmp;
+
+		mid = lo + (hi - lo) / 2;
+		entry = &keys->entries[mid];
+
+		if (entry->uid >= keys->strings_len ||
+		    entry->key >= keys->strings_len)
+			return NULL;
+
+		cmp = strcmp (uid, keys->strings + entry->uid);
+		if (cmp == 0)
+			return entry;
+
+		if (cmp < 0)
+			hi = mid;
+		else
+			lo = mid + 1;
+	}
+
+	return NULL;
+}
+
+static void
+collate_keys_destroy (EMailCollateKeys *keys)
+{
+	if (keys->mapped != NULL)
+		g_mapped_file_unref (keys->mapped);
+
+	g_hash_table_destroy (keys->added);
+	g_mutex_clear (&keys->lock);
+	g_object_unref (keys->folder);
+	g_free (keys->filename);
+
+	g_slice_free (EMailCollateKeys, keys);
+}
+
+static gint
+collate_keys_cmp_save_items (gconstpointer a,
+                             gconstpointer b)
+{
+	const SaveItem *item1 = a, *item2 = b;
+
+	return strcmp (item1->uid, item2->uid);
+}
+
+static gpointer
+collate_keys_save_thread (gpointer user_data)
+{
+	EMailCollateKeys *keys = user_data;
+	CamelFolderSummary *summary;
+	GHashTableIter iter;
+	GByteArray *data;
+	GArray *items;
+	FileHeader header;
+	gpointer key, value;
+	gsize strings_start;
+	guint32 ii;
+	GError *local_error = NULL;
+
+	summary = keys->folder->summary;
+
+	if (!keys->tried_load)
+		collate_keys_load (keys);
+
+	items = g_array_new (FALSE, FALSE, sizeof (SaveItem));
+
+	/* Messages which are gone from the folder are dropped here. */
+	for (ii = 0; ii < keys->n_entries; ii++) {
+		const FileEntry *entry = &keys->entries[ii];
+		SaveItem item;
+
+		if (entry->uid >= keys->strings_len ||
+		    entry->key >= keys->strings_len)
+			continue;
+
+		item.uid = keys->strings + entry->uid;
+		item.string_hash = entry->string_hash;
+		item.key = keys->strings + entry->key;
+
+		if (g_hash_table_contains (keys->added, item.uid) ||
+		    !camel_folder_summary_check_uid (summary, item.uid))
+			continue;
+
+		g_array_append_val (items, item);
+	}
+
+	g_hash_table_iter_init (&iter, keys->added);
+	while (g_hash_table_iter_next (&iter, &key, &value)) {
+		AddedKey *added = value;
+		SaveItem item;
+
+		item.uid = key;
+		item.string_hash = added->string_hash;
+		item.key = added->key;
+
+		if (!camel_folder_summary_check_uid (summary, item.uid))
+			continue;
+
+		g_array_append_val (items, item);
+	}
+
+	g_array_sort (items, collate_keys_cmp_save_items);
+
+	memcpy (header.magic, COLLATE_KEYS_MAGIC, sizeof (header.magic));
+	header.validity = keys->validity;
+	header.n_entries = items->len;
+
+	data = g_byte_array_new ();
+	g_byte_array_append (data, (const guint8 *) &header, sizeof (FileHeader));
+	g_byte_array_set_size (data, sizeof (FileHeader) + items->len * sizeof (FileEntry));
+
+	strings_start = data->len;
+
+	for (ii = 0; ii < items->len; ii++) {
+		SaveItem *item = &g_array_index (items, SaveItem, ii);
+		FileEntry entry;
+
+		entry.uid = data->len - strings_start;
+		g_byte_array_append (data, (const guint8 *) item->uid, strlen (item->uid) + 1);
+
+		entry.string_hash = item->string_hash;
+
+		entry.key = data->len - strings_start;
+		g_byte_array_append (data, (const guint8 *) item->key, strlen (item->key) + 1);
+
+		memcpy (
+			data->data + sizeof (FileHeader) + ii * sizeof (FileEntry),
+			&entry, sizeof (FileEntry));
+	}
+
+	if (items->len > 0 && !g_file_set_contents (
+		keys->filename, (const gchar *) data->data,
+		data->len, &local_error)) {
+		g_warning ("%s: %s", G_STRFUNC, local_error->message);
+		g_error_free (local_error);
+	}
+
+	g_byte_array_free (data, TRUE);
+	g_array_free (items, TRUE);
+
+	collate_keys_destroy (keys);
+
+	return NULL;
+}
+
+/**
+ * e_mail_collate_keys_new:
+ * @folder: a #CamelFolder
+ * @filename: where to store the keys
+ * @validity: describes how the keys are computed
+ *
+ * Creates a collation key cache for @folder, stored in @filename.
+ * Keys stored with a different @validity are ignored.  Nothing is
+ * read until the first e_mail_collate_keys_lookup().
+ *
+ * Returns: a new #EMailCollateKeys
+ **/
+EMailCollateKeys *
+e_mail_collate_keys_new (CamelFolder *folder,
+                         const gchar *filename,
+                         const gchar *validity)
+{
+	EMailCollateKeys *keys;
+
+	g_return_val_if_fail (CAMEL_IS_FOLDER (folder), NULL);
+	g_return_val_if_fail (filename != NULL, NULL);
+	g_return_val_if_fail (validity != NULL, NULL);
+
+	keys = g_slice_new0 (EMailCollateKeys);
+	keys->ref_count = 1;
+	keys->folder = g_object_ref (folder);
+	keys->filename = g_strdup (filename);
+	keys->validity = g_str_hash (validity);
+	keys->added = g_hash_table_new_full (
+		g_str_hash, g_str_equal,
+		(GDestroyNotify) camel_pstring_free,
+		(GDestroyNotify) added_key_free);
+
+	g_mutex_init (&keys->lock);
+
+	return keys;
+}
+
+/**
+ * e_mail_collate_keys_ref:
+ * @keys: an #EMailCollateKeys
+ *
+ * Increases the reference count of @keys.  A thread which uses
+ * @keys holds a reference, thus @keys stays valid while the owner
+ * drops its own.
+ *
+ * Returns: @keys
+ **/
+EMailCollateKeys *
+e_mail_collate_keys_ref (EMailCollateKeys *keys)
+{
+	g_return_val_if_fail (keys != NULL, NULL);
+	g_return_val_if_fail (keys->ref_count > 0, NULL);
+
+	g_atomic_int_inc (&keys->ref_count);
+
+	return keys;
+}
+
+/**
+ * e_mail_collate_keys_unref:
+ * @keys: an #EMailCollateKeys
+ *
+ * Decreases the reference count of @keys.  When it reaches zero,
+ * @keys is freed.  Keys added since it was created are written out
+ * in a dedicated thread, to not block the caller.
+ **/
+void
+e_mail_collate_keys_unref (EMailCollateKeys *keys)
+{
+	g_return_if_fail (keys != NULL);
+	g_return_if_fail (keys->ref_count > 0);
+
+	if (!g_atomic_int_dec_and_test (&keys->ref_count))
+		return;
+
+	if (g_hash_table_size (keys->added) > 0) {
+		GThread *thread;
+
+		thread = g_thread_new (
+			NULL, collate_keys_save_thread, keys);
+		g_thread_unref (thread);
+	} else {
+		collate_keys_destroy (keys);
+	}
+}
+
+/**
+ * e_mail_collate_keys_lookup:
+ * @keys: an #EMailCollateKeys
+ * @uid: a message UID
+ * @string: the string the key is computed from
+ *
+ * Looks up the key of the message @uid, which is valid only if it
+ * was computed from the same @string.
+ *
+ * Returns: the collation key, or %NULL when not known; the string
+ *    is owned by @keys and is valid while the caller holds a reference
+ **/
+const gchar *
+e_mail_collate_keys_lookup (EMailCollateKeys *keys,
+                            const gchar *uid,
+                            const gchar *string)
+{
+	const FileEntry *entry;
+	const gchar *key = NULL;
+	AddedKey *added;
+	guint32 string_hash;
+
+	g_return_val_if_fail (keys != NULL, NULL);
+	g_return_val_if_fail (uid != NULL, NULL);
+	g_return_val_if_fail (string != NULL, NULL);
+
+	string_hash = g_str_hash (string);
+
+	g_mutex_lock (&keys->lock);
+
+	added = g_hash_table_lookup (keys->added, uid);
+
+	if (added != NULL) {
+		if (added->string_hash == string_hash)
+			key = added->key;
+	} else {
+		if (!keys->tried_load)
+			collate_keys_load (keys);
+
+		entry = collate_keys_find (keys, uid);
+		if (entry != NULL && entry->string_hash == string_hash)
+			key = keys->strings + entry->key;
+	}
+
+	g_mutex_unlock (&keys->lock);
+
+	return key;
+}
+
+/**
+ * e_mail_collate_keys_add:
+ * @keys: an #EMailCollateKeys
+ * @uid: a message UID
+ * @string: the string the key is computed from
+ * @collate_key: the collation key
+ *
+ * Remembers @collate_key of the message @uid, computed from @string.
+ **/
+void
+e_mail_collate_keys_add (EMailCollateKeys *keys,
+                         const gchar *uid,
+                         const gchar *string,
+                         const gchar *collate_key)
+{
+	AddedKey *added;
+
+	g_return_if_fail (keys != NULL);
+	g_return_if_fail (uid != NULL);
+	g_return_if_fail (string != NULL);
+	g_return_if_fail (collate_key != NULL);
+
+	added = g_slice_new (AddedKey);
+	added->string_hash = g_str_hash (string);
+	added->key = camel_pstring_strdup (collate_key);
+
+	g_mutex_lock (&keys->lock);
+
+	g_hash_table_replace (
+		keys->added,
+		(gpointer) camel_pstring_strdup (uid), added);
+
+	g_mutex_unlock (&keys->lock);
+}
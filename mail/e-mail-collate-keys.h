@@ -0,0 +1,44 @@
+/*
+ * e-mail-collate-keys.h
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef E_MAIL_COLLATE_KEYS_H
+#define E_MAIL_COLLATE_KEYS_H
+
+#include <camel/camel.h>
+
+G_BEGIN_DECLS
+
+typedef struct _EMailCollateKeys EMailCollateKeys;
+
+EMailCollateKeys *
+		e_mail_collate_keys_new		(CamelFolder *folder,
+						 const gchar *filename,
+						 const gchar *validity);
+EMailCollateKeys *
+		e_mail_collate_keys_ref		(EMailCollateKeys *keys);
+void		e_mail_collate_keys_unref	(EMailCollateKeys *keys);
+const gchar *	e_mail_collate_keys_lookup	(EMailCollateKeys *keys,
+						 const gchar *uid,
+						 const gchar *string);
+void		e_mail_collate_keys_add		(EMailCollateKeys *keys,
+						 const gchar *uid,
+						 const gchar *string,
+						 const gchar *collate_key);
+
+G_END_DECLS
+
+#endif /* E_MAIL_COLLATE_KEYS_H */
@@ -2261,6 +2261,11 @@ do_reload_display (EMailDisplay *display)
 	if (uri == NULL || *uri == '\0')
 		return FALSE;
 
+	/* Reloads follow changes of the formatter settings
+	 * or of the message flags, which the cached content
+	 * does not reflect. */
+	e_mail_request_flush_formatted ();
+
 	if (strstr (uri, "?") == NULL) {
 		e_web_view_reload (web_view);
 		return FALSE;
@@ -2460,6 +2465,7 @@ e_mail_display_load_images (EMailDisplay *display)
 	g_return_if_fail (E_IS_MAIL_DISPLAY (display));
 
 	display->priv->force_image_load = TRUE;
+	e_mail_request_flush_formatted ();
 	e_web_view_reload (E_WEB_VIEW (display));
 }
 
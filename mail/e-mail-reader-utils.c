@@ -1391,6 +1391,80 @@ e_mail_reader_print (EMailReader *reader,
 	g_object_unref (activity);
 }
 
+static void
+mail_reader_check_for_junk_cb (GObject *source_object,
+                               GAsyncResult *result,
+                               gpointer user_data)
+{
+	EActivity *activity;
+	EAlertSink *alert_sink;
+	AsyncContext *async_context;
+	GError *local_error = NULL;
+
+	async_context = (AsyncContext *) user_data;
+
+	activity = async_context->activity;
+	alert_sink = e_activity_get_alert_sink (activity);
+
+	e_mail_folder_check_junk_finish (
+		CAMEL_FOLDER (source_object), result, &local_error);
+
+	if (e_activity_handle_cancellation (activity, local_error)) {
+		g_error_free (local_error);
+
+	} else if (local_error != NULL) {
+		e_alert_submit (
+			alert_sink,
+			"mail:junk-check-error",
+			local_error->message, NULL);
+		g_error_free (local_error);
+
+	} else {
+		e_activity_set_state (activity, E_ACTIVITY_COMPLETED);
+	}
+
+	async_context_free (async_context);
+}
+
+void
+e_mail_reader_check_for_junk (EMailReader *reader)
+{
+	EActivity *activity;
+	AsyncContext *async_context;
+	GCancellable *cancellable;
+	CamelFolder *folder;
+	GPtrArray *uids;
+
+	g_return_if_fail (E_IS_MAIL_READER (reader));
+
+	uids = e_mail_reader_get_selected_uids (reader);
+	g_return_if_fail (uids != NULL);
+
+	/* Classify the messages asynchronously, in batches. */
+
+	activity = e_mail_reader_new_activity (reader);
+	cancellable = e_activity_get_cancellable (activity);
+
+	async_context = g_slice_new0 (AsyncContext);
+	async_context->activity = g_object_ref (activity);
+	async_context->reader = g_object_ref (reader);
+
+	folder = e_mail_reader_ref_folder (reader);
+
+	e_mail_folder_check_junk (
+		folder, uids,
+		G_PRIORITY_DEFAULT,
+		cancellable,
+		mail_reader_check_for_junk_cb,
+		async_context);
+
+	g_object_unref (folder);
+
+	g_object_unref (activity);
+
+	g_ptr_array_unref (uids);
+}
+
 static void
 mail_reader_remove_attachments_cb (GObject *source_object,
                                    GAsyncResult *result,
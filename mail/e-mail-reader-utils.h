@@ -66,6 +66,7 @@ void		e_mail_reader_mark_selected_ignore_thread
 guint		e_mail_reader_open_selected	(EMailReader *reader);
 void		e_mail_reader_print		(EMailReader *reader,
 						 GtkPrintOperationAction action);
+void		e_mail_reader_check_for_junk	(EMailReader *reader);
 void		e_mail_reader_remove_attachments
 						(EMailReader *reader);
 void		e_mail_reader_remove_duplicates	(EMailReader *reader);
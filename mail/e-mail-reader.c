@@ -54,6 +54,11 @@
 #include "mail-vfolder-ui.h"
 #include "message-list.h"
 
+/* How many messages on each side of the selected message to prefetch,
+ * and how much memory the prefetched messages are allowed to occupy. */
+#define PREFETCH_N_NEIGHBOURS 2
+#define PREFETCH_MEMORY_BUDGET (16 * 1024 * 1024)
+
 #define E_MAIL_READER_GET_PRIVATE(obj) \
 	((EMailReaderPrivate *) g_object_get_qdata \
 	(G_OBJECT (obj), quark_private))
@@ -62,6 +67,8 @@
 
 typedef struct _EMailReaderClosure EMailReaderClosure;
 typedef struct _EMailReaderPrivate EMailReaderPrivate;
+typedef struct _PrefetchContext PrefetchContext;
+typedef struct _PrefetchedParts PrefetchedParts;
 
 struct _EMailReaderClosure {
 	EMailReader *reader;
@@ -97,6 +104,27 @@ struct _EMailReaderPrivate {
 	guint schedule_mark_seen_interval;
 
 	gpointer remote_content_alert; /* EAlert */
+
+	/* Neighbours of the selected message are fetched and parsed
+	 * in advance, thus moving to them shows them immediately.
+	 * The prefetched part lists are kept alive, oldest first,
+	 * until they exceed PREFETCH_MEMORY_BUDGET. */
+	GHashTable *prefetching; /* message UID ~> GCancellable */
+	GQueue prefetched; /* PrefetchedParts */
+	gsize prefetched_size;
+};
+
+struct _PrefetchContext {
+	CamelFolder *folder;
+	EMailSession *session;
+	gchar *message_uid;
+	gsize size;
+	EMailPartList *part_list;
+};
+
+struct _PrefetchedParts {
+	EMailPartList *part_list;
+	gsize size;
 };
 
 enum {
@@ -139,6 +167,44 @@ mail_reader_closure_free (EMailReaderClosure *closure)
 	g_slice_free (EMailReaderClosure, closure);
 }
 
+static void
+prefetch_context_free (PrefetchContext *context)
+{
+	g_clear_object (&context->folder);
+	g_clear_object (&context->session);
+	g_clear_object (&context->part_list);
+	g_free (context->message_uid);
+
+	g_slice_free (PrefetchContext, context);
+}
+
+static void
+prefetched_parts_free (PrefetchedParts *prefetched)
+{
+	g_object_unref (prefetched->part_list);
+
+	g_slice_free (PrefetchedParts, prefetched);
+}
+
+static void
+mail_reader_prefetch_cancel_all (EMailReaderPrivate *priv)
+{
+	GHashTableIter iter;
+	gpointer value;
+
+	g_hash_table_iter_init (&iter, priv->prefetching);
+	while (g_hash_table_iter_next (&iter, NULL, &value))
+		g_cancellable_cancel (value);
+
+	g_hash_table_remove_all (priv->prefetching);
+
+	g_queue_foreach (
+		&priv->prefetched,
+		(GFunc) prefetched_parts_free, NULL);
+	g_queue_clear (&priv->prefetched);
+	priv->prefetched_size = 0;
+}
+
 static void
 mail_reader_private_free (EMailReaderPrivate *priv)
 {
@@ -151,6 +217,9 @@ mail_reader_private_free (EMailReaderPrivate *priv)
 		priv->retrieving_message = 0;
 	}
 
+	mail_reader_prefetch_cancel_all (priv);
+	g_hash_table_destroy (priv->prefetching);
+
 	g_slice_free (EMailReaderPrivate, priv);
 }
 
@@ -303,21 +372,16 @@ action_mail_check_for_junk_cb (GtkAction *action,
 {
 	EMailBackend *backend;
 	EMailSession *session;
-	CamelFolder *folder;
-	GPtrArray *uids;
 
-	folder = e_mail_reader_ref_folder (reader);
 	backend = e_mail_reader_get_backend (reader);
-	uids = e_mail_reader_get_selected_uids (reader);
-
 	session = e_mail_backend_get_session (backend);
 
-	mail_filter_folder (
-		session, folder, uids,
-		E_FILTER_SOURCE_JUNKTEST, FALSE);
+	/* Respect the "check-junk" setting like the incoming filters do. */
+	if (E_IS_MAIL_UI_SESSION (session) &&
+	    !e_mail_ui_session_get_check_junk (E_MAIL_UI_SESSION (session)))
+		return;
 
-	g_clear_object (&folder);
-	g_ptr_array_unref (uids);
+	e_mail_reader_check_for_junk (reader);
 }
 
 static void
@@ -2894,6 +2958,294 @@ discard_timeout_mark_seen_cb (EMailReader *reader)
 	return FALSE;
 }
 
+static EMailPartList *
+mail_reader_ref_parsed_part_list (CamelFolder *folder,
+                                  const gchar *message_uid)
+{
+	CamelObjectBag *registry;
+	EMailPartList *part_list;
+	gchar *mail_uri;
+
+	registry = e_mail_part_list_get_registry ();
+	mail_uri = e_mail_part_build_uri (folder, message_uid, NULL, NULL);
+	part_list = camel_object_bag_peek (registry, mail_uri);
+	g_free (mail_uri);
+
+	return part_list;
+}
+
+static EMailPartList *
+mail_reader_ref_prefetched (EMailReader *reader,
+                            const gchar *message_uid)
+{
+	EMailPartList *part_list = NULL;
+	CamelFolder *folder;
+
+	folder = e_mail_reader_ref_folder (reader);
+
+	if (folder != NULL && message_uid != NULL)
+		part_list = mail_reader_ref_parsed_part_list (
+			folder, message_uid);
+
+	g_clear_object (&folder);
+
+	return part_list;
+}
+
+/* Moves @part_list to the end of the queue, if it is kept there. */
+static gboolean
+mail_reader_prefetch_touch (EMailReaderPrivate *priv,
+                            EMailPartList *part_list)
+{
+	GList *link;
+
+	for (link = g_queue_peek_head_link (&priv->prefetched); link; link = g_list_next (link)) {
+		PrefetchedParts *prefetched = link->data;
+
+		if (prefetched->part_list == part_list) {
+			g_queue_unlink (&priv->prefetched, link);
+			g_queue_push_tail_link (&priv->prefetched, link);
+			return TRUE;
+		}
+	}
+
+	return FALSE;
+}
+
+static void
+mail_reader_prefetch_keep (EMailReaderPrivate *priv,
+                           EMailPartList *part_list,
+                           gsize size)
+{
+	PrefetchedParts *prefetched;
+
+	if (mail_reader_prefetch_touch (priv, part_list))
+		return;
+
+	prefetched = g_slice_new0 (PrefetchedParts);
+	prefetched->part_list = g_object_ref (part_list);
+	prefetched->size = size;
+
+	g_queue_push_tail (&priv->prefetched, prefetched);
+	priv->prefetched_size += size;
+
+	/* Once dropped from here the part list is removed from
+	 * the registry, unless an EMailDisplay still uses it. */
+	while (priv->prefetched_size > PREFETCH_MEMORY_BUDGET &&
+	       g_queue_get_length (&priv->prefetched) > 1) {
+		prefetched = g_queue_pop_head (&priv->prefetched);
+		priv->prefetched_size -= prefetched->size;
+		prefetched_parts_free (prefetched);
+	}
+}
+
+static void
+mail_reader_prefetch_run (GSimpleAsyncResult *simple,
+                          GObject *object,
+                          GCancellable *cancellable)
+{
+	PrefetchContext *context;
+	CamelMimeMessage *message;
+	CamelObjectBag *registry;
+	EMailPartList *part_list;
+	gchar *mail_uri;
+	GError *local_error = NULL;
+
+	context = g_simple_async_result_get_op_res_gpointer (simple);
+
+	message = camel_folder_get_message_sync (
+		context->folder, context->message_uid,
+		cancellable, &local_error);
+
+	if (message == NULL) {
+		g_simple_async_result_take_error (simple, local_error);
+		return;
+	}
+
+	registry = e_mail_part_list_get_registry ();
+
+	mail_uri = e_mail_part_build_uri (
+		context->folder, context->message_uid, NULL, NULL);
+
+	/* This waits for the message being parsed for the display,
+	 * if the user selected it in the meantime. */
+	part_list = camel_object_bag_reserve (registry, mail_uri);
+	if (part_list == NULL) {
+		EMailParser *parser;
+
+		parser = e_mail_parser_new (CAMEL_SESSION (context->session));
+
+		part_list = e_mail_parser_parse_sync (
+			parser, context->folder,
+			context->message_uid, message,
+			cancellable);
+
+		g_object_unref (parser);
+
+		if (part_list == NULL)
+			camel_object_bag_abort (registry, mail_uri);
+		else
+			camel_object_bag_add (registry, mail_uri, part_list);
+	}
+
+	g_free (mail_uri);
+	g_object_unref (message);
+
+	context->part_list = part_list;
+
+	if (g_cancellable_set_error_if_cancelled (cancellable, &local_error))
+		g_simple_async_result_take_error (simple, local_error);
+}
+
+static void
+mail_reader_prefetch_done_cb (GObject *source_object,
+                              GAsyncResult *result,
+                              gpointer user_data)
+{
+	EMailReaderPrivate *priv;
+	GSimpleAsyncResult *simple;
+	PrefetchContext *context;
+	GCancellable *cancellable = user_data;
+
+	priv = E_MAIL_READER_GET_PRIVATE (source_object);
+
+	simple = G_SIMPLE_ASYNC_RESULT (result);
+	context = g_simple_async_result_get_op_res_gpointer (simple);
+
+	if (priv == NULL)
+		goto exit;
+
+	/* The same message can be prefetched again after a cancel. */
+	if (g_hash_table_lookup (priv->prefetching, context->message_uid) == cancellable)
+		g_hash_table_remove (priv->prefetching, context->message_uid);
+
+	/* Errors are not interesting here, the message is fetched
+	 * again and the error is shown, should the user select it. */
+	if (!g_simple_async_result_propagate_error (simple, NULL) &&
+	    context->part_list != NULL)
+		mail_reader_prefetch_keep (
+			priv, context->part_list, context->size);
+
+exit:
+	g_object_unref (cancellable);
+}
+
+static void
+mail_reader_prefetch_neighbours (EMailReader *reader,
+                                 gboolean start)
+{
+	EMailReaderPrivate *priv;
+	EMailBackend *backend;
+	EMailSession *session;
+	MessageList *message_list;
+	CamelFolder *folder;
+	GHashTableIter iter;
+	GPtrArray *uids;
+	gpointer key, value;
+	guint ii;
+
+	priv = E_MAIL_READER_GET_PRIVATE (reader);
+	message_list = MESSAGE_LIST (e_mail_reader_get_message_list (reader));
+
+	if (message_list == NULL)
+		return;
+
+	uids = message_list_get_neighbours (message_list, PREFETCH_N_NEIGHBOURS);
+
+	/* The user jumped elsewhere, stop prefetching messages which
+	 * are not around the cursor; the one under it is left alone,
+	 * it is going to be displayed. */
+	g_hash_table_iter_init (&iter, priv->prefetching);
+	while (g_hash_table_iter_next (&iter, &key, &value)) {
+		if (g_strcmp0 (key, message_list->cursor_uid) == 0)
+			continue;
+
+		for (ii = 0; ii < uids->len; ii++) {
+			if (g_strcmp0 (key, uids->pdata[ii]) == 0)
+				break;
+		}
+
+		if (ii == uids->len) {
+			g_cancellable_cancel (value);
+			g_hash_table_iter_remove (&iter);
+		}
+	}
+
+	folder = e_mail_reader_ref_folder (reader);
+
+	if (!start || folder == NULL)
+		goto exit;
+
+	backend = e_mail_reader_get_backend (reader);
+	session = e_mail_backend_get_session (backend);
+
+	for (ii = 0; ii < uids->len; ii++) {
+		const gchar *message_uid = uids->pdata[ii];
+		GSimpleAsyncResult *simple;
+		GCancellable *cancellable;
+		PrefetchContext *context;
+		CamelMessageInfo *info;
+		EMailPartList *part_list;
+		gsize size;
+
+		if (g_hash_table_contains (priv->prefetching, message_uid))
+			continue;
+
+		/* Already parsed, possibly shown in another window. */
+		part_list = mail_reader_ref_parsed_part_list (folder, message_uid);
+		if (part_list != NULL) {
+			mail_reader_prefetch_touch (priv, part_list);
+			g_object_unref (part_list);
+			continue;
+		}
+
+		info = camel_folder_get_message_info (folder, message_uid);
+		if (info == NULL)
+			continue;
+
+		size = camel_message_info_size (info);
+		camel_message_info_unref (info);
+
+		/* Do not download large attachments the user
+		 * might not be interested in. */
+		if (size > PREFETCH_MEMORY_BUDGET / (2 * PREFETCH_N_NEIGHBOURS))
+			continue;
+
+		context = g_slice_new0 (PrefetchContext);
+		context->folder = g_object_ref (folder);
+		context->session = g_object_ref (session);
+		context->message_uid = g_strdup (message_uid);
+		context->size = size;
+
+		cancellable = g_cancellable_new ();
+
+		g_hash_table_insert (
+			priv->prefetching,
+			g_strdup (message_uid),
+			g_object_ref (cancellable));
+
+		simple = g_simple_async_result_new (
+			G_OBJECT (reader),
+			mail_reader_prefetch_done_cb, cancellable,
+			mail_reader_prefetch_neighbours);
+
+		g_simple_async_result_set_check_cancellable (simple, cancellable);
+
+		g_simple_async_result_set_op_res_gpointer (
+			simple, context, (GDestroyNotify) prefetch_context_free);
+
+		g_simple_async_result_run_in_thread (
+			simple, mail_reader_prefetch_run,
+			G_PRIORITY_LOW, cancellable);
+
+		g_object_unref (simple);
+	}
+
+exit:
+	g_clear_object (&folder);
+	g_ptr_array_unref (uids);
+}
+
 static void
 mail_reader_message_loaded_cb (CamelFolder *folder,
                                GAsyncResult *result,
@@ -2981,6 +3333,7 @@ mail_reader_message_selected_timeout_cb (gpointer user_data)
 	const gchar *cursor_uid;
 	const gchar *format_uid;
 	EMailPartList *parts;
+	EMailPartList *prefetched = NULL;
 
 	reader = E_MAIL_READER (user_data);
 	priv = E_MAIL_READER_GET_PRIVATE (reader);
@@ -3006,7 +3359,23 @@ mail_reader_message_selected_timeout_cb (gpointer user_data)
 
 		selected_uid_changed = (g_strcmp0 (cursor_uid, format_uid) != 0);
 
-		if (display_visible && selected_uid_changed) {
+		if (display_visible && selected_uid_changed)
+			prefetched = mail_reader_ref_prefetched (reader, cursor_uid);
+
+		if (prefetched != NULL) {
+			gchar *message_uid;
+
+			/* Fetched and parsed already, show it right away. */
+			message_uid = g_strdup (cursor_uid);
+
+			g_signal_emit (
+				reader, signals[MESSAGE_LOADED], 0, message_uid,
+				e_mail_part_list_get_message (prefetched));
+
+			g_object_unref (prefetched);
+			g_free (message_uid);
+
+		} else if (display_visible && selected_uid_changed) {
 			EMailReaderClosure *closure;
 			GCancellable *cancellable;
 			CamelFolder *folder;
@@ -3062,6 +3431,9 @@ mail_reader_message_selected_cb (EMailReader *reader,
 	/* Cancel the previous message retrieval activity. */
 	g_cancellable_cancel (priv->retrieving_message);
 
+	/* Cancel prefetching of messages far from the new one. */
+	mail_reader_prefetch_neighbours (reader, FALSE);
+
 	/* Cancel the message selected timer. */
 	if (priv->message_selected_timeout_id > 0) {
 		g_source_remove (priv->message_selected_timeout_id);
@@ -3116,8 +3488,19 @@ mail_reader_message_selected_cb (EMailReader *reader,
 		mail_reader_message_selected_timeout_cb (reader);
 
 	} else {
-		priv->message_selected_timeout_id = e_named_timeout_add (
-			100, mail_reader_message_selected_timeout_cb, reader);
+		EMailPartList *prefetched;
+
+		prefetched = mail_reader_ref_prefetched (
+			reader, message_list->cursor_uid);
+
+		/* Nothing to wait for when the message was prefetched. */
+		if (prefetched != NULL) {
+			g_object_unref (prefetched);
+			mail_reader_message_selected_timeout_cb (reader);
+		} else {
+			priv->message_selected_timeout_id = e_named_timeout_add (
+				100, mail_reader_message_selected_timeout_cb, reader);
+		}
 	}
 
 	e_mail_reader_changed (reader);
@@ -3240,6 +3623,8 @@ mail_reader_set_folder (EMailReader *reader,
 	if (folder != previous_folder) {
 		e_web_view_clear (E_WEB_VIEW (display));
 
+		mail_reader_prefetch_cancel_all (priv);
+
 		priv->folder_was_just_selected = (folder != NULL) && !priv->mark_seen_always;
 		priv->did_try_to_open_message = FALSE;
 
@@ -3341,6 +3726,8 @@ mail_reader_set_display_formatter_for_message (EMailReader *reader,
 		e_mail_display_load (display, NULL);
 		g_object_unref (parts);
 	}
+
+	mail_reader_prefetch_neighbours (reader, TRUE);
 }
 
 static void
@@ -4007,6 +4394,7 @@ e_mail_reader_init (EMailReader *reader,
                     gboolean connect_signals)
 {
 	EMenuToolAction *menu_tool_action;
+	EMailReaderPrivate *priv;
 	GtkActionGroup *action_group;
 	GtkWidget *message_list;
 	GtkAction *action;
@@ -4020,9 +4408,15 @@ e_mail_reader_init (EMailReader *reader,
 	display = e_mail_reader_get_mail_display (reader);
 
 	/* Initialize a private struct. */
+	priv = g_slice_new0 (EMailReaderPrivate);
+	priv->prefetching = g_hash_table_new_full (
+		g_str_hash, g_str_equal,
+		(GDestroyNotify) g_free,
+		(GDestroyNotify) g_object_unref);
+	g_queue_init (&priv->prefetched);
+
 	g_object_set_qdata_full (
-		G_OBJECT (reader), quark_private,
-		g_slice_new0 (EMailReaderPrivate),
+		G_OBJECT (reader), quark_private, priv,
 		(GDestroyNotify) mail_reader_private_free);
 
 	e_binding_bind_property (
@@ -55,10 +55,142 @@ struct _EMailRequestPrivate {
 	gchar *ret_mime_type;
 };
 
+/* Formatted output of recent requests, thus collapsing the headers,
+ * changing the charset back or WebKit loading the same frame again
+ * does not format the message anew.  Entries of a part list are
+ * dropped as soon as the part list is finalized. */
+#define FORMATTED_CACHE_MAX_ITEMS 32
+#define FORMATTED_CACHE_MAX_SIZE (16 * 1024 * 1024)
+
+typedef struct _FormattedItem {
+	gchar *key;
+	gpointer part_list; /* not referenced */
+	GBytes *bytes;
+} FormattedItem;
+
+static GHashTable *formatted_cache;	/* key ~> GList in formatted_lru */
+static GHashTable *formatted_part_lists;	/* EMailPartList * set */
+static GQueue formatted_lru = G_QUEUE_INIT;	/* most recent first */
+static gsize formatted_size;
+static volatile gint formatted_generation;	/* bumped on flush */
+G_LOCK_DEFINE_STATIC (formatted_cache);
+
 static const gchar *data_schemes[] = { "mail", NULL };
 
 G_DEFINE_TYPE (EMailRequest, e_mail_request, SOUP_TYPE_REQUEST)
 
+static void
+formatted_cache_remove_link (GList *link)
+{
+	FormattedItem *item = link->data;
+
+	g_hash_table_remove (formatted_cache, item->key);
+	g_queue_delete_link (&formatted_lru, link);
+	formatted_size -= g_bytes_get_size (item->bytes);
+
+	g_free (item->key);
+	g_bytes_unref (item->bytes);
+	g_slice_free (FormattedItem, item);
+}
+
+static void
+formatted_cache_part_list_finalized_cb (gpointer user_data,
+                                        GObject *where_the_object_was)
+{
+	GList *link;
+
+	G_LOCK (formatted_cache);
+
+	link = g_queue_peek_head_link (&formatted_lru);
+	while (link != NULL) {
+		FormattedItem *item = link->data;
+		GList *next = g_list_next (link);
+
+		if (item->part_list == (gpointer) where_the_object_was)
+			formatted_cache_remove_link (link);
+
+		link = next;
+	}
+
+	g_hash_table_remove (formatted_part_lists, where_the_object_was);
+
+	G_UNLOCK (formatted_cache);
+}
+
+static GBytes *
+formatted_cache_lookup (const gchar *key)
+{
+	GBytes *bytes = NULL;
+	GList *link;
+
+	G_LOCK (formatted_cache);
+
+	if (formatted_cache != NULL) {
+		link = g_hash_table_lookup (formatted_cache, key);
+
+		if (link != NULL) {
+			FormattedItem *item = link->data;
+
+			g_queue_unlink (&formatted_lru, link);
+			g_queue_push_head_link (&formatted_lru, link);
+
+			bytes = g_bytes_ref (item->bytes);
+		}
+	}
+
+	G_UNLOCK (formatted_cache);
+
+	return bytes;
+}
+
+static void
+formatted_cache_add (const gchar *key,
+                     EMailPartList *part_list,
+                     GBytes *bytes)
+{
+	FormattedItem *item;
+	GList *link;
+
+	if (g_bytes_get_size (bytes) > FORMATTED_CACHE_MAX_SIZE / 4)
+		return;
+
+	G_LOCK (formatted_cache);
+
+	if (formatted_cache == NULL) {
+		formatted_cache = g_hash_table_new (g_str_hash, g_str_equal);
+		formatted_part_lists = g_hash_table_new (NULL, NULL);
+	}
+
+	link = g_hash_table_lookup (formatted_cache, key);
+	if (link != NULL)
+		formatted_cache_remove_link (link);
+
+	if (!g_hash_table_contains (formatted_part_lists, part_list)) {
+		g_hash_table_add (formatted_part_lists, part_list);
+		g_object_weak_ref (
+			G_OBJECT (part_list),
+			formatted_cache_part_list_finalized_cb, NULL);
+	}
+
+	item = g_slice_new (FormattedItem);
+	item->key = g_strdup (key);
+	item->part_list = part_list;
+	item->bytes = g_bytes_ref (bytes);
+
+	g_queue_push_head (&formatted_lru, item);
+	g_hash_table_insert (
+		formatted_cache, item->key,
+		g_queue_peek_head_link (&formatted_lru));
+	formatted_size += g_bytes_get_size (bytes);
+
+	while (g_queue_get_length (&formatted_lru) > FORMATTED_CACHE_MAX_ITEMS ||
+	       formatted_size > FORMATTED_CACHE_MAX_SIZE)
+		formatted_cache_remove_link (
+			g_queue_peek_tail_link (&formatted_lru));
+
+	G_UNLOCK (formatted_cache);
+}
+
 static void
 handle_mail_request (GSimpleAsyncResult *simple,
                      GObject *object,
@@ -72,6 +204,9 @@ handle_mail_request (GSimpleAsyncResult *simple,
 	GOutputStream *output_stream;
 	const gchar *val;
 	const gchar *default_charset, *charset;
+	const gchar *query_part_id, *query_mime_type;
+	gchar *cache_key;
+	gboolean formatted = FALSE;
 
 	EMailFormatterContext context = { 0 };
 
@@ -108,6 +243,35 @@ handle_mail_request (GSimpleAsyncResult *simple,
 	charset = g_hash_table_lookup (
 		request->priv->uri_query, "formatter_charset");
 
+	query_part_id = g_hash_table_lookup (
+		request->priv->uri_query, "part_id");
+	query_mime_type = g_hash_table_lookup (
+		request->priv->uri_query, "mime_type");
+
+	/* The part list itself is part of the key, because
+	 * a message can be parsed again under the same URI.
+	 * The generation keeps content formatted before a
+	 * flush, but added after it, from being used. */
+	cache_key = g_strdup_printf (
+		"%s\n%p\n%d\n%s\n%d\n%u\n%s\n%s\n%s",
+		request->priv->uri_base, part_list,
+		g_atomic_int_get (&formatted_generation),
+		query_part_id ? query_part_id : "",
+		context.mode, context.flags,
+		charset ? charset : "",
+		default_charset ? default_charset : "",
+		query_mime_type ? query_mime_type : "");
+
+	if (request->priv->bytes != NULL)
+		g_bytes_unref (request->priv->bytes);
+
+	request->priv->bytes = formatted_cache_lookup (cache_key);
+
+	if (request->priv->bytes != NULL) {
+		g_free (cache_key);
+		goto exit;
+	}
+
 	context.part_list = g_object_ref (part_list);
 	context.uri = request->priv->full_uri;
 
@@ -178,14 +342,13 @@ handle_mail_request (GSimpleAsyncResult *simple,
 			context.flags, context.mode, cancellable);
 	}
 
+	formatted = !g_cancellable_is_cancelled (cancellable);
+
  no_part:
 	g_clear_object (&context.part_list);
 
 	g_output_stream_close (output_stream, NULL, NULL);
 
-	if (request->priv->bytes != NULL)
-		g_bytes_unref (request->priv->bytes);
-
 	request->priv->bytes = g_memory_output_stream_steal_as_bytes (
 		G_MEMORY_OUTPUT_STREAM (output_stream));
 
@@ -203,6 +366,14 @@ handle_mail_request (GSimpleAsyncResult *simple,
 			data, strlen (data) + 1);
 	}
 
+	if (formatted)
+		formatted_cache_add (cache_key, part_list, request->priv->bytes);
+
+	g_free (cache_key);
+	g_object_unref (output_stream);
+	g_object_unref (formatter);
+
+ exit:
 	input_stream =
 		g_memory_input_stream_new_from_bytes (request->priv->bytes);
 
@@ -211,10 +382,7 @@ handle_mail_request (GSimpleAsyncResult *simple,
 		(GDestroyNotify) g_object_unref);
 
 	g_object_unref (input_stream);
-	g_object_unref (output_stream);
-
 	g_object_unref (part_list);
-	g_object_unref (formatter);
 }
 
 static GInputStream *
@@ -470,3 +638,19 @@ e_mail_request_init (EMailRequest *request)
 	request->priv = E_MAIL_REQUEST_GET_PRIVATE (request);
 }
 
+/* Drops all the formatted content, which the formatter settings used for
+ * it are not part of the key of.  Call this when those change, that is
+ * when a mail display reloads its content. */
+void
+e_mail_request_flush_formatted (void)
+{
+	G_LOCK (formatted_cache);
+
+	g_atomic_int_inc (&formatted_generation);
+
+	while (!g_queue_is_empty (&formatted_lru))
+		formatted_cache_remove_link (
+			g_queue_peek_head_link (&formatted_lru));
+
+	G_UNLOCK (formatted_cache);
+}
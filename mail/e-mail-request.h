@@ -58,6 +58,7 @@ struct _EMailRequestClass {
 };
 
 GType		e_mail_request_get_type		(void) G_GNUC_CONST;
+void		e_mail_request_flush_formatted	(void);
 
 G_END_DECLS
 
@@ -29,7 +29,6 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
-#include <fcntl.h>
 
 #include <glib/gstdio.h>
 #include <glib/gi18n.h>
@@ -102,39 +101,260 @@ decode_mozilla_status (const gchar *tmp)
 	return flags;
 }
 
-static void
-import_mbox_add_message (CamelFolder *folder,
-			 CamelMimeMessage *msg,
-			 GCancellable *cancellable,
-			 GError **error)
+static CamelMessageInfo *
+import_mbox_new_info (CamelMimeMessage *msg,
+		      guint32 flags,
+		      gboolean decode_status_headers)
 {
 	CamelMessageInfo *info;
 	CamelMedium *medium;
-	guint32 flags = 0;
 	const gchar *tmp;
 
-	g_return_if_fail (CAMEL_IS_FOLDER (folder));
-	g_return_if_fail (CAMEL_IS_MIME_MESSAGE (msg));
-
 	medium = CAMEL_MEDIUM (msg);
 
-	tmp = camel_medium_get_header (medium, "X-Mozilla-Status");
-	if (tmp)
-		flags |= decode_mozilla_status (tmp);
-	tmp = camel_medium_get_header (medium, "Status");
-	if (tmp)
-		flags |= decode_status (tmp);
-	tmp = camel_medium_get_header (medium, "X-Status");
-	if (tmp)
-		flags |= decode_status (tmp);
+	if (decode_status_headers) {
+		tmp = camel_medium_get_header (medium, "X-Mozilla-Status");
+		if (tmp)
+			flags |= decode_mozilla_status (tmp);
+		tmp = camel_medium_get_header (medium, "Status");
+		if (tmp)
+			flags |= decode_status (tmp);
+		tmp = camel_medium_get_header (medium, "X-Status");
+		if (tmp)
+			flags |= decode_status (tmp);
+	}
 
 	info = camel_message_info_new (NULL);
-
 	camel_message_info_set_flags (info, flags, ~0);
-	camel_folder_append_message_sync (
-		folder, msg, info, NULL,
-		cancellable, error);
-	camel_message_info_unref (info);
+
+	return info;
+}
+
+/* The import pipeline: messages are split out of memory-mapped files
+ * by the caller, parsed by a pool of threads, and appended to the folder
+ * in their original order, in batches of those parsed already, while
+ * the parsers continue.  The folder is frozen for the whole import. */
+
+/* How many messages can wait for being parsed or appended */
+#define IMPORT_MAX_PENDING 256
+
+typedef struct _ImportItem {
+	GMappedFile *mapped;
+	const gchar *data;
+	gsize length;
+	guint32 flags;
+	goffset progress; /* bytes done once this is appended */
+
+	gboolean parsed;
+	CamelMimeMessage *message; /* NULL when failed to parse */
+	CamelMessageInfo *info;
+} ImportItem;
+
+typedef struct _ImportPipeline {
+	CamelFolder *folder;
+	GCancellable *operation; /* for progress */
+	GCancellable *cancellable;
+	gboolean decode_status_headers;
+	goffset total_bytes;
+
+	GThreadPool *parsers;
+	GMutex lock;
+	GCond cond;
+	GQueue items; /* ImportItem, in order of appends */
+	volatile gint stop;
+	GError *error;
+} ImportPipeline;
+
+static void
+import_item_free (ImportItem *item)
+{
+	g_clear_object (&item->message);
+	if (item->info)
+		camel_message_info_unref (item->info);
+	g_mapped_file_unref (item->mapped);
+	g_slice_free (ImportItem, item);
+}
+
+static void
+import_pipeline_parse_thread (gpointer data,
+			      gpointer user_data)
+{
+	ImportItem *item = data;
+	ImportPipeline *pipeline = user_data;
+
+	if (!g_atomic_int_get (&pipeline->stop) &&
+	    !g_cancellable_is_cancelled (pipeline->cancellable)) {
+		CamelMimeMessage *msg;
+		GInputStream *stream;
+
+		/* The stream reads directly from the mapped file */
+		stream = g_memory_input_stream_new_from_data (item->data, item->length, NULL);
+		msg = camel_mime_message_new ();
+
+		if (camel_data_wrapper_construct_from_input_stream_sync (
+			CAMEL_DATA_WRAPPER (msg), stream, pipeline->cancellable, NULL)) {
+			item->info = import_mbox_new_info (msg, item->flags, pipeline->decode_status_headers);
+			item->message = msg;
+		} else {
+			g_object_unref (msg);
+		}
+
+		g_object_unref (stream);
+	}
+
+	g_mutex_lock (&pipeline->lock);
+	item->parsed = TRUE;
+	g_cond_broadcast (&pipeline->cond);
+	g_mutex_unlock (&pipeline->lock);
+}
+
+static ImportPipeline *
+import_pipeline_new (CamelFolder *folder,
+		     GCancellable *operation,
+		     GCancellable *cancellable,
+		     gboolean decode_status_headers,
+		     goffset total_bytes)
+{
+	ImportPipeline *pipeline;
+
+	pipeline = g_slice_new0 (ImportPipeline);
+	pipeline->folder = g_object_ref (folder);
+	pipeline->operation = operation;
+	pipeline->cancellable = cancellable;
+	pipeline->decode_status_headers = decode_status_headers;
+	pipeline->total_bytes = total_bytes;
+
+	g_mutex_init (&pipeline->lock);
+	g_cond_init (&pipeline->cond);
+	g_queue_init (&pipeline->items);
+
+	pipeline->parsers = g_thread_pool_new (
+		import_pipeline_parse_thread, pipeline,
+		g_get_num_processors (), FALSE, NULL);
+
+	camel_folder_freeze (folder);
+
+	return pipeline;
+}
+
+/* Appends parsed messages from the head of the queue; with 'wait_for'
+ * set it waits until no more than that many messages are pending */
+static void
+import_pipeline_write (ImportPipeline *pipeline,
+		       guint wait_for)
+{
+	while (TRUE) {
+		GQueue batch = G_QUEUE_INIT;
+		ImportItem *item;
+
+		g_mutex_lock (&pipeline->lock);
+
+		while (item = g_queue_peek_head (&pipeline->items), item &&
+		       !item->parsed && g_queue_get_length (&pipeline->items) > wait_for)
+			g_cond_wait (&pipeline->cond, &pipeline->lock);
+
+		while (item = g_queue_peek_head (&pipeline->items), item && item->parsed)
+			g_queue_push_tail (&batch, g_queue_pop_head (&pipeline->items));
+
+		g_mutex_unlock (&pipeline->lock);
+
+		if (g_queue_is_empty (&batch))
+			break;
+
+		while ((item = g_queue_pop_head (&batch))) {
+			if (item->message && !pipeline->error) {
+				camel_folder_append_message_sync (
+					pipeline->folder, item->message, item->info, NULL,
+					pipeline->cancellable, &pipeline->error);
+
+				if (pipeline->error)
+					g_atomic_int_set (&pipeline->stop, 1);
+			}
+
+			if (!pipeline->error && pipeline->total_bytes > 0)
+				camel_operation_progress (
+					pipeline->operation, (gint) (100.0 *
+					((gdouble) item->progress / (gdouble) pipeline->total_bytes)));
+
+			import_item_free (item);
+		}
+	}
+}
+
+/* Takes a reference of 'mapped'; returns FALSE when the import failed */
+static gboolean
+import_pipeline_push (ImportPipeline *pipeline,
+		      GMappedFile *mapped,
+		      const gchar *data,
+		      gsize length,
+		      guint32 flags,
+		      goffset progress)
+{
+	ImportItem *item;
+
+	if (pipeline->error || g_cancellable_is_cancelled (pipeline->cancellable))
+		return FALSE;
+
+	item = g_slice_new0 (ImportItem);
+	item->mapped = g_mapped_file_ref (mapped);
+	item->data = data;
+	item->length = length;
+	item->flags = flags;
+	item->progress = progress;
+
+	g_mutex_lock (&pipeline->lock);
+	g_queue_push_tail (&pipeline->items, item);
+	g_mutex_unlock (&pipeline->lock);
+
+	g_thread_pool_push (pipeline->parsers, item, NULL);
+
+	import_pipeline_write (pipeline, IMPORT_MAX_PENDING);
+
+	return !pipeline->error;
+}
+
+static void
+import_pipeline_finish (ImportPipeline *pipeline,
+			GError **error)
+{
+	import_pipeline_write (pipeline, 0);
+
+	/* Parsers have nothing left to do here */
+	g_thread_pool_free (pipeline->parsers, FALSE, TRUE);
+
+	g_queue_free_full (&pipeline->items, (GDestroyNotify) import_item_free);
+
+	/* Not passing a GCancellable or GError here. */
+	camel_folder_synchronize_sync (pipeline->folder, FALSE, NULL, NULL);
+	camel_folder_thaw (pipeline->folder);
+
+	if (pipeline->error)
+		g_propagate_error (error, pipeline->error);
+
+	g_mutex_clear (&pipeline->lock);
+	g_cond_clear (&pipeline->cond);
+	g_object_unref (pipeline->folder);
+	g_slice_free (ImportPipeline, pipeline);
+}
+
+/* Returns the start of the next "From " line at or after 'from', or NULL */
+static const gchar *
+import_mbox_find_from_line (const gchar *from,
+			    const gchar *end)
+{
+	const gchar *p = from;
+
+	while (p + 5 <= end) {
+		if (memcmp (p, "From ", 5) == 0)
+			return p;
+
+		p = memchr (p, '\n', end - p);
+		if (!p)
+			break;
+		p++;
+	}
+
+	return NULL;
 }
 
 static void
@@ -143,9 +363,7 @@ import_mbox_exec (struct _import_mbox_msg *m,
                   GError **error)
 {
 	CamelFolder *folder;
-	CamelMimeParser *mp = NULL;
 	struct stat st;
-	gint fd;
 
 	if (g_stat (m->path, &st) == -1) {
 		g_warning (
@@ -166,88 +384,67 @@ import_mbox_exec (struct _import_mbox_msg *m,
 		return;
 
 	if (S_ISREG (st.st_mode)) {
-		gboolean any_read = FALSE;
+		ImportPipeline *pipeline;
+		GMappedFile *mapped;
+		const gchar *contents, *end, *line;
+		GError *local_error = NULL;
 
-		fd = g_open (m->path, O_RDONLY | O_BINARY, 0);
-		if (fd == -1) {
+		mapped = g_mapped_file_new (m->path, FALSE, &local_error);
+		if (mapped == NULL) {
 			g_warning (
-				"cannot find source file to import '%s': %s",
-				m->path, g_strerror (errno));
+				"cannot read source file to import '%s': %s",
+				m->path, local_error->message);
+			g_error_free (local_error);
 			goto fail1;
 		}
 
-		mp = camel_mime_parser_new ();
-		camel_mime_parser_scan_from (mp, TRUE);
-		if (camel_mime_parser_init_with_fd (mp, fd) == -1) {
-			/* will never happen - 0 is unconditionally returned */
-			goto fail2;
-		}
+		contents = g_mapped_file_get_contents (mapped);
+		end = contents + g_mapped_file_get_length (mapped);
 
 		camel_operation_push_message (
 			m->cancellable, _("Importing '%s'"),
 			camel_folder_get_display_name (folder));
-		camel_folder_freeze (folder);
-		while (camel_mime_parser_step (mp, NULL, NULL) ==
-				CAMEL_MIME_PARSER_STATE_FROM) {
-
-			CamelMimeMessage *msg;
-			gint pc = 0;
-
-			any_read = TRUE;
-
-			if (st.st_size > 0)
-				pc = (gint) (100.0 * ((gdouble)
-					camel_mime_parser_tell (mp) /
-					(gdouble) st.st_size));
-			camel_operation_progress (m->cancellable, pc);
-
-			msg = camel_mime_message_new ();
-			if (!camel_mime_part_construct_from_parser_sync (
-				(CamelMimePart *) msg, mp, NULL, NULL)) {
-				/* set exception? */
-				g_object_unref (msg);
-				break;
-			}
 
-			import_mbox_add_message (folder, msg, cancellable, error);
+		pipeline = import_pipeline_new (
+			folder, m->cancellable, cancellable, TRUE,
+			g_mapped_file_get_length (mapped));
 
-			g_object_unref (msg);
-
-			if (error && *error != NULL)
-				break;
-
-			camel_mime_parser_step (mp, NULL, NULL);
-		}
+		line = contents ? import_mbox_find_from_line (contents, end) : NULL;
 
-		if (!any_read) {
-			CamelStream *stream;
+		if (line) {
+			while (line) {
+				const gchar *message, *next;
 
-			stream = camel_stream_fs_new_with_name (m->path, O_RDONLY, 0, NULL);
-			if (stream) {
-				CamelMimeMessage *msg;
+				/* The "From " line itself is not part of the message */
+				message = memchr (line, '\n', end - line);
+				message = message ? message + 1 : end;
 
-				msg = camel_mime_message_new ();
+				next = import_mbox_find_from_line (message, end);
 
-				if (camel_data_wrapper_construct_from_stream_sync ((CamelDataWrapper *) msg, stream, NULL, NULL))
-					import_mbox_add_message (folder, msg, cancellable, error);
+				if (!import_pipeline_push (
+					pipeline, mapped, message,
+					(next ? next : end) - message, 0,
+					(next ? next : end) - contents))
+					break;
 
-				g_object_unref (msg);
-				g_object_unref (stream);
+				line = next;
 			}
+		} else if (contents) {
+			/* Not an mbox, try it as a single message */
+			import_pipeline_push (
+				pipeline, mapped, contents,
+				end - contents, 0, end - contents);
 		}
-		/* Not passing a GCancellable or GError here. */
-		camel_folder_synchronize_sync (folder, FALSE, NULL, NULL);
-		camel_folder_thaw (folder);
+
+		import_pipeline_finish (pipeline, error);
 		camel_operation_pop_message (m->cancellable);
-	fail2:
-		g_object_unref (mp);
+
+		g_mapped_file_unref (mapped);
 	}
 fail1:
 	/* Not passing a GCancellable or GError here. */
 	camel_folder_synchronize_sync (folder, FALSE, NULL, NULL);
 	g_object_unref (folder);
-	/* 'fd' is freed together with 'mp' */
-	/* coverity[leaked_handle] */
 }
 
 static void
@@ -267,6 +464,19 @@ import_mbox_free (struct _import_mbox_msg *m)
 	g_free (m->path);
 }
 
+typedef struct _KMailFile {
+	gchar *filename;
+	guint32 flags;
+	goffset size;
+} KMailFile;
+
+static void
+kmail_file_free (KMailFile *file)
+{
+	g_free (file->filename);
+	g_slice_free (KMailFile, file);
+}
+
 static void
 import_kmail_folder (struct _import_mbox_msg *m,
                      gchar *k_path_in,
@@ -277,10 +487,10 @@ import_kmail_folder (struct _import_mbox_msg *m,
 	gchar *special_path;
 	const CamelStore *store;
 	CamelFolder *folder;
-	CamelMimeParser *mp = NULL;
-	CamelMessageInfo *info;
-	CamelMimeMessage *msg;
-	guint32 flags = 0;
+	ImportPipeline *pipeline;
+	GQueue files = G_QUEUE_INIT;
+	KMailFile *file;
+	goffset total_bytes = 0, done_bytes = 0;
 
 	gchar *e_uri, *e_path;
 	gchar *k_path;
@@ -288,7 +498,7 @@ import_kmail_folder (struct _import_mbox_msg *m,
 	gchar *mail_url;
 	GDir *dir;
 	struct stat st;
-	gint fd, i;
+	gint i;
 
 	e_uri = kuri_to_euri (k_path_in);
 	/* we need to drop some folders, like: Trash */
@@ -310,68 +520,78 @@ import_kmail_folder (struct _import_mbox_msg *m,
 		return;
 	}
 
-	camel_operation_push_message (
-			m->cancellable, _("Importing '%s'"),
-			camel_folder_get_display_name (folder));
-	camel_folder_freeze (folder);
-
+	/* Collect the messages first, to report progress in bytes */
 	for (i = 0; special_folders [i]; i++) {
-		camel_operation_progress (m->cancellable, 100*i/3);
+		guint32 flags = 0;
+
+		if (strcmp (special_folders[i], "cur") == 0) {
+			flags = CAMEL_MESSAGE_SEEN;
+		} else if (strcmp (special_folders[i], "tmp") == 0) {
+			flags = CAMEL_MESSAGE_DELETED; /* Mark the 'tmp' mails as 'deleted' */
+		}
+
 		special_path = g_build_filename (k_path, special_folders[i], NULL);
 		dir = g_dir_open (special_path, 0, NULL);
-		while ((d = g_dir_read_name (dir))) {
+		while (dir && (d = g_dir_read_name (dir))) {
 			if ((strcmp (d, ".") == 0) || (strcmp (d, "..") == 0)) {
 				continue;
 			}
 			mail_url = g_build_filename (special_path, d, NULL);
-			if (g_stat (mail_url, &st) == -1) {
+			if (g_stat (mail_url, &st) == -1 || !S_ISREG (st.st_mode)) {
 				g_free (mail_url);
 				continue;
 			}
-			if (S_ISREG (st.st_mode)) {
-				fd = g_open (mail_url, O_RDONLY | O_BINARY, 0);
-				g_free (mail_url);
-				if (fd == -1) {
-					continue;
-				}
-				mp = camel_mime_parser_new ();
-				camel_mime_parser_scan_from (mp, FALSE);
-				if (camel_mime_parser_init_with_fd (mp, fd) == -1) {
-					/* will never happen - 0 is unconditionally returned */
-					g_object_unref (mp);
-					continue;
-				}
-				msg = camel_mime_message_new ();
-				if (!camel_mime_part_construct_from_parser_sync (
-						(CamelMimePart *) msg, mp, NULL, NULL)) {
-					/* set exception? */
-					g_object_unref (mp);
-					g_object_unref (msg);
-					continue;
-				}
-				info = camel_message_info_new (NULL);
-				if (strcmp (special_folders[i], "cur") == 0) {
-					flags |= CAMEL_MESSAGE_SEEN;
-				} else if (strcmp (special_folders[i], "tmp") == 0) {
-					flags |= CAMEL_MESSAGE_DELETED; /* Mark the 'tmp' mails as 'deleted' */
-				}
-				camel_message_info_set_flags (info, flags, ~0);
-				camel_folder_append_message_sync (
-					folder, msg, info, NULL,
-					cancellable, error);
-				camel_message_info_unref (info);
-				g_object_unref (msg);
-				g_object_unref (mp);
-			} else {
-				g_free (mail_url);
-			}
+
+			file = g_slice_new (KMailFile);
+			file->filename = mail_url;
+			file->flags = flags;
+			file->size = st.st_size;
+			g_queue_push_tail (&files, file);
+
+			total_bytes += st.st_size;
 		}
+		if (dir)
+			g_dir_close (dir);
+		g_free (special_path);
 	}
+
+	camel_operation_push_message (
+			m->cancellable, _("Importing '%s'"),
+			camel_folder_get_display_name (folder));
+
+	pipeline = import_pipeline_new (folder, m->cancellable, cancellable, FALSE, total_bytes);
+
+	while ((file = g_queue_pop_head (&files))) {
+		GMappedFile *mapped;
+		gboolean success = TRUE;
+
+		done_bytes += file->size;
+
+		mapped = g_mapped_file_new (file->filename, FALSE, NULL);
+		if (mapped && g_mapped_file_get_length (mapped) > 0) {
+			success = import_pipeline_push (
+				pipeline, mapped,
+				g_mapped_file_get_contents (mapped),
+				g_mapped_file_get_length (mapped),
+				file->flags, done_bytes);
+		}
+
+		if (mapped)
+			g_mapped_file_unref (mapped);
+		kmail_file_free (file);
+
+		if (!success)
+			break;
+	}
+
+	g_queue_foreach (&files, (GFunc) kmail_file_free, NULL);
+	g_queue_clear (&files);
+
+	import_pipeline_finish (pipeline, error);
 	camel_operation_progress (m->cancellable, 100);
-	camel_folder_synchronize_sync (folder, FALSE, NULL, NULL);
-	camel_folder_thaw (folder);
 	camel_operation_pop_message (m->cancellable);
 
+	g_object_unref (folder);
 	g_free (k_path);
 }
 
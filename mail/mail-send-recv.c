@@ -1176,6 +1176,46 @@ test_should_delete_junk_or_expunge (CamelStore *store,
 	g_object_unref (settings);
 }
 
+/* Upper limit of folders refreshed at once in one store. */
+#define REFRESH_MAX_CONCURRENT 8
+
+struct _refresh_folder {
+	gchar *uri;
+	gchar *full_name;
+	gboolean is_inbox;
+	gint64 last_activity;
+	gint unread_delta;
+	guint index;
+	gboolean is_priority;
+};
+
+static void
+refresh_folder_free (struct _refresh_folder *rf)
+{
+	g_free (rf->uri);
+	g_free (rf->full_name);
+	g_slice_free (struct _refresh_folder, rf);
+}
+
+static gint
+refresh_folder_compare (gconstpointer a,
+                        gconstpointer b)
+{
+	const struct _refresh_folder *rf1 = *((struct _refresh_folder **) a);
+	const struct _refresh_folder *rf2 = *((struct _refresh_folder **) b);
+
+	if (rf1->is_inbox != rf2->is_inbox)
+		return rf1->is_inbox ? -1 : 1;
+
+	if (rf1->last_activity != rf2->last_activity)
+		return rf1->last_activity > rf2->last_activity ? -1 : 1;
+
+	if (ABS (rf1->unread_delta) != ABS (rf2->unread_delta))
+		return ABS (rf1->unread_delta) > ABS (rf2->unread_delta) ? -1 : 1;
+
+	return rf1->index < rf2->index ? -1 : rf1->index > rf2->index ? 1 : 0;
+}
+
 static void
 get_folders (CamelStore *store,
              GPtrArray *folders,
@@ -1184,11 +1224,18 @@ get_folders (CamelStore *store,
 	while (info) {
 		if (camel_store_can_refresh_folder (store, info, NULL)) {
 			if ((info->flags & CAMEL_FOLDER_NOSELECT) == 0) {
-				gchar *folder_uri;
+				struct _refresh_folder *rf;
 
-				folder_uri = e_mail_folder_uri_build (
+				rf = g_slice_new0 (struct _refresh_folder);
+				rf->uri = e_mail_folder_uri_build (
 					store, info->full_name);
-				g_ptr_array_add (folders, folder_uri);
+				rf->full_name = g_strdup (info->full_name);
+				rf->is_inbox =
+					(info->flags & CAMEL_FOLDER_TYPE_MASK) == CAMEL_FOLDER_TYPE_INBOX ||
+					g_ascii_strcasecmp (info->full_name, "INBOX") == 0;
+				rf->index = folders->len;
+
+				g_ptr_array_add (folders, rf);
 			}
 		}
 
@@ -1204,6 +1251,31 @@ main_op_cancelled_cb (GCancellable *main_op,
 	g_cancellable_cancel (refresh_op);
 }
 
+/* Shared by the refresh threads.  It outlives the refresh_folders_msg,
+ * which completes once the priority folders are refreshed, while the
+ * rest of the folders are refreshed in the background. */
+struct _refresh_folders_context {
+	volatile gint ref_count;
+
+	GMutex lock;
+	GCond cond;
+
+	CamelSession *session;
+	CamelStore *store;
+	GPtrArray *folders;
+	GCancellable *cancellable;
+
+	/* The Send/Receive operation, for progress; NULL once it completed */
+	GCancellable *progress;
+
+	GHashTable *known_errors;
+	gboolean expunge;
+	gboolean stop;
+	guint n_done;
+	guint n_priority;
+	guint n_priority_pending;
+};
+
 struct _refresh_folders_msg {
 	MailMsg base;
 
@@ -1213,6 +1285,29 @@ struct _refresh_folders_msg {
 	CamelFolderInfo *finfo;
 };
 
+static struct _refresh_folders_context *
+refresh_folders_context_ref (struct _refresh_folders_context *context)
+{
+	g_atomic_int_inc (&context->ref_count);
+
+	return context;
+}
+
+static void
+refresh_folders_context_unref (struct _refresh_folders_context *context)
+{
+	if (g_atomic_int_dec_and_test (&context->ref_count)) {
+		g_object_unref (context->session);
+		g_object_unref (context->store);
+		g_ptr_array_unref (context->folders);
+		g_clear_object (&context->cancellable);
+		g_hash_table_destroy (context->known_errors);
+		g_mutex_clear (&context->lock);
+		g_cond_clear (&context->cond);
+		g_slice_free (struct _refresh_folders_context, context);
+	}
+}
+
 static gchar *
 refresh_folders_desc (struct _refresh_folders_msg *m)
 {
@@ -1221,17 +1316,121 @@ refresh_folders_desc (struct _refresh_folders_msg *m)
 		camel_service_get_display_name (CAMEL_SERVICE (m->store)));
 }
 
+static gint
+refresh_folders_get_max_threads (CamelStore *store)
+{
+	CamelSettings *settings;
+	gint max_threads;
+
+	settings = camel_service_ref_settings (CAMEL_SERVICE (store));
+
+	if (settings != NULL && g_object_class_find_property (
+	    G_OBJECT_GET_CLASS (settings), "concurrent-connections") != NULL) {
+		guint concurrent_connections = 1;
+
+		g_object_get (
+			settings, "concurrent-connections",
+			&concurrent_connections, NULL);
+
+		max_threads = concurrent_connections;
+	} else if (CAMEL_IS_NETWORK_SERVICE (store)) {
+		/* Do not open more connections than the user asked for. */
+		max_threads = 1;
+	} else {
+		max_threads = MIN (g_get_num_processors (), 4);
+	}
+
+	g_clear_object (&settings);
+
+	return CLAMP (max_threads, 1, REFRESH_MAX_CONCURRENT);
+}
+
+static void
+refresh_folders_thread (gpointer data,
+                        gpointer user_data)
+{
+	struct _refresh_folder *rf = data;
+	struct _refresh_folders_context *context = user_data;
+	CamelFolder *folder = NULL;
+	gboolean stop;
+	GError *local_error = NULL;
+
+	g_mutex_lock (&context->lock);
+	stop = context->stop;
+	g_mutex_unlock (&context->lock);
+
+	if (stop || g_cancellable_is_cancelled (context->cancellable))
+		goto exit;
+
+	folder = e_mail_session_uri_to_folder_sync (
+		E_MAIL_SESSION (context->session),
+		rf->uri, 0, context->cancellable, &local_error);
+	if (folder && camel_folder_synchronize_sync (folder, context->expunge, context->cancellable, &local_error))
+		camel_folder_refresh_info_sync (folder, context->cancellable, &local_error);
+
+	if (local_error != NULL) {
+		g_mutex_lock (&context->lock);
+
+		if (g_hash_table_contains (context->known_errors, local_error->message)) {
+			/* Received the same error message multiple times; there can be some
+			   connection issue probably, thus skip the rest folder updates for now */
+			context->stop = TRUE;
+		} else if (!g_error_matches (local_error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+			CamelStore *store;
+			const gchar *full_name;
+
+			if (folder) {
+				store = camel_folder_get_parent_store (folder);
+				full_name = camel_folder_get_full_name (folder);
+			} else {
+				store = context->store;
+				full_name = rf->full_name;
+			}
+
+			report_error_to_ui (CAMEL_SERVICE (store), full_name, local_error);
+
+			/* To not report one error for multiple folders multiple times */
+			g_hash_table_insert (context->known_errors, g_strdup (local_error->message), GINT_TO_POINTER (1));
+		}
+
+		g_mutex_unlock (&context->lock);
+
+		g_clear_error (&local_error);
+	}
+
+	g_clear_object (&folder);
+
+exit:
+	g_mutex_lock (&context->lock);
+
+	context->n_done++;
+
+	/* The progress covers the priority folders only. */
+	if (context->progress != NULL && context->n_done <= context->n_priority)
+		camel_operation_progress (
+			context->progress, 100 * context->n_done / context->n_priority);
+
+	if (rf->is_priority) {
+		context->n_priority_pending--;
+		g_cond_broadcast (&context->cond);
+	}
+
+	g_mutex_unlock (&context->lock);
+
+	refresh_folders_context_unref (context);
+}
+
 static void
 refresh_folders_exec (struct _refresh_folders_msg *m,
                       GCancellable *cancellable,
                       GError **error)
 {
-	CamelFolder *folder;
+	struct _refresh_folders_context *context;
+	MailFolderCache *folder_cache;
+	GThreadPool *thread_pool;
 	gint i;
 	gboolean success;
 	gboolean delete_junk = FALSE, expunge = FALSE;
-	GHashTable *known_errors;
-	GError *local_error = NULL;
 	gulong handler_id = 0;
 
 	if (cancellable)
@@ -1255,58 +1454,69 @@ refresh_folders_exec (struct _refresh_folders_msg *m,
 		goto exit;
 	}
 
-	known_errors = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+	folder_cache = e_mail_session_get_folder_cache (
+		E_MAIL_SESSION (m->info->session));
+
+	context = g_slice_new0 (struct _refresh_folders_context);
+	context->ref_count = 1;
+	g_mutex_init (&context->lock);
+	g_cond_init (&context->cond);
+	context->session = g_object_ref (m->info->session);
+	context->store = g_object_ref (m->store);
+	context->folders = g_ptr_array_ref (m->folders);
+	if (cancellable)
+		context->cancellable = g_object_ref (cancellable);
+	context->progress = m->info->cancellable;
+	context->known_errors = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+	context->expunge = expunge;
 
+	/* Inbox-class folders first, then those which changed recently,
+	 * so that the new mail is where the user looks for it early. */
 	for (i = 0; i < m->folders->len; i++) {
-		folder = e_mail_session_uri_to_folder_sync (
-			E_MAIL_SESSION (m->info->session),
-			m->folders->pdata[i], 0,
-			cancellable, &local_error);
-		if (folder && camel_folder_synchronize_sync (folder, expunge, cancellable, &local_error))
-			camel_folder_refresh_info_sync (folder, cancellable, &local_error);
-
-		if (local_error != NULL) {
-			if (g_hash_table_contains (known_errors, local_error->message)) {
-				/* Received the same error message multiple times; there can be some
-				   connection issue probably, thus skip the rest folder updates for now */
-				g_clear_object (&folder);
-				g_clear_error (&local_error);
-				break;
-			} else if (!g_error_matches (local_error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
-				CamelStore *store = m->store;
-				const gchar *full_name;
-
-				if (folder) {
-					store = camel_folder_get_parent_store (folder);
-					full_name = camel_folder_get_full_name (folder);
-				} else {
-					store = m->store;
-					full_name = (const gchar *) m->folders->pdata[i];
-				}
-
-				report_error_to_ui (CAMEL_SERVICE (store), full_name, local_error);
-
-				/* To not report one error for multiple folders multiple times */
-				g_hash_table_insert (known_errors, g_strdup (local_error->message), GINT_TO_POINTER (1));
-			}
+		struct _refresh_folder *rf = m->folders->pdata[i];
 
-			g_clear_error (&local_error);
-		}
+		mail_folder_cache_get_folder_activity (
+			folder_cache, m->store, rf->full_name,
+			&rf->last_activity, &rf->unread_delta);
+	}
 
-		if (folder)
-			g_object_unref (folder);
+	g_ptr_array_sort (m->folders, refresh_folder_compare);
 
-		if (g_cancellable_is_cancelled (m->info->cancellable) ||
-		    g_cancellable_is_cancelled (cancellable))
-			break;
+	/* The operation completes once these are refreshed, the rest
+	 * of the folders are refreshed in the background after it. */
+	for (i = 0; i < m->folders->len; i++) {
+		struct _refresh_folder *rf = m->folders->pdata[i];
+
+		rf->is_priority = rf->is_inbox || rf->last_activity > 0 || i == 0;
+		if (rf->is_priority)
+			context->n_priority++;
+	}
 
-		if (m->info->state != SEND_CANCELLED)
-			camel_operation_progress (
-				m->info->cancellable, 100 * i / m->folders->len);
+	context->n_priority_pending = context->n_priority;
+
+	thread_pool = g_thread_pool_new (
+		refresh_folders_thread, context,
+		refresh_folders_get_max_threads (m->store),
+		FALSE, NULL);
+
+	for (i = 0; i < m->folders->len; i++) {
+		refresh_folders_context_ref (context);
+		g_thread_pool_push (thread_pool, m->folders->pdata[i], NULL);
 	}
 
+	g_mutex_lock (&context->lock);
+	while (context->n_priority_pending > 0)
+		g_cond_wait (&context->cond, &context->lock);
+	context->progress = NULL;
+	g_mutex_unlock (&context->lock);
+
+	/* Does not wait for the rest of the folders; the pool
+	 * is freed once they are refreshed. */
+	g_thread_pool_free (thread_pool, FALSE, FALSE);
+
 	camel_operation_pop_message (m->info->cancellable);
-	g_hash_table_destroy (known_errors);
+
+	refresh_folders_context_unref (context);
 
 exit:
 	if (handler_id > 0)
@@ -1322,11 +1532,7 @@ refresh_folders_done (struct _refresh_folders_msg *m)
 static void
 refresh_folders_free (struct _refresh_folders_msg *m)
 {
-	gint i;
-
-	for (i = 0; i < m->folders->len; i++)
-		g_free (m->folders->pdata[i]);
-	g_ptr_array_free (m->folders, TRUE);
+	g_ptr_array_unref (m->folders);
 
 	camel_folder_info_free (m->finfo);
 	g_object_unref (m->store);
@@ -1370,10 +1576,15 @@ receive_update_got_folderinfo (GObject *source_object,
 
 	/* CamelFolderInfo may be NULL even if no error occurred. */
 	} else if (info != NULL) {
-		GPtrArray *folders = g_ptr_array_new ();
+		GPtrArray *folders;
 		struct _refresh_folders_msg *m;
 
+		folders = g_ptr_array_new_with_free_func (
+			(GDestroyNotify) refresh_folder_free);
+
 		m = mail_msg_new (&refresh_folders_info);
+		m->base.priority = MAIL_MSG_PRIORITY_BACKGROUND;
+		m->base.service = send_info->service;
 		m->store = g_object_ref (send_info->service);
 		m->folders = folders;
 		m->info = send_info;
@@ -1486,6 +1697,8 @@ maybe_delete_junk_or_expunge_local_store (EMailSession *session)
 		return;
 
 	m = mail_msg_new (&refresh_local_store_info);
+	m->base.priority = MAIL_MSG_PRIORITY_BACKGROUND;
+	m->base.service = store;
 	m->store = g_object_ref (store);
 	m->delete_junk = delete_junk;
 	m->expunge_trash = expunge_trash;
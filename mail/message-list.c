@@ -29,10 +29,12 @@
 #include <unistd.h>
 #include <string.h>
 #include <ctype.h>
+#include <locale.h>
 
 #include <glib/gi18n.h>
 #include <glib/gstdio.h>
 
+#include "e-mail-collate-keys.h"
 #include "e-mail-label-list-store.h"
 #include "e-mail-ui-session.h"
 #include "em-utils.h"
@@ -120,6 +122,12 @@ struct _MessageListPrivate {
 	GSettings *mail_settings;
 	gchar **re_prefixes;
 	GMutex re_prefixes_lock;
+
+	/* Normalised subjects of the current folder, stored on disk.
+	 * Replaced on folder change while regen threads may use it,
+	 * thus use message_list_ref_collate_keys() to access it. */
+	EMailCollateKeys *collate_keys;
+	GMutex collate_keys_lock;
 };
 
 /* XXX Plain GNode suffers from O(N) tail insertions, and that won't
@@ -147,6 +155,12 @@ struct _RegenData {
 	 * we received a "folder-changed" signal from our CamelFolder. */
 	gboolean folder_changed;
 
+	/* If set, the current message list content is still valid for
+	 * the search and only these folder changes need to be applied
+	 * to it, instead of searching the whole folder all over again. */
+	CamelFolderChangeInfo *changes;
+	GPtrArray *removed_uids;
+
 	CamelFolder *folder;
 	GPtrArray *summary;
 
@@ -272,7 +286,8 @@ static gint	on_click			(ETree *tree,
 
 static void	mail_regen_list			(MessageList *message_list,
 						 const gchar *search,
-						 gboolean folder_changed);
+						 gboolean folder_changed,
+						 CamelFolderChangeInfo *changes);
 static void	mail_regen_cancel		(MessageList *message_list);
 
 static void	clear_info			(gchar *key,
@@ -501,6 +516,12 @@ regen_data_unref (RegenData *regen_data)
 
 		g_free (regen_data->search);
 
+		if (regen_data->changes != NULL)
+			camel_folder_change_info_free (regen_data->changes);
+
+		if (regen_data->removed_uids != NULL)
+			g_ptr_array_free (regen_data->removed_uids, TRUE);
+
 		if (regen_data->thread_tree != NULL)
 			camel_folder_thread_messages_unref (
 				regen_data->thread_tree);
@@ -730,11 +751,47 @@ get_message_info (MessageList *message_list,
 	return node->data;
 }
 
+static EMailCollateKeys *
+message_list_ref_collate_keys (MessageList *message_list)
+{
+	EMailCollateKeys *collate_keys = NULL;
+
+	g_mutex_lock (&message_list->priv->collate_keys_lock);
+
+	if (message_list->priv->collate_keys != NULL)
+		collate_keys = e_mail_collate_keys_ref (
+			message_list->priv->collate_keys);
+
+	g_mutex_unlock (&message_list->priv->collate_keys_lock);
+
+	return collate_keys;
+}
+
+static void
+message_list_set_collate_keys (MessageList *message_list,
+                               EMailCollateKeys *collate_keys)
+{
+	EMailCollateKeys *old_collate_keys;
+
+	g_mutex_lock (&message_list->priv->collate_keys_lock);
+
+	old_collate_keys = message_list->priv->collate_keys;
+	message_list->priv->collate_keys = collate_keys;
+
+	g_mutex_unlock (&message_list->priv->collate_keys_lock);
+
+	/* A regen thread can still hold a reference,
+	 * the keys are saved once it drops it. */
+	if (old_collate_keys != NULL)
+		e_mail_collate_keys_unref (old_collate_keys);
+}
+
 static const gchar *
 get_normalised_string (MessageList *message_list,
                        CamelMessageInfo *info,
                        gint col)
 {
+	EMailCollateKeys *collate_keys = NULL;
 	const gchar *string, *str;
 	gchar *normalised;
 	EPoolv *poolv;
@@ -773,6 +830,21 @@ get_normalised_string (MessageList *message_list,
 			return str;
 	}
 
+	/* The from and to are just copied, only the subject
+	 * normalisation is worth remembering across sessions. */
+	if (col == COL_SUBJECT_NORM)
+		collate_keys = message_list_ref_collate_keys (message_list);
+
+	if (collate_keys != NULL) {
+		str = e_mail_collate_keys_lookup (
+			collate_keys, camel_message_info_uid (info), string);
+		if (str != NULL) {
+			e_poolv_set (poolv, index, (gchar *) str, FALSE);
+			e_mail_collate_keys_unref (collate_keys);
+			return e_poolv_get (poolv, index);
+		}
+	}
+
 	if (col == COL_SUBJECT_NORM) {
 		gint skip_len;
 		const gchar *subject;
@@ -797,8 +869,13 @@ get_normalised_string (MessageList *message_list,
 		while (*subject && isspace ((gint) *subject))
 			subject++;
 
-		string = subject;
-		normalised = g_utf8_collate_key (string, -1);
+		normalised = g_utf8_collate_key (subject, -1);
+
+		if (collate_keys != NULL)
+			e_mail_collate_keys_add (
+				collate_keys,
+				camel_message_info_uid (info),
+				string, normalised);
 	} else {
 		/* because addresses require strings, not collate keys */
 		normalised = g_strdup (string);
@@ -806,6 +883,9 @@ get_normalised_string (MessageList *message_list,
 
 	e_poolv_set (poolv, index, normalised, TRUE);
 
+	if (collate_keys != NULL)
+		e_mail_collate_keys_unref (collate_keys);
+
 	return e_poolv_get (poolv, index);
 }
 
@@ -1145,6 +1225,69 @@ message_list_can_select (MessageList *message_list,
 	return ml_search_path (message_list, direction, flags, mask) != NULL;
 }
 
+/**
+ * message_list_get_neighbours:
+ * @message_list: a #MessageList
+ * @n_neighbours: how many messages to return in each direction
+ *
+ * Returns UIDs of up to @n_neighbours messages shown after and before
+ * the cursor, in the order they are likely to be selected: the next
+ * message, the previous message, the one after the next and so on.
+ * Messages in collapsed threads are not included.
+ *
+ * Return value: a #GPtrArray of UIDs; free it with g_ptr_array_unref()
+ **/
+GPtrArray *
+message_list_get_neighbours (MessageList *message_list,
+                             guint n_neighbours)
+{
+	ETreeTableAdapter *adapter;
+	GPtrArray *uids;
+	GNode *node;
+	gint row_count;
+	gint row, ii;
+
+	g_return_val_if_fail (IS_MESSAGE_LIST (message_list), NULL);
+
+	uids = g_ptr_array_new_with_free_func (g_free);
+
+	if (message_list->cursor_uid == NULL)
+		return uids;
+
+	node = g_hash_table_lookup (
+		message_list->uid_nodemap,
+		message_list->cursor_uid);
+	if (node == NULL)
+		return uids;
+
+	adapter = e_tree_get_table_adapter (E_TREE (message_list));
+	row_count = e_table_model_row_count (E_TABLE_MODEL (adapter));
+
+	row = e_tree_table_adapter_row_of_node (adapter, node);
+	if (row == -1)
+		return uids;
+
+	for (ii = 1; ii <= (gint) n_neighbours; ii++) {
+		if (row + ii < row_count) {
+			node = e_tree_table_adapter_node_at_row (adapter, row + ii);
+			if (node != NULL && node->data != NULL)
+				g_ptr_array_add (
+					uids, g_strdup (
+					get_message_uid (message_list, node)));
+		}
+
+		if (row - ii >= 0) {
+			node = e_tree_table_adapter_node_at_row (adapter, row - ii);
+			if (node != NULL && node->data != NULL)
+				g_ptr_array_add (
+					uids, g_strdup (
+					get_message_uid (message_list, node)));
+		}
+	}
+
+	return uids;
+}
+
 /**
  * message_list_select_uid:
  * @message_list:
@@ -2721,7 +2864,7 @@ ml_tree_sorting_changed (ETreeTableAdapter *adapter,
 		/* Invalidate the thread tree. */
 		message_list_set_thread_tree (message_list, NULL);
 
-		mail_regen_list (message_list, NULL, FALSE);
+		mail_regen_list (message_list, NULL, FALSE, NULL);
 
 		return TRUE;
 	}
@@ -2918,6 +3061,8 @@ message_list_finalize (GObject *object)
 	MessageList *message_list = MESSAGE_LIST (object);
 
 	g_hash_table_destroy (message_list->normalised_hash);
+	message_list_set_collate_keys (message_list, NULL);
+	g_mutex_clear (&message_list->priv->collate_keys_lock);
 
 	if (message_list->priv->thread_tree != NULL)
 		camel_folder_thread_messages_unref (
@@ -3551,6 +3696,7 @@ message_list_init (MessageList *message_list)
 	g_mutex_init (&message_list->priv->regen_lock);
 	g_mutex_init (&message_list->priv->thread_tree_lock);
 	g_mutex_init (&message_list->priv->re_prefixes_lock);
+	g_mutex_init (&message_list->priv->collate_keys_lock);
 
 	/* TODO: Should this only get the selection if we're realised? */
 	p = message_list->priv;
@@ -4209,8 +4355,9 @@ add_node_diff (MessageList *message_list,
 	/* XXX Casting away constness. */
 	info = (CamelMessageInfo *) c->message;
 
-	/* we just update the hashtable key */
-	ml_uid_nodemap_remove (message_list, info);
+	/* The message may still be shown elsewhere in the tree, when it
+	 * moved between threads.  Its hashtable entry is simply pointed
+	 * to the new node; remove_node_diff() releases the old one. */
 	new_node = ml_uid_nodemap_insert (message_list, info, parent, myrow);
 	(*row)++;
 
@@ -4247,7 +4394,11 @@ remove_node_diff (MessageList *message_list,
 		message_list_tree_model_remove (message_list, node);
 
 	g_return_if_fail (info);
-	ml_uid_nodemap_remove (message_list, info);
+
+	if (g_hash_table_lookup (message_list->uid_nodemap, camel_message_info_uid (info)) == node)
+		ml_uid_nodemap_remove (message_list, info);
+	else
+		camel_message_info_unref (info);
 }
 
 /* applies a new tree structure to an existing tree, but only by changing things
@@ -4558,7 +4709,7 @@ message_list_folder_changed (CamelFolder *folder,
 	}
 
 	if (need_list_regen)
-		mail_regen_list (message_list, NULL, TRUE);
+		mail_regen_list (message_list, NULL, TRUE, changes);
 
 	if (altered_changes != NULL)
 		camel_folder_change_info_free (altered_changes);
@@ -4579,6 +4730,33 @@ message_list_ref_folder (MessageList *message_list)
 	return folder;
 }
 
+static EMailCollateKeys *
+message_list_new_collate_keys (MessageList *message_list,
+                               CamelFolder *folder)
+{
+	EMailCollateKeys *collate_keys;
+	gchar *filename, *prefixes, *validity;
+
+	/* The subject collation keys depend on the locale
+	 * and on the localized "Re:" prefixes being used. */
+	prefixes = g_settings_get_string (
+		message_list->priv->mail_settings,
+		"composer-localized-re");
+	validity = g_strconcat (
+		setlocale (LC_COLLATE, NULL), "|",
+		prefixes ? prefixes : "", NULL);
+
+	filename = mail_config_folder_to_cachename (folder, "ml-collate-keys-");
+
+	collate_keys = e_mail_collate_keys_new (folder, filename, validity);
+
+	g_free (filename);
+	g_free (validity);
+	g_free (prefixes);
+
+	return collate_keys;
+}
+
 /**
  * message_list_set_folder:
  * @message_list: Message List widget
@@ -4615,6 +4793,7 @@ message_list_set_folder (MessageList *message_list,
 
 	/* reset the normalised sort performance hack */
 	g_hash_table_remove_all (message_list->normalised_hash);
+	message_list_set_collate_keys (message_list, NULL);
 
 	mail_regen_cancel (message_list);
 
@@ -4666,6 +4845,10 @@ message_list_set_folder (MessageList *message_list,
 		message_list->priv->folder = folder;
 		message_list->just_set_folder = TRUE;
 
+		message_list_set_collate_keys (
+			message_list,
+			message_list_new_collate_keys (message_list, folder));
+
 		store = camel_folder_get_parent_store (folder);
 
 		non_trash_folder =
@@ -4700,7 +4883,7 @@ message_list_set_folder (MessageList *message_list,
 		message_list->priv->folder_changed_handler_id = handler_id;
 
 		if (message_list->frozen == 0)
-			mail_regen_list (message_list, NULL, FALSE);
+			mail_regen_list (message_list, NULL, FALSE, NULL);
 	}
 }
 
@@ -4753,7 +4936,7 @@ message_list_set_group_by_threads (MessageList *message_list,
 
 	/* Changing this property triggers a message list regen. */
 	if (message_list->frozen == 0)
-		mail_regen_list (message_list, NULL, FALSE);
+		mail_regen_list (message_list, NULL, FALSE, NULL);
 }
 
 gboolean
@@ -4782,7 +4965,7 @@ message_list_set_show_deleted (MessageList *message_list,
 
 	/* Changing this property triggers a message list regen. */
 	if (message_list->frozen == 0)
-		mail_regen_list (message_list, NULL, FALSE);
+		mail_regen_list (message_list, NULL, FALSE, NULL);
 }
 
 gboolean
@@ -5229,7 +5412,7 @@ message_list_thaw (MessageList *message_list)
 		else
 			search = NULL;
 
-		mail_regen_list (message_list, search, FALSE);
+		mail_regen_list (message_list, search, FALSE, NULL);
 
 		g_free (message_list->frozen_search);
 		message_list->frozen_search = NULL;
@@ -5246,7 +5429,7 @@ message_list_set_threaded_expand_all (MessageList *message_list)
 		message_list->expand_all = 1;
 
 		if (message_list->frozen == 0)
-			mail_regen_list (message_list, NULL, FALSE);
+			mail_regen_list (message_list, NULL, FALSE, NULL);
 	}
 }
 
@@ -5259,7 +5442,7 @@ message_list_set_threaded_collapse_all (MessageList *message_list)
 		message_list->collapse_all = 1;
 
 		if (message_list->frozen == 0)
-			mail_regen_list (message_list, NULL, FALSE);
+			mail_regen_list (message_list, NULL, FALSE, NULL);
 	}
 }
 
@@ -5280,7 +5463,7 @@ message_list_set_search (MessageList *message_list,
 	message_list_set_thread_tree (message_list, NULL);
 
 	if (message_list->frozen == 0)
-		mail_regen_list (message_list, search ? search : "", FALSE);
+		mail_regen_list (message_list, search ? search : "", FALSE, NULL);
 	else {
 		g_free (message_list->frozen_search);
 		message_list->frozen_search = g_strdup (search);
@@ -5572,6 +5755,148 @@ message_list_regen_tweak_search_results (MessageList *message_list,
 	camel_message_info_unref (info);
 }
 
+/* Evaluates the search expression only against the added and changed
+ * messages of an incremental regen.  Messages which no longer satisfy
+ * it are collected in regen_data->removed_uids.  The returned array is
+ * what needs to be (re)inserted into a flat list, or the complete set
+ * of messages to be shown when grouping by threads. */
+static GPtrArray *
+message_list_regen_search_changes (MessageList *message_list,
+                                   RegenData *regen_data,
+                                   CamelFolder *folder,
+                                   const gchar *expr,
+                                   GCancellable *cancellable,
+                                   GError **error)
+{
+	CamelFolderChangeInfo *changes;
+	GPtrArray *candidates;
+	GPtrArray *matches = NULL;
+	GPtrArray *uids;
+	GHashTable *matched;
+	GHashTable *removed;
+	GHashTableIter iter;
+	gpointer key;
+	guint ii;
+
+	changes = regen_data->changes;
+
+	candidates = g_ptr_array_sized_new (
+		changes->uid_added->len + changes->uid_changed->len);
+
+	for (ii = 0; ii < changes->uid_added->len; ii++)
+		g_ptr_array_add (candidates, changes->uid_added->pdata[ii]);
+
+	for (ii = 0; ii < changes->uid_changed->len; ii++)
+		g_ptr_array_add (candidates, changes->uid_changed->pdata[ii]);
+
+	matched = g_hash_table_new (g_str_hash, g_str_equal);
+
+	if (candidates->len > 0 && expr != NULL && *expr != '\0') {
+		matches = camel_folder_search_by_uids (
+			folder, expr, candidates, cancellable, error);
+
+		if (matches == NULL) {
+			g_hash_table_destroy (matched);
+			g_ptr_array_free (candidates, TRUE);
+			return NULL;
+		}
+
+		for (ii = 0; ii < matches->len; ii++)
+			g_hash_table_add (matched, matches->pdata[ii]);
+	} else {
+		for (ii = 0; ii < candidates->len; ii++) {
+			CamelMessageInfo *info;
+
+			info = camel_folder_get_message_info (
+				folder, candidates->pdata[ii]);
+			if (info != NULL) {
+				g_hash_table_add (
+					matched, candidates->pdata[ii]);
+				camel_message_info_unref (info);
+			}
+		}
+	}
+
+	removed = g_hash_table_new (g_str_hash, g_str_equal);
+	regen_data->removed_uids = g_ptr_array_new_with_free_func (
+		(GDestroyNotify) camel_pstring_free);
+
+	for (ii = 0; ii < changes->uid_removed->len; ii++) {
+		const gchar *uid = changes->uid_removed->pdata[ii];
+
+		g_hash_table_add (removed, (gpointer) uid);
+		g_ptr_array_add (
+			regen_data->removed_uids,
+			(gpointer) camel_pstring_strdup (uid));
+	}
+
+	for (ii = 0; ii < changes->uid_changed->len; ii++) {
+		const gchar *uid = changes->uid_changed->pdata[ii];
+
+		if (g_hash_table_contains (matched, uid))
+			continue;
+
+		/* Same as message_list_regen_tweak_search_results(),
+		 * do not hide the displayed message from the user. */
+		if (g_strcmp0 (uid, message_list->cursor_uid) == 0) {
+			g_hash_table_add (matched, (gpointer) uid);
+			continue;
+		}
+
+		g_hash_table_add (removed, (gpointer) uid);
+		g_ptr_array_add (
+			regen_data->removed_uids,
+			(gpointer) camel_pstring_strdup (uid));
+	}
+
+	uids = g_ptr_array_new ();
+
+	if (regen_data->group_by_threads) {
+		CamelFolderThread *thread_tree;
+
+		/* The thread tree is rebuilt from the complete list of
+		 * shown messages, which is the one it was built with
+		 * the last time, with the changes applied. */
+		thread_tree = message_list_ref_thread_tree (message_list);
+
+		if (thread_tree != NULL) {
+			g_mutex_lock (&message_list->priv->thread_tree_lock);
+
+			for (ii = 0; ii < thread_tree->summary->len; ii++) {
+				const gchar *uid;
+
+				uid = camel_message_info_uid (
+					thread_tree->summary->pdata[ii]);
+
+				if (!g_hash_table_contains (removed, uid) &&
+				    !g_hash_table_contains (matched, uid))
+					g_ptr_array_add (
+						uids, (gpointer)
+						camel_pstring_strdup (uid));
+			}
+
+			g_mutex_unlock (&message_list->priv->thread_tree_lock);
+
+			camel_folder_thread_messages_unref (thread_tree);
+		}
+	}
+
+	g_hash_table_iter_init (&iter, matched);
+	while (g_hash_table_iter_next (&iter, &key, NULL))
+		g_ptr_array_add (
+			uids, (gpointer) camel_pstring_strdup (key));
+
+	g_hash_table_destroy (removed);
+	g_hash_table_destroy (matched);
+
+	if (matches != NULL)
+		camel_folder_search_free (folder, matches);
+
+	g_ptr_array_free (candidates, TRUE);
+
+	return uids;
+}
+
 static void
 message_list_regen_thread (GSimpleAsyncResult *simple,
                            GObject *source_object,
@@ -5579,7 +5904,7 @@ message_list_regen_thread (GSimpleAsyncResult *simple,
 {
 	MessageList *message_list;
 	RegenData *regen_data;
-	GPtrArray *uids, *searchuids = NULL;
+	GPtrArray *uids, *searchuids = NULL, *changeuids = NULL;
 	CamelMessageInfo *info;
 	CamelFolder *folder;
 	GNode *cursor;
@@ -5640,7 +5965,13 @@ message_list_regen_thread (GSimpleAsyncResult *simple,
 
 	/* Execute the search. */
 
-	if (expr->len == 0) {
+	if (regen_data->changes != NULL) {
+		uids = message_list_regen_search_changes (
+			message_list, regen_data, folder,
+			expr->str, cancellable, &local_error);
+
+		changeuids = uids;
+	} else if (expr->len == 0) {
 		uids = camel_folder_get_uids (folder);
 	} else {
 		uids = camel_folder_search_by_expression (
@@ -5725,7 +6056,11 @@ message_list_regen_thread (GSimpleAsyncResult *simple,
 	}
 
 exit:
-	if (searchuids != NULL)
+	if (changeuids != NULL) {
+		g_ptr_array_foreach (
+			changeuids, (GFunc) camel_pstring_free, NULL);
+		g_ptr_array_free (changeuids, TRUE);
+	} else if (searchuids != NULL)
 		camel_folder_search_free (folder, searchuids);
 	else if (uids != NULL)
 		camel_folder_free_uids (folder, uids);
@@ -5733,6 +6068,121 @@ exit:
 	g_object_unref (folder);
 }
 
+/* Patches the current tree model content in place with the outcome
+ * of an incremental regen, rather than rebuilding it from scratch. */
+static void
+message_list_regen_apply_changes (MessageList *message_list,
+                                  RegenData *regen_data)
+{
+	CamelFolderChangeInfo *changes;
+	ETreeModel *tree_model;
+	ETableItem *table_item;
+	GNode *node;
+	gchar *saveuid = NULL;
+	gboolean freeze;
+	guint ii;
+
+	changes = regen_data->changes;
+	tree_model = E_TREE_MODEL (message_list);
+	table_item = e_tree_get_item (E_TREE (message_list));
+
+	/* Per-node notifications are cheap for a handful of changes,
+	 * but for a bulk of them it's faster to let the table adapter
+	 * rebuild its row map once, when the tree model is thawed. */
+	freeze =
+		changes->uid_added->len +
+		changes->uid_removed->len +
+		changes->uid_changed->len > 100;
+
+	if (message_list->cursor_uid != NULL)
+		saveuid = find_next_selectable (message_list);
+
+	if (table_item != NULL)
+		e_table_item_freeze (table_item);
+
+	if (freeze)
+		message_list_tree_model_freeze (message_list);
+
+	if (regen_data->group_by_threads) {
+		GNode *root;
+		gint row = 0;
+
+		root = message_list->priv->tree_model_root;
+
+		build_subtree_diff (
+			message_list, root,
+			g_node_first_child (root),
+			regen_data->thread_tree->tree, &row);
+
+		message_list_set_thread_tree (
+			message_list, regen_data->thread_tree);
+	} else {
+		for (ii = 0; ii < regen_data->removed_uids->len; ii++) {
+			node = g_hash_table_lookup (
+				message_list->uid_nodemap,
+				regen_data->removed_uids->pdata[ii]);
+			if (node != NULL)
+				remove_node_diff (message_list, node, 0);
+		}
+
+		for (ii = 0; ii < regen_data->summary->len; ii++) {
+			CamelMessageInfo *info;
+
+			info = regen_data->summary->pdata[ii];
+
+			node = g_hash_table_lookup (
+				message_list->uid_nodemap,
+				camel_message_info_uid (info));
+			if (node == NULL)
+				ml_uid_nodemap_insert (
+					message_list, info, NULL, -1);
+		}
+	}
+
+	if (freeze) {
+		message_list_tree_model_thaw (message_list);
+	} else {
+		for (ii = 0; ii < changes->uid_changed->len; ii++) {
+			node = g_hash_table_lookup (
+				message_list->uid_nodemap,
+				changes->uid_changed->pdata[ii]);
+			if (node != NULL) {
+				e_tree_model_pre_change (tree_model);
+				e_tree_model_node_data_changed (tree_model, node);
+
+				message_list_change_first_visible_parent (
+					message_list, node);
+			}
+		}
+	}
+
+	node = NULL;
+
+	if (saveuid != NULL)
+		node = g_hash_table_lookup (
+			message_list->uid_nodemap, saveuid);
+
+	if (node != NULL) {
+		e_tree_set_cursor (E_TREE (message_list), node);
+	} else if (message_list->cursor_uid != NULL &&
+		   g_hash_table_lookup (message_list->uid_nodemap, message_list->cursor_uid) == NULL) {
+		g_free (message_list->cursor_uid);
+		message_list->cursor_uid = NULL;
+		g_signal_emit (
+			message_list,
+			signals[MESSAGE_SELECTED], 0, NULL);
+	}
+
+	g_free (saveuid);
+
+	if (table_item != NULL) {
+		/* Do not show the cursor, this is always
+		 * a response to a "folder-changed" signal. */
+		table_item->queue_show_cursor = FALSE;
+		e_table_item_thaw (table_item);
+	}
+}
+
 static void
 message_list_regen_done_cb (GObject *source_object,
                             GAsyncResult *result,
@@ -5796,7 +6246,9 @@ message_list_regen_done_cb (GObject *source_object,
 
 	is_searching = message_list_is_searching (message_list);
 
-	if (regen_data->group_by_threads) {
+	if (regen_data->changes != NULL) {
+		message_list_regen_apply_changes (message_list, regen_data);
+	} else if (regen_data->group_by_threads) {
 		ETableItem *table_item = e_tree_get_item (E_TREE (message_list));
 		GPtrArray *selected;
 		gchar *saveuid = NULL;
@@ -6030,10 +6482,38 @@ message_list_regen_idle_cb (gpointer user_data)
 
 	searching = message_list_is_searching (message_list);
 
+	/* Folder changes can be applied incrementally only if the
+	 * current content was built for the same search and mode. */
+	if (regen_data->changes != NULL) {
+		CamelFolderThread *thread_tree;
+		gboolean can_apply_changes;
+
+		thread_tree = message_list_ref_thread_tree (message_list);
+
+		can_apply_changes =
+			!message_list->just_set_folder &&
+			!message_list->expand_all &&
+			!message_list->collapse_all &&
+			message_list->priv->tree_model_root != NULL &&
+			g_strcmp0 (regen_data->search, message_list->search) == 0 &&
+			(!regen_data->group_by_threads || thread_tree != NULL);
+
+		if (thread_tree != NULL)
+			camel_folder_thread_messages_unref (thread_tree);
+
+		if (!can_apply_changes) {
+			camel_folder_change_info_free (regen_data->changes);
+			regen_data->changes = NULL;
+		}
+	}
+
 	adapter = e_tree_get_table_adapter (E_TREE (message_list));
 	row_count = e_table_model_row_count (E_TABLE_MODEL (adapter));
 
-	if (row_count <= 0) {
+	if (regen_data->changes != NULL) {
+		/* The nodes are patched in place, thus
+		 * they keep their expanded state as is. */
+	} else if (row_count <= 0) {
 		if (gtk_widget_get_visible (GTK_WIDGET (message_list))) {
 			gchar *txt;
 
@@ -6106,7 +6586,8 @@ mail_regen_cancel (MessageList *message_list)
 static void
 mail_regen_list (MessageList *message_list,
                  const gchar *search,
-                 gboolean folder_changed)
+                 gboolean folder_changed,
+                 CamelFolderChangeInfo *changes)
 {
 	GSimpleAsyncResult *simple;
 	GCancellable *cancellable;
@@ -6160,10 +6641,23 @@ mail_regen_list (MessageList *message_list,
 		if (g_strcmp0 (search, old_regen_data->search) != 0) {
 			g_free (old_regen_data->search);
 			old_regen_data->search = g_strdup (search);
+
+			/* The whole folder needs to be searched now. */
+			changes = NULL;
 		}
 
 		old_regen_data->folder_changed = folder_changed;
 
+		/* Accumulate folder changes, unless either of the
+		 * requests asks for a full regen of the content. */
+		if (changes != NULL && old_regen_data->changes != NULL) {
+			camel_folder_change_info_cat (
+				old_regen_data->changes, changes);
+		} else if (old_regen_data->changes != NULL) {
+			camel_folder_change_info_free (old_regen_data->changes);
+			old_regen_data->changes = NULL;
+		}
+
 		/* Avoid cancelling on the way out. */
 		old_regen_data = NULL;
 
@@ -6176,6 +6670,23 @@ mail_regen_list (MessageList *message_list,
 	new_regen_data->search = g_strdup (search);
 	new_regen_data->folder_changed = folder_changed;
 
+	/* A regen being cancelled here may leave the content outdated.
+	 * Take over its folder changes, or fall back to a full regen if
+	 * it was one itself. */
+	if (changes != NULL && (old_regen_data == NULL || (
+	    old_regen_data->changes != NULL &&
+	    g_strcmp0 (search, old_regen_data->search) == 0))) {
+		new_regen_data->changes = camel_folder_change_info_new ();
+
+		if (old_regen_data != NULL)
+			camel_folder_change_info_cat (
+				new_regen_data->changes,
+				old_regen_data->changes);
+
+		camel_folder_change_info_cat (
+			new_regen_data->changes, changes);
+	}
+
 	/* We generate the message list content in a worker thread, and
 	 * then supply our own GAsyncReadyCallback to redraw the widget. */
 
@@ -188,6 +188,8 @@ gboolean	message_list_can_select		(MessageList *message_list,
 						 MessageListSelectDirection direction,
 						 guint32 flags,
 						 guint32 mask);
+GPtrArray *	message_list_get_neighbours	(MessageList *message_list,
+						 guint n_neighbours);
 void		message_list_select_uid		(MessageList *message_list,
 						 const gchar *uid,
 						 gboolean with_fallback);
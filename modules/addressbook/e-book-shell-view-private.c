@@ -135,21 +135,25 @@ selection_change (EBookShellView *book_shell_view,
 static void
 contact_changed (EBookShellView *book_shell_view,
                  gint index,
+                 gint count,
                  EAddressbookModel *model)
 {
 	EBookShellContent *book_shell_content;
 	EContact *contact;
+	gint preview_index;
 
 	g_return_if_fail (E_IS_SHELL_VIEW (book_shell_view));
 	g_return_if_fail (book_shell_view->priv != NULL);
 
 	book_shell_content = book_shell_view->priv->book_shell_content;
 
-	contact = e_addressbook_model_contact_at (model, index);
+	preview_index = book_shell_view->priv->preview_index;
 
-	if (book_shell_view->priv->preview_index != index)
+	if (preview_index < index || preview_index >= index + count)
 		return;
 
+	contact = e_addressbook_model_contact_at (model, preview_index);
+
 	/* Re-render the same contact. */
 	e_book_shell_content_set_preview_contact (book_shell_content, contact);
 }
@@ -0,0 +1,1303 @@
+/*
+ * evolution-backup-archive.c
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/* An incremental back up archive.  It is a folder with two subfolders:
+ * "chunks", with gzip-compressed pieces of the backed up files, named by
+ * the SHA-256 checksum of their content, and "snapshots", with a manifest
+ * per back up, which lists the files and the chunks they consist of.
+ *
+ * Files are split at content-defined boundaries, thus a change in a file
+ * changes only the chunks around it, and each chunk is stored only once,
+ * no matter how many files or back ups refer to it.  Files with the same
+ * size, modification and change time as in the previous back up are not
+ * read at all.  The files are not expected to be left alone while being
+ * read; a file which changed during the read is read again, and one which
+ * kept changing is marked as inconsistent.  SQLite databases are copied
+ * through the online back up API, which sees a consistent state of them
+ * even while they are being written; their journals are not needed then. */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <glib/gi18n.h>
+#include <glib/gstdio.h>
+
+#include <sqlite3.h>
+
+#include "evolution-backup-archive.h"
+
+#define MANIFEST_MAGIC "EVOBACKUP 1"
+
+#define CHUNKS_DIR "chunks"
+#define SNAPSHOTS_DIR "snapshots"
+
+/* Chunks are between 16 and 256 KiB long, around 64 KiB on average. */
+#define CHUNK_MIN_SIZE (16 * 1024)
+#define CHUNK_MAX_SIZE (256 * 1024)
+#define CHUNK_BOUNDARY_MASK 0xFFFF0000
+
+/* How many chunks can wait for being compressed. */
+#define MAX_PENDING_CHUNKS 64
+
+/* How many times a file is read, when it keeps changing. */
+#define MAX_READ_ATTEMPTS 3
+
+/* How many times a busy database is waited for, 100 ms each. */
+#define MAX_DATABASE_ATTEMPTS 50
+
+/* Stored as the change time of files which are read again next time. */
+#define SMUDGED_CTIME -1
+
+#ifdef HAVE_STRUCT_STAT_ST_MTIM_TV_NSEC
+#define STAT_MTIME_NSEC(st) ((gint64) (st)->st_mtim.tv_nsec)
+#define STAT_CTIME_NSEC(st) ((gint64) (st)->st_ctim.tv_nsec)
+#else
+#define STAT_MTIME_NSEC(st) ((gint64) 0)
+#define STAT_CTIME_NSEC(st) ((gint64) 0)
+#endif
+
+/* Nanoseconds since the epoch. */
+#define STAT_MTIME(st) \
+	((gint64) (st)->st_mtime * G_GINT64_CONSTANT (1000000000) + STAT_MTIME_NSEC (st))
+#define STAT_CTIME(st) \
+	((gint64) (st)->st_ctime * G_GINT64_CONSTANT (1000000000) + STAT_CTIME_NSEC (st))
+
+typedef struct _ChunkRef {
+	gchar hash[65];
+	gsize length;
+} ChunkRef;
+
+typedef struct _FileRecord {
+	gchar *root;
+	gchar *path;
+	guint mode;
+	gint64 mtime;		/* nanoseconds */
+	gint64 ctime;		/* nanoseconds */
+	guint64 size;
+	gboolean inconsistent;	/* kept changing while being read */
+	GArray *chunks;		/* ChunkRef; NULL for directories */
+} FileRecord;
+
+typedef struct _ChunkJob {
+	gchar hash[65];
+	GBytes *bytes;
+} ChunkJob;
+
+typedef struct _WriteContext {
+	const gchar *archive_dir;
+	GCancellable *cancellable;
+	GHashTable *previous;	/* "root/path" ~> FileRecord */
+	GHashTable *known_chunks;
+	GPtrArray *records;
+	gint64 start_time;	/* nanoseconds, of the file system clock */
+
+	GThreadPool *thread_pool;
+	GMutex lock;
+	GCond cond;
+	guint n_pending;
+	GError *error;
+} WriteContext;
+
+static guint32 gear_table[256];
+
+static void
+gear_table_init (void)
+{
+	static gsize initialized = 0;
+
+	if (g_once_init_enter (&initialized)) {
+		guint32 state = 0x9E3779B9;
+		gint ii;
+
+		/* The table is part of the archive format; a different
+		 * table would put the chunk boundaries elsewhere. */
+		for (ii = 0; ii < G_N_ELEMENTS (gear_table); ii++) {
+			state ^= state << 13;
+			state ^= state >> 17;
+			state ^= state << 5;
+			gear_table[ii] = state;
+		}
+
+		g_once_init_leave (&initialized, 1);
+	}
+}
+
+static void
+file_record_free (FileRecord *record)
+{
+	g_free (record->root);
+	g_free (record->path);
+	if (record->chunks != NULL)
+		g_array_free (record->chunks, TRUE);
+	g_slice_free (FileRecord, record);
+}
+
+static gchar *
+file_record_key (const gchar *root,
+                 const gchar *path)
+{
+	return g_strconcat (root, "/", path, NULL);
+}
+
+static gchar *
+chunk_filename (const gchar *archive_dir,
+                const gchar *hash)
+{
+	gchar prefix[3];
+
+	prefix[0] = hash[0];
+	prefix[1] = hash[1];
+	prefix[2] = '\0';
+
+	return g_build_filename (archive_dir, CHUNKS_DIR, prefix, hash, NULL);
+}
+
+static gchar *
+find_latest_snapshot (const gchar *archive_dir)
+{
+	GDir *dir;
+	gchar *dirname;
+	gchar *latest = NULL;
+	const gchar *name;
+
+	dirname = g_build_filename (archive_dir, SNAPSHOTS_DIR, NULL);
+	dir = g_dir_open (dirname, 0, NULL);
+
+	if (dir != NULL) {
+		/* Snapshot names sort by their creation time. */
+		while ((name = g_dir_read_name (dir)) != NULL) {
+			if (*name == '.')
+				continue;
+
+			if (latest == NULL || strcmp (name, latest) > 0) {
+				g_free (latest);
+				latest = g_strdup (name);
+			}
+		}
+
+		g_dir_close (dir);
+	}
+
+	if (latest != NULL) {
+		gchar *filename;
+
+		filename = g_build_filename (dirname, latest, NULL);
+		g_free (latest);
+		latest = filename;
+	}
+
+	g_free (dirname);
+
+	return latest;
+}
+
+static GPtrArray *
+manifest_load (const gchar *filename,
+               gchar **out_version,
+               GError **error)
+{
+	GPtrArray *records;
+	FileRecord *file = NULL;
+	gchar *contents = NULL;
+	gchar **lines;
+	gint ii;
+	gboolean valid;
+
+	if (!g_file_get_contents (filename, &contents, NULL, error))
+		return NULL;
+
+	lines = g_strsplit (contents, "\n", -1);
+	g_free (contents);
+
+	records = g_ptr_array_new_with_free_func (
+		(GDestroyNotify) file_record_free);
+
+	valid = lines[0] != NULL && strcmp (lines[0], MANIFEST_MAGIC) == 0;
+
+	for (ii = 1; valid && lines[ii] != NULL; ii++) {
+		gchar **fields;
+		guint n_fields;
+
+		if (*lines[ii] == '\0')
+			continue;
+
+		fields = g_strsplit (lines[ii], "\t", -1);
+		n_fields = g_strv_length (fields);
+
+		if (strcmp (fields[0], "V") == 0 && n_fields == 2) {
+			if (out_version != NULL) {
+				g_free (*out_version);
+				*out_version = g_strcompress (fields[1]);
+			}
+
+		} else if (strcmp (fields[0], "D") == 0 && n_fields == 4) {
+			FileRecord *record;
+
+			record = g_slice_new0 (FileRecord);
+			record->root = g_strdup (fields[1]);
+			record->mode = strtoul (fields[2], NULL, 8);
+			record->path = g_strcompress (fields[3]);
+			g_ptr_array_add (records, record);
+
+			file = NULL;
+
+		} else if (strcmp (fields[0], "F") == 0 && n_fields == 7) {
+			file = g_slice_new0 (FileRecord);
+			file->root = g_strdup (fields[1]);
+			file->mode = strtoul (fields[2], NULL, 8);
+			file->mtime = g_ascii_strtoll (fields[3], NULL, 10);
+			file->ctime = g_ascii_strtoll (fields[4], NULL, 10);
+			file->size = g_ascii_strtoull (fields[5], NULL, 10);
+			file->path = g_strcompress (fields[6]);
+			file->chunks = g_array_new (FALSE, FALSE, sizeof (ChunkRef));
+			g_ptr_array_add (records, file);
+
+		/* Written with seconds only and without the change
+		 * time, thus such files are always read again. */
+		} else if (strcmp (fields[0], "F") == 0 && n_fields == 6) {
+			file = g_slice_new0 (FileRecord);
+			file->root = g_strdup (fields[1]);
+			file->mode = strtoul (fields[2], NULL, 8);
+			file->mtime = g_ascii_strtoll (fields[3], NULL, 10) *
+				G_GINT64_CONSTANT (1000000000);
+			file->ctime = SMUDGED_CTIME;
+			file->size = g_ascii_strtoull (fields[4], NULL, 10);
+			file->path = g_strcompress (fields[5]);
+			file->chunks = g_array_new (FALSE, FALSE, sizeof (ChunkRef));
+			g_ptr_array_add (records, file);
+
+		} else if (strcmp (fields[0], "I") == 0 && n_fields == 1 &&
+			   file != NULL) {
+			file->inconsistent = TRUE;
+
+		} else if (strcmp (fields[0], "C") == 0 && n_fields == 3 &&
+			   file != NULL && strlen (fields[1]) == 64) {
+			ChunkRef ref;
+
+			g_strlcpy (ref.hash, fields[1], sizeof (ref.hash));
+			ref.length = g_ascii_strtoull (fields[2], NULL, 10);
+			g_array_append_val (file->chunks, ref);
+
+		} else {
+			valid = FALSE;
+		}
+
+		g_strfreev (fields);
+	}
+
+	g_strfreev (lines);
+
+	if (!valid) {
+		g_set_error (
+			error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+			_("Back up manifest '%s' is corrupted"), filename);
+		g_ptr_array_unref (records);
+		return NULL;
+	}
+
+	return records;
+}
+
+static gboolean
+manifest_save (const gchar *archive_dir,
+               GPtrArray *records,
+               const gchar *version,
+               GError **error)
+{
+	GDateTime *date_time;
+	GString *contents;
+	gchar *escaped;
+	gchar *name, *filename;
+	guint ii, jj;
+	gboolean success;
+
+	contents = g_string_new (MANIFEST_MAGIC "\n");
+
+	escaped = g_strescape (version, NULL);
+	g_string_append_printf (contents, "V\t%s\n", escaped);
+	g_free (escaped);
+
+	for (ii = 0; ii < records->len; ii++) {
+		FileRecord *record = records->pdata[ii];
+
+		escaped = g_strescape (record->path, NULL);
+
+		if (record->chunks == NULL) {
+			g_string_append_printf (
+				contents, "D\t%s\t%o\t%s\n",
+				record->root, record->mode, escaped);
+		} else {
+			g_string_append_printf (
+				contents, "F\t%s\t%o\t%" G_GINT64_FORMAT
+				"\t%" G_GINT64_FORMAT
+				"\t%" G_GUINT64_FORMAT "\t%s\n",
+				record->root, record->mode,
+				record->mtime, record->ctime,
+				record->size, escaped);
+
+			if (record->inconsistent)
+				g_string_append (contents, "I\n");
+
+			for (jj = 0; jj < record->chunks->len; jj++) {
+				ChunkRef *ref;
+
+				ref = &g_array_index (record->chunks, ChunkRef, jj);
+				g_string_append_printf (
+					contents, "C\t%s\t%" G_GSIZE_FORMAT "\n",
+					ref->hash, ref->length);
+			}
+		}
+
+		g_free (escaped);
+	}
+
+	date_time = g_date_time_new_now_utc ();
+	name = g_date_time_format (date_time, "%Y%m%dT%H%M%SZ");
+	g_date_time_unref (date_time);
+
+	filename = g_build_filename (archive_dir, SNAPSHOTS_DIR, name, NULL);
+
+	/* Two back ups within the same second. */
+	for (ii = 1; g_file_test (filename, G_FILE_TEST_EXISTS); ii++) {
+		gchar *tmp;
+
+		g_free (filename);
+
+		tmp = g_strdup_printf ("%s-%u", name, ii);
+		filename = g_build_filename (archive_dir, SNAPSHOTS_DIR, tmp, NULL);
+		g_free (tmp);
+	}
+
+	success = g_file_set_contents (
+		filename, contents->str, contents->len, error);
+
+	g_string_free (contents, TRUE);
+	g_free (filename);
+	g_free (name);
+
+	return success;
+}
+
+static GBytes *
+compress_bytes (GBytes *bytes,
+                GError **error)
+{
+	GConverter *compressor;
+	GOutputStream *memory_stream;
+	GOutputStream *output_stream;
+	GBytes *compressed = NULL;
+	gconstpointer data;
+	gsize size;
+
+	data = g_bytes_get_data (bytes, &size);
+
+	compressor = G_CONVERTER (g_zlib_compressor_new (
+		G_ZLIB_COMPRESSOR_FORMAT_GZIP, -1));
+	memory_stream = g_memory_output_stream_new_resizable ();
+	output_stream = g_converter_output_stream_new (
+		memory_stream, compressor);
+
+	if (g_output_stream_write_all (output_stream, data, size, NULL, NULL, error) &&
+	    g_output_stream_close (output_stream, NULL, error)) {
+		compressed = g_memory_output_stream_steal_as_bytes (
+			G_MEMORY_OUTPUT_STREAM (memory_stream));
+	}
+
+	g_object_unref (output_stream);
+	g_object_unref (memory_stream);
+	g_object_unref (compressor);
+
+	return compressed;
+}
+
+static gboolean
+chunk_store (const gchar *archive_dir,
+             ChunkJob *job,
+             GError **error)
+{
+	GBytes *compressed;
+	gchar *filename, *dirname;
+	gboolean success = FALSE;
+
+	compressed = compress_bytes (job->bytes, error);
+	if (compressed == NULL)
+		return FALSE;
+
+	filename = chunk_filename (archive_dir, job->hash);
+	dirname = g_path_get_dirname (filename);
+
+	if (g_mkdir_with_parents (dirname, 0700) == -1) {
+		g_set_error (
+			error, G_IO_ERROR,
+			g_io_error_from_errno (errno),
+			"%s", g_strerror (errno));
+	} else {
+		/* Written into a temporary file and renamed, thus
+		 * an interrupted back up leaves no partial chunk. */
+		success = g_file_set_contents (
+			filename,
+			g_bytes_get_data (compressed, NULL),
+			g_bytes_get_size (compressed), error);
+	}
+
+	g_bytes_unref (compressed);
+	g_free (filename);
+	g_free (dirname);
+
+	return success;
+}
+
+static void
+chunk_store_thread (gpointer data,
+                    gpointer user_data)
+{
+	ChunkJob *job = data;
+	WriteContext *context = user_data;
+	gboolean failed;
+	GError *local_error = NULL;
+
+	g_mutex_lock (&context->lock);
+	failed = context->error != NULL;
+	g_mutex_unlock (&context->lock);
+
+	if (!failed)
+		chunk_store (context->archive_dir, job, &local_error);
+
+	g_mutex_lock (&context->lock);
+
+	if (local_error != NULL && context->error == NULL)
+		context->error = local_error;
+	else
+		g_clear_error (&local_error);
+
+	context->n_pending--;
+	g_cond_signal (&context->cond);
+
+	g_mutex_unlock (&context->lock);
+
+	g_bytes_unref (job->bytes);
+	g_slice_free (ChunkJob, job);
+}
+
+static gboolean
+archive_add_chunk (WriteContext *context,
+                   GByteArray *chunk,
+                   GArray *chunks,
+                   GError **error)
+{
+	ChunkJob *job;
+	ChunkRef ref;
+	gchar *hash;
+	gchar *filename;
+	gboolean exists;
+
+	hash = g_compute_checksum_for_data (
+		G_CHECKSUM_SHA256, chunk->data, chunk->len);
+	g_strlcpy (ref.hash, hash, sizeof (ref.hash));
+	ref.length = chunk->len;
+	g_array_append_val (chunks, ref);
+
+	if (g_hash_table_contains (context->known_chunks, hash)) {
+		g_free (hash);
+		return TRUE;
+	}
+
+	g_hash_table_add (context->known_chunks, hash);
+
+	filename = chunk_filename (context->archive_dir, hash);
+	exists = g_file_test (filename, G_FILE_TEST_EXISTS);
+	g_free (filename);
+
+	if (exists)
+		return TRUE;
+
+	g_mutex_lock (&context->lock);
+
+	while (context->n_pending >= MAX_PENDING_CHUNKS && context->error == NULL)
+		g_cond_wait (&context->cond, &context->lock);
+
+	if (context->error != NULL) {
+		g_propagate_error (error, g_error_copy (context->error));
+		g_mutex_unlock (&context->lock);
+		return FALSE;
+	}
+
+	context->n_pending++;
+
+	g_mutex_unlock (&context->lock);
+
+	job = g_slice_new (ChunkJob);
+	g_strlcpy (job->hash, hash, sizeof (job->hash));
+	job->bytes = g_bytes_new (chunk->data, chunk->len);
+
+	g_thread_pool_push (context->thread_pool, job, NULL);
+
+	return TRUE;
+}
+
+static gboolean
+archive_read_file (WriteContext *context,
+                   const gchar *filename,
+                   GArray *chunks,
+                   guint64 *out_size,
+                   GError **error)
+{
+	GFile *file;
+	GFileInputStream *input_stream;
+	GByteArray *chunk;
+	guint8 buffer[65536];
+	guint32 fingerprint = 0;
+	gssize n_read = 0;
+	gboolean success = TRUE;
+
+	gear_table_init ();
+
+	*out_size = 0;
+
+	file = g_file_new_for_path (filename);
+	input_stream = g_file_read (file, context->cancellable, error);
+	g_object_unref (file);
+
+	if (input_stream == NULL)
+		return FALSE;
+
+	chunk = g_byte_array_sized_new (CHUNK_MAX_SIZE);
+
+	while (success && (n_read = g_input_stream_read (
+		G_INPUT_STREAM (input_stream), buffer, sizeof (buffer),
+		context->cancellable, error)) > 0) {
+		gssize start = 0, ii;
+
+		*out_size += n_read;
+
+		for (ii = 0; ii < n_read; ii++) {
+			gsize chunk_len = chunk->len + (ii - start) + 1;
+
+			fingerprint = (fingerprint << 1) + gear_table[buffer[ii]];
+
+			if (chunk_len < CHUNK_MIN_SIZE)
+				continue;
+
+			if ((fingerprint & CHUNK_BOUNDARY_MASK) != 0 &&
+			    chunk_len < CHUNK_MAX_SIZE)
+				continue;
+
+			g_byte_array_append (chunk, buffer + start, ii - start + 1);
+			start = ii + 1;
+
+			success = archive_add_chunk (context, chunk, chunks, error);
+			if (!success)
+				break;
+
+			g_byte_array_set_size (chunk, 0);
+			fingerprint = 0;
+		}
+
+		if (success)
+			g_byte_array_append (chunk, buffer + start, n_read - start);
+	}
+
+	if (n_read < 0)
+		success = FALSE;
+
+	if (success && chunk->len > 0)
+		success = archive_add_chunk (context, chunk, chunks, error);
+
+	g_byte_array_free (chunk, TRUE);
+	g_object_unref (input_stream);
+
+	return success;
+}
+
+/* Copies the SQLite database at @filename into a temporary file with the
+ * online back up API, which sees a consistent state of the database even
+ * while other processes write it, and reads the copy.  Sets @out_copied
+ * to FALSE, without an error, when the file cannot be copied this way,
+ * like when it is not a database; it is read as any other file then. */
+static gboolean
+archive_read_database (WriteContext *context,
+                       const gchar *filename,
+                       GArray *chunks,
+                       gboolean *out_copied,
+                       GError **error)
+{
+	sqlite3 *source = NULL;
+	sqlite3 *copy = NULL;
+	sqlite3_backup *backup;
+	gchar *copy_filename;
+	guint64 size;
+	gint attempt, rc;
+	gboolean success = TRUE;
+
+	*out_copied = FALSE;
+
+	/* Hidden files are not snapshots. */
+	copy_filename = g_build_filename (
+		context->archive_dir, SNAPSHOTS_DIR, ".database", NULL);
+	g_unlink (copy_filename);
+
+	rc = sqlite3_open_v2 (filename, &source, SQLITE_OPEN_READONLY, NULL);
+	if (rc == SQLITE_OK)
+		rc = sqlite3_open_v2 (
+			copy_filename, &copy,
+			SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, NULL);
+
+	if (rc == SQLITE_OK) {
+		backup = sqlite3_backup_init (copy, "main", source, "main");
+
+		if (backup != NULL) {
+			/* All pages in one step, thus the copy cannot
+			 * mix states of the database before and after
+			 * a write; a database being written is busy. */
+			for (attempt = 0; attempt < MAX_DATABASE_ATTEMPTS; attempt++) {
+				rc = sqlite3_backup_step (backup, -1);
+				if (rc != SQLITE_BUSY && rc != SQLITE_LOCKED)
+					break;
+
+				sqlite3_sleep (100);
+			}
+
+			sqlite3_backup_finish (backup);
+		} else {
+			rc = sqlite3_errcode (copy);
+		}
+	}
+
+	sqlite3_close (source);
+	sqlite3_close (copy);
+
+	if (rc == SQLITE_DONE) {
+		*out_copied = TRUE;
+		success = archive_read_file (
+			context, copy_filename, chunks, &size, error);
+	} else if (rc != SQLITE_NOTADB && rc != SQLITE_CANTOPEN) {
+		g_warning (
+			"%s: Cannot copy database '%s': %s",
+			G_STRFUNC, filename, sqlite3_errstr (rc));
+	}
+
+	g_unlink (copy_filename);
+	g_free (copy_filename);
+
+	return success;
+}
+
+static gboolean
+archive_is_database_journal (const gchar *name)
+{
+	return g_str_has_suffix (name, ".db-journal") ||
+		g_str_has_suffix (name, ".db-wal") ||
+		g_str_has_suffix (name, ".db-shm");
+}
+
+static gboolean
+archive_add_file (WriteContext *context,
+                  const gchar *root,
+                  const gchar *path,
+                  const gchar *filename,
+                  GStatBuf *st,
+                  GError **error)
+{
+	FileRecord *previous, *record;
+	GArray *chunks = NULL;
+	gchar *key;
+	gint attempt;
+	gboolean inconsistent = FALSE;
+
+	key = file_record_key (root, path);
+	previous = g_hash_table_lookup (context->previous, key);
+	g_free (key);
+
+	if (previous != NULL && previous->chunks != NULL &&
+	    previous->size == st->st_size &&
+	    previous->mtime == STAT_MTIME (st) &&
+	    previous->ctime == STAT_CTIME (st)) {
+		guint ii;
+
+		chunks = g_array_sized_new (
+			FALSE, FALSE, sizeof (ChunkRef), previous->chunks->len);
+		g_array_append_vals (
+			chunks, previous->chunks->data, previous->chunks->len);
+
+		for (ii = 0; ii < chunks->len; ii++) {
+			ChunkRef *ref = &g_array_index (chunks, ChunkRef, ii);
+
+			g_hash_table_add (
+				context->known_chunks, g_strdup (ref->hash));
+		}
+	}
+
+	if (chunks == NULL && g_str_has_suffix (filename, ".db")) {
+		gboolean copied;
+
+		chunks = g_array_new (FALSE, FALSE, sizeof (ChunkRef));
+
+		if (!archive_read_database (context, filename, chunks, &copied, error)) {
+			g_array_free (chunks, TRUE);
+			return FALSE;
+		}
+
+		if (!copied) {
+			g_array_free (chunks, TRUE);
+			chunks = NULL;
+		}
+	}
+
+	for (attempt = 0; chunks == NULL && attempt < MAX_READ_ATTEMPTS; attempt++) {
+		GStatBuf st_after;
+		guint64 size = 0;
+		gboolean changed;
+		GError *local_error = NULL;
+
+		chunks = g_array_new (FALSE, FALSE, sizeof (ChunkRef));
+
+		if (!archive_read_file (context, filename, chunks, &size, &local_error)) {
+			g_array_free (chunks, TRUE);
+
+			/* Removed meanwhile, thus not part of the back up. */
+			if (g_error_matches (local_error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND)) {
+				g_error_free (local_error);
+				return TRUE;
+			}
+
+			g_propagate_error (error, local_error);
+			return FALSE;
+		}
+
+		if (g_stat (filename, &st_after) == -1) {
+			g_array_free (chunks, TRUE);
+			return TRUE;
+		}
+
+		changed =
+			STAT_MTIME (&st_after) != STAT_MTIME (st) ||
+			STAT_CTIME (&st_after) != STAT_CTIME (st) ||
+			st_after.st_size != st->st_size ||
+			size != st->st_size;
+
+		/* The file changed while being read; the last attempt
+		 * is kept, but it can be torn, thus it is marked so. */
+		if (changed && attempt + 1 < MAX_READ_ATTEMPTS) {
+			g_array_free (chunks, TRUE);
+			chunks = NULL;
+		} else if (changed) {
+			g_warning (
+				"%s: File '%s' kept changing while being "
+				"read, its back up can be inconsistent",
+				G_STRFUNC, filename);
+			inconsistent = TRUE;
+		}
+
+		*st = st_after;
+	}
+
+	record = g_slice_new0 (FileRecord);
+	record->root = g_strdup (root);
+	record->path = g_strdup (path);
+	record->mode = st->st_mode & 0777;
+	record->mtime = STAT_MTIME (st);
+	record->ctime = STAT_CTIME (st);
+	record->size = st->st_size;
+	record->inconsistent = inconsistent;
+	record->chunks = chunks;
+
+	/* The file can change again within the same timestamp, after
+	 * being read, thus the stored times would match the changed
+	 * file.  Those modified since this back up started are read
+	 * again next time, like the racily clean files of git. */
+	if (record->mtime >= context->start_time || record->inconsistent)
+		record->ctime = SMUDGED_CTIME;
+
+	g_ptr_array_add (context->records, record);
+
+	return TRUE;
+}
+
+static gint
+archive_compare_names (gconstpointer a,
+                       gconstpointer b)
+{
+	return strcmp (*((const gchar **) a), *((const gchar **) b));
+}
+
+static gboolean
+archive_add_dir (WriteContext *context,
+                 const gchar *root,
+                 const gchar *base_dir,
+                 const gchar *path,
+                 GError **error)
+{
+	GDir *dir;
+	GPtrArray *names;
+	gchar *dirname;
+	const gchar *name;
+	guint ii;
+	gboolean success = TRUE;
+
+	if (*path != '\0')
+		dirname = g_build_filename (base_dir, path, NULL);
+	else
+		dirname = g_strdup (base_dir);
+
+	dir = g_dir_open (dirname, 0, error);
+	if (dir == NULL) {
+		g_free (dirname);
+		return FALSE;
+	}
+
+	names = g_ptr_array_new_with_free_func (g_free);
+
+	while ((name = g_dir_read_name (dir)) != NULL)
+		g_ptr_array_add (names, g_strdup (name));
+
+	g_dir_close (dir);
+
+	g_ptr_array_sort (names, archive_compare_names);
+
+	for (ii = 0; success && ii < names->len; ii++) {
+		GStatBuf st;
+		gchar *child_path, *filename;
+
+		name = names->pdata[ii];
+
+		/* Written for running instances only. */
+		if (*path == '\0' && g_strcmp0 (name, ".running") == 0)
+			continue;
+
+		if (*path != '\0')
+			child_path = g_strconcat (path, "/", name, NULL);
+		else
+			child_path = g_strdup (name);
+
+		filename = g_build_filename (dirname, name, NULL);
+
+		if (g_cancellable_set_error_if_cancelled (context->cancellable, error)) {
+			success = FALSE;
+
+		/* Removed meanwhile, or the archive itself. */
+		} else if (g_stat (filename, &st) == -1 ||
+			   g_strcmp0 (filename, context->archive_dir) == 0) {
+			/* skip it */
+
+		} else if (S_ISDIR (st.st_mode)) {
+			/* Linked folders are not followed, to avoid loops. */
+			if (!g_file_test (filename, G_FILE_TEST_IS_SYMLINK)) {
+				FileRecord *record;
+
+				record = g_slice_new0 (FileRecord);
+				record->root = g_strdup (root);
+				record->path = g_strdup (child_path);
+				record->mode = st.st_mode & 0777;
+				g_ptr_array_add (context->records, record);
+
+				success = archive_add_dir (
+					context, root, base_dir, child_path, error);
+			}
+
+		/* Their content is in the copy of the database. */
+		} else if (archive_is_database_journal (name)) {
+			/* skip it */
+
+		} else if (S_ISREG (st.st_mode)) {
+			success = archive_add_file (
+				context, root, child_path, filename, &st, error);
+		}
+
+		g_free (child_path);
+		g_free (filename);
+	}
+
+	g_ptr_array_unref (names);
+	g_free (dirname);
+
+	return success;
+}
+
+/* Whether the @archive_dir is an incremental back up archive. */
+gboolean
+backup_archive_is_archive (const gchar *archive_dir)
+{
+	gchar *dirname;
+	gboolean is_archive;
+
+	g_return_val_if_fail (archive_dir != NULL, FALSE);
+
+	dirname = g_build_filename (archive_dir, SNAPSHOTS_DIR, NULL);
+	is_archive = g_file_test (dirname, G_FILE_TEST_IS_DIR);
+	g_free (dirname);
+
+	return is_archive;
+}
+
+/* Returns the current time of the file system clock, which can differ
+ * from the system clock, or lag behind it, as the modification time of
+ * a new file in the @dirname. */
+static gint64
+archive_get_start_time (const gchar *dirname)
+{
+	GStatBuf st;
+	gchar *filename;
+	gint64 start_time;
+
+	filename = g_build_filename (dirname, ".start", NULL);
+
+	if (g_file_set_contents (filename, "", 0, NULL) &&
+	    g_stat (filename, &st) == 0)
+		start_time = STAT_MTIME (&st);
+	else
+		start_time = g_get_real_time () * 1000;
+
+	g_unlink (filename);
+	g_free (filename);
+
+	return start_time;
+}
+
+/* Adds a snapshot of the @data_dir and the @config_dir into the archive
+ * at @archive_dir, which is created if needed.  Only chunks not stored
+ * by the previous back ups are written, compressed by parallel threads. */
+gboolean
+backup_archive_write (const gchar *archive_dir,
+                      const gchar *data_dir,
+                      const gchar *config_dir,
+                      const gchar *version,
+                      GCancellable *cancellable,
+                      GError **error)
+{
+	WriteContext context;
+	GPtrArray *previous_records = NULL;
+	gchar *snapshot, *dirname;
+	guint ii;
+	gboolean success;
+
+	g_return_val_if_fail (archive_dir != NULL, FALSE);
+	g_return_val_if_fail (data_dir != NULL, FALSE);
+	g_return_val_if_fail (config_dir != NULL, FALSE);
+	g_return_val_if_fail (version != NULL, FALSE);
+
+	dirname = g_build_filename (archive_dir, SNAPSHOTS_DIR, NULL);
+	if (g_mkdir_with_parents (dirname, 0700) == -1) {
+		g_set_error (
+			error, G_IO_ERROR,
+			g_io_error_from_errno (errno),
+			_("Cannot create folder '%s': %s"),
+			dirname, g_strerror (errno));
+		g_free (dirname);
+		return FALSE;
+	}
+
+	memset (&context, 0, sizeof (WriteContext));
+	context.archive_dir = archive_dir;
+	context.start_time = archive_get_start_time (dirname);
+	g_free (dirname);
+
+	context.cancellable = cancellable;
+	context.previous = g_hash_table_new_full (
+		g_str_hash, g_str_equal, g_free, NULL);
+	context.known_chunks = g_hash_table_new_full (
+		g_str_hash, g_str_equal, g_free, NULL);
+	context.records = g_ptr_array_new_with_free_func (
+		(GDestroyNotify) file_record_free);
+	g_mutex_init (&context.lock);
+	g_cond_init (&context.cond);
+
+	snapshot = find_latest_snapshot (archive_dir);
+	if (snapshot != NULL) {
+		GError *local_error = NULL;
+
+		previous_records = manifest_load (snapshot, NULL, &local_error);
+
+		/* Everything is read again, then. */
+		if (local_error != NULL) {
+			g_warning ("%s: %s", G_STRFUNC, local_error->message);
+			g_error_free (local_error);
+		}
+
+		g_free (snapshot);
+	}
+
+	for (ii = 0; previous_records != NULL && ii < previous_records->len; ii++) {
+		FileRecord *record = previous_records->pdata[ii];
+
+		g_hash_table_insert (
+			context.previous,
+			file_record_key (record->root, record->path),
+			record);
+	}
+
+	context.thread_pool = g_thread_pool_new (
+		chunk_store_thread, &context,
+		g_get_num_processors (), FALSE, NULL);
+
+	success =
+		archive_add_dir (&context, "data", data_dir, "", error) &&
+		archive_add_dir (&context, "config", config_dir, "", error);
+
+	/* Waits for the pending chunks to be written. */
+	g_thread_pool_free (context.thread_pool, FALSE, TRUE);
+
+	if (success && context.error != NULL) {
+		g_propagate_error (error, context.error);
+		context.error = NULL;
+		success = FALSE;
+	}
+
+	/* The snapshot is saved only after all its chunks are stored. */
+	if (success)
+		success = manifest_save (
+			archive_dir, context.records, version, error);
+
+	g_clear_error (&context.error);
+	g_hash_table_destroy (context.previous);
+	g_hash_table_destroy (context.known_chunks);
+	g_ptr_array_unref (context.records);
+	g_mutex_clear (&context.lock);
+	g_cond_clear (&context.cond);
+
+	if (previous_records != NULL)
+		g_ptr_array_unref (previous_records);
+
+	return success;
+}
+
+/* Verifies that the latest snapshot in the @archive_dir can be read
+ * and that all the chunks it refers to are stored. */
+gboolean
+backup_archive_check (const gchar *archive_dir,
+                      GError **error)
+{
+	GPtrArray *records;
+	gchar *snapshot;
+	guint ii, jj;
+	gboolean success = TRUE;
+
+	g_return_val_if_fail (archive_dir != NULL, FALSE);
+
+	snapshot = find_latest_snapshot (archive_dir);
+	if (snapshot == NULL) {
+		g_set_error (
+			error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND,
+			_("No back up found in '%s'"), archive_dir);
+		return FALSE;
+	}
+
+	records = manifest_load (snapshot, NULL, error);
+	g_free (snapshot);
+
+	if (records == NULL)
+		return FALSE;
+
+	for (ii = 0; success && ii < records->len; ii++) {
+		FileRecord *record = records->pdata[ii];
+
+		for (jj = 0; success && record->chunks != NULL && jj < record->chunks->len; jj++) {
+			ChunkRef *ref = &g_array_index (record->chunks, ChunkRef, jj);
+			gchar *filename;
+
+			filename = chunk_filename (archive_dir, ref->hash);
+
+			if (!g_file_test (filename, G_FILE_TEST_IS_REGULAR)) {
+				g_set_error (
+					error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND,
+					_("Back up of '%s' is incomplete"),
+					record->path);
+				success = FALSE;
+			}
+
+			g_free (filename);
+		}
+	}
+
+	g_ptr_array_unref (records);
+
+	return success;
+}
+
+static gboolean
+archive_restore_file (const gchar *archive_dir,
+                      FileRecord *record,
+                      const gchar *filename,
+                      GCancellable *cancellable,
+                      GError **error)
+{
+	GFile *file;
+	GFileOutputStream *output_stream;
+	gchar *dirname;
+	guint ii;
+	gboolean success = TRUE;
+
+	dirname = g_path_get_dirname (filename);
+	g_mkdir_with_parents (dirname, 0700);
+	g_free (dirname);
+
+	file = g_file_new_for_path (filename);
+
+	output_stream = g_file_replace (
+		file, NULL, FALSE, G_FILE_CREATE_NONE, cancellable, error);
+	if (output_stream == NULL) {
+		g_object_unref (file);
+		return FALSE;
+	}
+
+	/* The chunks are decompressed directly into the file. */
+	for (ii = 0; success && ii < record->chunks->len; ii++) {
+		ChunkRef *ref = &g_array_index (record->chunks, ChunkRef, ii);
+		GFileInputStream *chunk_stream;
+		GConverter *decompressor;
+		GInputStream *input_stream;
+		GFile *chunk_file;
+		gchar *chunk_path;
+		gssize written;
+
+		chunk_path = chunk_filename (archive_dir, ref->hash);
+		chunk_file = g_file_new_for_path (chunk_path);
+		chunk_stream = g_file_read (chunk_file, cancellable, error);
+		g_object_unref (chunk_file);
+		g_free (chunk_path);
+
+		if (chunk_stream == NULL) {
+			success = FALSE;
+			break;
+		}
+
+		decompressor = G_CONVERTER (g_zlib_decompressor_new (
+			G_ZLIB_COMPRESSOR_FORMAT_GZIP));
+		input_stream = g_converter_input_stream_new (
+			G_INPUT_STREAM (chunk_stream), decompressor);
+
+		written = g_output_stream_splice (
+			G_OUTPUT_STREAM (output_stream), input_stream,
+			G_OUTPUT_STREAM_SPLICE_CLOSE_SOURCE,
+			cancellable, error);
+
+		if (written == -1) {
+			success = FALSE;
+		} else if (written != ref->length) {
+			g_set_error (
+				error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+				_("Back up of '%s' is corrupted"),
+				record->path);
+			success = FALSE;
+		}
+
+		g_object_unref (input_stream);
+		g_object_unref (decompressor);
+		g_object_unref (chunk_stream);
+	}
+
+	if (success)
+		success = g_output_stream_close (
+			G_OUTPUT_STREAM (output_stream), cancellable, error);
+
+	g_object_unref (output_stream);
+
+	if (success) {
+		GFileInfo *file_info;
+
+		g_chmod (filename, record->mode);
+
+		file_info = g_file_info_new ();
+		g_file_info_set_attribute_uint64 (
+			file_info, G_FILE_ATTRIBUTE_TIME_MODIFIED,
+			record->mtime / 1000000000);
+		g_file_info_set_attribute_uint32 (
+			file_info, G_FILE_ATTRIBUTE_TIME_MODIFIED_USEC,
+			(record->mtime % 1000000000) / 1000);
+		g_file_set_attributes_from_info (
+			file, file_info, G_FILE_QUERY_INFO_NONE,
+			NULL, NULL);
+		g_object_unref (file_info);
+	}
+
+	g_object_unref (file);
+
+	return success;
+}
+
+/* Restores the latest snapshot in the @archive_dir into the @data_dir
+ * and the @config_dir.  The version of Evolution the back up was made
+ * with is returned in the @out_version. */
+gboolean
+backup_archive_restore (const gchar *archive_dir,
+                        const gchar *data_dir,
+                        const gchar *config_dir,
+                        gchar **out_version,
+                        GCancellable *cancellable,
+                        GError **error)
+{
+	GPtrArray *records;
+	gchar *snapshot;
+	guint ii;
+	gboolean success = TRUE;
+
+	g_return_val_if_fail (archive_dir != NULL, FALSE);
+	g_return_val_if_fail (data_dir != NULL, FALSE);
+	g_return_val_if_fail (config_dir != NULL, FALSE);
+
+	snapshot = find_latest_snapshot (archive_dir);
+	if (snapshot == NULL) {
+		g_set_error (
+			error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND,
+			_("No back up found in '%s'"), archive_dir);
+		return FALSE;
+	}
+
+	records = manifest_load (snapshot, out_version, error);
+	g_free (snapshot);
+
+	if (records == NULL)
+		return FALSE;
+
+	for (ii = 0; success && ii < records->len; ii++) {
+		FileRecord *record = records->pdata[ii];
+		const gchar *base_dir;
+		gchar *filename;
+
+		if (g_strcmp0 (record->root, "data") == 0)
+			base_dir = data_dir;
+		else if (g_strcmp0 (record->root, "config") == 0)
+			base_dir = config_dir;
+		else
+			continue;
+
+		filename = g_build_filename (base_dir, record->path, NULL);
+
+		if (record->chunks == NULL)
+			g_mkdir_with_parents (filename, record->mode | 0700);
+		else
+			success = archive_restore_file (
+				archive_dir, record, filename,
+				cancellable, error);
+
+		if (success && record->inconsistent)
+			g_warning (
+				"%s: File '%s' was changing while being "
+				"backed up, it can be inconsistent",
+				G_STRFUNC, filename);
+
+		g_free (filename);
+	}
+
+	g_ptr_array_unref (records);
+
+	return success;
+}
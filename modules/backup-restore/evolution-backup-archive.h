@@ -0,0 +1,43 @@
+/*
+ * evolution-backup-archive.h
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef EVOLUTION_BACKUP_ARCHIVE_H
+#define EVOLUTION_BACKUP_ARCHIVE_H
+
+#include <gio/gio.h>
+
+G_BEGIN_DECLS
+
+gboolean	backup_archive_is_archive	(const gchar *archive_dir);
+gboolean	backup_archive_write		(const gchar *archive_dir,
+						 const gchar *data_dir,
+						 const gchar *config_dir,
+						 const gchar *version,
+						 GCancellable *cancellable,
+						 GError **error);
+gboolean	backup_archive_check		(const gchar *archive_dir,
+						 GError **error);
+gboolean	backup_archive_restore		(const gchar *archive_dir,
+						 const gchar *data_dir,
+						 const gchar *config_dir,
+						 gchar **out_version,
+						 GCancellable *cancellable,
+						 GError **error);
+
+G_END_DECLS
+
+#endif /* EVOLUTION_BACKUP_ARCHIVE_H */
@@ -39,6 +39,8 @@
 #include "e-util/e-util-private.h"
 #include "e-util/e-util.h"
 
+#include "evolution-backup-archive.h"
+
 #define EVOUSERDATADIR_MAGIC "#EVO_USERDATADIR#"
 
 #define EVOLUTION "evolution"
@@ -63,6 +65,7 @@ static gchar *res_file = NULL;
 static gboolean check_op = FALSE;
 static gchar *chk_file = NULL;
 static gboolean restart_arg = FALSE;
+static gboolean incremental_arg = FALSE;
 static gboolean gui_arg = FALSE;
 static gchar **opt_remaining = NULL;
 static gint result = 0;
@@ -79,6 +82,9 @@ static GOptionEntry options[] = {
 	  N_("Check Evolution Back up"), NULL },
 	{ "restart", '\0', 0, G_OPTION_ARG_NONE, &restart_arg,
 	  N_("Restart Evolution"), NULL },
+	{ "incremental", '\0', 0, G_OPTION_ARG_NONE, &incremental_arg,
+	  N_("Back up into an archive folder, storing only what changed, "
+	  "without closing Evolution"), NULL },
 	{ "gui", '\0', 0, G_OPTION_ARG_NONE, &gui_arg,
 	  N_("With Graphical User Interface"), NULL },
 	{ G_OPTION_REMAINING, '\0', 0,
@@ -265,6 +271,53 @@ write_dir_file (void)
 	g_string_free (content, TRUE);
 }
 
+static void
+backup_settings (void)
+{
+	run_cmd ("dconf dump " DCONF_PATH_EDS " >" EVOLUTION_DIR DCONF_DUMP_FILE_EDS);
+	run_cmd ("dconf dump " DCONF_PATH_EVO " >" EVOLUTION_DIR DCONF_DUMP_FILE_EVO);
+
+	replace_in_file (
+		EVOLUTION_DIR DCONF_DUMP_FILE_EDS,
+		e_get_user_data_dir (), EVOUSERDATADIR_MAGIC);
+
+	replace_in_file (
+		EVOLUTION_DIR DCONF_DUMP_FILE_EVO,
+		e_get_user_data_dir (), EVOUSERDATADIR_MAGIC);
+}
+
+static void
+backup_incremental (const gchar *archive_dir,
+                    GCancellable *cancellable)
+{
+	GError *error = NULL;
+
+	g_return_if_fail (archive_dir && *archive_dir);
+
+	/* Evolution keeps running; a file which is changed
+	 * while being backed up is read again. */
+	txt = _("Backing Evolution accounts and settings");
+	backup_settings ();
+
+	if (g_cancellable_is_cancelled (cancellable))
+		return;
+
+	txt = _("Backing Evolution data (Mails, Contacts, Calendar, Tasks, Memos)");
+
+	if (!backup_archive_write (
+		archive_dir, e_get_user_data_dir (),
+		e_get_user_config_dir (), VERSION,
+		cancellable, &error)) {
+		if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+			g_warning ("Failed to back up to '%s': %s", archive_dir, error->message);
+		g_error_free (error);
+		result = 1;
+		return;
+	}
+
+	txt = _("Back up complete");
+}
+
 static void
 backup (const gchar *filename,
         GCancellable *cancellable)
@@ -273,6 +326,12 @@ backup (const gchar *filename,
 	gchar *quotedfname;
 
 	g_return_if_fail (filename && *filename);
+
+	if (incremental_arg) {
+		backup_incremental (filename, cancellable);
+		return;
+	}
+
 	quotedfname = g_shell_quote (filename);
 
 	if (g_cancellable_is_cancelled (cancellable))
@@ -288,16 +347,7 @@ backup (const gchar *filename,
 		return;
 
 	txt = _("Backing Evolution accounts and settings");
-	run_cmd ("dconf dump " DCONF_PATH_EDS " >" EVOLUTION_DIR DCONF_DUMP_FILE_EDS);
-	run_cmd ("dconf dump " DCONF_PATH_EVO " >" EVOLUTION_DIR DCONF_DUMP_FILE_EVO);
-
-	replace_in_file (
-		EVOLUTION_DIR DCONF_DUMP_FILE_EDS,
-		e_get_user_data_dir (), EVOUSERDATADIR_MAGIC);
-
-	replace_in_file (
-		EVOLUTION_DIR DCONF_DUMP_FILE_EVO,
-		e_get_user_data_dir (), EVOUSERDATADIR_MAGIC);
+	backup_settings ();
 
 	write_dir_file ();
 
@@ -468,9 +518,12 @@ restore (const gchar *filename,
 	gchar *command;
 	gchar *quotedfname;
 	gboolean is_new_format = FALSE;
+	gboolean is_archive;
 
 	g_return_if_fail (filename && *filename);
 
+	is_archive = backup_archive_is_archive (filename);
+
 	if (!check (filename, &is_new_format)) {
 		g_message ("Cannot restore from an incorrect archive '%s'.", filename);
 		goto end;
@@ -497,7 +550,35 @@ restore (const gchar *filename,
 
 	txt = _("Extracting files from back up");
 
-	if (is_new_format) {
+	if (is_archive) {
+		gchar *restored_version = NULL;
+		GError *error = NULL;
+
+		g_mkdir_with_parents (e_get_user_data_dir (), 0700);
+		g_mkdir_with_parents (e_get_user_config_dir (), 0700);
+
+		if (!backup_archive_restore (
+			filename, e_get_user_data_dir (),
+			e_get_user_config_dir (), &restored_version,
+			cancellable, &error)) {
+			g_warning ("Failed to restore from '%s': %s", filename, error->message);
+			g_error_free (error);
+			g_free (restored_version);
+			g_free (quotedfname);
+			goto end;
+		}
+
+		if (restored_version != NULL && *restored_version != '\0') {
+			GSettings *settings;
+
+			settings = e_util_ref_settings ("org.gnome.evolution");
+			g_settings_set_string (
+				settings, "version", restored_version);
+			g_object_unref (settings);
+		}
+
+		g_free (restored_version);
+	} else if (is_new_format) {
 		GString *dir_fn;
 		gchar *data_dir = NULL;
 		gchar *config_dir = NULL;
@@ -695,11 +776,30 @@ check (const gchar *filename,
 	gboolean is_new = TRUE;
 
 	g_return_val_if_fail (filename && *filename, FALSE);
-	quotedfname = g_shell_quote (filename);
 
 	if (is_new_format)
 		*is_new_format = FALSE;
 
+	if (backup_archive_is_archive (filename)) {
+		GError *error = NULL;
+
+		if (!backup_archive_check (filename, &error)) {
+			g_message ("%s", error->message);
+			g_error_free (error);
+			result = 1;
+			return FALSE;
+		}
+
+		/* Holds the settings in the data directory, as the new format. */
+		if (is_new_format)
+			*is_new_format = TRUE;
+
+		result = 0;
+		return TRUE;
+	}
+
+	quotedfname = g_shell_quote (filename);
+
 	command = g_strdup_printf ("tar ztf %s 1>/dev/null", quotedfname);
 	result = system (command);
 	g_free (command);
@@ -813,7 +913,7 @@ dlg_response (GtkWidget *dlg,
 	 * them will be just a second of microseconds.*/
 	run_cmd ("pkill tar");
 
-	if (bk_file && backup_op && response == GTK_RESPONSE_REJECT) {
+	if (bk_file && backup_op && !incremental_arg && response == GTK_RESPONSE_REJECT) {
 		/* Backup was canceled, delete the
 		 * backup file as it is not needed now. */
 		gchar *cmd, *filename;
@@ -19,8 +19,10 @@
 #include <config.h>
 #endif
 
+#include <string.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <glib/gstdio.h>
 #include <glib/gi18n-lib.h>
 
 #include <camel/camel.h>
@@ -39,6 +41,9 @@
 #define BOGOFILTER_EXIT_STATUS_UNSURE		2
 #define BOGOFILTER_EXIT_STATUS_ERROR		3
 
+/* How many messages one Bogofilter process gets in bulk mode. */
+#define BOGOFILTER_BULK_MAX_MESSAGES		256
+
 typedef struct _EBogofilter EBogofilter;
 typedef struct _EBogofilterClass EBogofilterClass;
 
@@ -78,6 +83,8 @@ G_DEFINE_DYNAMIC_TYPE_EXTENDED (
 #define BOGOFILTER_COMMAND "/usr/bin/bogofilter"
 #endif
 
+static gboolean wordlist_initialized = FALSE;
+
 static const gchar *
 bogofilter_get_command_path (EBogofilter *extension)
 {
@@ -119,17 +126,18 @@ bogofilter_exited_cb (GPid *pid,
 }
 
 static gint
-bogofilter_command (const gchar **argv,
-                    CamelMimeMessage *message,
-                    GCancellable *cancellable,
-                    GError **error)
+bogofilter_command_full (const gchar **argv,
+                         CamelMimeMessage *message,
+                         GByteArray *output_buffer,
+                         GCancellable *cancellable,
+                         GError **error)
 {
-	CamelStream *stream;
 	GMainContext *context;
+	GSpawnFlags flags = G_SPAWN_DO_NOT_REAP_CHILD;
 	GSource *source;
 	GPid child_pid;
-	gssize bytes_written;
 	gint standard_input;
+	gint standard_output;
 	gulong handler_id = 0;
 	gboolean success;
 
@@ -138,17 +146,19 @@ bogofilter_command (const gchar **argv,
 		gint exit_code;
 	} source_data;
 
+	if (output_buffer == NULL)
+		flags |= G_SPAWN_STDOUT_TO_DEV_NULL;
+
 	/* Spawn Bogofilter with an open stdin pipe. */
 	success = g_spawn_async_with_pipes (
 		NULL,
 		(gchar **) argv,
 		NULL,
-		G_SPAWN_DO_NOT_REAP_CHILD |
-		G_SPAWN_STDOUT_TO_DEV_NULL,
+		flags,
 		NULL, NULL,
 		&child_pid,
-		&standard_input,
-		NULL,
+		(message != NULL) ? &standard_input : NULL,
+		(output_buffer != NULL) ? &standard_output : NULL,
 		NULL,
 		error);
 
@@ -164,20 +174,57 @@ bogofilter_command (const gchar **argv,
 		return BOGOFILTER_EXIT_STATUS_ERROR;
 	}
 
-	/* Stream the CamelMimeMessage to Bogofilter. */
-	stream = camel_stream_fs_new_with_fd (standard_input);
-	bytes_written = camel_data_wrapper_write_to_stream_sync (
-		CAMEL_DATA_WRAPPER (message), stream, cancellable, error);
-	success = (bytes_written >= 0) &&
-		(camel_stream_close (stream, cancellable, error) == 0);
-	g_object_unref (stream);
+	if (message != NULL) {
+		CamelStream *stream;
+		gssize bytes_written;
+
+		/* Stream the CamelMimeMessage to Bogofilter. */
+		stream = camel_stream_fs_new_with_fd (standard_input);
+		bytes_written = camel_data_wrapper_write_to_stream_sync (
+			CAMEL_DATA_WRAPPER (message),
+			stream, cancellable, error);
+		success = (bytes_written >= 0) &&
+			(camel_stream_close (stream, cancellable, error) == 0);
+		g_object_unref (stream);
+
+		if (!success) {
+			g_spawn_close_pid (child_pid);
+			g_prefix_error (
+				error, _("Failed to stream mail "
+				"message content to Bogofilter: "));
+			return BOGOFILTER_EXIT_STATUS_ERROR;
+		}
+	}
 
-	if (!success) {
-		g_spawn_close_pid (child_pid);
-		g_prefix_error (
-			error, _("Failed to stream mail "
-			"message content to Bogofilter: "));
-		return BOGOFILTER_EXIT_STATUS_ERROR;
+	if (output_buffer != NULL) {
+		CamelStream *input_stream;
+		CamelStream *output_stream;
+		gssize bytes_written;
+
+		input_stream = camel_stream_fs_new_with_fd (standard_output);
+
+		output_stream = camel_stream_mem_new ();
+		camel_stream_mem_set_byte_array (
+			CAMEL_STREAM_MEM (output_stream), output_buffer);
+
+		bytes_written = camel_stream_write_to_stream (
+			input_stream, output_stream, cancellable, error);
+		g_byte_array_append (output_buffer, (guint8 *) "", 1);
+		success = (bytes_written >= 0);
+
+		g_object_unref (input_stream);
+		g_object_unref (output_stream);
+
+		if (!success) {
+#ifdef G_OS_UNIX
+			kill (child_pid, SIGTERM);
+#endif
+			g_spawn_close_pid (child_pid);
+			g_prefix_error (
+				error, _("Failed to read "
+				"output from Bogofilter: "));
+			return BOGOFILTER_EXIT_STATUS_ERROR;
+		}
 	}
 
 	/* Wait for the Bogofilter process to terminate
@@ -230,12 +277,184 @@ bogofilter_command (const gchar **argv,
 	return source_data.exit_code;
 }
 
+static gint
+bogofilter_command (const gchar **argv,
+                    CamelMimeMessage *message,
+                    GCancellable *cancellable,
+                    GError **error)
+{
+	return bogofilter_command_full (
+		argv, message, NULL, cancellable, error);
+}
+
+/* Picks the verdicts from the output of Bogofilter in bulk mode, which
+ * is a line per file, starting with the file name.  The files are named
+ * by the message index in the temporary directory @tmp_dir. */
+static void
+bogofilter_parse_bulk_output (const gchar *output,
+                              const gchar *tmp_dir,
+                              CamelJunkStatus *statuses,
+                              guint n_messages)
+{
+	gchar **lines;
+	gsize tmp_dir_len;
+	guint ii;
+
+	tmp_dir_len = strlen (tmp_dir);
+	lines = g_strsplit (output, "\n", -1);
+
+	for (ii = 0; lines[ii] != NULL; ii++) {
+		const gchar *cp = lines[ii];
+		gchar *endptr;
+		guint64 index;
+
+		if (strncmp (cp, tmp_dir, tmp_dir_len) != 0 ||
+		    cp[tmp_dir_len] != G_DIR_SEPARATOR)
+			continue;
+
+		cp += tmp_dir_len + 1;
+		index = g_ascii_strtoull (cp, &endptr, 10);
+		if (endptr == cp || index >= n_messages)
+			continue;
+
+		cp = endptr;
+		while (g_ascii_isspace (*cp))
+			cp++;
+
+		if (g_ascii_strncasecmp (cp, "X-Bogosity:", 11) == 0) {
+			cp += 11;
+			while (g_ascii_isspace (*cp))
+				cp++;
+		}
+
+		switch (g_ascii_toupper (*cp)) {
+			case 'S':
+				statuses[index] = CAMEL_JUNK_STATUS_MESSAGE_IS_JUNK;
+				break;
+
+			case 'H':
+				statuses[index] = CAMEL_JUNK_STATUS_MESSAGE_IS_NOT_JUNK;
+				break;
+
+			default:
+				statuses[index] = CAMEL_JUNK_STATUS_INCONCLUSIVE;
+				break;
+		}
+	}
+
+	g_strfreev (lines);
+}
+
+/* Runs a single Bogofilter process in bulk mode for @n_messages messages
+ * starting at @first.  The messages are saved into a temporary directory
+ * and the files are named on the command line.  With @statuses set the
+ * verdicts are read from the output, those Bogofilter did not report are
+ * left inconclusive. */
+static gint
+bogofilter_command_bulk (const gchar **argv,
+                         GPtrArray *messages,
+                         guint first,
+                         guint n_messages,
+                         CamelJunkStatus *statuses,
+                         GCancellable *cancellable,
+                         GError **error)
+{
+	GByteArray *output_buffer = NULL;
+	GPtrArray *bulk_argv;
+	GPtrArray *filenames;
+	gchar *tmp_dir;
+	gint exit_code = 0;
+	guint ii;
+
+	tmp_dir = g_dir_make_tmp ("evolution-bogofilter-XXXXXX", error);
+	if (tmp_dir == NULL)
+		return BOGOFILTER_EXIT_STATUS_ERROR;
+
+	filenames = g_ptr_array_new_with_free_func (g_free);
+
+	for (ii = 0; ii < n_messages; ii++) {
+		CamelMimeMessage *message;
+		CamelStream *stream;
+		gchar *filename;
+		gchar basename[16];
+		gssize bytes_written;
+		gboolean success;
+
+		message = g_ptr_array_index (messages, first + ii);
+
+		g_snprintf (basename, sizeof (basename), "%u", ii);
+		filename = g_build_filename (tmp_dir, basename, NULL);
+		g_ptr_array_add (filenames, filename);
+
+		stream = camel_stream_fs_new_with_name (
+			filename, O_WRONLY | O_CREAT | O_TRUNC, 0600, error);
+		if (stream == NULL) {
+			exit_code = BOGOFILTER_EXIT_STATUS_ERROR;
+			break;
+		}
+
+		bytes_written = camel_data_wrapper_write_to_stream_sync (
+			CAMEL_DATA_WRAPPER (message),
+			stream, cancellable, error);
+		success = (bytes_written >= 0) &&
+			(camel_stream_close (stream, cancellable, error) == 0);
+		g_object_unref (stream);
+
+		if (!success) {
+			exit_code = BOGOFILTER_EXIT_STATUS_ERROR;
+			break;
+		}
+	}
+
+	if (exit_code != BOGOFILTER_EXIT_STATUS_ERROR) {
+		bulk_argv = g_ptr_array_new ();
+
+		for (ii = 0; argv[ii] != NULL; ii++)
+			g_ptr_array_add (bulk_argv, (gpointer) argv[ii]);
+		g_ptr_array_add (bulk_argv, (gpointer) "-B");
+		for (ii = 0; ii < filenames->len; ii++)
+			g_ptr_array_add (bulk_argv, filenames->pdata[ii]);
+		g_ptr_array_add (bulk_argv, NULL);
+
+		if (statuses != NULL)
+			output_buffer = g_byte_array_new ();
+
+		exit_code = bogofilter_command_full (
+			(const gchar **) bulk_argv->pdata, NULL,
+			output_buffer, cancellable, error);
+
+		g_ptr_array_free (bulk_argv, TRUE);
+	}
+
+	if (output_buffer != NULL) {
+		for (ii = 0; ii < n_messages; ii++)
+			statuses[first + ii] = CAMEL_JUNK_STATUS_INCONCLUSIVE;
+
+		if (exit_code != BOGOFILTER_EXIT_STATUS_ERROR)
+			bogofilter_parse_bulk_output (
+				(const gchar *) output_buffer->data,
+				tmp_dir, statuses + first, n_messages);
+
+		g_byte_array_free (output_buffer, TRUE);
+	}
+
+	for (ii = 0; ii < filenames->len; ii++)
+		g_unlink (filenames->pdata[ii]);
+	g_rmdir (tmp_dir);
+
+	g_ptr_array_free (filenames, TRUE);
+	g_free (tmp_dir);
+
+	return exit_code;
+}
+
 static void
 bogofilter_init_wordlist (EBogofilter *extension)
 {
 	CamelStream *stream;
 	CamelMimeParser *parser;
 	CamelMimeMessage *message;
+	GPtrArray *messages;
 
 	/* Initialize the Bogofilter database with a welcome message. */
 
@@ -251,9 +470,14 @@ bogofilter_init_wordlist (EBogofilter *extension)
 	camel_mime_part_construct_from_parser_sync (
 		CAMEL_MIME_PART (message), parser, NULL, NULL);
 
-	camel_junk_filter_learn_not_junk (
-		CAMEL_JUNK_FILTER (extension), message, NULL, NULL);
+	/* Register it right away, not through the queue. */
+	messages = g_ptr_array_new ();
+	g_ptr_array_add (messages, message);
+
+	e_mail_junk_filter_learn_messages_sync (
+		E_MAIL_JUNK_FILTER (extension), messages, FALSE, NULL, NULL);
 
+	g_ptr_array_unref (messages);
 	g_object_unref (message);
 	g_object_unref (parser);
 }
@@ -399,7 +623,6 @@ bogofilter_classify (CamelJunkFilter *junk_filter,
                      GError **error)
 {
 	EBogofilter *extension = E_BOGOFILTER (junk_filter);
-	static gboolean wordlist_initialized = FALSE;
 	CamelJunkStatus status;
 	gint exit_code;
 
@@ -458,13 +681,48 @@ bogofilter_learn_junk (CamelJunkFilter *junk_filter,
                        CamelMimeMessage *message,
                        GCancellable *cancellable,
                        GError **error)
+{
+	/* Registered in bulk by bogofilter_synchronize(). */
+	return e_mail_junk_filter_queue_learn_sync (
+		E_MAIL_JUNK_FILTER (junk_filter), message,
+		TRUE, cancellable, error);
+}
+
+static gboolean
+bogofilter_learn_not_junk (CamelJunkFilter *junk_filter,
+                           CamelMimeMessage *message,
+                           GCancellable *cancellable,
+                           GError **error)
+{
+	/* Registered in bulk by bogofilter_synchronize(). */
+	return e_mail_junk_filter_queue_learn_sync (
+		E_MAIL_JUNK_FILTER (junk_filter), message,
+		FALSE, cancellable, error);
+}
+
+static gboolean
+bogofilter_synchronize (CamelJunkFilter *junk_filter,
+                        GCancellable *cancellable,
+                        GError **error)
+{
+	return e_mail_junk_filter_flush_learn_sync (
+		E_MAIL_JUNK_FILTER (junk_filter), cancellable, error);
+}
+
+static gboolean
+bogofilter_classify_messages (EMailJunkFilter *junk_filter,
+                              GPtrArray *messages,
+                              CamelJunkStatus *statuses,
+                              GCancellable *cancellable,
+                              GError **error)
 {
 	EBogofilter *extension = E_BOGOFILTER (junk_filter);
-	gint exit_code;
+	gint exit_code = 0;
+	guint first;
 
 	const gchar *argv[] = {
 		bogofilter_get_command_path (extension),
-		"--register-spam",
+		"-t",
 		NULL,  /* leave room for unicode option */
 		NULL
 	};
@@ -472,34 +730,46 @@ bogofilter_learn_junk (CamelJunkFilter *junk_filter,
 	if (bogofilter_get_convert_to_unicode (extension))
 		argv[2] = "--unicode=yes";
 
-	exit_code = bogofilter_command (argv, message, cancellable, error);
+	for (first = 0; first < messages->len; first += BOGOFILTER_BULK_MAX_MESSAGES) {
+		guint n_messages;
 
-	if (exit_code != 0)
-		g_warning (
-			"Bogofilter: Unexpected exit code (%d) "
-			"while registering spam", exit_code);
+		n_messages = MIN (
+			messages->len - first,
+			BOGOFILTER_BULK_MAX_MESSAGES);
 
-	/* Check that the return value and GError agree. */
-	if (exit_code != BOGOFILTER_EXIT_STATUS_ERROR)
-		g_warn_if_fail (error == NULL || *error == NULL);
-	else
-		g_warn_if_fail (error == NULL || *error != NULL);
+retry:
+		exit_code = bogofilter_command_bulk (
+			argv, messages, first, n_messages,
+			statuses, cancellable, error);
+
+		if (exit_code == BOGOFILTER_EXIT_STATUS_ERROR) {
+			if (!wordlist_initialized) {
+				wordlist_initialized = TRUE;
+				g_clear_error (error);
+				bogofilter_init_wordlist (extension);
+				goto retry;
+			}
+			break;
+		}
+	}
 
 	return (exit_code != BOGOFILTER_EXIT_STATUS_ERROR);
 }
 
 static gboolean
-bogofilter_learn_not_junk (CamelJunkFilter *junk_filter,
-                           CamelMimeMessage *message,
+bogofilter_learn_messages (EMailJunkFilter *junk_filter,
+                           GPtrArray *messages,
+                           gboolean is_junk,
                            GCancellable *cancellable,
                            GError **error)
 {
 	EBogofilter *extension = E_BOGOFILTER (junk_filter);
-	gint exit_code;
+	gint exit_code = 0;
+	guint first;
 
 	const gchar *argv[] = {
 		bogofilter_get_command_path (extension),
-		"--register-ham",
+		is_junk ? "--register-spam" : "--register-ham",
 		NULL,  /* leave room for unicode option */
 		NULL
 	};
@@ -507,18 +777,20 @@ bogofilter_learn_not_junk (CamelJunkFilter *junk_filter,
 	if (bogofilter_get_convert_to_unicode (extension))
 		argv[2] = "--unicode=yes";
 
-	exit_code = bogofilter_command (argv, message, cancellable, error);
+	for (first = 0; first < messages->len; first += BOGOFILTER_BULK_MAX_MESSAGES) {
+		guint n_messages;
 
-	if (exit_code != 0)
-		g_warning (
-			"Bogofilter: Unexpected exit code (%d) "
-			"while registering ham", exit_code);
+		n_messages = MIN (
+			messages->len - first,
+			BOGOFILTER_BULK_MAX_MESSAGES);
 
-	/* Check that the return value and GError agree. */
-	if (exit_code != BOGOFILTER_EXIT_STATUS_ERROR)
-		g_warn_if_fail (error == NULL || *error == NULL);
-	else
-		g_warn_if_fail (error == NULL || *error != NULL);
+		exit_code = bogofilter_command_bulk (
+			argv, messages, first, n_messages,
+			NULL, cancellable, error);
+
+		if (exit_code == BOGOFILTER_EXIT_STATUS_ERROR)
+			break;
+	}
 
 	return (exit_code != BOGOFILTER_EXIT_STATUS_ERROR);
 }
@@ -539,6 +811,8 @@ e_bogofilter_class_init (EBogofilterClass *class)
 	junk_filter_class->display_name = _("Bogofilter");
 	junk_filter_class->available = bogofilter_available;
 	junk_filter_class->new_config_widget = bogofilter_new_config_widget;
+	junk_filter_class->classify_messages = bogofilter_classify_messages;
+	junk_filter_class->learn_messages = bogofilter_learn_messages;
 
 	g_object_class_install_property (
 		object_class,
@@ -572,6 +846,7 @@ e_bogofilter_interface_init (CamelJunkFilterInterface *iface)
 	iface->classify = bogofilter_classify;
 	iface->learn_junk = bogofilter_learn_junk;
 	iface->learn_not_junk = bogofilter_learn_not_junk;
+	iface->synchronize = bogofilter_synchronize;
 }
 
 static void
@@ -19,9 +19,24 @@
 #include <config.h>
 #endif
 
+/* Snapshot files are append-only journals.  Each attachment is stored
+ * once, in a part record keyed by the hash of its content.  Every other
+ * snapshot appends a message record with the headers and the body only,
+ * which refers to its attachments by their hashes.  The last complete
+ * message record describes the message; a record cut short by a crash
+ * ends the journal.  The file is rewritten from scratch when it holds
+ * too many stale records or when an append failed.
+ *
+ *   EVOLUTION-AUTOSAVE-JOURNAL 1
+ *   P <hash> <length>\n<serialized attachment part>\n
+ *   M <length> [<hash> ...]\n<message without attachments>\n
+ */
+
 #include "e-autosave-utils.h"
 
 #include <errno.h>
+#include <string.h>
+#include <glib/gi18n-lib.h>
 #include <glib/gstdio.h>
 #include <camel/camel.h>
 
@@ -31,8 +46,17 @@
 #define SNAPSHOT_FILE_PREFIX	".evolution-composer.autosave"
 #define SNAPSHOT_FILE_SEED	SNAPSHOT_FILE_PREFIX "-XXXXXX"
 
+#define SNAPSHOT_JOURNAL_KEY	"e-composer-snapshot-journal"
+#define SNAPSHOT_JOURNAL_MAGIC	"EVOLUTION-AUTOSAVE-JOURNAL 1\n"
+#define SNAPSHOT_PART_HASH_KEY	"e-composer-snapshot-part-hash"
+
+/* Stale records are tolerated up to this size above the live ones. */
+#define SNAPSHOT_JOURNAL_SLACK	(1024 * 1024)
+
 typedef struct _LoadContext LoadContext;
 typedef struct _SaveContext SaveContext;
+typedef struct _SnapshotJournal SnapshotJournal;
+typedef struct _SnapshotPartHash SnapshotPartHash;
 
 struct _LoadContext {
 	EMsgComposer *composer;
@@ -40,7 +64,39 @@ struct _LoadContext {
 
 struct _SaveContext {
 	GCancellable *cancellable;
-	GOutputStream *output_stream;
+	GFile *snapshot_file;
+	SnapshotJournal *journal;
+
+	/* The message record and the attachment part hashes */
+	GString *header;
+	GByteArray *body;
+	gchar *message_hash;
+	GPtrArray *hashes;
+
+	/* Part hash -> serialized part, the parts to store */
+	GHashTable *serialized;
+};
+
+/* What the snapshot file of a composer currently holds. */
+struct _SnapshotJournal {
+	GMutex lock;
+
+	/* Part hash -> size of its record in the file */
+	GHashTable *parts;
+
+	/* Hash of the last message record */
+	gchar *message_hash;
+
+	goffset file_size;
+	gboolean needs_rewrite;
+};
+
+/* The hash of an attachment part, valid while the part
+ * has the same content and headers it was computed for. */
+struct _SnapshotPartHash {
+	CamelDataWrapper *content;
+	gchar *headers_hash;
+	gchar *hash;
 };
 
 static void
@@ -58,12 +114,613 @@ save_context_free (SaveContext *context)
 	if (context->cancellable != NULL)
 		g_object_unref (context->cancellable);
 
-	if (context->output_stream != NULL)
-		g_object_unref (context->output_stream);
+	if (context->snapshot_file != NULL)
+		g_object_unref (context->snapshot_file);
+
+	if (context->body != NULL)
+		g_byte_array_free (context->body, TRUE);
+
+	g_string_free (context->header, TRUE);
+	g_free (context->message_hash);
+	g_ptr_array_free (context->hashes, TRUE);
+	g_hash_table_destroy (context->serialized);
 
 	g_slice_free (SaveContext, context);
 }
 
+static void
+snapshot_journal_free (SnapshotJournal *journal)
+{
+	g_hash_table_destroy (journal->parts);
+	g_free (journal->message_hash);
+	g_mutex_clear (&journal->lock);
+
+	g_slice_free (SnapshotJournal, journal);
+}
+
+static void
+snapshot_part_hash_free (SnapshotPartHash *part_hash)
+{
+	if (part_hash->content != NULL)
+		g_object_unref (part_hash->content);
+
+	g_free (part_hash->headers_hash);
+	g_free (part_hash->hash);
+
+	g_slice_free (SnapshotPartHash, part_hash);
+}
+
+static gchar *
+snapshot_hash_part_headers (CamelMimePart *part)
+{
+	struct _camel_header_raw *header;
+	GChecksum *checksum;
+	gchar *hash;
+
+	checksum = g_checksum_new (G_CHECKSUM_SHA256);
+
+	for (header = part->headers; header != NULL; header = header->next) {
+		g_checksum_update (
+			checksum, (const guchar *) header->name, -1);
+		g_checksum_update (checksum, (const guchar *) ":", 1);
+		if (header->value != NULL)
+			g_checksum_update (
+				checksum, (const guchar *) header->value, -1);
+		g_checksum_update (checksum, (const guchar *) "\n", 1);
+	}
+
+	hash = g_strdup (g_checksum_get_string (checksum));
+	g_checksum_free (checksum);
+
+	return hash;
+}
+
+static SnapshotJournal *
+snapshot_journal_get (EMsgComposer *composer)
+{
+	SnapshotJournal *journal;
+
+	journal = g_object_get_data (G_OBJECT (composer), SNAPSHOT_JOURNAL_KEY);
+
+	if (journal == NULL) {
+		journal = g_slice_new0 (SnapshotJournal);
+		journal->parts = g_hash_table_new_full (
+			g_str_hash, g_str_equal,
+			(GDestroyNotify) g_free,
+			(GDestroyNotify) NULL);
+		g_mutex_init (&journal->lock);
+
+		/* Whatever is in the file, start it over. */
+		journal->needs_rewrite = TRUE;
+
+		g_object_set_data_full (
+			G_OBJECT (composer),
+			SNAPSHOT_JOURNAL_KEY, journal,
+			(GDestroyNotify) snapshot_journal_free);
+	}
+
+	return journal;
+}
+
+static GByteArray *
+snapshot_serialize (CamelDataWrapper *wrapper,
+                    GCancellable *cancellable,
+                    GError **error)
+{
+	CamelStream *camel_stream;
+	GByteArray *buffer;
+	gssize n_written;
+
+	buffer = g_byte_array_new ();
+	camel_stream = camel_stream_mem_new ();
+	camel_stream_mem_set_byte_array (
+		CAMEL_STREAM_MEM (camel_stream), buffer);
+	n_written = camel_data_wrapper_write_to_stream_sync (
+		wrapper, camel_stream, cancellable, error);
+	g_object_unref (camel_stream);
+
+	if (n_written < 0) {
+		g_byte_array_free (buffer, TRUE);
+		return NULL;
+	}
+
+	return buffer;
+}
+
+static void
+snapshot_buffer_free (GByteArray *buffer)
+{
+	g_byte_array_free (buffer, TRUE);
+}
+
+static gboolean
+snapshot_write_record (GOutputStream *output_stream,
+                       const gchar *header,
+                       GByteArray *buffer,
+                       goffset *file_size,
+                       GError **error)
+{
+	gsize header_len = strlen (header);
+
+	/* Records are never cut short by a cancellation,
+	 * only an I/O error can leave one incomplete. */
+	if (!g_output_stream_write_all (
+		output_stream, header, header_len, NULL, NULL, error) ||
+	    !g_output_stream_write_all (
+		output_stream, buffer->data, buffer->len, NULL, NULL, error) ||
+	    !g_output_stream_write_all (
+		output_stream, "\n", 1, NULL, NULL, error))
+		return FALSE;
+
+	*file_size += header_len + buffer->len + 1;
+
+	return TRUE;
+}
+
+/* Serializes the attachments the snapshot file might not hold yet and
+ * the rest of the message.  The attachment parts are shared with the
+ * composer's attachments, which the main thread changes at any time,
+ * thus this runs in the main thread and leaves only byte buffers for
+ * the writing thread. */
+static gboolean
+snapshot_journal_prepare (SaveContext *context,
+                          CamelMimeMessage *message,
+                          gboolean has_attachments,
+                          GError **error)
+{
+	SnapshotJournal *journal = context->journal;
+	CamelDataWrapper *content;
+	CamelMultipart *attachments = NULL;
+	GArray *missing;
+	GChecksum *checksum;
+	gboolean rewrite;
+	gboolean success = FALSE;
+	guint ii;
+
+	missing = g_array_new (FALSE, FALSE, sizeof (guint));
+
+	content = camel_medium_get_content (CAMEL_MEDIUM (message));
+
+	/* The composer puts attachments after the body
+	 * into a multipart/mixed; split them off here. */
+	if (has_attachments && CAMEL_IS_MULTIPART (content) &&
+	    camel_content_type_is (
+		camel_data_wrapper_get_mime_type_field (content),
+		"multipart", "mixed") &&
+	    camel_multipart_get_number (CAMEL_MULTIPART (content)) > 1) {
+		CamelMultipart *stripped;
+		guint n_parts;
+
+		attachments = g_object_ref (content);
+		n_parts = camel_multipart_get_number (attachments);
+
+		for (ii = 1; ii < n_parts; ii++) {
+			CamelMimePart *part;
+			CamelDataWrapper *part_content;
+			SnapshotPartHash *part_hash;
+			gchar *headers_hash;
+
+			part = camel_multipart_get_part (attachments, ii);
+			part_content = camel_medium_get_content (
+				CAMEL_MEDIUM (part));
+			headers_hash = snapshot_hash_part_headers (part);
+
+			/* The content of a part is hashed only once,
+			 * unless the attachment dialog changes the part's
+			 * filename, description or disposition. */
+			part_hash = g_object_get_data (
+				G_OBJECT (part), SNAPSHOT_PART_HASH_KEY);
+
+			if (part_hash == NULL ||
+			    part_hash->content != part_content ||
+			    g_strcmp0 (part_hash->headers_hash, headers_hash) != 0) {
+				GByteArray *buffer;
+				gchar *new_hash;
+
+				buffer = snapshot_serialize (
+					CAMEL_DATA_WRAPPER (part),
+					context->cancellable, error);
+				if (buffer == NULL) {
+					g_free (headers_hash);
+					goto exit;
+				}
+
+				new_hash = g_compute_checksum_for_data (
+					G_CHECKSUM_SHA256,
+					buffer->data, buffer->len);
+
+				part_hash = g_slice_new0 (SnapshotPartHash);
+				if (part_content != NULL)
+					part_hash->content =
+						g_object_ref (part_content);
+				part_hash->headers_hash = headers_hash;
+				part_hash->hash = g_strdup (new_hash);
+				headers_hash = NULL;
+
+				g_object_set_data_full (
+					G_OBJECT (part),
+					SNAPSHOT_PART_HASH_KEY, part_hash,
+					(GDestroyNotify) snapshot_part_hash_free);
+				g_hash_table_replace (
+					context->serialized, new_hash, buffer);
+			}
+
+			g_free (headers_hash);
+
+			g_ptr_array_add (
+				context->hashes, g_strdup (part_hash->hash));
+		}
+
+		stripped = camel_multipart_new ();
+		camel_data_wrapper_set_mime_type_field (
+			CAMEL_DATA_WRAPPER (stripped),
+			camel_data_wrapper_get_mime_type_field (content));
+		camel_multipart_add_part (
+			stripped, camel_multipart_get_part (attachments, 0));
+		camel_medium_set_content (
+			CAMEL_MEDIUM (message),
+			CAMEL_DATA_WRAPPER (stripped));
+		g_object_unref (stripped);
+	}
+
+	context->body = snapshot_serialize (
+		CAMEL_DATA_WRAPPER (message), context->cancellable, error);
+	if (context->body == NULL)
+		goto exit;
+
+	g_string_append_printf (context->header, "M %u", context->body->len);
+	for (ii = 0; ii < context->hashes->len; ii++) {
+		g_string_append_c (context->header, ' ');
+		g_string_append (context->header, context->hashes->pdata[ii]);
+	}
+	g_string_append_c (context->header, '\n');
+
+	checksum = g_checksum_new (G_CHECKSUM_SHA256);
+	g_checksum_update (
+		checksum, (const guchar *) context->header->str,
+		context->header->len);
+	g_checksum_update (
+		checksum, context->body->data, context->body->len);
+	context->message_hash = g_strdup (g_checksum_get_string (checksum));
+	g_checksum_free (checksum);
+
+	/* A snapshot still being written can change what the file
+	 * holds meanwhile, thus expect the file to be rewritten then. */
+	if (g_mutex_trylock (&journal->lock)) {
+		goffset live_size;
+
+		live_size = context->header->len + context->body->len + 1;
+		for (ii = 0; ii < context->hashes->len; ii++)
+			live_size += GPOINTER_TO_SIZE (g_hash_table_lookup (
+				journal->parts, context->hashes->pdata[ii]));
+
+		rewrite = journal->needs_rewrite ||
+			journal->file_size > 2 * live_size + SNAPSHOT_JOURNAL_SLACK;
+
+		for (ii = 0; ii < context->hashes->len; ii++) {
+			const gchar *hash = context->hashes->pdata[ii];
+
+			if (!g_hash_table_contains (context->serialized, hash) &&
+			    (rewrite || !g_hash_table_contains (journal->parts, hash)))
+				g_array_append_val (missing, ii);
+		}
+
+		g_mutex_unlock (&journal->lock);
+	} else {
+		for (ii = 0; ii < context->hashes->len; ii++) {
+			const gchar *hash = context->hashes->pdata[ii];
+
+			if (!g_hash_table_contains (context->serialized, hash))
+				g_array_append_val (missing, ii);
+		}
+	}
+
+	for (ii = 0; ii < missing->len; ii++) {
+		guint index = g_array_index (missing, guint, ii);
+		CamelMimePart *part;
+		GByteArray *buffer;
+
+		part = camel_multipart_get_part (attachments, index + 1);
+		buffer = snapshot_serialize (
+			CAMEL_DATA_WRAPPER (part), context->cancellable, error);
+		if (buffer == NULL)
+			goto exit;
+
+		g_hash_table_replace (
+			context->serialized,
+			g_strdup (context->hashes->pdata[index]), buffer);
+	}
+
+	success = TRUE;
+
+exit:
+	if (attachments != NULL)
+		g_object_unref (attachments);
+
+	g_array_free (missing, TRUE);
+
+	return success;
+}
+
+/* Writes what snapshot_journal_prepare() serialized; the caller
+ * holds the journal lock.  It does not touch the message at all. */
+static gboolean
+snapshot_journal_write (SaveContext *context,
+                        GError **error)
+{
+	SnapshotJournal *journal = context->journal;
+	GOutputStream *output_stream = NULL;
+	GPtrArray *hashes = context->hashes;
+	goffset live_size;
+	gboolean rewrite;
+	gboolean success = FALSE;
+	guint ii;
+
+	/* Nothing changed since the last snapshot. */
+	if (!journal->needs_rewrite &&
+	    g_strcmp0 (context->message_hash, journal->message_hash) == 0)
+		return TRUE;
+
+	live_size = context->header->len + context->body->len + 1;
+	for (ii = 0; ii < hashes->len; ii++)
+		live_size += GPOINTER_TO_SIZE (g_hash_table_lookup (
+			journal->parts, hashes->pdata[ii]));
+
+	rewrite = journal->needs_rewrite ||
+		journal->file_size > 2 * live_size + SNAPSHOT_JOURNAL_SLACK;
+
+	/* Another snapshot changed the file since this one was prepared
+	 * and it lacks some of the attachments now; the next one will
+	 * serialize all of them, the file keeps the previous snapshot. */
+	for (ii = 0; ii < hashes->len; ii++) {
+		const gchar *hash = hashes->pdata[ii];
+
+		if (!g_hash_table_contains (context->serialized, hash) &&
+		    (rewrite || !g_hash_table_contains (journal->parts, hash))) {
+			journal->needs_rewrite = TRUE;
+			return TRUE;
+		}
+	}
+
+	if (g_cancellable_set_error_if_cancelled (context->cancellable, error))
+		return FALSE;
+
+	if (rewrite) {
+		/* Output stream might be NULL, so don't use cast macro. */
+		output_stream = (GOutputStream *) g_file_replace (
+			context->snapshot_file, NULL, FALSE,
+			G_FILE_CREATE_PRIVATE, NULL, error);
+		if (output_stream == NULL)
+			goto exit;
+
+		g_hash_table_remove_all (journal->parts);
+		journal->file_size = strlen (SNAPSHOT_JOURNAL_MAGIC);
+		journal->needs_rewrite = TRUE;
+
+		if (!g_output_stream_write_all (
+			output_stream, SNAPSHOT_JOURNAL_MAGIC,
+			strlen (SNAPSHOT_JOURNAL_MAGIC), NULL, NULL, error))
+			goto exit;
+	} else {
+		/* Output stream might be NULL, so don't use cast macro. */
+		output_stream = (GOutputStream *) g_file_append_to (
+			context->snapshot_file, G_FILE_CREATE_PRIVATE, NULL, error);
+		if (output_stream == NULL)
+			goto exit;
+	}
+
+	/* Store attachments the file does not hold yet. */
+	for (ii = 0; ii < hashes->len; ii++) {
+		const gchar *hash = hashes->pdata[ii];
+		GByteArray *buffer;
+		gchar *part_header;
+		goffset file_size;
+
+		if (g_hash_table_contains (journal->parts, hash))
+			continue;
+
+		buffer = g_hash_table_lookup (context->serialized, hash);
+
+		part_header = g_strdup_printf ("P %s %u\n", hash, buffer->len);
+		file_size = journal->file_size;
+
+		if (!snapshot_write_record (
+			output_stream, part_header, buffer,
+			&journal->file_size, error)) {
+			g_free (part_header);
+			journal->needs_rewrite = TRUE;
+			goto exit;
+		}
+
+		g_free (part_header);
+
+		g_hash_table_replace (
+			journal->parts, g_strdup (hash),
+			GSIZE_TO_POINTER (journal->file_size - file_size));
+	}
+
+	if (!snapshot_write_record (
+		output_stream, context->header->str, context->body,
+		&journal->file_size, error) ||
+	    !g_output_stream_close (output_stream, NULL, error)) {
+		journal->needs_rewrite = TRUE;
+		goto exit;
+	}
+
+	g_free (journal->message_hash);
+	journal->message_hash = g_strdup (context->message_hash);
+	journal->needs_rewrite = FALSE;
+
+	success = TRUE;
+
+exit:
+	if (output_stream != NULL) {
+		if (!success) {
+			GCancellable *abort_cancellable;
+
+			/* A replaced file keeps its previous
+			 * content when the close is cancelled. */
+			abort_cancellable = g_cancellable_new ();
+			g_cancellable_cancel (abort_cancellable);
+			g_output_stream_close (
+				output_stream, abort_cancellable, NULL);
+			g_object_unref (abort_cancellable);
+		}
+
+		g_object_unref (output_stream);
+	}
+
+	return success;
+}
+
+static CamelMimePart *
+snapshot_parse_part (CamelMimePart *part,
+                     const gchar *data,
+                     gsize length,
+                     GError **error)
+{
+	CamelStream *camel_stream;
+	gboolean success;
+
+	camel_stream = camel_stream_mem_new_with_buffer (data, length);
+	success = camel_data_wrapper_construct_from_stream_sync (
+		CAMEL_DATA_WRAPPER (part), camel_stream, NULL, error);
+	g_object_unref (camel_stream);
+
+	if (!success) {
+		g_object_unref (part);
+		return NULL;
+	}
+
+	return part;
+}
+
+static CamelMimeMessage *
+snapshot_journal_replay (const gchar *contents,
+                         gsize length,
+                         GError **error)
+{
+	CamelMimeMessage *message;
+	CamelDataWrapper *content;
+	GHashTable *parts;
+	const gchar *pos, *end;
+	const gchar *body = NULL;
+	gsize body_len = 0;
+	gchar **body_hashes = NULL;
+	guint ii;
+
+	/* Snapshots of former versions are plain messages. */
+	if (!g_str_has_prefix (contents, SNAPSHOT_JOURNAL_MAGIC))
+		return (CamelMimeMessage *) snapshot_parse_part (
+			CAMEL_MIME_PART (camel_mime_message_new ()),
+			contents, length, error);
+
+	parts = g_hash_table_new_full (
+		g_str_hash, g_str_equal,
+		(GDestroyNotify) g_free,
+		(GDestroyNotify) g_bytes_unref);
+
+	pos = contents + strlen (SNAPSHOT_JOURNAL_MAGIC);
+	end = contents + length;
+
+	while (pos < end) {
+		const gchar *eol, *data;
+		gchar *line;
+		gchar **tokens;
+		guint n_tokens;
+		guint64 record_len;
+
+		eol = memchr (pos, '\n', end - pos);
+		if (eol == NULL)
+			break;
+
+		line = g_strndup (pos, eol - pos);
+		tokens = g_strsplit (line, " ", -1);
+		n_tokens = g_strv_length (tokens);
+		g_free (line);
+
+		data = eol + 1;
+
+		if (n_tokens == 3 && strcmp (tokens[0], "P") == 0)
+			record_len = g_ascii_strtoull (tokens[2], NULL, 10);
+		else if (n_tokens >= 2 && strcmp (tokens[0], "M") == 0)
+			record_len = g_ascii_strtoull (tokens[1], NULL, 10);
+		else
+			record_len = G_MAXUINT64;
+
+		/* An unknown or incomplete record ends the journal. */
+		if (record_len >= (guint64) (end - data) ||
+		    data[record_len] != '\n') {
+			g_strfreev (tokens);
+			break;
+		}
+
+		if (*tokens[0] == 'P') {
+			g_hash_table_replace (
+				parts, g_strdup (tokens[1]),
+				g_bytes_new_static (data, record_len));
+		} else {
+			body = data;
+			body_len = record_len;
+			g_strfreev (body_hashes);
+			body_hashes = g_strdupv (tokens + 2);
+		}
+
+		g_strfreev (tokens);
+
+		pos = data + record_len + 1;
+	}
+
+	if (body == NULL) {
+		g_set_error_literal (
+			error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+			_("The auto-save file contains no message"));
+		g_hash_table_destroy (parts);
+		return NULL;
+	}
+
+	message = (CamelMimeMessage *) snapshot_parse_part (
+		CAMEL_MIME_PART (camel_mime_message_new ()),
+		body, body_len, error);
+
+	content = (message != NULL) ?
+		camel_medium_get_content (CAMEL_MEDIUM (message)) : NULL;
+
+	/* Put the attachments back after the body. */
+	for (ii = 0; CAMEL_IS_MULTIPART (content) && body_hashes[ii]; ii++) {
+		CamelMimePart *part;
+		GBytes *bytes;
+		GError *local_error = NULL;
+
+		bytes = g_hash_table_lookup (parts, body_hashes[ii]);
+		if (bytes == NULL) {
+			g_warning (
+				"%s: Attachment %s is missing",
+				G_STRFUNC, body_hashes[ii]);
+			continue;
+		}
+
+		part = snapshot_parse_part (
+			camel_mime_part_new (),
+			g_bytes_get_data (bytes, NULL),
+			g_bytes_get_size (bytes), &local_error);
+
+		if (part != NULL) {
+			camel_multipart_add_part (
+				CAMEL_MULTIPART (content), part);
+			g_object_unref (part);
+		} else {
+			g_warning ("%s: %s", G_STRFUNC, local_error->message);
+			g_error_free (local_error);
+		}
+	}
+
+	g_hash_table_destroy (parts);
+	g_strfreev (body_hashes);
+
+	return message;
+}
+
 static void
 delete_snapshot_file (GFile *snapshot_file)
 {
@@ -126,7 +783,6 @@ load_snapshot_loaded_cb (GFile *snapshot_file,
 	LoadContext *context;
 	EMsgComposer *composer;
 	CamelMimeMessage *message;
-	CamelStream *camel_stream;
 	gchar *contents = NULL;
 	gsize length;
 	GError *local_error = NULL;
@@ -143,20 +799,16 @@ load_snapshot_loaded_cb (GFile *snapshot_file,
 		return;
 	}
 
-	/* Create an in-memory buffer for the MIME parser to read from.
-	 * We have to do this because CamelStreams are syncrhonous-only,
-	 * and feeding the parser a direct file stream would block. */
-	message = camel_mime_message_new ();
-	camel_stream = camel_stream_mem_new_with_buffer (contents, length);
-	camel_data_wrapper_construct_from_stream_sync (
-		CAMEL_DATA_WRAPPER (message), camel_stream, NULL, &local_error);
-	g_object_unref (camel_stream);
+	/* Replay the journal from the in-memory contents.  We have to do
+	 * this because CamelStreams are syncrhonous-only, and feeding the
+	 * parser a direct file stream would block. */
+	message = snapshot_journal_replay (contents, length, &local_error);
 	g_free (contents);
 
 	if (local_error != NULL) {
+		g_warn_if_fail (message == NULL);
 		g_simple_async_result_take_error (simple, local_error);
 		g_simple_async_result_complete (simple);
-		g_object_unref (message);
 		return;
 	}
 
@@ -183,19 +835,25 @@ load_snapshot_loaded_cb (GFile *snapshot_file,
 }
 
 static void
-save_snapshot_splice_cb (GOutputStream *output_stream,
-                         GAsyncResult *result,
-                         GSimpleAsyncResult *simple)
+save_snapshot_thread (GSimpleAsyncResult *simple,
+                      GObject *object,
+                      GCancellable *cancellable)
 {
+	SaveContext *context;
 	GError *local_error = NULL;
 
-	g_output_stream_splice_finish (output_stream, result, &local_error);
+	context = g_simple_async_result_get_op_res_gpointer (simple);
+
+	/* A cancelled snapshot may still be writing,
+	 * do not let the next one interleave with it. */
+	g_mutex_lock (&context->journal->lock);
+
+	snapshot_journal_write (context, &local_error);
+
+	g_mutex_unlock (&context->journal->lock);
 
 	if (local_error != NULL)
 		g_simple_async_result_take_error (simple, local_error);
-
-	g_simple_async_result_complete (simple);
-	g_object_unref (simple);
 }
 
 static void
@@ -205,9 +863,8 @@ save_snapshot_get_message_cb (EMsgComposer *composer,
 {
 	SaveContext *context;
 	CamelMimeMessage *message;
-	GInputStream *input_stream;
-	CamelStream *camel_stream;
-	GByteArray *buffer;
+	EAttachmentView *view;
+	EAttachmentStore *store;
 	GError *local_error = NULL;
 
 	context = g_simple_async_result_get_op_res_gpointer (simple);
@@ -225,77 +882,30 @@ save_snapshot_get_message_cb (EMsgComposer *composer,
 
 	g_return_if_fail (CAMEL_IS_MIME_MESSAGE (message));
 
-	/* Decode the message to an in-memory buffer.  We have to do this
-	 * because CamelStreams are synchronous-only, and using threads is
-	 * dangerous because CamelDataWrapper is not reentrant. */
-	buffer = g_byte_array_new ();
-	camel_stream = camel_stream_mem_new ();
-	camel_stream_mem_set_byte_array (
-		CAMEL_STREAM_MEM (camel_stream), buffer);
-	camel_data_wrapper_decode_to_stream_sync (
-		CAMEL_DATA_WRAPPER (message), camel_stream, NULL, NULL);
-	g_object_unref (camel_stream);
-
-	g_object_unref (message);
-
-	/* Load the buffer into a GMemoryInputStream. */
-	input_stream = g_memory_input_stream_new ();
-	if (buffer->len > 0)
-		g_memory_input_stream_add_data (
-			G_MEMORY_INPUT_STREAM (input_stream),
-			buffer->data, (gssize) buffer->len,
-			(GDestroyNotify) g_free);
-	g_byte_array_free (buffer, FALSE);
-
-	/* Splice the input and output streams. */
-	g_output_stream_splice_async (
-		context->output_stream, input_stream,
-		G_OUTPUT_STREAM_SPLICE_CLOSE_SOURCE |
-		G_OUTPUT_STREAM_SPLICE_CLOSE_TARGET,
-		G_PRIORITY_DEFAULT, context->cancellable,
-		(GAsyncReadyCallback) save_snapshot_splice_cb,
-		simple);
-
-	g_object_unref (input_stream);
-}
+	view = e_msg_composer_get_attachment_view (composer);
+	store = e_attachment_view_get_store (view);
 
-static void
-save_snapshot_replace_cb (GFile *snapshot_file,
-                          GAsyncResult *result,
-                          GSimpleAsyncResult *simple)
-{
-	GObject *object;
-	SaveContext *context;
-	GFileOutputStream *output_stream;
-	GError *local_error = NULL;
+	snapshot_journal_prepare (
+		context, message,
+		e_attachment_store_get_num_attachments (store) > 0,
+		&local_error);
 
-	context = g_simple_async_result_get_op_res_gpointer (simple);
-
-	/* Output stream might be NULL, so don't use cast macro. */
-	output_stream = g_file_replace_finish (
-		snapshot_file, result, &local_error);
-	context->output_stream = (GOutputStream *) output_stream;
+	g_object_unref (message);
 
 	if (local_error != NULL) {
-		g_warn_if_fail (output_stream == NULL);
 		g_simple_async_result_take_error (simple, local_error);
 		g_simple_async_result_complete (simple);
 		g_object_unref (simple);
 		return;
 	}
 
-	g_return_if_fail (G_IS_OUTPUT_STREAM (output_stream));
-
-	/* g_async_result_get_source_object() returns a new reference. */
-	object = g_async_result_get_source_object (G_ASYNC_RESULT (simple));
+	/* Writing to the snapshot file blocks, so do it in a
+	 * separate thread; it gets only the serialized data. */
+	g_simple_async_result_run_in_thread (
+		simple, save_snapshot_thread,
+		G_PRIORITY_DEFAULT, context->cancellable);
 
-	/* Extract a MIME message from the composer. */
-	e_msg_composer_get_message_draft (
-		E_MSG_COMPOSER (object), G_PRIORITY_DEFAULT,
-		context->cancellable, (GAsyncReadyCallback)
-		save_snapshot_get_message_cb, simple);
-
-	g_object_unref (object);
+	g_object_unref (simple);
 }
 
 static EMsgComposer *
@@ -370,9 +980,10 @@ e_composer_find_orphans (GQueue *registry,
 			continue;
 		}
 
-		/* If the file is empty, delete it.  Failure here
-		 * is non-fatal; just emit a warning and move on. */
-		if (st.st_size == 0) {
+		/* If the file is empty or holds nothing but the journal
+		 * header, delete it.  Failure here is non-fatal; just
+		 * emit a warning and move on. */
+		if (st.st_size <= strlen (SNAPSHOT_JOURNAL_MAGIC)) {
 			errno = 0;
 			if (g_unlink (filename) < 0) {
 				errmsg = g_strerror (errno);
@@ -460,6 +1071,12 @@ e_composer_save_snapshot (EMsgComposer *composer,
 	g_return_if_fail (E_IS_MSG_COMPOSER (composer));
 
 	context = g_slice_new0 (SaveContext);
+	context->header = g_string_new ("");
+	context->hashes = g_ptr_array_new_with_free_func (g_free);
+	context->serialized = g_hash_table_new_full (
+		g_str_hash, g_str_equal,
+		(GDestroyNotify) g_free,
+		(GDestroyNotify) snapshot_buffer_free);
 
 	if (G_IS_CANCELLABLE (cancellable))
 		context->cancellable = g_object_ref (cancellable);
@@ -488,11 +1105,14 @@ e_composer_save_snapshot (EMsgComposer *composer,
 
 	g_return_if_fail (G_IS_FILE (snapshot_file));
 
-	g_file_replace_async (
-		snapshot_file, NULL, FALSE,
-		G_FILE_CREATE_PRIVATE, G_PRIORITY_DEFAULT,
+	context->snapshot_file = g_object_ref (snapshot_file);
+	context->journal = snapshot_journal_get (composer);
+
+	/* Extract a MIME message from the composer. */
+	e_msg_composer_get_message_draft (
+		composer, G_PRIORITY_DEFAULT,
 		context->cancellable, (GAsyncReadyCallback)
-		save_snapshot_replace_cb, simple);
+		save_snapshot_get_message_cb, simple);
 }
 
 gboolean
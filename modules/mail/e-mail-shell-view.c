@@ -178,6 +178,7 @@ mail_shell_view_setup_search_results_folder (CamelFolder *folder,
 	g_object_ref (folder);
 
 	msg = mail_msg_new (&search_results_setup_info);
+	msg->base.priority = MAIL_MSG_PRIORITY_INTERACTIVE;
 	msg->folder = folder;
 	msg->cancellable = cancellable;
 	msg->stores_list = stores;
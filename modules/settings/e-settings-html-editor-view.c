@@ -86,6 +86,11 @@ settings_html_editor_view_realize (GtkWidget *widget,
 		widget, "inline-spelling",
 		G_SETTINGS_BIND_GET);
 
+	g_settings_bind (
+		settings, "composer-spell-check-citations",
+		widget, "spell-check-citations",
+		G_SETTINGS_BIND_GET);
+
 	g_settings_bind (
 		settings, "composer-magic-links",
 		widget, "magic-links",
@@ -17,6 +17,7 @@
 
 #include <config.h>
 #include <errno.h>
+#include <string.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <glib/gstdio.h>
@@ -137,6 +138,70 @@ spam_assassin_exited_cb (GPid *pid,
 	g_main_loop_quit (source_data->loop);
 }
 
+static gint
+spam_assassin_wait_child (GPid child_pid,
+                          GCancellable *cancellable,
+                          GError **error)
+{
+	GMainContext *context;
+	GSource *source;
+	gulong handler_id = 0;
+
+	struct {
+		GMainLoop *loop;
+		gint exit_code;
+	} source_data;
+
+	/* Wait for the SpamAssassin process to terminate
+	 * using GLib's main loop for better portability. */
+
+	context = g_main_context_new ();
+
+	source = g_child_watch_source_new (child_pid);
+	g_source_set_callback (
+		source, (GSourceFunc)
+		spam_assassin_exited_cb,
+		&source_data, NULL);
+	g_source_attach (source, context);
+	g_source_unref (source);
+
+	source_data.loop = g_main_loop_new (context, TRUE);
+	source_data.exit_code = 0;
+
+#ifdef G_OS_UNIX
+	if (G_IS_CANCELLABLE (cancellable))
+		handler_id = g_cancellable_connect (
+			cancellable,
+			G_CALLBACK (spam_assassin_cancelled_cb),
+			&child_pid, (GDestroyNotify) NULL);
+#endif
+
+	g_main_loop_run (source_data.loop);
+
+	if (handler_id > 0)
+		g_cancellable_disconnect (cancellable, handler_id);
+
+	g_main_loop_unref (source_data.loop);
+	source_data.loop = NULL;
+
+	g_main_context_unref (context);
+
+	/* Clean up. */
+
+	g_spawn_close_pid (child_pid);
+
+	if (g_cancellable_set_error_if_cancelled (cancellable, error))
+		source_data.exit_code = SPAM_ASSASSIN_EXIT_STATUS_ERROR;
+
+	else if (source_data.exit_code == SPAM_ASSASSIN_EXIT_STATUS_ERROR)
+		g_set_error_literal (
+			error, CAMEL_ERROR, CAMEL_ERROR_GENERIC,
+			_("SpamAssassin either crashed or "
+			"failed to process a mail message"));
+
+	return source_data.exit_code;
+}
+
 static gint
 spam_assassin_command_full (const gchar **argv,
                             CamelMimeMessage *message,
@@ -146,20 +211,12 @@ spam_assassin_command_full (const gchar **argv,
                             GCancellable *cancellable,
                             GError **error)
 {
-	GMainContext *context;
 	GSpawnFlags flags = 0;
-	GSource *source;
 	GPid child_pid;
 	gint standard_input;
 	gint standard_output;
-	gulong handler_id = 0;
 	gboolean success;
 
-	struct {
-		GMainLoop *loop;
-		gint exit_code;
-	} source_data;
-
 	if (wait_for_termination)
 		flags |= G_SPAWN_DO_NOT_REAP_CHILD;
 	if (output_buffer == NULL)
@@ -265,65 +322,244 @@ spam_assassin_command_full (const gchar **argv,
 	if (!wait_for_termination)
 		return 0;
 
-	/* Wait for the SpamAssassin process to terminate
-	 * using GLib's main loop for better portability. */
+	return spam_assassin_wait_child (child_pid, cancellable, error);
+}
 
-	context = g_main_context_new ();
+static gint
+spam_assassin_command (const gchar **argv,
+                       CamelMimeMessage *message,
+                       const gchar *input_data,
+                       GCancellable *cancellable,
+                       GError **error)
+{
+	return spam_assassin_command_full (
+		argv, message, input_data, NULL, TRUE, cancellable, error);
+}
 
-	source = g_child_watch_source_new (child_pid);
-	g_source_set_callback (
-		source, (GSourceFunc)
-		spam_assassin_exited_cb,
-		&source_data, NULL);
-	g_source_attach (source, context);
-	g_source_unref (source);
+typedef struct _MboxWriter {
+	CamelStream *stream;
+	GPtrArray *messages;
+	GCancellable *cancellable;
+	GError *error;
+} MboxWriter;
 
-	source_data.loop = g_main_loop_new (context, TRUE);
-	source_data.exit_code = 0;
+static gboolean
+spam_assassin_write_mbox (CamelStream *stream,
+                          GPtrArray *messages,
+                          GCancellable *cancellable,
+                          GError **error)
+{
+	guint ii;
 
-#ifdef G_OS_UNIX
-	if (G_IS_CANCELLABLE (cancellable))
-		handler_id = g_cancellable_connect (
-			cancellable,
-			G_CALLBACK (spam_assassin_cancelled_cb),
-			&child_pid, (GDestroyNotify) NULL);
-#endif
+	for (ii = 0; ii < messages->len; ii++) {
+		CamelMimeMessage *message;
+		CamelMimeFilter *filter;
+		CamelStream *filter_stream;
+		gchar *from_line;
+		gssize bytes_written;
 
-	g_main_loop_run (source_data.loop);
+		message = g_ptr_array_index (messages, ii);
 
-	if (handler_id > 0)
-		g_cancellable_disconnect (cancellable, handler_id);
+		from_line = camel_mime_message_build_mbox_from (message);
+		bytes_written = camel_stream_write_string (
+			stream, from_line, cancellable, error);
+		g_free (from_line);
 
-	g_main_loop_unref (source_data.loop);
-	source_data.loop = NULL;
+		if (bytes_written < 0)
+			return FALSE;
 
-	g_main_context_unref (context);
+		/* Escape "From " lines in the message body. */
+		filter_stream = camel_stream_filter_new (stream);
+		filter = camel_mime_filter_from_new ();
+		camel_stream_filter_add (
+			CAMEL_STREAM_FILTER (filter_stream), filter);
+		g_object_unref (filter);
 
-	/* Clean up. */
+		bytes_written = camel_data_wrapper_write_to_stream_sync (
+			CAMEL_DATA_WRAPPER (message),
+			filter_stream, cancellable, error);
+		if (bytes_written >= 0 && camel_stream_flush (
+			filter_stream, cancellable, error) < 0)
+			bytes_written = -1;
 
-	g_spawn_close_pid (child_pid);
+		g_object_unref (filter_stream);
 
-	if (g_cancellable_set_error_if_cancelled (cancellable, error))
-		source_data.exit_code = SPAM_ASSASSIN_EXIT_STATUS_ERROR;
+		if (bytes_written < 0)
+			return FALSE;
 
-	else if (source_data.exit_code == SPAM_ASSASSIN_EXIT_STATUS_ERROR)
-		g_set_error_literal (
-			error, CAMEL_ERROR, CAMEL_ERROR_GENERIC,
-			_("SpamAssassin either crashed or "
-			"failed to process a mail message"));
+		bytes_written = camel_stream_write_string (
+			stream, "\n", cancellable, error);
 
-	return source_data.exit_code;
+		if (bytes_written < 0)
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+static gpointer
+spam_assassin_mbox_writer_thread (gpointer user_data)
+{
+	MboxWriter *writer = user_data;
+
+	spam_assassin_write_mbox (
+		writer->stream, writer->messages,
+		writer->cancellable, &writer->error);
+
+	camel_stream_close (writer->stream, NULL, NULL);
+
+	return NULL;
+}
+
+/* Reads the mbox SpamAssassin writes back, which has the messages
+ * in the input order, and takes the verdict from the X-Spam-Status
+ * header of each of them.  Messages without it stay inconclusive. */
+static gboolean
+spam_assassin_read_mbox_statuses (CamelStream *stream,
+                                  CamelJunkStatus *statuses,
+                                  guint n_messages,
+                                  GCancellable *cancellable,
+                                  GError **error)
+{
+	CamelStream *buffer_stream;
+	gboolean in_headers = FALSE;
+	gboolean after_blank = TRUE;
+	gint index = -1;
+	gchar *line;
+	guint ii;
+
+	for (ii = 0; ii < n_messages; ii++)
+		statuses[ii] = CAMEL_JUNK_STATUS_INCONCLUSIVE;
+
+	buffer_stream = camel_stream_buffer_new (
+		stream, CAMEL_STREAM_BUFFER_READ);
+
+	while ((line = camel_stream_buffer_read_line (
+		CAMEL_STREAM_BUFFER (buffer_stream),
+		cancellable, error)) != NULL) {
+
+		if (after_blank && strncmp (line, "From ", 5) == 0) {
+			index++;
+			in_headers = TRUE;
+
+		} else if (in_headers && *line == '\0') {
+			in_headers = FALSE;
+
+		} else if (in_headers && (guint) index < n_messages &&
+			   g_ascii_strncasecmp (line, "X-Spam-Status:", 14) == 0) {
+			const gchar *cp = line + 14;
+
+			while (g_ascii_isspace (*cp))
+				cp++;
+
+			if (g_ascii_strncasecmp (cp, "Yes", 3) == 0)
+				statuses[index] = CAMEL_JUNK_STATUS_MESSAGE_IS_JUNK;
+			else
+				statuses[index] = CAMEL_JUNK_STATUS_MESSAGE_IS_NOT_JUNK;
+		}
+
+		after_blank = (*line == '\0');
+
+		g_free (line);
+	}
+
+	g_object_unref (buffer_stream);
+
+	return (error == NULL || *error == NULL);
 }
 
+/* Runs a single SpamAssassin process for all @messages, which are
+ * streamed to it as an mbox.  With @statuses set the classified
+ * messages are read back while the rest is still being written. */
 static gint
-spam_assassin_command (const gchar **argv,
-                       CamelMimeMessage *message,
-                       const gchar *input_data,
-                       GCancellable *cancellable,
-                       GError **error)
+spam_assassin_command_mbox (const gchar **argv,
+                            GPtrArray *messages,
+                            CamelJunkStatus *statuses,
+                            GCancellable *cancellable,
+                            GError **error)
 {
-	return spam_assassin_command_full (
-		argv, message, input_data, NULL, TRUE, cancellable, error);
+	GSpawnFlags flags;
+	GPid child_pid;
+	GThread *thread;
+	MboxWriter writer;
+	gint standard_input;
+	gint standard_output;
+	gint exit_code;
+	gboolean success;
+
+	flags = G_SPAWN_DO_NOT_REAP_CHILD | G_SPAWN_STDERR_TO_DEV_NULL;
+	if (statuses == NULL)
+		flags |= G_SPAWN_STDOUT_TO_DEV_NULL;
+
+	success = g_spawn_async_with_pipes (
+		NULL,
+		(gchar **) argv,
+		NULL,
+		flags,
+		NULL, NULL,
+		&child_pid,
+		&standard_input,
+		(statuses != NULL) ? &standard_output : NULL,
+		NULL,
+		error);
+
+	if (!success) {
+		gchar *command_line;
+
+		command_line = g_strjoinv (" ", (gchar **) argv);
+		g_prefix_error (
+			error, _("Failed to spawn SpamAssassin (%s): "),
+			command_line);
+		g_free (command_line);
+
+		return SPAM_ASSASSIN_EXIT_STATUS_ERROR;
+	}
+
+	writer.stream = camel_stream_fs_new_with_fd (standard_input);
+	writer.messages = messages;
+	writer.cancellable = cancellable;
+	writer.error = NULL;
+
+	/* Write from a dedicated thread, otherwise both processes
+	 * could block on full pipes when reading the output here. */
+	thread = g_thread_new (
+		NULL, spam_assassin_mbox_writer_thread, &writer);
+
+	if (statuses != NULL) {
+		CamelStream *stream;
+
+		stream = camel_stream_fs_new_with_fd (standard_output);
+		success = spam_assassin_read_mbox_statuses (
+			stream, statuses, messages->len, cancellable, error);
+		g_object_unref (stream);
+
+#ifdef G_OS_UNIX
+		/* Unblock the writer thread. */
+		if (!success)
+			kill (child_pid, SIGTERM);
+#endif
+	}
+
+	g_thread_join (thread);
+	g_object_unref (writer.stream);
+
+	if (success && writer.error != NULL) {
+		g_propagate_prefixed_error (
+			error, writer.error, _("Failed to stream mail "
+			"message content to SpamAssassin: "));
+		writer.error = NULL;
+		success = FALSE;
+	}
+
+	g_clear_error (&writer.error);
+
+	exit_code = spam_assassin_wait_child (
+		child_pid, cancellable, success ? error : NULL);
+
+	if (!success)
+		exit_code = SPAM_ASSASSIN_EXIT_STATUS_ERROR;
+
+	return exit_code;
 }
 
 static gboolean
@@ -625,18 +861,44 @@ spam_assassin_learn_junk (CamelJunkFilter *junk_filter,
                           CamelMimeMessage *message,
                           GCancellable *cancellable,
                           GError **error)
+{
+	/* Learned in one sa-learn run by spam_assassin_synchronize(). */
+	return e_mail_junk_filter_queue_learn_sync (
+		E_MAIL_JUNK_FILTER (junk_filter), message,
+		TRUE, cancellable, error);
+}
+
+static gboolean
+spam_assassin_learn_not_junk (CamelJunkFilter *junk_filter,
+                              CamelMimeMessage *message,
+                              GCancellable *cancellable,
+                              GError **error)
+{
+	/* Learned in one sa-learn run by spam_assassin_synchronize(). */
+	return e_mail_junk_filter_queue_learn_sync (
+		E_MAIL_JUNK_FILTER (junk_filter), message,
+		FALSE, cancellable, error);
+}
+
+static gboolean
+spam_assassin_synchronize (CamelJunkFilter *junk_filter,
+                           GCancellable *cancellable,
+                           GError **error)
 {
 	ESpamAssassin *extension = E_SPAM_ASSASSIN (junk_filter);
-	const gchar *argv[5];
+	const gchar *argv[4];
 	gint exit_code;
 	gint ii = 0;
 
+	if (!e_mail_junk_filter_flush_learn_sync (
+		E_MAIL_JUNK_FILTER (junk_filter), cancellable, error))
+		return FALSE;
+
 	if (g_cancellable_set_error_if_cancelled (cancellable, error))
 		return FALSE;
 
 	argv[ii++] = spam_assassin_get_learn_command_path (extension);
-	argv[ii++] = "--spam";
-	argv[ii++] = "--no-sync";
+	argv[ii++] = "--sync";
 	if (extension->local_only)
 		argv[ii++] = "--local";
 	argv[ii] = NULL;
@@ -644,7 +906,7 @@ spam_assassin_learn_junk (CamelJunkFilter *junk_filter,
 	g_assert (ii < G_N_ELEMENTS (argv));
 
 	exit_code = spam_assassin_command (
-		argv, message, NULL, cancellable, error);
+		argv, NULL, NULL, cancellable, error);
 
 	/* Check that the return value and GError agree. */
 	if (exit_code == SPAM_ASSASSIN_EXIT_STATUS_SUCCESS)
@@ -656,30 +918,30 @@ spam_assassin_learn_junk (CamelJunkFilter *junk_filter,
 }
 
 static gboolean
-spam_assassin_learn_not_junk (CamelJunkFilter *junk_filter,
-                              CamelMimeMessage *message,
-                              GCancellable *cancellable,
-                              GError **error)
+spam_assassin_classify_messages (EMailJunkFilter *junk_filter,
+                                 GPtrArray *messages,
+                                 CamelJunkStatus *statuses,
+                                 GCancellable *cancellable,
+                                 GError **error)
 {
 	ESpamAssassin *extension = E_SPAM_ASSASSIN (junk_filter);
-	const gchar *argv[5];
+	const gchar *argv[4];
 	gint exit_code;
 	gint ii = 0;
 
 	if (g_cancellable_set_error_if_cancelled (cancellable, error))
 		return FALSE;
 
-	argv[ii++] = spam_assassin_get_learn_command_path (extension);
-	argv[ii++] = "--ham";
-	argv[ii++] = "--no-sync";
+	argv[ii++] = spam_assassin_get_command_path (extension);
+	argv[ii++] = "--mbox";
 	if (extension->local_only)
 		argv[ii++] = "--local";
 	argv[ii] = NULL;
 
 	g_assert (ii < G_N_ELEMENTS (argv));
 
-	exit_code = spam_assassin_command (
-		argv, message, NULL, cancellable, error);
+	exit_code = spam_assassin_command_mbox (
+		argv, messages, statuses, cancellable, error);
 
 	/* Check that the return value and GError agree. */
 	if (exit_code == SPAM_ASSASSIN_EXIT_STATUS_SUCCESS)
@@ -691,12 +953,14 @@ spam_assassin_learn_not_junk (CamelJunkFilter *junk_filter,
 }
 
 static gboolean
-spam_assassin_synchronize (CamelJunkFilter *junk_filter,
-                           GCancellable *cancellable,
-                           GError **error)
+spam_assassin_learn_messages (EMailJunkFilter *junk_filter,
+                              GPtrArray *messages,
+                              gboolean is_junk,
+                              GCancellable *cancellable,
+                              GError **error)
 {
 	ESpamAssassin *extension = E_SPAM_ASSASSIN (junk_filter);
-	const gchar *argv[4];
+	const gchar *argv[6];
 	gint exit_code;
 	gint ii = 0;
 
@@ -704,15 +968,17 @@ spam_assassin_synchronize (CamelJunkFilter *junk_filter,
 		return FALSE;
 
 	argv[ii++] = spam_assassin_get_learn_command_path (extension);
-	argv[ii++] = "--sync";
+	argv[ii++] = is_junk ? "--spam" : "--ham";
+	argv[ii++] = "--no-sync";
+	argv[ii++] = "--mbox";
 	if (extension->local_only)
 		argv[ii++] = "--local";
 	argv[ii] = NULL;
 
 	g_assert (ii < G_N_ELEMENTS (argv));
 
-	exit_code = spam_assassin_command (
-		argv, NULL, NULL, cancellable, error);
+	exit_code = spam_assassin_command_mbox (
+		argv, messages, NULL, cancellable, error);
 
 	/* Check that the return value and GError agree. */
 	if (exit_code == SPAM_ASSASSIN_EXIT_STATUS_SUCCESS)
@@ -739,6 +1005,8 @@ e_spam_assassin_class_init (ESpamAssassinClass *class)
 	junk_filter_class->display_name = _("SpamAssassin");
 	junk_filter_class->available = spam_assassin_available;
 	junk_filter_class->new_config_widget = spam_assassin_new_config_widget;
+	junk_filter_class->classify_messages = spam_assassin_classify_messages;
+	junk_filter_class->learn_messages = spam_assassin_learn_messages;
 
 	g_object_class_install_property (
 		object_class,
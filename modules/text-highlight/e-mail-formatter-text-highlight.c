@@ -31,8 +31,20 @@
 #include <libedataserver/libedataserver.h>
 
 #include <glib/gi18n-lib.h>
+#include <glib/gstdio.h>
 #include <camel/camel.h>
 
+#ifdef HAVE_SYS_WAIT_H
+#include <sys/types.h>
+#include <sys/wait.h>
+#endif
+
+/* Bump when the way the output is generated changes. */
+#define TEXT_HIGHLIGHT_CACHE_VERSION "1"
+
+/* Cached outputs not used for this long are removed. */
+#define TEXT_HIGHLIGHT_CACHE_MAX_AGE (30 * 24 * 60 * 60)
+
 typedef EMailFormatterExtension EMailFormatterTextHighlight;
 typedef EMailFormatterExtensionClass EMailFormatterTextHighlightClass;
 
@@ -41,6 +53,8 @@ typedef EExtensionClass EMailFormatterTextHighlightLoaderClass;
 
 typedef struct _TextHighlightClosure TextHighlightClosure;
 
+typedef struct _TextHighlightRequest TextHighlightRequest;
+
 struct _TextHighlightClosure {
 	CamelStream *read_stream;
 	GOutputStream *output_stream;
@@ -48,6 +62,26 @@ struct _TextHighlightClosure {
 	GError *error;
 };
 
+struct _TextHighlightRequest {
+	volatile gint ref_count;
+	gchar *key;
+	gchar **argv;
+	GBytes *input;
+
+	GMutex lock;
+	GCond cond;
+	gboolean done;
+	GBytes *output;
+	GError *error;
+};
+
+/* The 'highlight' runs are done by a single long-lived thread, thus
+ * rendering many parts at once does not fork many processes at once,
+ * and the same content requested more times is highlighted only once. */
+static GMutex worker_lock;
+static GAsyncQueue *worker_queue = NULL;
+static GHashTable *worker_requests = NULL; /* key ~> TextHighlightRequest */
+
 GType e_mail_formatter_text_highlight_get_type (void);
 
 G_DEFINE_DYNAMIC_TYPE (
@@ -145,15 +179,16 @@ text_hightlight_read_data_thread (gpointer user_data)
 
 static gboolean
 text_highlight_feed_data (GOutputStream *output_stream,
-                          CamelDataWrapper *data_wrapper,
+                          GBytes *input,
                           gint pipe_stdin,
                           gint pipe_stdout,
                           GCancellable *cancellable,
                           GError **error)
 {
 	TextHighlightClosure closure;
-	CamelContentType *content_type;
 	CamelStream *write_stream;
+	gconstpointer data;
+	gsize size;
 	gboolean success = TRUE;
 	GThread *thread;
 
@@ -166,6 +201,50 @@ text_highlight_feed_data (GOutputStream *output_stream,
 
 	thread = g_thread_new (NULL, text_hightlight_read_data_thread, &closure);
 
+	data = g_bytes_get_data (input, &size);
+
+	if (size > 0 && camel_stream_write (write_stream, data, size, cancellable, error) < 0) {
+		g_cancellable_cancel (cancellable);
+		success = FALSE;
+	} else {
+		/* Close the stream, thus the highlight knows no more data will come */
+		g_clear_object (&write_stream);
+	}
+
+	g_thread_join (thread);
+
+	g_clear_object (&closure.read_stream);
+	g_clear_object (&write_stream);
+
+	if (closure.error) {
+		if (error && !*error)
+			g_propagate_error (error, closure.error);
+		else
+			g_clear_error (&closure.error);
+
+		return FALSE;
+	}
+
+	return success;
+}
+
+/* Decodes the content of the @data_wrapper, converted to UTF-8,
+ * which the 'highlight' expects. */
+static GBytes *
+text_highlight_decode_data (CamelDataWrapper *data_wrapper,
+                            GCancellable *cancellable,
+                            GError **error)
+{
+	CamelContentType *content_type;
+	CamelStream *write_stream;
+	GByteArray *byte_array;
+	GBytes *bytes = NULL;
+
+	byte_array = g_byte_array_new ();
+	write_stream = camel_stream_mem_new ();
+	camel_stream_mem_set_byte_array (
+		CAMEL_STREAM_MEM (write_stream), byte_array);
+
 	content_type = camel_data_wrapper_get_mime_type_field (data_wrapper);
 	if (content_type) {
 		const gchar *charset = camel_content_type_param (content_type, "charset");
@@ -190,29 +269,371 @@ text_highlight_feed_data (GOutputStream *output_stream,
 		}
 	}
 
-	if (camel_data_wrapper_decode_to_stream_sync (data_wrapper, write_stream, cancellable, error) < 0) {
-		g_cancellable_cancel (cancellable);
-		success = FALSE;
-	} else {
-		/* Close the stream, thus the highlight knows no more data will come */
-		g_clear_object (&write_stream);
+	if (camel_data_wrapper_decode_to_stream_sync (data_wrapper, write_stream, cancellable, error) >= 0 &&
+	    camel_stream_flush (write_stream, cancellable, error) == 0)
+		bytes = g_bytes_new (byte_array->data, byte_array->len);
+
+	g_object_unref (write_stream);
+	g_byte_array_free (byte_array, TRUE);
+
+	return bytes;
+}
+
+/* The output depends on the 'highlight' arguments and on the content only. */
+static gchar *
+text_highlight_compute_key (const gchar * const *argv,
+                            GBytes *input)
+{
+	GChecksum *checksum;
+	gconstpointer data;
+	gsize size;
+	gchar *key;
+	gint ii;
+
+	checksum = g_checksum_new (G_CHECKSUM_SHA256);
+
+	g_checksum_update (checksum, (const guchar *) TEXT_HIGHLIGHT_CACHE_VERSION, -1);
+
+	for (ii = 1; argv[ii] != NULL; ii++) {
+		g_checksum_update (checksum, (const guchar *) "\n", 1);
+		g_checksum_update (checksum, (const guchar *) argv[ii], -1);
 	}
 
-	g_thread_join (thread);
+	g_checksum_update (checksum, (const guchar *) "", 1);
 
-	g_clear_object (&closure.read_stream);
-	g_clear_object (&write_stream);
+	data = g_bytes_get_data (input, &size);
+	g_checksum_update (checksum, data, size);
 
-	if (closure.error) {
-		if (error && !*error)
-			g_propagate_error (error, closure.error);
-		else
-			g_clear_error (&closure.error);
+	key = g_strdup (g_checksum_get_string (checksum));
 
-		return FALSE;
+	g_checksum_free (checksum);
+
+	return key;
+}
+
+static gchar *
+text_highlight_cache_dir (void)
+{
+	return g_build_filename (e_get_user_cache_dir (), "text-highlight", NULL);
+}
+
+static gchar *
+text_highlight_cache_filename (const gchar *key)
+{
+	gchar *cache_dir, *filename, *basename;
+	gchar prefix[3];
+
+	prefix[0] = key[0];
+	prefix[1] = key[1];
+	prefix[2] = '\0';
+
+	cache_dir = text_highlight_cache_dir ();
+	basename = g_strconcat (key, ".html", NULL);
+	filename = g_build_filename (cache_dir, prefix, basename, NULL);
+	g_free (basename);
+	g_free (cache_dir);
+
+	return filename;
+}
+
+static GBytes *
+text_highlight_cache_lookup (const gchar *key)
+{
+	gchar *filename;
+	gchar *contents = NULL;
+	gsize length = 0;
+	GBytes *bytes = NULL;
+
+	filename = text_highlight_cache_filename (key);
+
+	if (g_file_get_contents (filename, &contents, &length, NULL)) {
+		/* The modification time tells when it was used last. */
+		g_utime (filename, NULL);
+
+		bytes = g_bytes_new_take (contents, length);
 	}
 
-	return success;
+	g_free (filename);
+
+	return bytes;
+}
+
+static void
+text_highlight_cache_store (const gchar *key,
+                            GBytes *output)
+{
+	gchar *filename, *dirname;
+	GError *local_error = NULL;
+
+	filename = text_highlight_cache_filename (key);
+	dirname = g_path_get_dirname (filename);
+
+	if (g_mkdir_with_parents (dirname, 0700) == 0 &&
+	    !g_file_set_contents (filename,
+		g_bytes_get_data (output, NULL),
+		g_bytes_get_size (output), &local_error)) {
+		g_warning ("%s: %s", G_STRFUNC, local_error->message);
+		g_clear_error (&local_error);
+	}
+
+	g_free (dirname);
+	g_free (filename);
+}
+
+static void
+text_highlight_cache_prune (void)
+{
+	GDir *dir;
+	gchar *cache_dir;
+	const gchar *name;
+	time_t oldest;
+
+	cache_dir = text_highlight_cache_dir ();
+	dir = g_dir_open (cache_dir, 0, NULL);
+
+	if (dir == NULL) {
+		g_free (cache_dir);
+		return;
+	}
+
+	oldest = time (NULL) - TEXT_HIGHLIGHT_CACHE_MAX_AGE;
+
+	while ((name = g_dir_read_name (dir)) != NULL) {
+		GDir *subdir;
+		gchar *dirname;
+		const gchar *subname;
+
+		dirname = g_build_filename (cache_dir, name, NULL);
+		subdir = g_dir_open (dirname, 0, NULL);
+
+		while (subdir != NULL && (subname = g_dir_read_name (subdir)) != NULL) {
+			GStatBuf st;
+			gchar *filename;
+
+			filename = g_build_filename (dirname, subname, NULL);
+
+			if (g_stat (filename, &st) == 0 && st.st_mtime < oldest)
+				g_unlink (filename);
+
+			g_free (filename);
+		}
+
+		if (subdir != NULL)
+			g_dir_close (subdir);
+
+		g_free (dirname);
+	}
+
+	g_dir_close (dir);
+	g_free (cache_dir);
+}
+
+static TextHighlightRequest *
+text_highlight_request_ref (TextHighlightRequest *request)
+{
+	g_atomic_int_inc (&request->ref_count);
+
+	return request;
+}
+
+static void
+text_highlight_request_unref (TextHighlightRequest *request)
+{
+	if (g_atomic_int_dec_and_test (&request->ref_count)) {
+		g_free (request->key);
+		g_strfreev (request->argv);
+		g_bytes_unref (request->input);
+		if (request->output != NULL)
+			g_bytes_unref (request->output);
+		g_clear_error (&request->error);
+		g_mutex_clear (&request->lock);
+		g_cond_clear (&request->cond);
+		g_slice_free (TextHighlightRequest, request);
+	}
+}
+
+/* Sets @out_clean_exit to whether the process exited with zero status;
+ * the output of a crashed or failed process can be cut short. */
+static GBytes *
+text_highlight_run_sync (gchar **argv,
+                         GBytes *input,
+                         gboolean *out_clean_exit,
+                         GError **error)
+{
+	GOutputStream *output_stream;
+	GBytes *output = NULL;
+	gint pipe_stdin, pipe_stdout;
+	GPid pid;
+
+	*out_clean_exit = FALSE;
+
+	if (!g_spawn_async_with_pipes (
+		NULL, argv, NULL, G_SPAWN_DO_NOT_REAP_CHILD, NULL, NULL,
+		&pid, &pipe_stdin, &pipe_stdout, NULL, error))
+		return NULL;
+
+	output_stream = g_memory_output_stream_new_resizable ();
+
+	if (text_highlight_feed_data (
+		output_stream, input,
+		pipe_stdin, pipe_stdout,
+		NULL, error) &&
+	    g_output_stream_close (output_stream, NULL, error)) {
+		output = g_memory_output_stream_steal_as_bytes (
+			G_MEMORY_OUTPUT_STREAM (output_stream));
+	}
+
+	g_object_unref (output_stream);
+
+#ifdef HAVE_SYS_WAIT_H
+	{
+		gint status;
+
+		/* The pipes are closed, thus the process ends now. */
+		if (waitpid (pid, &status, 0) == pid)
+			*out_clean_exit =
+				WIFEXITED (status) &&
+				WEXITSTATUS (status) == 0;
+	}
+#endif
+
+	g_spawn_close_pid (pid);
+
+	return output;
+}
+
+static gpointer
+text_highlight_worker_thread (gpointer user_data)
+{
+	text_highlight_cache_prune ();
+
+	while (TRUE) {
+		TextHighlightRequest *request;
+		GBytes *output;
+		gboolean clean_exit;
+		GError *local_error = NULL;
+
+		request = g_async_queue_pop (worker_queue);
+
+		output = text_highlight_run_sync (
+			request->argv, request->input,
+			&clean_exit, &local_error);
+
+		/* Stored even when nobody waits for it anymore, but
+		 * only when complete; it would be there for good. */
+		if (output != NULL && clean_exit &&
+		    g_bytes_get_size (output) > 0)
+			text_highlight_cache_store (request->key, output);
+
+		g_mutex_lock (&worker_lock);
+		g_hash_table_remove (worker_requests, request->key);
+		g_mutex_unlock (&worker_lock);
+
+		g_mutex_lock (&request->lock);
+		request->output = output;
+		request->error = local_error;
+		request->done = TRUE;
+		g_cond_broadcast (&request->cond);
+		g_mutex_unlock (&request->lock);
+
+		text_highlight_request_unref (request);
+	}
+
+	return NULL;
+}
+
+static void
+text_highlight_request_cancelled_cb (GCancellable *cancellable,
+                                     TextHighlightRequest *request)
+{
+	g_mutex_lock (&request->lock);
+	g_cond_broadcast (&request->cond);
+	g_mutex_unlock (&request->lock);
+}
+
+/* Returns the highlighted @input, either from the disk cache,
+ * or as produced by the worker thread. */
+static GBytes *
+text_highlight_get_output (const gchar * const *argv,
+                           GBytes *input,
+                           GCancellable *cancellable,
+                           GError **error)
+{
+	TextHighlightRequest *request;
+	GBytes *output;
+	gchar *key;
+	gulong handler_id = 0;
+
+	key = text_highlight_compute_key (argv, input);
+
+	output = text_highlight_cache_lookup (key);
+	if (output != NULL) {
+		g_free (key);
+		return output;
+	}
+
+	g_mutex_lock (&worker_lock);
+
+	if (worker_queue == NULL) {
+		GThread *thread;
+
+		worker_queue = g_async_queue_new ();
+		worker_requests = g_hash_table_new (g_str_hash, g_str_equal);
+
+		thread = g_thread_new (
+			"text-highlight",
+			text_highlight_worker_thread, NULL);
+		g_thread_unref (thread);
+	}
+
+	request = g_hash_table_lookup (worker_requests, key);
+
+	if (request != NULL) {
+		text_highlight_request_ref (request);
+		g_free (key);
+	} else {
+		request = g_slice_new0 (TextHighlightRequest);
+		request->ref_count = 2; /* one for the worker */
+		request->key = key;
+		request->argv = g_strdupv ((gchar **) argv);
+		request->input = g_bytes_ref (input);
+		g_mutex_init (&request->lock);
+		g_cond_init (&request->cond);
+
+		g_hash_table_insert (worker_requests, request->key, request);
+		g_async_queue_push (worker_queue, request);
+	}
+
+	g_mutex_unlock (&worker_lock);
+
+	if (G_IS_CANCELLABLE (cancellable))
+		handler_id = g_cancellable_connect (
+			cancellable,
+			G_CALLBACK (text_highlight_request_cancelled_cb),
+			request, NULL);
+
+	g_mutex_lock (&request->lock);
+
+	while (!request->done && !g_cancellable_is_cancelled (cancellable))
+		g_cond_wait (&request->cond, &request->lock);
+
+	if (g_cancellable_set_error_if_cancelled (cancellable, error))
+		output = NULL;
+	else if (request->output != NULL)
+		output = g_bytes_ref (request->output);
+	else if (request->error != NULL)
+		g_propagate_error (error, g_error_copy (request->error));
+	else
+		output = NULL;
+
+	g_mutex_unlock (&request->lock);
+
+	if (G_IS_CANCELLABLE (cancellable))
+		g_cancellable_disconnect (cancellable, handler_id);
+
+	text_highlight_request_unref (request);
+
+	return output;
 }
 
 static gboolean
@@ -248,9 +669,9 @@ emfe_text_highlight_format (EMailFormatterExtension *extension,
 		goto exit;
 
 	} else if (context->mode == E_MAIL_FORMATTER_MODE_RAW) {
-		gint pipe_stdin, pipe_stdout;
-		GPid pid;
 		CamelDataWrapper *dw;
+		GBytes *input, *output = NULL;
+		GError *local_error = NULL;
 		gchar *font_family, *font_size, *syntax;
 		PangoFontDescription *fd;
 		GSettings *settings;
@@ -312,34 +733,38 @@ emfe_text_highlight_format (EMailFormatterExtension *extension,
 		argv[3] = g_strdup_printf ("--syntax=%s", syntax);
 		g_free (syntax);
 
-		success = g_spawn_async_with_pipes (
-			NULL, (gchar **) argv, NULL, 0, NULL, NULL,
-			&pid, &pipe_stdin, &pipe_stdout, NULL, NULL);
-
-		if (success) {
-			GError *local_error = NULL;
+		input = text_highlight_decode_data (dw, cancellable, &local_error);
 
-			success = text_highlight_feed_data (
-				stream, dw,
-				pipe_stdin, pipe_stdout,
-				cancellable, &local_error);
-
-			if (g_error_matches (
-				local_error, G_IO_ERROR,
-				G_IO_ERROR_CANCELLED)) {
-				/* Do nothing. */
+		if (input != NULL) {
+			output = text_highlight_get_output (
+				argv, input, cancellable, &local_error);
+			g_bytes_unref (input);
+		}
 
-			} else if (local_error != NULL) {
-				g_warning (
-					"%s: %s", G_STRFUNC,
-					local_error->message);
-			}
+		if (output != NULL) {
+			success = g_output_stream_write_all (
+				stream,
+				g_bytes_get_data (output, NULL),
+				g_bytes_get_size (output),
+				NULL, cancellable, &local_error);
+			g_bytes_unref (output);
+		} else {
+			success = FALSE;
+		}
 
-			g_clear_error (&local_error);
+		if (g_error_matches (
+			local_error, G_IO_ERROR,
+			G_IO_ERROR_CANCELLED)) {
+			/* Do nothing. */
 
-			g_spawn_close_pid (pid);
+		} else if (local_error != NULL) {
+			g_warning (
+				"%s: %s", G_STRFUNC,
+				local_error->message);
 		}
 
+		g_clear_error (&local_error);
+
 		if (!success) {
 			/* We can't call e_mail_formatter_format_as on text/plain,
 			 * because text-highlight is registered as an handler for
@@ -0,0 +1,604 @@
+/*
+ *  An index of the e-mail addresses stored in the address books the
+ *  automatic contacts are checked against, kept up to date by book
+ *  views, thus asking whether an address is known does not need to
+ *  query the address books.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string.h>
+
+#include <e-util/e-util.h>
+#include <shell/e-shell.h>
+
+#include "bbdb.h"
+
+typedef struct {
+	gchar *source_uid;
+	EBookClient *client;
+	EBookClientView *view;
+	GCancellable *cancellable;
+	gboolean complete;
+
+	/* contact UID ~> NULL-terminated array of folded e-mails */
+	GHashTable *contacts;
+
+	gulong objects_added_handler_id;
+	gulong objects_modified_handler_id;
+	gulong objects_removed_handler_id;
+	gulong complete_handler_id;
+} IndexBook;
+
+/* The books are changed only in the main thread, while the e-mails
+ * are read by the thread processing the sent messages. */
+static GMutex index_lock;
+static GHashTable *index_books = NULL;	/* source UID ~> IndexBook */
+static GHashTable *index_emails = NULL;	/* folded e-mail ~> count */
+static GHashTable *index_noted = NULL;	/* folded e-mail, added by us */
+
+static GSettings *index_settings = NULL;
+static ESourceRegistry *index_registry = NULL;
+static gulong index_registry_handler_ids[5];
+static guint index_sync_id = 0;
+
+static gchar *
+index_fold_email (const gchar *email)
+{
+	gchar *tmp, *folded;
+
+	tmp = g_strstrip (g_strdup (email));
+	folded = g_utf8_casefold (tmp, -1);
+	g_free (tmp);
+
+	return folded;
+}
+
+/* Call with the index_lock held. */
+static void
+index_add_emails (gchar **emails)
+{
+	gint ii;
+
+	for (ii = 0; emails != NULL && emails[ii] != NULL; ii++) {
+		guint count;
+
+		count = GPOINTER_TO_UINT (g_hash_table_lookup (index_emails, emails[ii]));
+
+		g_hash_table_insert (
+			index_emails, g_strdup (emails[ii]),
+			GUINT_TO_POINTER (count + 1));
+
+		/* Known from the book now. */
+		g_hash_table_remove (index_noted, emails[ii]);
+	}
+}
+
+/* Call with the index_lock held. */
+static void
+index_remove_emails (gchar **emails)
+{
+	gint ii;
+
+	for (ii = 0; emails != NULL && emails[ii] != NULL; ii++) {
+		guint count;
+
+		count = GPOINTER_TO_UINT (g_hash_table_lookup (index_emails, emails[ii]));
+
+		if (count > 1)
+			g_hash_table_insert (
+				index_emails, g_strdup (emails[ii]),
+				GUINT_TO_POINTER (count - 1));
+		else
+			g_hash_table_remove (index_emails, emails[ii]);
+	}
+}
+
+static void
+index_book_set_contacts (IndexBook *book,
+                         const GSList *contacts)
+{
+	const GSList *link;
+
+	g_mutex_lock (&index_lock);
+
+	for (link = contacts; link != NULL; link = g_slist_next (link)) {
+		EContact *contact = link->data;
+		GList *list, *elink;
+		GPtrArray *emails;
+		const gchar *uid;
+
+		uid = e_contact_get_const (contact, E_CONTACT_UID);
+		if (uid == NULL)
+			continue;
+
+		emails = g_ptr_array_new ();
+
+		list = e_contact_get (contact, E_CONTACT_EMAIL);
+		for (elink = list; elink != NULL; elink = g_list_next (elink)) {
+			if (elink->data != NULL && *((gchar *) elink->data) != '\0')
+				g_ptr_array_add (emails, index_fold_email (elink->data));
+		}
+		g_list_free_full (list, g_free);
+
+		g_ptr_array_add (emails, NULL);
+
+		index_remove_emails (g_hash_table_lookup (book->contacts, uid));
+		index_add_emails ((gchar **) emails->pdata);
+
+		g_hash_table_insert (
+			book->contacts, g_strdup (uid),
+			g_ptr_array_free (emails, FALSE));
+	}
+
+	g_mutex_unlock (&index_lock);
+}
+
+static void
+index_book_objects_added_cb (EBookClientView *view,
+                             const GSList *contacts,
+                             IndexBook *book)
+{
+	index_book_set_contacts (book, contacts);
+}
+
+static void
+index_book_objects_modified_cb (EBookClientView *view,
+                                const GSList *contacts,
+                                IndexBook *book)
+{
+	index_book_set_contacts (book, contacts);
+}
+
+static void
+index_book_objects_removed_cb (EBookClientView *view,
+                               const GSList *uids,
+                               IndexBook *book)
+{
+	const GSList *link;
+
+	g_mutex_lock (&index_lock);
+
+	for (link = uids; link != NULL; link = g_slist_next (link)) {
+		index_remove_emails (g_hash_table_lookup (book->contacts, link->data));
+		g_hash_table_remove (book->contacts, link->data);
+	}
+
+	g_mutex_unlock (&index_lock);
+}
+
+static void
+index_book_complete_cb (EBookClientView *view,
+                        const GError *error,
+                        IndexBook *book)
+{
+	if (error != NULL) {
+		g_warning ("bbdb: Failed to index addressbook: %s", error->message);
+		return;
+	}
+
+	g_mutex_lock (&index_lock);
+	book->complete = TRUE;
+	g_mutex_unlock (&index_lock);
+}
+
+static void
+index_book_free (IndexBook *book)
+{
+	GHashTableIter iter;
+	gpointer value;
+
+	g_cancellable_cancel (book->cancellable);
+
+	if (book->view != NULL) {
+		g_signal_handler_disconnect (book->view, book->objects_added_handler_id);
+		g_signal_handler_disconnect (book->view, book->objects_modified_handler_id);
+		g_signal_handler_disconnect (book->view, book->objects_removed_handler_id);
+		g_signal_handler_disconnect (book->view, book->complete_handler_id);
+		e_book_client_view_stop (book->view, NULL);
+		g_object_unref (book->view);
+	}
+
+	/* Called with the index_lock held. */
+	g_hash_table_iter_init (&iter, book->contacts);
+	while (g_hash_table_iter_next (&iter, NULL, &value))
+		index_remove_emails (value);
+
+	g_hash_table_destroy (book->contacts);
+	g_clear_object (&book->client);
+	g_object_unref (book->cancellable);
+	g_free (book->source_uid);
+	g_free (book);
+}
+
+/* The books are freed only in the main thread, where this is called. */
+static IndexBook *
+index_lookup_book (const gchar *source_uid)
+{
+	IndexBook *book = NULL;
+
+	g_mutex_lock (&index_lock);
+	if (index_books != NULL)
+		book = g_hash_table_lookup (index_books, source_uid);
+	g_mutex_unlock (&index_lock);
+
+	return book;
+}
+
+static void
+index_book_got_view_cb (GObject *source_object,
+                        GAsyncResult *result,
+                        gpointer user_data)
+{
+	gchar *source_uid = user_data;
+	EBookClientView *view = NULL;
+	IndexBook *book;
+	GSList *fields = NULL;
+	GError *error = NULL;
+
+	e_book_client_get_view_finish (
+		E_BOOK_CLIENT (source_object), result, &view, &error);
+
+	book = index_lookup_book (source_uid);
+
+	if (error != NULL) {
+		if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+			g_warning ("bbdb: Failed to index addressbook: %s", error->message);
+		g_error_free (error);
+
+	/* The book was removed from the index meanwhile. */
+	} else if (book == NULL || book->client != (EBookClient *) source_object || book->view != NULL) {
+		g_object_unref (view);
+
+	} else {
+		book->view = view;
+
+		fields = g_slist_append (fields, (gpointer) e_contact_field_name (E_CONTACT_UID));
+		fields = g_slist_append (fields, (gpointer) e_contact_field_name (E_CONTACT_EMAIL));
+		e_book_client_view_set_fields_of_interest (view, fields, NULL);
+		g_slist_free (fields);
+
+		book->objects_added_handler_id = g_signal_connect (
+			view, "objects-added",
+			G_CALLBACK (index_book_objects_added_cb), book);
+		book->objects_modified_handler_id = g_signal_connect (
+			view, "objects-modified",
+			G_CALLBACK (index_book_objects_modified_cb), book);
+		book->objects_removed_handler_id = g_signal_connect (
+			view, "objects-removed",
+			G_CALLBACK (index_book_objects_removed_cb), book);
+		book->complete_handler_id = g_signal_connect (
+			view, "complete",
+			G_CALLBACK (index_book_complete_cb), book);
+
+		e_book_client_view_start (view, &error);
+
+		if (error != NULL) {
+			g_warning ("bbdb: Failed to index addressbook: %s", error->message);
+			g_error_free (error);
+		}
+	}
+
+	g_free (source_uid);
+}
+
+static void
+index_book_got_client_cb (GObject *source_object,
+                          GAsyncResult *result,
+                          gpointer user_data)
+{
+	gchar *source_uid = user_data;
+	EClient *client;
+	IndexBook *book;
+	GError *error = NULL;
+
+	client = e_client_cache_get_client_finish (
+		E_CLIENT_CACHE (source_object), result, &error);
+
+	book = index_lookup_book (source_uid);
+
+	if (error != NULL) {
+		/* Not checked by bbdb_do_it() either, thus not to be waited for. */
+		if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+			g_warning ("bbdb: Failed to get addressbook client: %s", error->message);
+
+			if (book != NULL) {
+				g_mutex_lock (&index_lock);
+				g_hash_table_remove (index_books, source_uid);
+				g_mutex_unlock (&index_lock);
+			}
+		}
+
+		g_error_free (error);
+		g_free (source_uid);
+
+	} else if (book == NULL || book->client != NULL) {
+		g_object_unref (client);
+		g_free (source_uid);
+
+	} else {
+		book->client = E_BOOK_CLIENT (client);
+
+		/* Only contacts with an e-mail address are of interest. */
+		e_book_client_get_view (
+			book->client, "(exists \"email\")",
+			book->cancellable, index_book_got_view_cb,
+			source_uid);
+	}
+}
+
+/* Indexes the same address books bbdb_do_it() looks into. */
+static gboolean
+index_sync_books_idle_cb (gpointer user_data)
+{
+	EShell *shell;
+	EClientCache *client_cache;
+	GHashTable *wanted;
+	GHashTableIter iter;
+	GList *list, *link;
+	gpointer key;
+	gchar *dest_uid = NULL;
+
+	index_sync_id = 0;
+
+	shell = e_shell_get_default ();
+	client_cache = e_shell_get_client_cache (shell);
+
+	wanted = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_object_unref);
+
+	if (g_settings_get_boolean (index_settings, CONF_KEY_ENABLE)) {
+		ESource *source;
+
+		dest_uid = g_settings_get_string (index_settings, CONF_KEY_WHICH_ADDRESSBOOK);
+		source = dest_uid ? e_source_registry_ref_source (index_registry, dest_uid) : NULL;
+		if (source == NULL)
+			source = e_source_registry_ref_builtin_address_book (index_registry);
+
+		g_free (dest_uid);
+		dest_uid = e_source_dup_uid (source);
+
+		list = e_source_registry_list_enabled (index_registry, E_SOURCE_EXTENSION_ADDRESS_BOOK);
+
+		for (link = list; link != NULL; link = g_list_next (link)) {
+			ESource *book_source = link->data;
+			ESourceAutocomplete *extension;
+
+			if (!e_source_has_extension (book_source, E_SOURCE_EXTENSION_AUTOCOMPLETE))
+				continue;
+
+			extension = e_source_get_extension (book_source, E_SOURCE_EXTENSION_AUTOCOMPLETE);
+			if (!e_source_autocomplete_get_include_me (extension))
+				continue;
+
+			g_hash_table_insert (
+				wanted, e_source_dup_uid (book_source),
+				g_object_ref (book_source));
+		}
+
+		g_list_free_full (list, g_object_unref);
+
+		g_hash_table_insert (wanted, g_strdup (dest_uid), source);
+	}
+
+	g_mutex_lock (&index_lock);
+
+	g_hash_table_iter_init (&iter, index_books);
+	while (g_hash_table_iter_next (&iter, &key, NULL)) {
+		if (!g_hash_table_contains (wanted, key))
+			g_hash_table_iter_remove (&iter);
+	}
+
+	g_mutex_unlock (&index_lock);
+
+	g_hash_table_iter_init (&iter, wanted);
+	while (g_hash_table_iter_next (&iter, &key, NULL)) {
+		IndexBook *book;
+
+		if (g_hash_table_contains (index_books, key))
+			continue;
+
+		book = g_new0 (IndexBook, 1);
+		book->source_uid = g_strdup (key);
+		book->cancellable = g_cancellable_new ();
+		book->contacts = g_hash_table_new_full (
+			g_str_hash, g_str_equal, g_free,
+			(GDestroyNotify) g_strfreev);
+
+		g_mutex_lock (&index_lock);
+		g_hash_table_insert (index_books, book->source_uid, book);
+		g_mutex_unlock (&index_lock);
+
+		e_client_cache_get_client (
+			client_cache, g_hash_table_lookup (wanted, key),
+			E_SOURCE_EXTENSION_ADDRESS_BOOK, 30,
+			book->cancellable, index_book_got_client_cb,
+			g_strdup (key));
+	}
+
+	g_hash_table_destroy (wanted);
+	g_free (dest_uid);
+
+	return FALSE;
+}
+
+static void
+index_schedule_sync (void)
+{
+	if (index_sync_id == 0)
+		index_sync_id = g_idle_add (index_sync_books_idle_cb, NULL);
+}
+
+static void
+index_registry_source_cb (ESourceRegistry *registry,
+                          ESource *source)
+{
+	if (e_source_has_extension (source, E_SOURCE_EXTENSION_ADDRESS_BOOK))
+		index_schedule_sync ();
+}
+
+static void
+index_settings_changed_cb (GSettings *settings,
+                           const gchar *key)
+{
+	index_schedule_sync ();
+}
+
+void
+bbdb_index_start (void)
+{
+	EShell *shell;
+
+	if (index_books != NULL)
+		return;
+
+	shell = e_shell_get_default ();
+	g_return_if_fail (shell != NULL);
+
+	g_mutex_lock (&index_lock);
+
+	index_books = g_hash_table_new_full (
+		g_str_hash, g_str_equal, NULL,
+		(GDestroyNotify) index_book_free);
+	index_emails = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+	index_noted = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+
+	g_mutex_unlock (&index_lock);
+
+	index_registry = g_object_ref (e_shell_get_registry (shell));
+
+	index_registry_handler_ids[0] = g_signal_connect (
+		index_registry, "source-added",
+		G_CALLBACK (index_registry_source_cb), NULL);
+	index_registry_handler_ids[1] = g_signal_connect (
+		index_registry, "source-removed",
+		G_CALLBACK (index_registry_source_cb), NULL);
+	index_registry_handler_ids[2] = g_signal_connect (
+		index_registry, "source-enabled",
+		G_CALLBACK (index_registry_source_cb), NULL);
+	index_registry_handler_ids[3] = g_signal_connect (
+		index_registry, "source-disabled",
+		G_CALLBACK (index_registry_source_cb), NULL);
+	index_registry_handler_ids[4] = g_signal_connect (
+		index_registry, "source-changed",
+		G_CALLBACK (index_registry_source_cb), NULL);
+
+	index_settings = e_util_ref_settings (CONF_SCHEMA);
+
+	g_signal_connect (
+		index_settings, "changed::" CONF_KEY_ENABLE,
+		G_CALLBACK (index_settings_changed_cb), NULL);
+	g_signal_connect (
+		index_settings, "changed::" CONF_KEY_WHICH_ADDRESSBOOK,
+		G_CALLBACK (index_settings_changed_cb), NULL);
+
+	index_schedule_sync ();
+}
+
+void
+bbdb_index_stop (void)
+{
+	gint ii;
+
+	if (index_books == NULL)
+		return;
+
+	if (index_sync_id != 0) {
+		g_source_remove (index_sync_id);
+		index_sync_id = 0;
+	}
+
+	for (ii = 0; ii < G_N_ELEMENTS (index_registry_handler_ids); ii++) {
+		g_signal_handler_disconnect (index_registry, index_registry_handler_ids[ii]);
+		index_registry_handler_ids[ii] = 0;
+	}
+
+	g_signal_handlers_disconnect_by_func (
+		index_settings, index_settings_changed_cb, NULL);
+
+	g_clear_object (&index_registry);
+	g_clear_object (&index_settings);
+
+	g_mutex_lock (&index_lock);
+
+	g_hash_table_destroy (index_books);
+	g_hash_table_destroy (index_emails);
+	g_hash_table_destroy (index_noted);
+	index_books = NULL;
+	index_emails = NULL;
+	index_noted = NULL;
+
+	g_mutex_unlock (&index_lock);
+}
+
+/* Returns whether the index can tell whether the @email is stored
+ * in any of the indexed address books, and if so, sets @out_found. */
+gboolean
+bbdb_index_lookup_email (const gchar *email,
+                         gboolean *out_found)
+{
+	GHashTableIter iter;
+	gpointer value;
+	gboolean ready;
+
+	g_return_val_if_fail (email != NULL, FALSE);
+	g_return_val_if_fail (out_found != NULL, FALSE);
+
+	g_mutex_lock (&index_lock);
+
+	ready = index_books != NULL && g_hash_table_size (index_books) > 0;
+
+	if (ready) {
+		g_hash_table_iter_init (&iter, index_books);
+		while (ready && g_hash_table_iter_next (&iter, NULL, &value)) {
+			IndexBook *book = value;
+
+			ready = book->complete;
+		}
+	}
+
+	if (ready) {
+		gchar *folded;
+
+		folded = index_fold_email (email);
+
+		*out_found =
+			g_hash_table_contains (index_emails, folded) ||
+			g_hash_table_contains (index_noted, folded);
+
+		g_free (folded);
+	}
+
+	g_mutex_unlock (&index_lock);
+
+	return ready;
+}
+
+/* Notes that the @email was just added to an indexed address book,
+ * thus it is known before the book view tells about it. */
+void
+bbdb_index_note_email (const gchar *email)
+{
+	g_return_if_fail (email != NULL);
+
+	g_mutex_lock (&index_lock);
+
+	if (index_noted != NULL)
+		g_hash_table_add (index_noted, index_fold_email (email));
+
+	g_mutex_unlock (&index_lock);
+}
@@ -88,6 +88,8 @@ e_plugin_lib_enable (EPlugin *ep,
 
 		d (fprintf (stderr, "BBDB spinning up...\n"));
 
+		bbdb_index_start ();
+
 		g_idle_add (bbdb_timeout, ep);
 
 		interval = get_check_interval ();
@@ -95,6 +97,8 @@ e_plugin_lib_enable (EPlugin *ep,
 			update_source = e_named_timeout_add_seconds (
 				interval, bbdb_timeout, NULL);
 		}
+	} else {
+		bbdb_index_stop ();
 	}
 
 	return 0;
@@ -311,6 +315,7 @@ bbdb_do_it (EBookClient *client,
 	EBookClient *client_addressbook;
 	ESourceAutocomplete *autocomplete_extension;
 	gboolean on_autocomplete, has_autocomplete;
+	gboolean indexed, found = FALSE;
 
 	g_return_if_fail (client != NULL);
 
@@ -320,6 +325,12 @@ bbdb_do_it (EBookClient *client,
 	if ((delim = strchr (email, '@')) == NULL)
 		return;
 
+	/* The index covers the same address books as the loop below,
+	 * thus the per-book e-mail queries can be skipped when it is ready. */
+	indexed = bbdb_index_lookup_email (email, &found);
+	if (indexed && found)
+		return;
+
 	/* don't miss the entry if the mail has only e-mail id and no name */
 	if (name == NULL || !strcmp (name, "")) {
 		temp_name = g_strndup (email, delim - email);
@@ -375,9 +386,13 @@ bbdb_do_it (EBookClient *client,
 		}
 
 		/* If any contacts exists with this email address, don't do anything */
-		query_string = g_strdup_printf ("(contains \"email\" \"%s\")", email);
-		status = e_book_client_get_contacts_sync (client_addressbook, query_string, &contacts, NULL, NULL);
-		g_free (query_string);
+		if (indexed) {
+			status = TRUE;
+		} else {
+			query_string = g_strdup_printf ("(contains \"email\" \"%s\")", email);
+			status = e_book_client_get_contacts_sync (client_addressbook, query_string, &contacts, NULL, NULL);
+			g_free (query_string);
+		}
 		if (contacts != NULL || !status) {
 			g_slist_free_full (contacts, (GDestroyNotify) g_object_unref);
 			g_free (temp_name);
@@ -427,6 +442,8 @@ bbdb_do_it (EBookClient *client,
 			if (error != NULL) {
 				g_warning ("bbdb: Could not modify contact: %s\n", error->message);
 				g_error_free (error);
+			} else {
+				bbdb_index_note_email (email);
 			}
 
 			g_slist_free_full (contacts, (GDestroyNotify) g_object_unref);
@@ -453,6 +470,8 @@ bbdb_do_it (EBookClient *client,
 	if (error != NULL) {
 		g_warning ("bbdb: Failed to add new contact: %s", error->message);
 		g_error_free (error);
+	} else {
+		bbdb_index_note_email (email);
 	}
 
 	g_object_unref (contact);
@@ -44,6 +44,13 @@ EBookClient *	bbdb_create_book_client		(gint type,
 						 GError **error);
 gboolean	bbdb_check_gaim_enabled		(void);
 
+/* bbdb-index.c */
+void		bbdb_index_start		(void);
+void		bbdb_index_stop			(void);
+gboolean	bbdb_index_lookup_email		(const gchar *email,
+						 gboolean *out_found);
+void		bbdb_index_note_email		(const gchar *email);
+
 /* gaimbuddies.c */
 void		bbdb_sync_buddy_list		(void);
 void		bbdb_sync_buddy_list_check	(void);
@@ -54,7 +54,7 @@ static void  error_queue_add (gchar *descriptions, GError *error);
 
 gint          e_plugin_lib_enable (EPlugin *ep, gint enable);
 GtkWidget   *publish_calendar_locations (EPlugin *epl, EConfigHookItemFactoryData *data);
-static void  update_timestamp (EPublishUri *uri);
+static void  update_timestamp (EPublishUri *uri, const gchar *publish_cursor);
 static void publish (EPublishUri *uri, gboolean can_report_success);
 
 static GtkStatusIcon *status_icon = NULL;
@@ -198,8 +198,29 @@ publish_online (EPublishUri *uri,
                 gboolean can_report_success)
 {
 	GOutputStream *stream;
+	gchar *publish_cursor = NULL;
 	GError *error = NULL;
 
+	/* Nothing is uploaded when none of the calendars
+	 * changed since the last successful publish. */
+	if (uri->publish_format == URI_PUBLISH_AS_ICAL) {
+		publish_cursor = publish_calendar_as_ical_get_cursor (uri);
+
+		if (publish_cursor != NULL &&
+		    g_strcmp0 (publish_cursor, uri->publish_cursor) == 0) {
+			if (can_report_success)
+				error_queue_add (
+					g_strdup_printf (
+						_("Publishing to %s finished successfully"),
+						uri->location),
+					NULL);
+
+			update_timestamp (uri, publish_cursor);
+			g_free (publish_cursor);
+			return;
+		}
+	}
+
 	stream = G_OUTPUT_STREAM (g_file_replace (
 		file, NULL, FALSE, G_FILE_CREATE_NONE, NULL, &error));
 
@@ -218,6 +239,7 @@ publish_online (EPublishUri *uri,
 					uri->location),
 				error);
 		}
+		g_free (publish_cursor);
 		return;
 	}
 
@@ -230,6 +252,10 @@ publish_online (EPublishUri *uri,
 			break;
 	}
 
+	/* Possibly only a part of the calendars was uploaded. */
+	if (error != NULL)
+		g_clear_pointer (&publish_cursor, g_free);
+
 	if (error != NULL)
 		error_queue_add (
 			g_strdup_printf (
@@ -243,10 +269,12 @@ publish_online (EPublishUri *uri,
 				uri->location),
 			NULL);
 
-	update_timestamp (uri);
+	update_timestamp (uri, publish_cursor);
 
 	g_output_stream_close (stream, NULL, NULL);
 	g_object_unref (stream);
+
+	g_free (publish_cursor);
 }
 
 static void
@@ -522,7 +550,8 @@ add_timeout (EPublishUri *uri)
 }
 
 static void
-update_timestamp (EPublishUri *uri)
+update_timestamp (EPublishUri *uri,
+                  const gchar *publish_cursor)
 {
 	GSettings *settings;
 	gchar **set_uris;
@@ -546,6 +575,11 @@ update_timestamp (EPublishUri *uri)
 		g_free (uri->last_pub_time);
 	uri->last_pub_time = g_strdup_printf ("%d", (gint) time (NULL));
 
+	if (g_strcmp0 (uri->publish_cursor, publish_cursor) != 0) {
+		g_free (uri->publish_cursor);
+		uri->publish_cursor = g_strdup (publish_cursor);
+	}
+
 	uris_array = g_ptr_array_new_full (3, g_free);
 	settings = e_util_ref_settings (PC_SETTINGS_ID);
 	set_uris = g_settings_get_strv (settings, PC_SETTINGS_URIS);
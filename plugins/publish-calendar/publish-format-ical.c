@@ -62,29 +62,32 @@ insert_tz_comps (icalparameter *param,
 	}
 
 	tzcomp = icalcomponent_new_clone (icaltimezone_get_component (zone));
-	g_hash_table_insert (tdata->zones, (gpointer) tzid, (gpointer) tzcomp);
+	g_hash_table_insert (tdata->zones, g_strdup (tzid), tzcomp);
 }
 
-static void
-append_tz_to_comp (gpointer key,
-                   gpointer value,
-                   icalcomponent *toplevel)
+static gboolean
+write_component (GOutputStream *stream,
+                 icalcomponent *icalcomp,
+                 GError **error)
 {
-	icalcomponent_add_component (toplevel, (icalcomponent *) value);
+	gchar *ical_string;
+	gboolean res;
+
+	ical_string = icalcomponent_as_ical_string_r (icalcomp);
+	res = g_output_stream_write_all (stream, ical_string, strlen (ical_string), NULL, NULL, error);
+	g_free (ical_string);
+
+	return res;
 }
 
-static gboolean
-write_calendar (const gchar *uid,
-                GOutputStream *stream,
-                GError **error)
+static EClient *
+ref_calendar_client (const gchar *uid,
+                     GError **error)
 {
 	EShell *shell;
 	ESource *source;
 	ESourceRegistry *registry;
 	EClient *client = NULL;
-	GSList *objects = NULL;
-	icalcomponent *top_level;
-	gboolean res = FALSE;
 
 	shell = e_shell_get_default ();
 	registry = e_shell_get_registry (shell);
@@ -104,45 +107,127 @@ write_calendar (const gchar *uid,
 			_("Invalid source UID '%s'"), uid);
 	}
 
+	return client;
+}
+
+static gboolean
+write_calendar (const gchar *uid,
+                GOutputStream *stream,
+                GError **error)
+{
+	EClient *client;
+	GSList *objects = NULL;
+	gboolean res = FALSE;
+
+	client = ref_calendar_client (uid, error);
 	if (client == NULL)
 		return FALSE;
 
-	top_level = e_cal_util_new_top_level ();
-
 	e_cal_client_get_object_list_sync (
 		E_CAL_CLIENT (client), "#t", &objects, NULL, error);
 
 	if (objects != NULL) {
-		GSList *iter;
-		gchar *ical_string;
+		GHashTableIter iter;
+		GSList *link;
+		icalcomponent *top_level;
+		gchar *ical_string, *end;
 		CompTzData tdata;
+		gpointer value;
 
-		tdata.zones = g_hash_table_new (g_str_hash, g_str_equal);
+		/* The objects are written one by one between the lines
+		 * of an empty top-level component, rather than cloned into
+		 * it and the whole calendar converted to a single string. */
+		top_level = e_cal_util_new_top_level ();
+		ical_string = icalcomponent_as_ical_string_r (top_level);
+		icalcomponent_free (top_level);
+
+		end = strstr (ical_string, "END:VCALENDAR");
+		g_warn_if_fail (end != NULL);
+		if (end == NULL)
+			end = ical_string + strlen (ical_string);
+
+		tdata.zones = g_hash_table_new_full (
+			g_str_hash, g_str_equal, g_free,
+			(GDestroyNotify) icalcomponent_free);
 		tdata.client = E_CAL_CLIENT (client);
 
-		for (iter = objects; iter; iter = iter->next) {
-			icalcomponent *icalcomp = icalcomponent_new_clone (iter->data);
-			icalcomponent_foreach_tzid (icalcomp, insert_tz_comps, &tdata);
-			icalcomponent_add_component (top_level, icalcomp);
+		res = g_output_stream_write_all (stream, ical_string, end - ical_string, NULL, NULL, error);
+
+		for (link = objects; link; link = g_slist_next (link)) {
+			icalcomponent *icalcomp = link->data;
+
+			if (res) {
+				icalcomponent_foreach_tzid (icalcomp, insert_tz_comps, &tdata);
+				res = write_component (stream, icalcomp, error);
+			}
+
+			/* Free the objects as soon as they are written. */
+			icalcomponent_free (icalcomp);
 		}
 
-		g_hash_table_foreach (tdata.zones, (GHFunc) append_tz_to_comp, top_level);
+		g_slist_free (objects);
 
-		g_hash_table_destroy (tdata.zones);
-		tdata.zones = NULL;
+		g_hash_table_iter_init (&iter, tdata.zones);
+		while (res && g_hash_table_iter_next (&iter, NULL, &value))
+			res = write_component (stream, value, error);
 
-		ical_string = icalcomponent_as_ical_string_r (top_level);
-		res = g_output_stream_write_all (stream, ical_string, strlen (ical_string), NULL, NULL, error);
+		if (res)
+			res = g_output_stream_write_all (stream, end, strlen (end), NULL, NULL, error);
+
+		g_hash_table_destroy (tdata.zones);
 		g_free (ical_string);
-		e_cal_client_free_icalcomp_slist (objects);
 	}
 
 	g_object_unref (client);
-	icalcomponent_free (top_level);
 
 	return res;
 }
 
+/* Returns a digest of the revisions of all the calendars published
+ * to the @uri, which changes whenever any of the calendars changes,
+ * or %NULL when not all the calendars can tell their revision. */
+gchar *
+publish_calendar_as_ical_get_cursor (EPublishUri *uri)
+{
+	GChecksum *checksum;
+	GSList *l;
+	gchar *cursor = NULL;
+	gboolean known = TRUE;
+
+	checksum = g_checksum_new (G_CHECKSUM_SHA1);
+
+	for (l = uri->events; known && l; l = g_slist_next (l)) {
+		const gchar *uid = l->data;
+		EClient *client;
+		gchar *revision = NULL;
+
+		client = ref_calendar_client (uid, NULL);
+
+		if (client == NULL ||
+		    !e_client_get_backend_property_sync (
+			client, CLIENT_BACKEND_PROPERTY_REVISION,
+			&revision, NULL, NULL) ||
+		    revision == NULL || *revision == '\0') {
+			known = FALSE;
+		} else {
+			g_checksum_update (checksum, (const guchar *) uid, -1);
+			g_checksum_update (checksum, (const guchar *) "\n", 1);
+			g_checksum_update (checksum, (const guchar *) revision, -1);
+			g_checksum_update (checksum, (const guchar *) "\n", 1);
+		}
+
+		g_clear_object (&client);
+		g_free (revision);
+	}
+
+	if (known)
+		cursor = g_strdup (g_checksum_get_string (checksum));
+
+	g_checksum_free (checksum);
+
+	return cursor;
+}
+
 void
 publish_calendar_as_ical (GOutputStream *stream,
                           EPublishUri *uri,
@@ -28,5 +28,6 @@
 #define PUBLISH_FORMAT_ICAL_H
 
 void publish_calendar_as_ical (GOutputStream *stream, EPublishUri *uri, GError **error);
+gchar *publish_calendar_as_ical_get_cursor (EPublishUri *uri);
 
 #endif
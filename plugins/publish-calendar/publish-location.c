@@ -136,7 +136,7 @@ e_publish_uri_from_xml (const gchar *xml)
 	xmlDocPtr doc;
 	xmlNodePtr root, p;
 	xmlChar *location, *enabled, *frequency, *fb_duration_value, *fb_duration_type;
-	xmlChar *publish_time, *format, *username = NULL;
+	xmlChar *publish_time, *publish_cursor, *format, *username = NULL;
 	GSList *events = NULL;
 	EPublishUri *uri;
 
@@ -161,6 +161,7 @@ e_publish_uri_from_xml (const gchar *xml)
 	frequency = xmlGetProp (root, (const guchar *)"frequency");
 	format = xmlGetProp (root, (const guchar *)"format");
 	publish_time = xmlGetProp (root, (const guchar *)"publish_time");
+	publish_cursor = xmlGetProp (root, (const guchar *)"publish_cursor");
 	fb_duration_value = xmlGetProp (root, (xmlChar *)"fb_duration_value");
 	fb_duration_type = xmlGetProp (root, (xmlChar *)"fb_duration_type");
 
@@ -174,6 +175,8 @@ e_publish_uri_from_xml (const gchar *xml)
 		uri->publish_format = atoi ((gchar *) format);
 	if (publish_time != NULL)
 		uri->last_pub_time = (gchar *) publish_time;
+	if (publish_cursor != NULL)
+		uri->publish_cursor = (gchar *) publish_cursor;
 
 	if (fb_duration_value)
 		uri->fb_duration_value = atoi ((gchar *) fb_duration_value);
@@ -239,6 +242,8 @@ e_publish_uri_to_xml (EPublishUri *uri)
 	xmlSetProp (root, (const guchar *)"frequency", (guchar *) frequency);
 	xmlSetProp (root, (const guchar *)"format", (guchar *) format);
 	xmlSetProp (root, (const guchar *)"publish_time", (guchar *) uri->last_pub_time);
+	if (uri->publish_cursor != NULL)
+		xmlSetProp (root, (const guchar *)"publish_cursor", (guchar *) uri->publish_cursor);
 
 	g_free (format);
 	format = g_strdup_printf ("%d", uri->fb_duration_value);
@@ -73,6 +73,9 @@ struct _EPublishUri {
 	gint fb_duration_type;
 
 	gint service_type;
+
+	/* Digest of the calendars' revisions at the last publish */
+	gchar *publish_cursor;
 };
 
 EPublishUri *e_publish_uri_from_xml (const gchar *xml);
@@ -601,6 +601,10 @@ url_editor_dialog_run (UrlEditorDialog *dialog)
 
 		create_uri (dialog);
 
+		/* The next publish uploads regardless of changes. */
+		g_free (dialog->uri->publish_cursor);
+		dialog->uri->publish_cursor = NULL;
+
 		dialog->uri->password = g_strdup (gtk_entry_get_text (GTK_ENTRY (dialog->password_entry)));
 
 		if (gtk_toggle_button_get_active (GTK_TOGGLE_BUTTON (dialog->remember_pw))) {